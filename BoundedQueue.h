@@ -0,0 +1,88 @@
+/*
+BoundedQueue
+A fixed capacity, thread safe first-in first-out queue used to connect the
+stages of a pipeline. A producer that gets ahead of its consumer blocks once
+the queue is full, so only a bounded number of items (for example loaded
+scenes) are ever held between two stages.
+*/
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+template <typename T>
+class BoundedQueue
+{
+	public:
+
+		// BoundedQueue
+		// Creates an empty, open queue.
+		// Pre-Condition: capacity is positive.
+		// Post-Condition: At most capacity items can be waiting at any time.
+		explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false)
+		{
+		}
+
+		// Push
+		// Adds an item to the back of the queue, waiting while the queue is full.
+		// Pre-Condition: None
+		// Post-Condition: Returns true once the item is queued, or false (dropping the
+		//  item) if the queue was closed.
+		bool Push(T item)
+		{
+			unique_lock<mutex> guard(lock);
+			notFull.wait(guard, [this]() { return closed || items.size() < capacity; });
+			if (closed)
+			{
+				return false;
+			}
+			items.push_back(move(item));
+			notEmpty.notify_one();
+			return true;
+		}
+
+		// Pop
+		// Takes the item at the front of the queue, waiting while the queue is empty.
+		// Pre-Condition: None
+		// Post-Condition: Returns true and fills item, or returns false once the queue
+		//  is closed and every queued item has been taken.
+		bool Pop(T& item)
+		{
+			unique_lock<mutex> guard(lock);
+			notEmpty.wait(guard, [this]() { return closed || !items.empty(); });
+			if (items.empty())
+			{
+				return false;
+			}
+			item = move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// Close
+		// Marks the end of the stream. Items already queued can still be taken.
+		// Pre-Condition: None
+		// Post-Condition: Further pushes fail, and waiting consumers wake up.
+		void Close()
+		{
+			lock_guard<mutex> guard(lock);
+			closed = true;
+			notEmpty.notify_all();
+			notFull.notify_all();
+		}
+
+	private:
+		BoundedQueue(const BoundedQueue&);
+		BoundedQueue& operator=(const BoundedQueue&);
+
+		size_t capacity;
+		bool closed;
+		deque<T> items;
+		mutex lock;
+		condition_variable notEmpty;
+		condition_variable notFull;
+};
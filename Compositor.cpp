@@ -0,0 +1,252 @@
+/*
+Compositor combines any number of masks (binary filter maps or score maps such as
+a single band) into one color image or one label image. Every pixel is composed
+in a single pass over the masks, spread over several threads, with each row worked
+on as separate channel planes so that the per-pixel operations vectorize.
+*/
+#include <algorithm>
+#include <iostream>
+
+#include "Compositor.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+using namespace cv;
+using namespace std;
+
+//  Rows composed by one task
+static const int COMPOSITE_BLOCK_ROWS = 32;
+
+//  CompositeLayer
+//  A binary layer, drawn in color where mask >= threshold.
+CompositeLayer::CompositeLayer(const Mat& mask, Vec3b color, uchar threshold, int priority)
+	: mask(mask), color(color), score(false), threshold(threshold), priority(priority)
+{
+}
+
+//  ScoreLayer
+//  Makes a layer that draws color scaled by the mask value wherever the mask is
+//  not zero. A channel that is 255 in color receives the mask value itself.
+//  Pre-Conditions: mask is 8UC1.
+//  Post-Conditions: Returns the layer.
+CompositeLayer ScoreLayer(const Mat& mask, Vec3b color, int priority)
+{
+	CompositeLayer layer(mask, color, 1, priority);
+	layer.score = true;
+	return layer;
+}
+
+//  checkLayers
+//  Checks that every mask is 8UC1 and that all masks have the same size.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true and sets size to the masks' size (0 x 0 if there
+//  are none), otherwise prints an error and returns false.
+static bool checkLayers(const vector<CompositeLayer>& layers, Size& size)
+{
+	size = layers.empty() ? Size() : layers[0].mask.size();
+	for (size_t i = 0; i < layers.size(); ++i)
+	{
+		if (layers[i].mask.type() != CV_8UC1 || layers[i].mask.size() != size)
+		{
+			cerr << "Error - Composite layer " << i << " is not an 8UC1 mask of the same size as the others." << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+//  drawOrder
+//  Orders layers by increasing priority, keeping the given order between equal
+//  priorities, so that painting in this order leaves the winner on top.
+static vector<int> drawOrder(const vector<CompositeLayer>& layers)
+{
+	vector<int> order(layers.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = static_cast<int>(i);
+	}
+	stable_sort(order.begin(), order.end(), [&](int a, int b)
+	{
+		return layers[a].priority < layers[b].priority;
+	});
+	return order;
+}
+
+//  scale
+//  Returns value * color / 255, rounded, without a division.
+static inline uchar scale(uchar value, uchar color)
+{
+	unsigned int x = static_cast<unsigned int>(value) * color + 128;
+	return static_cast<uchar>((x + (x >> 8)) >> 8);
+}
+
+//  drawPlane
+//  Draws one channel of one layer into a channel plane. The four loops differ
+//  only in how the layer's value is found and combined, and are kept apart so
+//  the compiler can vectorize each of them.
+//  Pre-Conditions: mask and plane hold cols values.
+//  Post-Conditions: plane holds the channel with the layer drawn on it.
+static void drawPlane(const uchar* mask, uchar* plane, int cols, const CompositeLayer& layer, int channel,
+	CompositeBlend blend)
+{
+	uchar threshold = layer.threshold;
+	uchar color = layer.color[channel];
+	if (blend == BLEND_MAX && !layer.score)
+	{
+		for (int x = 0; x < cols; ++x)
+		{
+			uchar value = mask[x] >= threshold ? color : 0;
+			plane[x] = max(plane[x], value);
+		}
+	}
+	else if (blend == BLEND_MAX)
+	{
+		for (int x = 0; x < cols; ++x)
+		{
+			uchar value = mask[x] >= threshold ? scale(mask[x], color) : 0;
+			plane[x] = max(plane[x], value);
+		}
+	}
+	else if (!layer.score)
+	{
+		for (int x = 0; x < cols; ++x)
+		{
+			plane[x] = mask[x] >= threshold ? color : plane[x];
+		}
+	}
+	else
+	{
+		for (int x = 0; x < cols; ++x)
+		{
+			plane[x] = mask[x] >= threshold ? scale(mask[x], color) : plane[x];
+		}
+	}
+}
+
+//  CompositeMasks
+//  Draws every layer over a base image.
+//  Pre-Conditions: Every mask is 8UC1 and all masks and base have the same size.
+//  base is empty (black), 8UC1 (used as gray) or 8UC3.
+//  Post-Conditions: Returns an 8UC3 image, or an empty Mat (after printing an
+//  error) if the sizes or types do not fit. Rows are shared between numThreads
+//  threads (0 uses every core); the result does not depend on the thread count.
+Mat CompositeMasks(const vector<CompositeLayer>& layers, const Mat& base, CompositeBlend blend, int numThreads)
+{
+	TRACE_SCOPE("CompositeMasks");
+	Size size;
+	if (!checkLayers(layers, size))
+	{
+		return Mat();
+	}
+	if (!base.empty())
+	{
+		if ((base.type() != CV_8UC1 && base.type() != CV_8UC3) || (!layers.empty() && base.size() != size))
+		{
+			cerr << "Error - Composite base is not an 8UC1 or 8UC3 image the size of the masks." << endl;
+			return Mat();
+		}
+		size = base.size();
+	}
+
+	int rows = size.height;
+	int cols = size.width;
+	vector<int> order = drawOrder(layers);
+	Mat result(rows, cols, CV_8UC3);
+	int blockCount = (rows + COMPOSITE_BLOCK_ROWS - 1) / COMPOSITE_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		vector<uchar> planes(3 * static_cast<size_t>(cols));
+		uchar* blue = cols > 0 ? &planes[0] : NULL;
+		uchar* green = blue + cols;
+		uchar* red = green + cols;
+		int last = min(rows, (block + 1) * COMPOSITE_BLOCK_ROWS);
+		for (int r = block * COMPOSITE_BLOCK_ROWS; r < last; ++r)
+		{
+			//  Split the base row into channel planes
+			if (base.empty())
+			{
+				fill(planes.begin(), planes.end(), static_cast<uchar>(0));
+			}
+			else if (base.type() == CV_8UC1)
+			{
+				const uchar* src = base.ptr<uchar>(r);
+				copy(src, src + cols, blue);
+				copy(src, src + cols, green);
+				copy(src, src + cols, red);
+			}
+			else
+			{
+				const uchar* src = base.ptr<uchar>(r);
+				for (int x = 0; x < cols; ++x)
+				{
+					blue[x] = src[3 * x];
+					green[x] = src[3 * x + 1];
+					red[x] = src[3 * x + 2];
+				}
+			}
+
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				const CompositeLayer& layer = layers[order[i]];
+				const uchar* mask = layer.mask.ptr<uchar>(r);
+				drawPlane(mask, blue, cols, layer, 0, blend);
+				drawPlane(mask, green, cols, layer, 1, blend);
+				drawPlane(mask, red, cols, layer, 2, blend);
+			}
+
+			//  Interleave the planes into the result
+			uchar* dst = result.ptr<uchar>(r);
+			for (int x = 0; x < cols; ++x)
+			{
+				dst[3 * x] = blue[x];
+				dst[3 * x + 1] = green[x];
+				dst[3 * x + 2] = red[x];
+			}
+		}
+	});
+	TRACE_COUNT("pixels composited", static_cast<long long>(rows) * cols);
+	return result;
+}
+
+//  LabelMasks
+//  Labels every pixel with the active layer of highest priority.
+//  Pre-Conditions: Every mask is 8UC1 and all masks have the same size.
+//  Post-Conditions: Returns a 16UC1 image holding the index of the winning layer
+//  plus one, or 0 where no layer is active (ties go to the later layer). An empty
+//  Mat is returned (after printing an error) if the masks do not fit.
+Mat LabelMasks(const vector<CompositeLayer>& layers, int numThreads)
+{
+	TRACE_SCOPE("LabelMasks");
+	Size size;
+	if (!checkLayers(layers, size))
+	{
+		return Mat();
+	}
+
+	int rows = size.height;
+	int cols = size.width;
+	vector<int> order = drawOrder(layers);
+	Mat labels(rows, cols, CV_16UC1);
+	int blockCount = (rows + COMPOSITE_BLOCK_ROWS - 1) / COMPOSITE_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		int last = min(rows, (block + 1) * COMPOSITE_BLOCK_ROWS);
+		for (int r = block * COMPOSITE_BLOCK_ROWS; r < last; ++r)
+		{
+			ushort* dst = labels.ptr<ushort>(r);
+			fill(dst, dst + cols, static_cast<ushort>(0));
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				const CompositeLayer& layer = layers[order[i]];
+				const uchar* mask = layer.mask.ptr<uchar>(r);
+				uchar threshold = layer.threshold;
+				ushort label = static_cast<ushort>(order[i] + 1);
+				for (int x = 0; x < cols; ++x)
+				{
+					dst[x] = mask[x] >= threshold ? label : dst[x];
+				}
+			}
+		}
+	});
+	return labels;
+}
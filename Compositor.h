@@ -0,0 +1,61 @@
+/*
+Compositor combines any number of masks (binary filter maps or score maps such as
+a single band) into one color image or one label image. Every pixel is composed
+in a single pass over the masks, spread over several threads, with each row worked
+on as separate channel planes so that the per-pixel operations vectorize.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+//  CompositeBlend
+//  How the layers active at a pixel are combined.
+//  BLEND_MAX:      Every channel takes the largest value of the base image and all
+//                  active layers, so overlapping layers mix (red and blue give
+//                  magenta).
+//  BLEND_PRIORITY: The active layer with the highest priority paints the pixel,
+//                  pixels without an active layer keep the base image.
+enum CompositeBlend { BLEND_MAX, BLEND_PRIORITY };
+
+//  CompositeLayer
+//  One mask and how it is drawn.
+struct CompositeLayer
+{
+	Mat mask;         //  8UC1 mask, the size of the composite
+	Vec3b color;      //  Color (BGR) drawn where the layer is active
+	bool score;       //  If set, color is scaled by the mask value (0 to 255)
+	uchar threshold;  //  The layer is active where mask >= threshold
+	int priority;     //  Higher priorities win in BLEND_PRIORITY and in labels
+
+	//  CompositeLayer
+	//  A binary layer, drawn in color where mask >= threshold.
+	CompositeLayer(const Mat& mask, Vec3b color, uchar threshold = 255, int priority = 0);
+};
+
+//  ScoreLayer
+//  Makes a layer that draws color scaled by the mask value wherever the mask is
+//  not zero. A channel that is 255 in color receives the mask value itself.
+//  Pre-Conditions: mask is 8UC1.
+//  Post-Conditions: Returns the layer.
+CompositeLayer ScoreLayer(const Mat& mask, Vec3b color, int priority = 0);
+
+//  CompositeMasks
+//  Draws every layer over a base image.
+//  Pre-Conditions: Every mask is 8UC1 and all masks and base have the same size.
+//  base is empty (black), 8UC1 (used as gray) or 8UC3.
+//  Post-Conditions: Returns an 8UC3 image, or an empty Mat (after printing an
+//  error) if the sizes or types do not fit. Rows are shared between numThreads
+//  threads (0 uses every core); the result does not depend on the thread count.
+Mat CompositeMasks(const vector<CompositeLayer>& layers, const Mat& base = Mat(),
+	CompositeBlend blend = BLEND_MAX, int numThreads = 0);
+
+//  LabelMasks
+//  Labels every pixel with the active layer of highest priority.
+//  Pre-Conditions: Every mask is 8UC1 and all masks have the same size.
+//  Post-Conditions: Returns a 16UC1 image holding the index of the winning layer
+//  plus one, or 0 where no layer is active (ties go to the later layer). An empty
+//  Mat is returned (after printing an error) if the masks do not fit.
+Mat LabelMasks(const vector<CompositeLayer>& layers, int numThreads = 0);
@@ -0,0 +1,242 @@
+// CubeFile
+// Defines the native spectral cube file format and a read-only memory mapping of
+//  a file. See CubeFile.h for the layout of a cube file.
+
+#include "CubeFile.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char CUBE_MAGIC[8] = { 'S', 'P', 'E', 'C', 'C', 'U', 'B', 'E' };
+static const uint32_t CUBE_VERSION = 1;
+static const uint64_t CUBE_ALIGNMENT = 4096;
+
+// Size of the fixed part of the header, before the wavelength table
+static const size_t CUBE_FIXED_HEADER = sizeof(CUBE_MAGIC) + 6 * sizeof(uint32_t) + sizeof(uint64_t);
+
+// WriteCubeHeader
+// Writes a cube header, including the wavelength table and the padding before
+//  the sample data.
+// Pre-Condition: out is a binary stream positioned at the start of the file.
+//  header.wavelengths holds header.bands values.
+// Post-Condition: The header is written and header.dataOffset is set to the 
+//  offset the samples must be written at (which is where out now points). 
+//  Returns false if writing failed.
+bool WriteCubeHeader(ostream& out, CubeHeader& header)
+{
+	if (header.wavelengths.size() != header.bands)
+	{
+		return false;
+	}
+
+	header.version = CUBE_VERSION;
+	uint64_t used = CUBE_FIXED_HEADER + header.bands * sizeof(float);
+	header.dataOffset = (used + CUBE_ALIGNMENT - 1) / CUBE_ALIGNMENT * CUBE_ALIGNMENT;
+
+	uint32_t fields[6] = { header.version, header.interleave, header.depth, 
+		header.rows, header.cols, header.bands };
+	out.write(CUBE_MAGIC, sizeof(CUBE_MAGIC));
+	out.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+	out.write(reinterpret_cast<const char*>(&header.dataOffset), sizeof(header.dataOffset));
+	if (header.bands > 0)
+	{
+		out.write(reinterpret_cast<const char*>(&header.wavelengths[0]), header.bands * sizeof(float));
+	}
+
+	vector<char> padding(static_cast<size_t>(header.dataOffset - used), 0);
+	if (!padding.empty())
+	{
+		out.write(&padding[0], padding.size());
+	}
+	return static_cast<bool>(out);
+}
+
+// ReadCubeHeader
+// Parses a cube header from the start of a cube file's contents.
+// Pre-Condition: data points to size bytes of a cube file.
+// Post-Condition: Returns true and fills header if the data starts with a valid
+//  header and is large enough to hold all of its samples, false otherwise. A 
+//  header written in the other byte order is reported on cerr.
+bool ReadCubeHeader(const uchar* data, size_t size, CubeHeader& header)
+{
+	if (data == NULL || size < CUBE_FIXED_HEADER || memcmp(data, CUBE_MAGIC, sizeof(CUBE_MAGIC)) != 0)
+	{
+		return false;
+	}
+
+	uint32_t fields[6];
+	memcpy(fields, data + sizeof(CUBE_MAGIC), sizeof(fields));
+	memcpy(&header.dataOffset, data + sizeof(CUBE_MAGIC) + sizeof(fields), sizeof(header.dataOffset));
+	header.version = fields[0];
+	header.interleave = fields[1];
+	header.depth = fields[2];
+	header.rows = fields[3];
+	header.cols = fields[4];
+	header.bands = fields[5];
+
+	// Files are in the writer's byte order, which shows in the version's bytes
+	uint32_t swappedVersion = (header.version >> 24) | ((header.version >> 8) & 0xFF00)
+		| ((header.version << 8) & 0xFF0000) | (header.version << 24);
+	if (header.version != CUBE_VERSION && swappedVersion == CUBE_VERSION)
+	{
+		cerr << "Error - The cube file was written on a host of the other byte order." << endl;
+		return false;
+	}
+	if (header.version != CUBE_VERSION || header.interleave > 2 || header.depth != CV_16U)
+	{
+		return false;
+	}
+
+	uint64_t tableEnd = CUBE_FIXED_HEADER + static_cast<uint64_t>(header.bands) * sizeof(float);
+	uint64_t samples = static_cast<uint64_t>(header.rows) * header.cols * header.bands;
+	if (tableEnd > header.dataOffset || header.dataOffset + samples * sizeof(ushort) > size)
+	{
+		return false;
+	}
+
+	header.wavelengths.resize(header.bands);
+	if (header.bands > 0)
+	{
+		memcpy(&header.wavelengths[0], data + CUBE_FIXED_HEADER, header.bands * sizeof(float));
+	}
+	return true;
+}
+
+// MappedFile
+// Creates a MappedFile that does not map anything yet.
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mapHandle = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+// ~MappedFile
+// Unmaps the file, if one is mapped.
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+// Open
+// Maps a whole file into memory. Pages are read by the operating system the
+//  first time they are touched. The mapping is copy-on-write, so writing to
+//  it never changes the file.
+// Pre-Condition: fileName refers to an existing, non-empty file.
+// Post-Condition: Returns true if the file was mapped. Any previous mapping
+//  is released first.
+bool MappedFile::Open(const string& fileName)
+{
+	Close();
+#ifdef _WIN32
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, 
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	mapHandle = CreateFileMappingA(fileHandle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapHandle == NULL)
+	{
+		Close();
+		return false;
+	}
+	data = static_cast<uchar*>(MapViewOfFile(mapHandle, FILE_MAP_COPY, 0, 0, 0));
+	if (data == NULL)
+	{
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+	void* mapping = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	data = static_cast<uchar*>(mapping);
+	size = static_cast<size_t>(info.st_size);
+#endif
+	return true;
+}
+
+// Close
+// Releases the mapping.
+// Pre-Condition: None
+// Post-Condition: Nothing is mapped. Pointers into the old mapping are invalid.
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data != NULL)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mapHandle != NULL)
+	{
+		CloseHandle(mapHandle);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(fileHandle);
+	}
+	fileHandle = INVALID_HANDLE_VALUE;
+	mapHandle = NULL;
+#else
+	if (data != NULL)
+	{
+		munmap(data, size);
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	fd = -1;
+#endif
+	data = NULL;
+	size = 0;
+}
+
+// getData
+// Returns the start of the mapped file, or NULL if nothing is mapped.
+uchar* MappedFile::getData() const
+{
+	return data;
+}
+
+// getSize
+// Returns the size of the mapped file in bytes.
+size_t MappedFile::getSize() const
+{
+	return size;
+}
@@ -0,0 +1,114 @@
+/*
+CubeFile
+Defines the native spectral cube file format and a read-only memory mapping of a
+file. A cube file holds a whole scene in one raw uint16 block with a small 
+header in front of it, similar to an ENVI .hdr/.img pair folded into one file. 
+This lets a scene that was converted once be opened again without decoding any
+GeoTIFFs: the file is mapped and the operating system loads pages on demand.
+
+The samples are mapped as they are, so every value is stored in the byte order of
+the host that wrote the file, and a file written on a host of the other byte
+order is rejected rather than read with its bytes swapped.
+
+File layout (all values in the writing host's byte order):
+	bytes 0-7     magic "SPECCUBE"
+	uint32        format version (1)
+	uint32        interleave (0 BSQ, 1 BIL, 2 BIP, see SpecImage::Interleave)
+	uint32        OpenCV depth of the samples (CV_16U)
+	uint32        rows
+	uint32        cols
+	uint32        bands
+	uint64        byte offset of the sample data from the start of the file
+	float32[]     centre wavelength of every band, in nanometers
+	padding       zeros up to the data offset (a multiple of 4096 bytes)
+	samples       rows * cols * bands samples in the given interleave
+*/
+
+#pragma once
+#include <opencv2/core/core.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+struct CubeHeader
+{
+	uint32_t version;
+	uint32_t interleave;
+	uint32_t depth;
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t bands;
+	uint64_t dataOffset;
+	vector<float> wavelengths;
+};
+
+// WriteCubeHeader
+// Writes a cube header, including the wavelength table and the padding before
+//  the sample data.
+// Pre-Condition: out is a binary stream positioned at the start of the file.
+//  header.wavelengths holds header.bands values.
+// Post-Condition: The header is written and header.dataOffset is set to the 
+//  offset the samples must be written at (which is where out now points). 
+//  Returns false if writing failed.
+bool WriteCubeHeader(ostream& out, CubeHeader& header);
+
+// ReadCubeHeader
+// Parses a cube header from the start of a cube file's contents.
+// Pre-Condition: data points to size bytes of a cube file.
+// Post-Condition: Returns true and fills header if the data starts with a valid
+//  header and is large enough to hold all of its samples, false otherwise. A 
+//  header written in the other byte order is reported on cerr.
+bool ReadCubeHeader(const uchar* data, size_t size, CubeHeader& header);
+
+class MappedFile
+{
+	public:
+		// MappedFile
+		// Creates a MappedFile that does not map anything yet.
+		MappedFile();
+
+		// ~MappedFile
+		// Unmaps the file, if one is mapped.
+		~MappedFile();
+
+		// Open
+		// Maps a whole file into memory. Pages are read by the operating system the
+		//  first time they are touched. The mapping is copy-on-write, so writing to
+		//  it never changes the file.
+		// Pre-Condition: fileName refers to an existing, non-empty file.
+		// Post-Condition: Returns true if the file was mapped. Any previous mapping
+		//  is released first.
+		bool Open(const string& fileName);
+
+		// Close
+		// Releases the mapping.
+		// Pre-Condition: None
+		// Post-Condition: Nothing is mapped. Pointers into the old mapping are invalid.
+		void Close();
+
+		// getData
+		// Returns the start of the mapped file, or NULL if nothing is mapped.
+		uchar* getData() const;
+
+		// getSize
+		// Returns the size of the mapped file in bytes.
+		size_t getSize() const;
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		uchar* data;
+		size_t size;
+#ifdef _WIN32
+		void* fileHandle;
+		void* mapHandle;
+#else
+		int fd;
+#endif
+};
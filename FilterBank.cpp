@@ -0,0 +1,353 @@
+#include "FilterBank.h"
+#include "FilterBankFile.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+
+//  FilterBank
+//  Creates an empty filter bank.
+FilterBank::FilterBank()
+{
+	//  Nothing to construct
+}
+
+//  AddFilter
+//  Adds a filter to the bank.
+//  Pre-Conditions: None
+//  Post-Conditions: The filter is stored under the given name. Its index is the 
+//  number of filters that were in the bank before it.
+void FilterBank::AddFilter(const string& name, const SpecFilter& filter)
+{
+	names.push_back(name);
+	filters.push_back(filter);
+}
+
+//  AddFilterFromFile
+//  Loads a USGS formatted Reflectance Pattern file (see SpecFilter::LoadFromFile)
+//  and adds it to the bank.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the file was read and added, false otherwise.
+bool FilterBank::AddFilterFromFile(const string& name, const string& fileName)
+{
+	SpecFilter filter;
+	if (!filter.LoadFromFile(fileName))
+	{
+		return false;
+	}
+	AddFilter(name, filter);
+	return true;
+}
+
+//  SaveToFile
+//  Writes every filter of the bank, with its name, to a filter bank file
+//  (see FilterBankFile.h).
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the file was written, false otherwise.
+bool FilterBank::SaveToFile(const string& fileName) const
+{
+	return WriteFilterBankFile(fileName, names, filters);
+}
+
+//  LoadFromFile
+//  Adds every filter of a filter bank file (see FilterBankFile.h) to the bank,
+//  in file order.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the file was read and its filters added,
+//  false (with nothing added) otherwise.
+bool FilterBank::LoadFromFile(const string& fileName)
+{
+	return ReadFilterBankFile(fileName, names, filters);
+}
+
+//  getCount
+//  Returns the number of filters in the bank.
+int FilterBank::getCount() const
+{
+	return static_cast<int>(filters.size());
+}
+
+//  getName
+//  Returns the name of the filter at the given index.
+//  Pre-Conditions: index is in the range [0, getCount())
+string FilterBank::getName(int index) const
+{
+	return names[index];
+}
+
+//  scores
+//  Scores every filter against a hyperspectral image in one pass.
+//  Pre-Conditions: The image has been loaded.
+//  Post-Conditions: Returns one CV_32FC1 plane per filter, in bank order, 
+//  holding each pixel's SAD score (lower is a closer match). Blocks of rows are
+//  shared out between numThreads threads (0 uses every core).
+vector<Mat> FilterBank::scores(const SpecImage& hyperImage, int numThreads) const
+{
+	int rows = hyperImage.getRows();
+	int cols = hyperImage.getCols();
+	vector<Mat> planes;
+	for (size_t f = 0; f < filters.size(); ++f)
+	{
+		planes.push_back(Mat(rows, cols, CV_32FC1, Scalar::all(0)));
+	}
+
+	run(hyperImage, numThreads, [&](int top, int blockRows, const vector<int*>& blockScores)
+	{
+		for (size_t f = 0; f < planes.size(); ++f)
+		{
+			for (int r = 0; r < blockRows; ++r)
+			{
+				const int* src = blockScores[f] + r * cols;
+				float* dst = planes[f].ptr<float>(top + r);
+				for (int c = 0; c < cols; ++c)
+				{
+					dst[c] = static_cast<float>(src[c]) / SAD_SCALE;
+				}
+			}
+		}
+	});
+	return planes;
+}
+
+//  filter
+//  Runs every filter against a hyperspectral image in one pass.
+//  Pre-Conditions: The image has been loaded.
+//  Post-Conditions: Returns one CV_8UC1 image per filter, in bank order, equal 
+//  to what SpecFilter::filter returns for that filter. Blocks of rows are shared
+//  out between numThreads threads (0 uses every core).
+vector<Mat> FilterBank::filter(const SpecImage& hyperImage, int numThreads) const
+{
+	int rows = hyperImage.getRows();
+	int cols = hyperImage.getCols();
+	vector<Mat> results;
+	for (size_t f = 0; f < filters.size(); ++f)
+	{
+		results.push_back(Mat(rows, cols, CV_8UC1, Scalar::all(0)));
+	}
+
+	run(hyperImage, numThreads, [&](int top, int blockRows, const vector<int*>& blockScores)
+	{
+		for (size_t f = 0; f < results.size(); ++f)
+		{
+			int low = INT_MAX;
+			int high = INT_MIN;
+			for (int r = 0; r < blockRows; ++r)
+			{
+				SADClassifyRow(blockScores[f] + r * cols, results[f].ptr<uchar>(top + r), cols, low, high);
+			}
+		}
+	});
+	return results;
+}
+
+//  classify
+//  Finds the best matching filter for every pixel in one pass.
+//  Pre-Conditions: The image has been loaded.
+//  Post-Conditions: Returns a CV_16UC1 label image holding 1 + the index of the
+//  filter with the lowest score, or 0 where no score is below maxScore. 
+//  bestScore is set to a CV_32FC1 plane of the lowest score of each pixel. 
+//  Blocks of rows are shared out between numThreads threads (0 uses every core).
+Mat FilterBank::classify(const SpecImage& hyperImage, Mat& bestScore, double maxScore, int numThreads) const
+{
+	int rows = hyperImage.getRows();
+	int cols = hyperImage.getCols();
+	Mat labels(rows, cols, CV_16UC1, Scalar::all(0));
+	bestScore = Mat(rows, cols, CV_32FC1, Scalar::all(FLT_MAX));
+	double limit = maxScore * SAD_SCALE;
+
+	run(hyperImage, numThreads, [&](int top, int blockRows, const vector<int*>& blockScores)
+	{
+		for (int r = 0; r < blockRows; ++r)
+		{
+			ushort* label = labels.ptr<ushort>(top + r);
+			float* best = bestScore.ptr<float>(top + r);
+			for (int c = 0; c < cols; ++c)
+			{
+				int bestIndex = -1;
+				int bestValue = INT_MAX;
+				for (size_t f = 0; f < blockScores.size(); ++f)
+				{
+					int value = blockScores[f][r * cols + c];
+					if (value < bestValue)
+					{
+						bestValue = value;
+						bestIndex = static_cast<int>(f);
+					}
+				}
+				if (bestIndex < 0)
+				{
+					continue;
+				}
+				best[c] = static_cast<float>(bestValue) / SAD_SCALE;
+				label[c] = bestValue < limit ? static_cast<ushort>(bestIndex + 1) : 0;
+			}
+		}
+	});
+	return labels;
+}
+
+//  run
+//  Private method that streams the image once, block of rows by block of rows,
+//  and hands every block's fixed point scores to consume. Blocks are shared out
+//  between numThreads threads (0 uses every core), each with its own scores.
+//  Pre-conditions: The image has been loaded, and consume is safe to run 
+//  concurrently for different blocks.
+//  Post-conditions: consume has been called once per block with the block's 
+//  first row, its number of rows, and one score array per filter (each holding
+//  blockRows * cols scores). Returns false if nothing could be run.
+bool FilterBank::run(const SpecImage& hyperImage, int numThreads,
+	const function<void(int top, int blockRows, const vector<int*>& blockScores)>& consume) const
+{
+	//  Target size of all filters' block scores together, so they stay in cache
+	//  while a block's band rows are streamed through
+	const size_t BLOCK_BYTES = 256 * 1024;
+
+	int rows = hyperImage.getRows();
+	int cols = hyperImage.getCols();
+	int count = getCount();
+	if (count == 0 || rows <= 0 || cols <= 0)
+	{
+		return false;
+	}
+	TRACE_SCOPE("FilterBank::run");
+	TRACE_COUNT("pixels scored", static_cast<long long>(rows) * cols * count);
+
+	//  Group the compiled entries of every filter by band, so a band that several
+	//  filters use is read once
+	struct BankBand
+	{
+		int band;
+		Mat image;
+		vector<int> filters;
+		vector<int> references;
+		vector<int> weights;
+	};
+	int depth = hyperImage.getDepth();
+	vector<int> slot(depth, -1);
+	vector<BankBand> bands;
+	vector<int> constantScores(count, 0);
+	for (int f = 0; f < count; ++f)
+	{
+		FilterPlan plan = filters[f].Compile(hyperImage);
+		for (size_t b = 0; b < plan.bands.size(); ++b)
+		{
+			//  Bad bands are not read, every pixel scores the same against them
+			int band = plan.bands[b].band;
+			if (hyperImage.isBadBand(band))
+			{
+				constantScores[f] += SADScoreValue(hyperImage.getBadBandValue(band),
+					toSADReference(plan.bands[b].reflectance), static_cast<int>(round(plan.bands[b].weight)));
+				continue;
+			}
+			if (slot[band] < 0)
+			{
+				slot[band] = static_cast<int>(bands.size());
+				bands.push_back(BankBand());
+				bands.back().band = band;
+			}
+			BankBand& entry = bands[slot[band]];
+			entry.filters.push_back(f);
+			entry.references.push_back(toSADReference(plan.bands[b].reflectance));
+			entry.weights.push_back(static_cast<int>(round(plan.bands[b].weight)));
+		}
+	}
+	sort(bands.begin(), bands.end(), [](const BankBand& a, const BankBand& b) { return a.band < b.band; });
+
+	//  Band interleaved by pixel cubes are scored straight from each pixel's spectrum,
+	//  every other layout one band row at a time.
+	bool interleaved = hyperImage.getInterleave() == SpecImage::BIP;
+	vector<vector<int> > pixelBands(count);
+	vector<vector<int> > pixelReferences(count);
+	vector<vector<int> > pixelWeights(count);
+	for (size_t b = 0; b < bands.size(); ++b)
+	{
+		if (interleaved && hyperImage.isBandMissing(bands[b].band))
+		{
+			//  Bands that failed to load are zeros in the cube, and skipped as in 
+			//  every other layout
+			continue;
+		}
+		if (interleaved)
+		{
+			for (size_t k = 0; k < bands[b].filters.size(); ++k)
+			{
+				int f = bands[b].filters[k];
+				pixelBands[f].push_back(bands[b].band);
+				pixelReferences[f].push_back(bands[b].references[k]);
+				pixelWeights[f].push_back(bands[b].weights[k]);
+			}
+			continue;
+		}
+		//  Bands smaller than the scene are skipped, as SpecFilter::filter does
+		bands[b].image = hyperImage.getBand(bands[b].band);
+		if (bands[b].image.rows < rows || bands[b].image.cols < cols)
+		{
+			bands[b].image.release();
+		}
+		if (!bands[b].image.empty() && bands[b].image.type() != CV_16UC1)
+		{
+			TRACE_SCOPE("convertTo");
+			bands[b].image.convertTo(bands[b].image, CV_16U);
+			TRACE_COUNT("pixels converted", static_cast<long long>(bands[b].image.total()));
+		}
+	}
+
+	int blockRows = static_cast<int>(BLOCK_BYTES / (static_cast<size_t>(count) * cols * sizeof(int)));
+	blockRows = max(1, min(blockRows, rows));
+	int blockCount = (rows + blockRows - 1) / blockRows;
+	int workers = min(resolveThreadCount(numThreads), blockCount);
+	size_t blockSize = static_cast<size_t>(blockRows) * cols;
+	vector<vector<int> > scores(workers, vector<int>(count * blockSize));
+
+	parallelForWorkers(blockCount, workers, [&](int block, int worker)
+	{
+		int top = block * blockRows;
+		int height = min(blockRows, rows - top);
+		vector<int*> blockScores(count);
+		for (int f = 0; f < count; ++f)
+		{
+			blockScores[f] = &scores[worker][f * blockSize];
+			fill(blockScores[f], blockScores[f] + blockSize, constantScores[f]);
+		}
+		if (interleaved)
+		{
+			for (int r = 0; r < height; ++r)
+			{
+				const ushort* spectra = hyperImage.getSpectrum(top + r, 0);
+				for (int f = 0; f < count; ++f)
+				{
+					if (pixelBands[f].empty())
+					{
+						continue;
+					}
+					SADAccumulateSpectra(spectra, depth, &pixelBands[f][0], &pixelReferences[f][0],
+						&pixelWeights[f][0], static_cast<int>(pixelBands[f].size()), blockScores[f] + r * cols, cols);
+				}
+			}
+		}
+		else
+		{
+			for (size_t b = 0; b < bands.size(); ++b)
+			{
+				const BankBand& entry = bands[b];
+				if (entry.image.empty())
+				{
+					continue;
+				}
+				for (int r = 0; r < height; ++r)
+				{
+					const ushort* src = entry.image.ptr<ushort>(top + r);
+					for (size_t k = 0; k < entry.filters.size(); ++k)
+					{
+						SADAccumulateRow(src, entry.references[k], entry.weights[k], 
+							blockScores[entry.filters[k]] + r * cols, cols);
+					}
+				}
+			}
+		}
+		consume(top, height, blockScores);
+	});
+	return true;
+}
@@ -0,0 +1,109 @@
+/*
+FilterBank holds several SpecFilters and scores all of them against a 
+hyperspectral image in a single pass. Each band row is read once per block of
+rows and added to the score of every filter that uses that band, so adding a
+material costs arithmetic but no extra pass over the cube.
+
+Results can be returned as one SAD score plane per filter, as the same binary
+maps SpecFilter::filter produces, or as a per-pixel best-match label and score.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "SADKernel.h"
+#include "SpecFilter.h"
+#include "SpecImage.h"
+
+using namespace cv;
+using namespace std;
+
+class FilterBank
+{
+	public:
+		//  FilterBank
+		//  Creates an empty filter bank.
+		FilterBank();
+
+		//  AddFilter
+		//  Adds a filter to the bank.
+		//  Pre-Conditions: None
+		//  Post-Conditions: The filter is stored under the given name. Its index is the 
+		//  number of filters that were in the bank before it.
+		void AddFilter(const string& name, const SpecFilter& filter);
+
+		//  AddFilterFromFile
+		//  Loads a USGS formatted Reflectance Pattern file (see SpecFilter::LoadFromFile)
+		//  and adds it to the bank.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the file was read and added, false otherwise.
+		bool AddFilterFromFile(const string& name, const string& fileName);
+
+		//  SaveToFile
+		//  Writes every filter of the bank, with its name, to a filter bank file
+		//  (see FilterBankFile.h).
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the file was written, false otherwise.
+		bool SaveToFile(const string& fileName) const;
+
+		//  LoadFromFile
+		//  Adds every filter of a filter bank file (see FilterBankFile.h) to the bank,
+		//  in file order.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the file was read and its filters added,
+		//  false (with nothing added) otherwise.
+		bool LoadFromFile(const string& fileName);
+
+		//  getCount
+		//  Returns the number of filters in the bank.
+		int getCount() const;
+
+		//  getName
+		//  Returns the name of the filter at the given index.
+		//  Pre-Conditions: index is in the range [0, getCount())
+		string getName(int index) const;
+
+		//  scores
+		//  Scores every filter against a hyperspectral image in one pass.
+		//  Pre-Conditions: The image has been loaded.
+		//  Post-Conditions: Returns one CV_32FC1 plane per filter, in bank order, 
+		//  holding each pixel's SAD score (lower is a closer match). Blocks of rows are
+		//  shared out between numThreads threads (0 uses every core).
+		vector<Mat> scores(const SpecImage& hyperImage, int numThreads = 0) const;
+
+		//  filter
+		//  Runs every filter against a hyperspectral image in one pass.
+		//  Pre-Conditions: The image has been loaded.
+		//  Post-Conditions: Returns one CV_8UC1 image per filter, in bank order, equal 
+		//  to what SpecFilter::filter returns for that filter. Blocks of rows are shared
+		//  out between numThreads threads (0 uses every core).
+		vector<Mat> filter(const SpecImage& hyperImage, int numThreads = 0) const;
+
+		//  classify
+		//  Finds the best matching filter for every pixel in one pass.
+		//  Pre-Conditions: The image has been loaded.
+		//  Post-Conditions: Returns a CV_16UC1 label image holding 1 + the index of the
+		//  filter with the lowest score, or 0 where no score is below maxScore. 
+		//  bestScore is set to a CV_32FC1 plane of the lowest score of each pixel. 
+		//  Blocks of rows are shared out between numThreads threads (0 uses every core).
+		Mat classify(const SpecImage& hyperImage, Mat& bestScore, double maxScore = MATCH_MAX,
+			int numThreads = 0) const;
+
+	private:
+		vector<string> names;
+		vector<SpecFilter> filters;
+
+		//  run
+		//  Private method that streams the image once, block of rows by block of rows,
+		//  and hands every block's fixed point scores to consume. Blocks are shared out
+		//  between numThreads threads (0 uses every core), each with its own scores.
+		//  Pre-conditions: The image has been loaded, and consume is safe to run 
+		//  concurrently for different blocks.
+		//  Post-conditions: consume has been called once per block with the block's 
+		//  first row, its number of rows, and one score array per filter (each holding
+		//  blockRows * cols scores). Returns false if nothing could be run.
+		bool run(const SpecImage& hyperImage, int numThreads,
+			const function<void(int top, int blockRows, const vector<int*>& blockScores)>& consume) const;
+};
@@ -0,0 +1,197 @@
+// FilterBankFile
+// Saves and loads many filters as one binary file. See FilterBankFile.h for the
+//  layout of a filter bank file.
+
+#include "FilterBankFile.h"
+#include "CubeFile.h"
+#include "Trace.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static const char BANK_MAGIC[8] = { 'S', 'P', 'E', 'C', 'B', 'A', 'N', 'K' };
+static const uint32_t BANK_VERSION = 1;
+
+// Size of the fixed part of the file and of each filter's entry
+static const size_t BANK_FIXED_HEADER = sizeof(BANK_MAGIC) + 2 * sizeof(uint32_t);
+static const size_t BANK_ENTRY = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+// putLittle
+// Appends the given number of low bytes of value to out, least significant
+//  first, so the file is little-endian whatever the byte order of the host.
+static void putLittle(string& out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+	}
+}
+
+// getLittle
+// Reads an unsigned little-endian value of the given number of bytes.
+static uint64_t getLittle(const uchar* p, int bytes)
+{
+	uint64_t value = 0;
+	for (int i = bytes - 1; i >= 0; i--)
+	{
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+// putDoubles
+// Appends count IEEE doubles to out in little-endian byte order.
+static void putDoubles(string& out, const double* values, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t bits;
+		memcpy(&bits, &values[i], sizeof(bits));
+		putLittle(out, bits, sizeof(bits));
+	}
+}
+
+// getDoubles
+// Reads count little-endian IEEE doubles, which need not be aligned, into values.
+static void getDoubles(const uchar* p, double* values, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t bits = getLittle(p + i * sizeof(bits), sizeof(bits));
+		memcpy(&values[i], &bits, sizeof(bits));
+	}
+}
+
+// WriteFilterBankFile
+// Writes filters and their names to a filter bank file.
+// Pre-Condition: names and filters are the same size.
+// Post-Condition: Returns true if the whole file was written. On failure an
+//  error is printed and false is returned.
+bool WriteFilterBankFile(const string& fileName, const vector<string>& names, const vector<SpecFilter>& filters)
+{
+	TRACE_SCOPE("WriteFilterBankFile");
+	ofstream out(fileName, ios::binary);
+	if (!out.is_open())
+	{
+		cerr << "Error - Could not write filter bank \"" << fileName << "\"." << endl;
+		return false;
+	}
+
+	// Samples follow the entries, names follow the samples
+	uint32_t count = static_cast<uint32_t>(filters.size());
+	uint64_t sampleOffset = BANK_FIXED_HEADER + static_cast<uint64_t>(count) * BANK_ENTRY;
+	uint64_t nameOffset = sampleOffset;
+	for (uint32_t f = 0; f < count; f++)
+	{
+		nameOffset += 2 * filters[f].getSampleCount() * sizeof(double);
+	}
+
+	string header(BANK_MAGIC, sizeof(BANK_MAGIC));
+	putLittle(header, BANK_VERSION, sizeof(BANK_VERSION));
+	putLittle(header, count, sizeof(count));
+	for (uint32_t f = 0; f < count; f++)
+	{
+		uint32_t samples = static_cast<uint32_t>(filters[f].getSampleCount());
+		uint32_t nameLength = static_cast<uint32_t>(names[f].size());
+		putLittle(header, sampleOffset, sizeof(sampleOffset));
+		putLittle(header, nameOffset, sizeof(nameOffset));
+		putLittle(header, samples, sizeof(samples));
+		putLittle(header, nameLength, sizeof(nameLength));
+		sampleOffset += 2 * static_cast<uint64_t>(samples) * sizeof(double);
+		nameOffset += nameLength;
+	}
+	out.write(header.data(), header.size());
+	string samples;
+	for (uint32_t f = 0; f < count; f++)
+	{
+		const vector<double>& wavelengths = filters[f].getSampleWavelengths();
+		const vector<double>& reflectances = filters[f].getSampleReflectances();
+		samples.clear();
+		putDoubles(samples, wavelengths.data(), wavelengths.size());
+		putDoubles(samples, reflectances.data(), reflectances.size());
+		out.write(samples.data(), samples.size());
+	}
+	for (uint32_t f = 0; f < count; f++)
+	{
+		out.write(names[f].data(), names[f].size());
+	}
+
+	if (!out)
+	{
+		cerr << "Error - Could not write filter bank \"" << fileName << "\"." << endl;
+		return false;
+	}
+	return true;
+}
+
+// ReadFilterBankFile
+// Reads every filter of a filter bank file.
+// Pre-Condition: None
+// Post-Condition: Returns true and appends the filters and their names, in file
+//  order, if the file is a valid filter bank. Otherwise an error is printed,
+//  nothing is appended and false is returned.
+bool ReadFilterBankFile(const string& fileName, vector<string>& names, vector<SpecFilter>& filters)
+{
+	TRACE_SCOPE("ReadFilterBankFile");
+	MappedFile file;
+	if (!file.Open(fileName))
+	{
+		cerr << "Error - Could not open filter bank \"" << fileName << "\"." << endl;
+		return false;
+	}
+	const uchar* data = file.getData();
+	size_t size = file.getSize();
+
+	if (size < BANK_FIXED_HEADER || memcmp(data, BANK_MAGIC, sizeof(BANK_MAGIC)) != 0)
+	{
+		cerr << "Error - \"" << fileName << "\" is not a filter bank." << endl;
+		return false;
+	}
+	uint32_t version = static_cast<uint32_t>(getLittle(data + sizeof(BANK_MAGIC), sizeof(uint32_t)));
+	uint32_t count = static_cast<uint32_t>(getLittle(data + sizeof(BANK_MAGIC) + sizeof(uint32_t), sizeof(uint32_t)));
+	if (version != BANK_VERSION || BANK_FIXED_HEADER + static_cast<uint64_t>(count) * BANK_ENTRY > size)
+	{
+		cerr << "Error - Filter bank \"" << fileName << "\" is corrupt or of an unknown version." << endl;
+		return false;
+	}
+
+	// Check every entry before adding anything
+	vector<string> newNames(count);
+	vector<SpecFilter> newFilters(count);
+	vector<double> wavelengths;
+	vector<double> reflectances;
+	for (uint32_t f = 0; f < count; f++)
+	{
+		const uchar* entry = data + BANK_FIXED_HEADER + static_cast<size_t>(f) * BANK_ENTRY;
+		uint64_t sampleOffset = getLittle(entry, sizeof(uint64_t));
+		uint64_t nameOffset = getLittle(entry + sizeof(uint64_t), sizeof(uint64_t));
+		uint32_t lengths[2];
+		lengths[0] = static_cast<uint32_t>(getLittle(entry + 2 * sizeof(uint64_t), sizeof(uint32_t)));
+		lengths[1] = static_cast<uint32_t>(getLittle(entry + 2 * sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint32_t)));
+		uint64_t sampleBytes = static_cast<uint64_t>(lengths[0]) * sizeof(double);
+		if (sampleOffset > size || 2 * sampleBytes > size - sampleOffset
+			|| nameOffset > size || lengths[1] > size - nameOffset)
+		{
+			cerr << "Error - Filter bank \"" << fileName << "\" is corrupt." << endl;
+			return false;
+		}
+
+		// The samples may not be aligned for doubles, so they are copied out
+		wavelengths.resize(lengths[0]);
+		reflectances.resize(lengths[0]);
+		if (lengths[0] > 0)
+		{
+			getDoubles(data + sampleOffset, &wavelengths[0], lengths[0]);
+			getDoubles(data + sampleOffset + sampleBytes, &reflectances[0], lengths[0]);
+			newFilters[f].SetSamples(&wavelengths[0], &reflectances[0], lengths[0]);
+		}
+		newNames[f].assign(reinterpret_cast<const char*>(data + nameOffset), lengths[1]);
+	}
+	TRACE_COUNT("filters read", count);
+
+	names.insert(names.end(), make_move_iterator(newNames.begin()), make_move_iterator(newNames.end()));
+	filters.insert(filters.end(), make_move_iterator(newFilters.begin()), make_move_iterator(newFilters.end()));
+	return true;
+}
@@ -0,0 +1,43 @@
+/*
+FilterBankFile
+Defines a binary file that holds the samples of many filters (see SpecFilter) in
+one piece, so a whole spectral library that was converted once loads with one
+memory mapping instead of parsing a text file per material. FilterBank and
+SpectralLibrary save and load it.
+
+File layout (all values little-endian, whatever the byte order of the host):
+	bytes 0-7     magic "SPECBANK"
+	uint32        format version (1)
+	uint32        number of filters
+	entry[]       one 24 byte entry per filter:
+	                uint64  byte offset of the filter's samples
+	                uint64  byte offset of the filter's name
+	                uint32  number of samples
+	                uint32  length of the name in bytes
+	samples       per filter, float64 wavelengths (micrometers, ascending)
+	              followed by float64 reflectances
+	names         the names, one after another, without terminators
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "SpecFilter.h"
+
+using namespace std;
+
+// WriteFilterBankFile
+// Writes filters and their names to a filter bank file.
+// Pre-Condition: names and filters are the same size.
+// Post-Condition: Returns true if the whole file was written. On failure an
+//  error is printed and false is returned.
+bool WriteFilterBankFile(const string& fileName, const vector<string>& names, const vector<SpecFilter>& filters);
+
+// ReadFilterBankFile
+// Reads every filter of a filter bank file.
+// Pre-Condition: None
+// Post-Condition: Returns true and appends the filters and their names, in file
+//  order, if the file is a valid filter bank. Otherwise an error is printed,
+//  nothing is appended and false is returned.
+bool ReadFilterBankFile(const string& fileName, vector<string>& names, vector<SpecFilter>& filters);
@@ -0,0 +1,108 @@
+// Parallel
+// Small helpers for spreading independent pieces of work across worker threads.
+//  SpecImage and SpecFilter use these so that every stage can be given its own
+//  thread count, instead of relying on a single global OpenCV setting.
+
+#include "Parallel.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// resolveThreadCount
+// Turns a requested thread count into the number of threads to actually use.
+// Pre-Condition: None
+// Post-Condition: Returns numThreads if it is positive, otherwise the number of
+//  hardware threads available (at least 1).
+int resolveThreadCount(int numThreads)
+{
+	if (numThreads > 0)
+	{
+		return numThreads;
+	}
+	int hardware = static_cast<int>(thread::hardware_concurrency());
+	return hardware > 0 ? hardware : 1;
+}
+
+// parallelFor
+// Runs body(i) for every i in [0, count) on up to numThreads worker threads.
+//  Indices are handed out one at a time, so tasks of uneven cost are balanced.
+// Pre-Condition: body is safe to run concurrently for different indices.
+// Post-Condition: body has run exactly once for each index. If any call threw,
+//  the first exception is rethrown on the calling thread after all workers
+//  have finished. With a single thread (or a single task) the work runs on the
+//  calling thread.
+void parallelFor(int count, int numThreads, const function<void(int)>& body)
+{
+	parallelForWorkers(count, numThreads, [&body](int i, int)
+	{
+		body(i);
+	});
+}
+
+// parallelForWorkers
+// Runs body(i, worker) for every i in [0, count) as parallelFor does. worker
+//  identifies the thread running the call, and is in the range 
+//  [0, resolveThreadCount(numThreads)).
+// Pre-Condition: body is safe to run concurrently for different indices.
+// Post-Condition: As for parallelFor. Calls with the same worker never run at
+//  the same time, so worker can index scratch memory kept per thread.
+void parallelForWorkers(int count, int numThreads, const function<void(int, int)>& body)
+{
+	int workers = resolveThreadCount(numThreads);
+	if (workers > count)
+	{
+		workers = count;
+	}
+	if (workers <= 1)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			body(i, 0);
+		}
+		return;
+	}
+
+	atomic<int> next(0);
+	exception_ptr firstError;
+	mutex errorLock;
+
+	auto work = [&](int worker)
+	{
+		for (int i = next++; i < count; i = next++)
+		{
+			try
+			{
+				body(i, worker);
+			}
+			catch (...)
+			{
+				lock_guard<mutex> guard(errorLock);
+				if (!firstError)
+				{
+					firstError = current_exception();
+				}
+			}
+		}
+	};
+
+	// The calling thread takes part as worker 0
+	vector<thread> pool;
+	pool.reserve(workers - 1);
+	for (int t = 1; t < workers; t++)
+	{
+		pool.push_back(thread(work, t));
+	}
+	work(0);
+	for (size_t t = 0; t < pool.size(); t++)
+	{
+		pool[t].join();
+	}
+
+	if (firstError)
+	{
+		rethrow_exception(firstError);
+	}
+}
@@ -0,0 +1,37 @@
+/*
+Parallel
+Small helpers for spreading independent pieces of work across worker threads.
+SpecImage and SpecFilter use these so that every stage can be given its own
+thread count, instead of relying on a single global OpenCV setting.
+*/
+
+#pragma once
+#include <functional>
+
+using namespace std;
+
+// resolveThreadCount
+// Turns a requested thread count into the number of threads to actually use.
+// Pre-Condition: None
+// Post-Condition: Returns numThreads if it is positive, otherwise the number of
+//  hardware threads available (at least 1).
+int resolveThreadCount(int numThreads);
+
+// parallelFor
+// Runs body(i) for every i in [0, count) on up to numThreads worker threads.
+//  Indices are handed out one at a time, so tasks of uneven cost are balanced.
+// Pre-Condition: body is safe to run concurrently for different indices.
+// Post-Condition: body has run exactly once for each index. If any call threw,
+//  the first exception is rethrown on the calling thread after all workers
+//  have finished. With a single thread (or a single task) the work runs on the
+//  calling thread.
+void parallelFor(int count, int numThreads, const function<void(int)>& body);
+
+// parallelForWorkers
+// Runs body(i, worker) for every i in [0, count) as parallelFor does. worker
+//  identifies the thread running the call, and is in the range 
+//  [0, resolveThreadCount(numThreads)).
+// Pre-Condition: body is safe to run concurrently for different indices.
+// Post-Condition: As for parallelFor. Calls with the same worker never run at
+//  the same time, so worker can index scratch memory kept per thread.
+void parallelForWorkers(int count, int numThreads, const function<void(int, int)>& body);
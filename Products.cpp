@@ -0,0 +1,100 @@
+/*
+Products are the images made from a hyperspectral scene: the vegetation health
+maps and the trees/water filter composite. They are computed here without any
+GUI calls, so they can be shown by the demo in main.cpp or written out by the
+headless batch runner.
+*/
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "Compositor.h"
+#include "FilterBank.h"
+#include "Products.h"
+#include "Trace.h"
+
+using namespace cv;
+using namespace std;
+
+//  MakeVegetationMaps
+//  Builds the color and SWIR composites of a scene and its vegetation health maps,
+//  where the near infrared band at 855nm is laid over the red channel.
+//  Pre-Conditions: Supplied hyperImage exists and is non-empty
+//  Post-Conditions: Returns the four images described in VegetationMaps. In the
+//  health maps areas of medium to high vegetation health are red, and areas of low
+//  vegetation health (those areas unlikely to have vegetation) keep their gray or
+//  color value. The maps are drawn on numThreads threads (0 uses every core).
+VegetationMaps MakeVegetationMaps(SpecImage& hyperImage, int numThreads)
+{
+	TRACE_SCOPE("MakeVegetationMaps");
+	VegetationMaps maps;
+	maps.colorComposite = hyperImage.getComposite(641, 580, 509); //  Hyperion reccomended color composite
+	maps.swir = hyperImage.getComposite(1954, 1629, 1074); //  Short Wavelength InfraRed (SWIR)
+
+	Mat grayscale;
+	Mat veg = hyperImage.getImage(855); //  16US1
+
+	short arbitraryThreshold = 32768 / 64;
+	{
+		TRACE_SCOPE("convertTo");
+		veg.convertTo(veg, CV_8UC1, 255.0 / arbitraryThreshold);
+		TRACE_COUNT("pixels converted", static_cast<long long>(veg.total()));
+	}
+
+	cvtColor(maps.colorComposite, grayscale, CV_RGB2GRAY); //  Convert to gray
+
+	//  The red channel of each map is the brighter of the vegetation band and the base
+	vector<CompositeLayer> vegetation(1, ScoreLayer(veg, Vec3b(0, 0, 255)));
+	maps.redVegetationGray = CompositeMasks(vegetation, grayscale, BLEND_MAX, numThreads);
+	maps.redVegetationColor = CompositeMasks(vegetation, maps.colorComposite, BLEND_MAX, numThreads);
+
+	return maps;
+}
+
+//  MakeTreesWaterMaps
+//  Filters a scene for trees and water, scoring both filters in a single pass.
+//  Pre-Conditions: Supplied hyperImage exists and is non-empty, and the filter
+//  files exist.
+//  Post-Conditions: Returns both filter maps and their composite (see
+//  MakeTreesWaterComposite). Maps of filters that could not be loaded are empty.
+//  The filters are scored on numThreads threads (0 uses every core).
+TreesWaterMaps MakeTreesWaterMaps(const SpecImage& hyperImage, const string& treesFilter, const string& waterFilter,
+	int numThreads)
+{
+	TRACE_SCOPE("MakeTreesWaterMaps");
+
+	//  Both filters are scored in a single pass over the image
+	FilterBank filters;
+	bool treesLoaded = filters.AddFilterFromFile("trees", treesFilter);
+	bool waterLoaded = filters.AddFilterFromFile("water", waterFilter);
+	vector<Mat> results = filters.filter(hyperImage, numThreads);
+
+	TreesWaterMaps maps;
+	int next = 0;
+	if (treesLoaded && next < static_cast<int>(results.size()))
+	{
+		maps.trees = results[next++];
+	}
+	if (waterLoaded && next < static_cast<int>(results.size()))
+	{
+		maps.water = results[next++];
+	}
+	if (!maps.trees.empty() && !maps.water.empty())
+	{
+		maps.waterAndTrees = MakeTreesWaterComposite(maps.trees, maps.water, numThreads);
+	}
+	return maps;
+}
+
+//  MakeTreesWaterComposite
+//  Combines a trees and a water filter map into one color image.
+//  Pre-Conditions: trees and water are 8UC1 filter maps of the same size.
+//  Post-Conditions: Returns an 8UC3 image that is red where trees were found and
+//  blue where water was found (magenta where both were), and black elsewhere. It
+//  is drawn on numThreads threads (0 uses every core).
+Mat MakeTreesWaterComposite(const Mat& trees, const Mat& water, int numThreads)
+{
+	vector<CompositeLayer> layers;
+	layers.push_back(CompositeLayer(water, Vec3b(255, 0, 0)));
+	layers.push_back(CompositeLayer(trees, Vec3b(0, 0, 255)));
+	return CompositeMasks(layers, Mat(), BLEND_MAX, numThreads);
+}
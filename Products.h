@@ -0,0 +1,61 @@
+/*
+Products are the images made from a hyperspectral scene: the vegetation health
+maps and the trees/water filter composite. They are computed here without any
+GUI calls, so they can be shown by the demo in main.cpp or written out by the
+headless batch runner.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <string>
+
+#include "SpecImage.h"
+
+using namespace cv;
+using namespace std;
+
+//  VegetationMaps
+//  The images made by MakeVegetationMaps. All are 8UC3.
+struct VegetationMaps
+{
+	Mat colorComposite;      //  Hyperion recommended color composite
+	Mat swir;                //  Short-Wave-Infared (SWIR) "hypercolor" image
+	Mat redVegetationGray;   //  Vegetation health map (red on grayscale)
+	Mat redVegetationColor;  //  Vegetation health map composite (red on color)
+};
+
+//  TreesWaterMaps
+//  The images made by MakeTreesWaterMaps.
+struct TreesWaterMaps
+{
+	Mat trees;          //  Trees filter map (8UC1)
+	Mat water;          //  Water filter map (8UC1)
+	Mat waterAndTrees;  //  Trees (red) and water (blue) composite (8UC3)
+};
+
+//  MakeVegetationMaps
+//  Builds the color and SWIR composites of a scene and its vegetation health maps,
+//  where the near infrared band at 855nm is laid over the red channel.
+//  Pre-Conditions: Supplied hyperImage exists and is non-empty
+//  Post-Conditions: Returns the four images described in VegetationMaps. In the
+//  health maps areas of medium to high vegetation health are red, and areas of low
+//  vegetation health (those areas unlikely to have vegetation) keep their gray or
+//  color value. The maps are drawn on numThreads threads (0 uses every core).
+VegetationMaps MakeVegetationMaps(SpecImage& hyperImage, int numThreads = 0);
+
+//  MakeTreesWaterMaps
+//  Filters a scene for trees and water, scoring both filters in a single pass.
+//  Pre-Conditions: Supplied hyperImage exists and is non-empty, and the filter
+//  files exist.
+//  Post-Conditions: Returns both filter maps and their composite (see
+//  MakeTreesWaterComposite). Maps of filters that could not be loaded are empty.
+//  The filters are scored on numThreads threads (0 uses every core).
+TreesWaterMaps MakeTreesWaterMaps(const SpecImage& hyperImage, const string& treesFilter = "douglas_fir.txt",
+	const string& waterFilter = "water.txt", int numThreads = 0);
+
+//  MakeTreesWaterComposite
+//  Combines a trees and a water filter map into one color image.
+//  Pre-Conditions: trees and water are 8UC1 filter maps of the same size.
+//  Post-Conditions: Returns an 8UC3 image that is red where trees were found and
+//  blue where water was found (magenta where both were), and black elsewhere. It
+//  is drawn on numThreads threads (0 uses every core).
+Mat MakeTreesWaterComposite(const Mat& trees, const Mat& water, int numThreads = 0);
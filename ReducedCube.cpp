@@ -0,0 +1,512 @@
+#include "ReducedCube.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+//  Number of chunks the covariance samples are split into. Chunks are summed in
+//  order, so the result does not depend on how many threads summed them.
+const int COVARIANCE_CHUNKS = 32;
+
+//  Rows projected or matched per parallel work item
+const int REDUCED_BLOCK_ROWS = 16;
+
+//  ReducedCube
+//  Creates an empty reduced cube. Use Build to fill it.
+ReducedCube::ReducedCube()
+{
+	rows = 0;
+	cols = 0;
+	componentCount = 0;
+	retainedVariance = 0;
+}
+
+//  Build
+//  Finds the principal components of a hyperspectral image and projects every
+//  pixel onto the first components of them. The covariance is accumulated over
+//  at most maxSamples pixels, spread evenly over the image, and both passes are
+//  shared between numThreads threads (0 uses every core).
+//  Pre-Conditions: The image has been loaded. components is at least 1.
+//  Post-Conditions: Returns true if the cube was built. components is lowered to
+//  the number of usable bands if there are fewer. On failure an error is
+//  printed, the cube is left empty and false is returned.
+//  NOTE: The result does not depend on the number of threads.
+bool ReducedCube::Build(const SpecImage& hyperImage, int components, int numThreads, int maxSamples)
+{
+	TRACE_SCOPE("ReducedCube::Build");
+	*this = ReducedCube();
+
+	int imageRows = hyperImage.getRows();
+	int imageCols = hyperImage.getCols();
+	if (imageRows <= 0 || imageCols <= 0 || components < 1 || maxSamples < 2)
+	{
+		cerr << "Error - Cannot reduce an empty image." << endl;
+		return false;
+	}
+
+	vector<Mat> images;
+	vector<int> usable = loadBands(hyperImage, images);
+	int depth = static_cast<int>(usable.size());
+	if (depth == 0)
+	{
+		cerr << "Error - The image has no usable bands to reduce." << endl;
+		return false;
+	}
+	components = min(components, depth);
+
+	//  Sample every step-th pixel in raster order
+	long long pixels = static_cast<long long>(imageRows) * imageCols;
+	long long step = max(1LL, (pixels + maxSamples - 1) / maxSamples);
+	long long samples = (pixels + step - 1) / step;
+	if (samples < 2)
+	{
+		cerr << "Error - The image has too few pixels to reduce." << endl;
+		return false;
+	}
+	TRACE_COUNT("pixels sampled", samples);
+
+	//  Each chunk sums its samples and the upper triangle of their products
+	size_t triangle = static_cast<size_t>(depth) * (depth + 1) / 2;
+	vector<vector<double> > chunkSums(COVARIANCE_CHUNKS);
+	vector<vector<double> > chunkProducts(COVARIANCE_CHUNKS);
+	parallelFor(COVARIANCE_CHUNKS, numThreads, [&](int chunk)
+	{
+		vector<double>& sum = chunkSums[chunk];
+		vector<double>& product = chunkProducts[chunk];
+		sum.assign(depth, 0);
+		product.assign(triangle, 0);
+		vector<double> spectrum(depth);
+
+		long long first = samples * chunk / COVARIANCE_CHUNKS;
+		long long last = samples * (chunk + 1) / COVARIANCE_CHUNKS;
+		for (long long s = first; s < last; ++s)
+		{
+			int r = static_cast<int>(s * step / imageCols);
+			int c = static_cast<int>(s * step % imageCols);
+			const ushort* bip = images.empty() ? hyperImage.getSpectrum(r, c) : NULL;
+			for (int i = 0; i < depth; ++i)
+			{
+				ushort value = bip ? bip[usable[i]] : images[i].ptr<ushort>(r)[c];
+				spectrum[i] = min<int>(value, 255) / 255.0;
+			}
+
+			double* dst = &product[0];
+			for (int i = 0; i < depth; ++i)
+			{
+				sum[i] += spectrum[i];
+				for (int j = i; j < depth; ++j)
+				{
+					*dst++ += spectrum[i] * spectrum[j];
+				}
+			}
+		}
+	});
+
+	vector<double> sum(depth, 0);
+	vector<double> product(triangle, 0);
+	for (int chunk = 0; chunk < COVARIANCE_CHUNKS; ++chunk)
+	{
+		for (int i = 0; i < depth; ++i)
+		{
+			sum[i] += chunkSums[chunk][i];
+		}
+		for (size_t k = 0; k < triangle; ++k)
+		{
+			product[k] += chunkProducts[chunk][k];
+		}
+	}
+
+	Mat covariance(depth, depth, CV_64FC1);
+	size_t k = 0;
+	for (int i = 0; i < depth; ++i)
+	{
+		for (int j = i; j < depth; ++j, ++k)
+		{
+			double value = (product[k] - sum[i] * sum[j] / samples) / (samples - 1);
+			covariance.at<double>(i, j) = value;
+			covariance.at<double>(j, i) = value;
+		}
+	}
+
+	Mat eigenvalues;
+	Mat eigenvectors;
+	{
+		TRACE_SCOPE("eigen");
+		if (!eigen(covariance, eigenvalues, eigenvectors))
+		{
+			cerr << "Error - The band covariance could not be decomposed." << endl;
+			return false;
+		}
+	}
+
+	double total = 0;
+	double kept = 0;
+	for (int i = 0; i < depth; ++i)
+	{
+		double value = max(0.0, eigenvalues.at<double>(i, 0));
+		total += value;
+		kept += i < components ? value : 0;
+	}
+
+	rows = imageRows;
+	cols = imageCols;
+	componentCount = components;
+	retainedVariance = total > 0 ? kept / total : 1.0;
+	bands = usable;
+	mean.resize(depth);
+	for (int i = 0; i < depth; ++i)
+	{
+		mean[i] = static_cast<float>(sum[i] / samples);
+	}
+	eigenvectors.rowRange(0, components).convertTo(transform, CV_32F);
+
+	//  Project every pixel, a block of rows at a time
+	cube = Mat(rows, cols * componentCount, CV_32FC1);
+	TRACE_COUNT("pixels projected", pixels);
+	int blockCount = (rows + REDUCED_BLOCK_ROWS - 1) / REDUCED_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		vector<float> spectra(static_cast<size_t>(cols) * depth);
+		int last = min(rows, (block + 1) * REDUCED_BLOCK_ROWS);
+		for (int r = block * REDUCED_BLOCK_ROWS; r < last; ++r)
+		{
+			readRow(hyperImage, bands, images, r, &spectra[0]);
+			float* dst = cube.ptr<float>(r);
+			for (int c = 0; c < cols; ++c)
+			{
+				float* spectrum = &spectra[static_cast<size_t>(c) * depth];
+				for (int i = 0; i < depth; ++i)
+				{
+					spectrum[i] -= mean[i];
+				}
+				for (int p = 0; p < componentCount; ++p)
+				{
+					const float* axis = transform.ptr<float>(p);
+					float value = 0;
+					for (int i = 0; i < depth; ++i)
+					{
+						value += axis[i] * spectrum[i];
+					}
+					*dst++ = value;
+				}
+			}
+		}
+	});
+	return true;
+}
+
+//  isEmpty
+//  Returns whether the cube has been built.
+bool ReducedCube::isEmpty() const
+{
+	return cube.empty();
+}
+
+//  getComponents
+//  Returns the number of components kept per pixel.
+int ReducedCube::getComponents() const
+{
+	return componentCount;
+}
+
+//  getRetainedVariance
+//  Returns the fraction (0 to 1) of the image's variance that the kept
+//  components explain.
+double ReducedCube::getRetainedVariance() const
+{
+	return retainedVariance;
+}
+
+//  getBands
+//  Returns the bands the transform was computed over, in band order.
+vector<int> ReducedCube::getBands() const
+{
+	return bands;
+}
+
+//  getComponent
+//  Fetches the image of a single component.
+//  Pre-Conditions: index is in the range [0, getComponents())
+//  Post-Conditions: Returns a CV_32FC1 image of the component's values.
+Mat ReducedCube::getComponent(int index) const
+{
+	Mat component(rows, cols, CV_32FC1);
+	for (int r = 0; r < rows; ++r)
+	{
+		const float* src = cube.ptr<float>(r) + index;
+		float* dst = component.ptr<float>(r);
+		for (int c = 0; c < cols; ++c)
+		{
+			dst[c] = src[static_cast<size_t>(c) * componentCount];
+		}
+	}
+	return component;
+}
+
+//  Distance
+//  Matches a compiled filter in the reduced space.
+//  Pre-Conditions: The cube has been built. plan was compiled for the image the
+//  cube was built from (see SpecFilter::Compile).
+//  Post-Conditions: Returns a CV_32FC1 image of each pixel's estimated distance
+//  to the filter's reference spectrum over the bands the plan covers (lower is a 
+//  closer match), or an empty Mat if the cube is empty.
+//  NOTE: The reference is included exactly. Each pixel is replaced by its 
+//  reconstruction from the kept components, so the part of it outside them is
+//  left out, which is what the retained variance measures.
+Mat ReducedCube::Distance(const FilterPlan& plan, int numThreads) const
+{
+	if (isEmpty())
+	{
+		return Mat();
+	}
+	TRACE_SCOPE("ReducedCube::Distance");
+	TRACE_COUNT("pixels matched", static_cast<long long>(rows) * cols);
+
+	//  Over the covered bands S, a pixel with components z is mean + T^T z, so its
+	//  squared distance to the reference is z^T (T_S T_S^T) z - 2 z^T T_S d + |d|^2
+	//  with d = reference - mean. The components are only orthonormal over every
+	//  band, so the k x k Gram matrix of T_S is needed.
+	vector<int> covered;
+	vector<float> reference = referenceSpectrum(plan, covered);
+	int k = componentCount;
+	vector<double> gram(static_cast<size_t>(k) * k, 0.0);
+	vector<double> cross(k, 0.0);
+	double offset = 0;
+	for (size_t i = 0; i < covered.size(); ++i)
+	{
+		int band = covered[i];
+		double difference = static_cast<double>(reference[i]) - mean[band];
+		offset += difference * difference;
+		for (int p = 0; p < k; ++p)
+		{
+			double axis = transform.at<float>(p, band);
+			cross[p] += axis * difference;
+			for (int q = 0; q < k; ++q)
+			{
+				gram[p * k + q] += axis * transform.at<float>(q, band);
+			}
+		}
+	}
+	vector<float> gramFloat(gram.begin(), gram.end());
+	vector<float> crossFloat(k);
+	for (int p = 0; p < k; ++p)
+	{
+		crossFloat[p] = static_cast<float>(2 * cross[p]);
+	}
+	float constant = static_cast<float>(offset);
+
+	Mat distance(rows, cols, CV_32FC1);
+	int blockCount = (rows + REDUCED_BLOCK_ROWS - 1) / REDUCED_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		int last = min(rows, (block + 1) * REDUCED_BLOCK_ROWS);
+		for (int r = block * REDUCED_BLOCK_ROWS; r < last; ++r)
+		{
+			const float* src = cube.ptr<float>(r);
+			float* dst = distance.ptr<float>(r);
+			for (int c = 0; c < cols; ++c, src += k)
+			{
+				float value = constant;
+				for (int p = 0; p < k; ++p)
+				{
+					const float* row = &gramFloat[p * k];
+					float sum = 0;
+					for (int q = 0; q < k; ++q)
+					{
+						sum += row[q] * src[q];
+					}
+					value += src[p] * (sum - crossFloat[p]);
+				}
+				dst[c] = sqrt(max(value, 0.0f));
+			}
+		}
+	});
+	return distance;
+}
+
+//  FullDistance
+//  Matches a compiled filter over the usable bands the plan covers, without the
+//  reduction. This is the full-band path Distance approximates.
+//  Pre-Conditions: The cube was built from hyperImage, and plan was compiled for it.
+//  Post-Conditions: Returns a CV_32FC1 image of each pixel's distance to the
+//  filter's reference spectrum, or an empty Mat if the cube is empty or the
+//  plan does not fit the image.
+Mat ReducedCube::FullDistance(const SpecImage& hyperImage, const FilterPlan& plan, int numThreads) const
+{
+	if (isEmpty() || !plan.isCompatible(hyperImage) || hyperImage.getRows() != rows || hyperImage.getCols() != cols)
+	{
+		return Mat();
+	}
+	TRACE_SCOPE("ReducedCube::FullDistance");
+	TRACE_COUNT("pixels matched", static_cast<long long>(rows) * cols);
+
+	vector<Mat> images;
+	if (loadBands(hyperImage, images) != bands)
+	{
+		cerr << "Error - The image's usable bands have changed since the cube was built." << endl;
+		return Mat();
+	}
+	vector<int> covered;
+	vector<float> reference = referenceSpectrum(plan, covered);
+	int depth = static_cast<int>(bands.size());
+	int count = static_cast<int>(covered.size());
+
+	Mat distance(rows, cols, CV_32FC1);
+	int blockCount = (rows + REDUCED_BLOCK_ROWS - 1) / REDUCED_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		vector<float> spectra(static_cast<size_t>(cols) * depth);
+		int last = min(rows, (block + 1) * REDUCED_BLOCK_ROWS);
+		for (int r = block * REDUCED_BLOCK_ROWS; r < last; ++r)
+		{
+			readRow(hyperImage, bands, images, r, &spectra[0]);
+			float* dst = distance.ptr<float>(r);
+			const float* spectrum = &spectra[0];
+			for (int c = 0; c < cols; ++c, spectrum += depth)
+			{
+				float value = 0;
+				for (int i = 0; i < count; ++i)
+				{
+					float difference = spectrum[covered[i]] - reference[i];
+					value += difference * difference;
+				}
+				dst[c] = sqrt(value);
+			}
+		}
+	});
+	return distance;
+}
+
+//  Match
+//  Finds the pixels within maxDistance of a filter's reference spectrum. The
+//  reduced space is used if the kept components explain at least minRetained
+//  of the variance, the full-band path otherwise.
+//  Pre-Conditions: The cube was built from hyperImage.
+//  Post-Conditions: Returns a CV_8UC1 image that is 255 where the distance is
+//  at most maxDistance and 0 elsewhere, or an empty Mat if the cube is empty.
+//  NOTE: The filter is compiled for hyperImage (see SpecFilter::Compile).
+//  NOTE: Both paths, the full-band fallback included, use the Euclidean distance
+//  between reflectance spectra over the bands the plan covers. That is a metric
+//  of its own, not the sum of absolute differences SpecFilter::filter scores, so
+//  maxDistance is a threshold of its own too (MATCH_MAX does not carry over) and
+//  the result is not the one SpecFilter::filter gives.
+Mat ReducedCube::Match(const SpecImage& hyperImage, const SpecFilter& filter, double maxDistance,
+	double minRetained, int numThreads) const
+{
+	FilterPlan plan = filter.Compile(hyperImage);
+	Mat distance = retainedVariance >= minRetained
+		? Distance(plan, numThreads)
+		: FullDistance(hyperImage, plan, numThreads);
+	if (distance.empty())
+	{
+		return Mat();
+	}
+
+	Mat result(rows, cols, CV_8UC1);
+	for (int r = 0; r < rows; ++r)
+	{
+		const float* src = distance.ptr<float>(r);
+		uchar* dst = result.ptr<uchar>(r);
+		for (int c = 0; c < cols; ++c)
+		{
+			dst[c] = src[c] <= maxDistance ? 255 : 0;
+		}
+	}
+	return result;
+}
+
+//  referenceSpectrum
+//  Private method that finds a compiled filter's reflectance on the usable bands.
+//  Pre-conditions: The cube has been built.
+//  Post-conditions: covered receives the positions (in getBands) of the usable 
+//  bands the plan has entries for, in band order, and the plan's mean reflectance 
+//  on each of them is returned. Other bands are left out of both distances.
+vector<float> ReducedCube::referenceSpectrum(const FilterPlan& plan, vector<int>& covered) const
+{
+	vector<float> reference;
+	covered.clear();
+	vector<FilterPlan::Band> means = plan.getBandMeans();
+	for (size_t b = 0; b < means.size(); ++b)
+	{
+		vector<int>::const_iterator found = lower_bound(bands.begin(), bands.end(), means[b].band);
+		if (found != bands.end() && *found == means[b].band)
+		{
+			covered.push_back(static_cast<int>(found - bands.begin()));
+			reference.push_back(static_cast<float>(means[b].reflectance));
+		}
+	}
+	return reference;
+}
+
+//  readRow
+//  STATIC private method that reads the reflectance of every usable band of an
+//  image row.
+//  Pre-conditions: images holds the usable bands as CV_16UC1 images, unless the
+//  image is BIP. row is inside the image.
+//  Post-conditions: out holds cols spectra of bands.size() values each.
+void ReducedCube::readRow(const SpecImage& hyperImage, const vector<int>& bands, const vector<Mat>& images,
+	int row, float* out)
+{
+	int cols = hyperImage.getCols();
+	size_t depth = bands.size();
+	if (images.empty())
+	{
+		int stride = hyperImage.getDepth();
+		const ushort* spectrum = hyperImage.getSpectrum(row, 0);
+		for (int c = 0; c < cols; ++c, spectrum += stride)
+		{
+			float* dst = out + c * depth;
+			for (size_t i = 0; i < depth; ++i)
+			{
+				dst[i] = min<int>(spectrum[bands[i]], 255) / 255.0f;
+			}
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < depth; ++i)
+	{
+		const ushort* src = images[i].ptr<ushort>(row);
+		for (int c = 0; c < cols; ++c)
+		{
+			out[c * depth + i] = min<int>(src[c], 255) / 255.0f;
+		}
+	}
+}
+
+//  loadBands
+//  STATIC private method that fetches the usable bands of an image for readRow.
+//  Pre-conditions: The image has been loaded.
+//  Post-conditions: Returns the usable bands: those that are not masked, could 
+//  be loaded and are the size of the scene. Unless the image is BIP, images receives them as CV_16UC1.
+vector<int> ReducedCube::loadBands(const SpecImage& hyperImage, vector<Mat>& images)
+{
+	//  Band interleaved by pixel cubes are read from each pixel's spectrum
+	bool interleaved = hyperImage.getInterleave() == SpecImage::BIP;
+	vector<int> usable;
+	images.clear();
+	for (int band = 0; band < hyperImage.getDepth(); ++band)
+	{
+		if (hyperImage.isBadBand(band) || hyperImage.isBandMissing(band))
+		{
+			continue;
+		}
+		if (!interleaved)
+		{
+			Mat image = hyperImage.getBand(band);
+			if (image.rows != hyperImage.getRows() || image.cols != hyperImage.getCols())
+			{
+				continue;
+			}
+			if (image.type() != CV_16UC1)
+			{
+				TRACE_SCOPE("convertTo");
+				image.convertTo(image, CV_16U);
+			}
+			images.push_back(image);
+		}
+		usable.push_back(band);
+	}
+	return usable;
+}
@@ -0,0 +1,138 @@
+/*
+ReducedCube holds a hyperspectral image reduced to its first principal components.
+The principal component transform is found from the covariance of the image's
+usable bands (bad bands are left out), accumulated over a sample of the pixels on
+several threads. Every pixel is then projected onto the top components and stored
+as a compact float cube of components * rows * cols values.
+
+Filters are matched in the reduced space by projecting their compiled reference
+spectrum (see FilterPlan) onto the same components, so each pixel costs a few
+operations per component instead of one per band. Matching uses the Euclidean
+distance between reflectance spectra (reflectance being a band value clamped to
+255 and divided by 255, as in SADKernel.h) over the bands the filter covers.
+FullDistance computes the same distance from the bands themselves, and Match
+falls back to it when too little of the image's variance was kept.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+#include "SpecFilter.h"
+#include "SpecImage.h"
+
+using namespace cv;
+using namespace std;
+
+class ReducedCube
+{
+	public:
+		//  ReducedCube
+		//  Creates an empty reduced cube. Use Build to fill it.
+		ReducedCube();
+
+		//  Build
+		//  Finds the principal components of a hyperspectral image and projects every
+		//  pixel onto the first components of them. The covariance is accumulated over
+		//  at most maxSamples pixels, spread evenly over the image, and both passes are
+		//  shared between numThreads threads (0 uses every core).
+		//  Pre-Conditions: The image has been loaded. components is at least 1.
+		//  Post-Conditions: Returns true if the cube was built. components is lowered to
+		//  the number of usable bands if there are fewer. On failure an error is
+		//  printed, the cube is left empty and false is returned.
+		//  NOTE: The result does not depend on the number of threads.
+		bool Build(const SpecImage& hyperImage, int components, int numThreads = 0, int maxSamples = 65536);
+
+		//  isEmpty
+		//  Returns whether the cube has been built.
+		bool isEmpty() const;
+
+		//  getComponents
+		//  Returns the number of components kept per pixel.
+		int getComponents() const;
+
+		//  getRetainedVariance
+		//  Returns the fraction (0 to 1) of the image's variance that the kept
+		//  components explain.
+		double getRetainedVariance() const;
+
+		//  getBands
+		//  Returns the bands the transform was computed over, in band order.
+		vector<int> getBands() const;
+
+		//  getComponent
+		//  Fetches the image of a single component.
+		//  Pre-Conditions: index is in the range [0, getComponents())
+		//  Post-Conditions: Returns a CV_32FC1 image of the component's values.
+		Mat getComponent(int index) const;
+
+		//  Distance
+		//  Matches a compiled filter in the reduced space.
+		//  Pre-Conditions: The cube has been built. plan was compiled for the image the
+		//  cube was built from (see SpecFilter::Compile).
+		//  Post-Conditions: Returns a CV_32FC1 image of each pixel's estimated distance
+		//  to the filter's reference spectrum over the bands the plan covers (lower is a 
+		//  closer match), or an empty Mat if the cube is empty.
+		//  NOTE: The reference is included exactly. Each pixel is replaced by its 
+		//  reconstruction from the kept components, so the part of it outside them is
+		//  left out, which is what the retained variance measures.
+		Mat Distance(const FilterPlan& plan, int numThreads = 0) const;
+
+		//  FullDistance
+		//  Matches a compiled filter over the usable bands the plan covers, without the
+		//  reduction. This is the full-band path Distance approximates.
+		//  Pre-Conditions: The cube was built from hyperImage, and plan was compiled for it.
+		//  Post-Conditions: Returns a CV_32FC1 image of each pixel's distance to the
+		//  filter's reference spectrum, or an empty Mat if the cube is empty or the
+		//  plan does not fit the image.
+		Mat FullDistance(const SpecImage& hyperImage, const FilterPlan& plan, int numThreads = 0) const;
+
+		//  Match
+		//  Finds the pixels within maxDistance of a filter's reference spectrum. The
+		//  reduced space is used if the kept components explain at least minRetained
+		//  of the variance, the full-band path otherwise.
+		//  Pre-Conditions: The cube was built from hyperImage.
+		//  Post-Conditions: Returns a CV_8UC1 image that is 255 where the distance is
+		//  at most maxDistance and 0 elsewhere, or an empty Mat if the cube is empty.
+		//  NOTE: The filter is compiled for hyperImage (see SpecFilter::Compile).
+		//  NOTE: Both paths, the full-band fallback included, use the Euclidean distance
+		//  between reflectance spectra over the bands the plan covers. That is a metric
+		//  of its own, not the sum of absolute differences SpecFilter::filter scores, so
+		//  maxDistance is a threshold of its own too (MATCH_MAX does not carry over) and
+		//  the result is not the one SpecFilter::filter gives.
+		Mat Match(const SpecImage& hyperImage, const SpecFilter& filter, double maxDistance,
+			double minRetained = 0.99, int numThreads = 0) const;
+
+	private:
+		int rows;
+		int cols;
+		int componentCount;
+		double retainedVariance;
+		vector<int> bands;        //  Usable bands, in band order
+		vector<float> mean;       //  Mean reflectance of every usable band
+		Mat transform;            //  componentCount x bands.size() CV_32FC1, one component per row
+		Mat cube;                 //  rows x (cols * componentCount) CV_32FC1, each pixel's components together
+
+		//  referenceSpectrum
+		//  Private method that finds a compiled filter's reflectance on the usable bands.
+		//  Pre-conditions: The cube has been built.
+		//  Post-conditions: covered receives the positions (in getBands) of the usable 
+		//  bands the plan has entries for, in band order, and the plan's mean reflectance 
+		//  on each of them is returned. Other bands are left out of both distances.
+		vector<float> referenceSpectrum(const FilterPlan& plan, vector<int>& covered) const;
+
+		//  readRow
+		//  STATIC private method that reads the reflectance of every usable band of an
+		//  image row.
+		//  Pre-conditions: images holds the usable bands as CV_16UC1 images, unless the
+		//  image is BIP. row is inside the image.
+		//  Post-conditions: out holds cols spectra of bands.size() values each.
+		static void readRow(const SpecImage& hyperImage, const vector<int>& bands, const vector<Mat>& images,
+			int row, float* out);
+
+		//  loadBands
+		//  STATIC private method that fetches the usable bands of an image for readRow.
+		//  Pre-conditions: The image has been loaded.
+		//  Post-conditions: Returns the usable bands: those that are not masked, could 
+		//  be loaded and are the size of the scene. Unless the image is BIP, images receives them as CV_16UC1.
+		static vector<int> loadBands(const SpecImage& hyperImage, vector<Mat>& images);
+};
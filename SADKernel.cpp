@@ -0,0 +1,264 @@
+#include "SADKernel.h"
+
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SAD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SAD_TARGET(isa)
+#else
+#define SAD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+//  scalarAccumulateRow
+//  Portable version of SADAccumulateRow.
+static void scalarAccumulateRow(const ushort* src, int reference, int weight, int* acc, int cols)
+{
+	for (int c = 0; c < cols; ++c)
+	{
+		int pixel = (src[c] < 255 ? src[c] : 255) << 8;
+		acc[c] += weight * abs(reference - pixel);
+	}
+}
+
+#ifdef SAD_X86
+//  sse41AccumulateRow
+//  SSE4.1 version of SADAccumulateRow, 8 pixels per step.
+SAD_TARGET("sse4.1")
+static void sse41AccumulateRow(const ushort* src, int reference, int weight, int* acc, int cols)
+{
+	const __m128i clamp = _mm_set1_epi16(255);
+	const __m128i ref = _mm_set1_epi32(reference);
+	const __m128i w = _mm_set1_epi32(weight);
+	int c = 0;
+	for (; c + 8 <= cols; c += 8)
+	{
+		__m128i pixels = _mm_min_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + c)), clamp);
+		__m128i low = _mm_slli_epi32(_mm_cvtepu16_epi32(pixels), 8);
+		__m128i high = _mm_slli_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(pixels, 8)), 8);
+		low = _mm_mullo_epi32(_mm_abs_epi32(_mm_sub_epi32(ref, low)), w);
+		high = _mm_mullo_epi32(_mm_abs_epi32(_mm_sub_epi32(ref, high)), w);
+		__m128i* out = reinterpret_cast<__m128i*>(acc + c);
+		_mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), low));
+		_mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), high));
+	}
+	scalarAccumulateRow(src + c, reference, weight, acc + c, cols - c);
+}
+
+//  avx2AccumulateRow
+//  AVX2 version of SADAccumulateRow, 16 pixels per step.
+SAD_TARGET("avx2")
+static void avx2AccumulateRow(const ushort* src, int reference, int weight, int* acc, int cols)
+{
+	const __m256i clamp = _mm256_set1_epi16(255);
+	const __m256i ref = _mm256_set1_epi32(reference);
+	const __m256i w = _mm256_set1_epi32(weight);
+	int c = 0;
+	for (; c + 16 <= cols; c += 16)
+	{
+		__m256i pixels = _mm256_min_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + c)), clamp);
+		__m256i low = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(pixels)), 8);
+		__m256i high = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(pixels, 1)), 8);
+		low = _mm256_mullo_epi32(_mm256_abs_epi32(_mm256_sub_epi32(ref, low)), w);
+		high = _mm256_mullo_epi32(_mm256_abs_epi32(_mm256_sub_epi32(ref, high)), w);
+		__m256i* out = reinterpret_cast<__m256i*>(acc + c);
+		_mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), low));
+		_mm256_storeu_si256(out + 1, _mm256_add_epi32(_mm256_loadu_si256(out + 1), high));
+	}
+	scalarAccumulateRow(src + c, reference, weight, acc + c, cols - c);
+}
+
+//  cpuSupports
+//  Checks whether this CPU (and operating system) can run a kernel.
+static bool cpuSupports(SADKernelType type)
+{
+	if (type == SAD_SCALAR)
+	{
+		return true;
+	}
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	if (type == SAD_SSE41)
+	{
+		return sse41;
+	}
+	bool avxEnabled = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	if (!avxEnabled || maxLeaf < 7)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	if (type == SAD_SSE41)
+	{
+		return __builtin_cpu_supports("sse4.1") != 0;
+	}
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#else
+static bool cpuSupports(SADKernelType type)
+{
+	return type == SAD_SCALAR;
+}
+#endif
+
+typedef void (*AccumulateRowFunc)(const ushort*, int, int, int*, int);
+
+//  The kernel in use, picked the first time a kernel is needed
+static SADKernelType currentKernel = SAD_SCALAR;
+static AccumulateRowFunc accumulateRow = NULL;
+
+//  selectKernel
+//  Points accumulateRow at the implementation for the given kernel.
+static void selectKernel(SADKernelType type)
+{
+	currentKernel = type;
+	accumulateRow = scalarAccumulateRow;
+#ifdef SAD_X86
+	if (type == SAD_AVX2)
+	{
+		accumulateRow = avx2AccumulateRow;
+	}
+	else if (type == SAD_SSE41)
+	{
+		accumulateRow = sse41AccumulateRow;
+	}
+#endif
+}
+
+//  bestKernel
+//  Returns the fastest kernel this CPU supports.
+static SADKernelType bestKernel()
+{
+	if (cpuSupports(SAD_AVX2))
+	{
+		return SAD_AVX2;
+	}
+	if (cpuSupports(SAD_SSE41))
+	{
+		return SAD_SSE41;
+	}
+	return SAD_SCALAR;
+}
+
+//  Runs before main, so kernels never race to pick an implementation
+static const bool kernelSelected = (selectKernel(bestKernel()), true);
+
+//  getSADKernel
+//  Returns the kernel implementation currently in use.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns the fastest kernel supported by this CPU, unless
+//  another one was selected with setSADKernel.
+SADKernelType getSADKernel()
+{
+	return currentKernel;
+}
+
+//  getSADKernelName
+//  Returns the name of the kernel implementation currently in use.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns "avx2", "sse4.1" or "scalar".
+const char* getSADKernelName()
+{
+	switch (currentKernel)
+	{
+		case SAD_AVX2:  return "avx2";
+		case SAD_SSE41: return "sse4.1";
+		default:        return "scalar";
+	}
+}
+
+//  setSADKernel
+//  Selects a kernel implementation, for example to compare against the scalar one.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true and uses the kernel if this CPU supports it,
+//  returns false and leaves the current kernel in place otherwise.
+bool setSADKernel(SADKernelType type)
+{
+	if (!cpuSupports(type))
+	{
+		return false;
+	}
+	selectKernel(type);
+	return true;
+}
+
+//  toSADReference
+//  Converts a reference reflectance (0 to 1) into fixed point.
+int toSADReference(double reflectance)
+{
+	return static_cast<int>(floor(reflectance * SAD_SCALE + 0.5));
+}
+
+//  SADScoreValue
+//  Returns weight * |reference - pixel| for a single raw band value, such as the
+//  value a whole band is known to hold.
+//  Pre-Conditions: reference is in fixed point (see toSADReference).
+int SADScoreValue(ushort value, int reference, int weight)
+{
+	int pixel = (value < 255 ? value : 255) << 8;
+	return weight * abs(reference - pixel);
+}
+
+//  SADAccumulateRow
+//  Adds weight * |reference - pixel| to the score of every pixel in a row.
+//  Pre-Conditions: src holds cols raw band values, acc holds cols scores, reference
+//  is in fixed point (see toSADReference).
+//  Post-Conditions: acc is updated for every pixel of the row.
+void SADAccumulateRow(const ushort* src, int reference, int weight, int* acc, int cols)
+{
+	accumulateRow(src, reference, weight, acc, cols);
+}
+
+//  SADAccumulateSpectra
+//  Adds up the SAD score of every pixel in a row of band-interleaved-by-pixel data.
+//  Pre-Conditions: spectra holds cols spectra of depth values each. bands, references
+//  and weights describe count plan entries.
+//  Post-Conditions: acc[c] is increased by the weighted SAD of pixel c over the
+//  listed bands.
+void SADAccumulateSpectra(const ushort* spectra, int depth, const int* bands, const int* references,
+	const int* weights, int count, int* acc, int cols)
+{
+	for (int c = 0; c < cols; ++c)
+	{
+		const ushort* spectrum = spectra + c * depth;
+		int score = 0;
+		for (int b = 0; b < count; ++b)
+		{
+			ushort value = spectrum[bands[b]];
+			int pixel = (value < 255 ? value : 255) << 8;
+			score += weights[b] * abs(references[b] - pixel);
+		}
+		acc[c] += score;
+	}
+}
+
+//  SADClassifyRow
+//  Turns a row of scores into the binary filter result, and tracks the score range.
+//  Pre-Conditions: acc holds cols scores in fixed point.
+//  Post-Conditions: out[c] is 255 where SAD_MATCH_STRONG <= acc[c] < SAD_MATCH_MAX and
+//  0 elsewhere. minScore and maxScore are lowered/raised to include this row.
+void SADClassifyRow(const int* acc, uchar* out, int cols, int& minScore, int& maxScore)
+{
+	int low = minScore;
+	int high = maxScore;
+	for (int c = 0; c < cols; ++c)
+	{
+		int score = acc[c];
+		low = score < low ? score : low;
+		high = score > high ? score : high;
+		out[c] = (score >= SAD_MATCH_STRONG && score < SAD_MATCH_MAX) ? 255 : 0;
+	}
+	minScore = low;
+	maxScore = high;
+}
@@ -0,0 +1,91 @@
+/*
+SADKernel
+Sum of Absolute Differences (SAD) kernels used by SpecFilter. The kernels work on
+rows of raw 16-bit band data, and keep scores in 32-bit fixed point so that the 
+reference spectrum is scaled once per band instead of every pixel being scaled.
+
+A pixel's reflectance is its band value clamped to 255 and divided by 255 (this is
+what the original CV_8U conversion did). Reflectances are stored in units of 
+1/SAD_SCALE, so a pixel value v is (min(v, 255) << 8) and a reference reflectance
+r is round(r * SAD_SCALE). Vectorized versions are chosen at runtime: AVX2, then
+SSE4.1, then a portable scalar loop.
+
+Accuracy: rounding the reference to 1/SAD_SCALE changes each band's contribution
+by at most weight / (2 * SAD_SCALE), so a score differs from the double precision 
+sum by at most totalWeight / 130560 (under 0.002 for a typical USGS filter). The 
+binary result can only differ for pixels that close to a threshold. Because the 
+sum is in integers, it does not depend on the order the bands are added in.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+//  Fixed point units per unit of reflectance
+const int SAD_SCALE = 255 * 256;
+
+//  There are 224 possible channels (wavelengths). If we set a max allowable difference of 0.20% intensity
+//  per channel, that's ~40 total possible difference.
+const double MATCH_MAX = 40.0;
+
+//  Scores (in fixed point) at or above SAD_MATCH_MAX are not matches. Scores below 
+//  SAD_MATCH_STRONG would give a pixelValue above 128 in SpecFilter::filter, which
+//  also maps to black: 255 - (uchar)(255 * score / MATCH_MAX) > 128 exactly when
+//  score < 40 * 127 / 255, which is 5080 * 256 in fixed point.
+const int SAD_MATCH_MAX = 40 * SAD_SCALE;
+const int SAD_MATCH_STRONG = 5080 * 256;
+
+enum SADKernelType { SAD_SCALAR, SAD_SSE41, SAD_AVX2 };
+
+//  getSADKernel
+//  Returns the kernel implementation currently in use.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns the fastest kernel supported by this CPU, unless
+//  another one was selected with setSADKernel.
+SADKernelType getSADKernel();
+
+//  getSADKernelName
+//  Returns the name of the kernel implementation currently in use.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns "avx2", "sse4.1" or "scalar".
+const char* getSADKernelName();
+
+//  setSADKernel
+//  Selects a kernel implementation, for example to compare against the scalar one.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true and uses the kernel if this CPU supports it,
+//  returns false and leaves the current kernel in place otherwise.
+bool setSADKernel(SADKernelType type);
+
+//  toSADReference
+//  Converts a reference reflectance (0 to 1) into fixed point.
+int toSADReference(double reflectance);
+
+//  SADScoreValue
+//  Returns weight * |reference - pixel| for a single raw band value, such as the
+//  value a whole band is known to hold.
+//  Pre-Conditions: reference is in fixed point (see toSADReference).
+int SADScoreValue(ushort value, int reference, int weight);
+
+//  SADAccumulateRow
+//  Adds weight * |reference - pixel| to the score of every pixel in a row.
+//  Pre-Conditions: src holds cols raw band values, acc holds cols scores, reference
+//  is in fixed point (see toSADReference).
+//  Post-Conditions: acc is updated for every pixel of the row.
+void SADAccumulateRow(const ushort* src, int reference, int weight, int* acc, int cols);
+
+//  SADAccumulateSpectra
+//  Adds up the SAD score of every pixel in a row of band-interleaved-by-pixel data.
+//  Pre-Conditions: spectra holds cols spectra of depth values each. bands, references
+//  and weights describe count plan entries.
+//  Post-Conditions: acc[c] is increased by the weighted SAD of pixel c over the
+//  listed bands.
+void SADAccumulateSpectra(const ushort* spectra, int depth, const int* bands, const int* references,
+	const int* weights, int count, int* acc, int cols);
+
+//  SADClassifyRow
+//  Turns a row of scores into the binary filter result, and tracks the score range.
+//  Pre-Conditions: acc holds cols scores in fixed point.
+//  Post-Conditions: out[c] is 255 where SAD_MATCH_STRONG <= acc[c] < SAD_MATCH_MAX and
+//  0 elsewhere. minScore and maxScore are lowered/raised to include this row.
+void SADClassifyRow(const int* acc, uchar* out, int cols, int& minScore, int& maxScore);
@@ -0,0 +1,39 @@
+#include "SensorDescriptor.h"
+
+typedef SensorTable<HYPERION_BAND_COUNT, 356, 2600> HyperionTable;
+
+//  makeHyperionTable
+//  Builds the Hyperion band tables from the nominal band centres of its VNIR and
+//  SWIR spectrometers, and marks the uncalibrated bands as bad.
+static constexpr HyperionTable makeHyperionTable()
+{
+	HyperionTable table = {};
+	for (int band = 0; band < HYPERION_BAND_COUNT; ++band)
+	{
+		table.centres[band] = band < HYPERION_VNIR_BAND_COUNT
+			? static_cast<float>(355.59 + band * 10.175)
+			: static_cast<float>(851.92 + (band - HYPERION_VNIR_BAND_COUNT) * 10.09);
+
+		//  B001-B007, B058-B076 and B225-B242
+		table.badBands[band] = band < 7 || (band >= 57 && band < 76) || band >= 224;
+	}
+	table.fillLookup();
+	return table;
+}
+
+static constexpr HyperionTable hyperionTable = makeHyperionTable();
+
+//  The lookup must agree with the spectrometers' band spacing
+static_assert(hyperionTable.lookup[0] == 0, "356nm is band 1");
+static_assert(hyperionTable.lookup[855 - 356] == 49, "855nm is VNIR band 50");
+static_assert(hyperionTable.lookup[1074 - 356] == 92, "1074nm is SWIR band 93");
+static_assert(hyperionTable.lookup[2600 - 356] == HYPERION_BAND_COUNT - 1, "2600nm is band 242");
+
+//  HyperionSensor
+//  Returns the descriptor of the EO-1 Hyperion sensor. Its lookup covers 356nm to
+//  2600nm.
+const SensorDescriptor& HyperionSensor()
+{
+	static const SensorDescriptor hyperion = hyperionTable.describe("Hyperion");
+	return hyperion;
+}
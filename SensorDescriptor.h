@@ -0,0 +1,128 @@
+/*
+SensorDescriptor
+Describes the bands of an imaging spectrometer: how many there are, the centre
+wavelength of each, and the band nearest to every whole nanometer the sensor
+covers. The tables are built at compile time, so finding the band of a wavelength
+is a single array read.
+
+Hyperion carries two spectrometers. The VNIR one records bands 1 to 70 (355.59nm
+to 1057.68nm, 10.175nm apart) and the SWIR one bands 71 to 242 (851.92nm to
+2577.08nm, 10.09nm apart), so bands 71 through 91 overlap bands 50 through 70.
+Where they overlap the nearest band centre is used, whichever spectrometer it
+belongs to. Bands 1-7, 58-76 and 225-242 are not calibrated and are delivered as
+zeros; they are the sensor's default bad bands.
+
+Other sensors are added by building their own SensorTable and describing it with
+a SensorDescriptor, the way HyperionSensor does.
+*/
+#pragma once
+
+//  Number of Hyperion bands, the size of the Hyperion band tables (and what the
+//  static_asserts on them check against)
+const int HYPERION_BAND_COUNT = 242;
+
+//  Number of bands recorded by Hyperion's VNIR spectrometer (the first bands)
+const int HYPERION_VNIR_BAND_COUNT = 70;
+
+//  SensorDescriptor
+//  The band tables of one sensor.
+struct SensorDescriptor
+{
+	const char* name;       //  Sensor name
+	int bandCount;          //  Number of bands
+	const float* centres;   //  Centre wavelength (nm) of every band, in band order
+	int lookupFirst;        //  Shortest wavelength (nm) that has a nearest band
+	int lookupLast;         //  Longest wavelength (nm) that has a nearest band
+	const short* lookup;    //  Nearest band of every nm from lookupFirst to lookupLast
+	const bool* badBands;   //  Bands that hold no usable data, such as uncalibrated ones
+
+	//  getBandIndex
+	//  Finds the band nearest to a wavelength.
+	//  Pre-Conditions: None
+	//  Post-Conditions: Returns the band index in the range [0, bandCount), or -1 if
+	//  the wavelength is outside [lookupFirst, lookupLast].
+	int getBandIndex(int wavelength) const
+	{
+		if (wavelength < lookupFirst || wavelength > lookupLast)
+		{
+			return -1;
+		}
+		return lookup[wavelength - lookupFirst];
+	}
+};
+
+//  SensorTable
+//  Storage for the band tables of a sensor with Bands bands whose lookup covers
+//  First to Last nanometers. Built at compile time by a constexpr function.
+template <int Bands, int First, int Last>
+struct SensorTable
+{
+	float centres[Bands];
+	short lookup[Last - First + 1];
+	bool badBands[Bands];
+
+	//  fillLookup
+	//  Fills the lookup from the band centres. Ties go to the later band.
+	//  Pre-Conditions: centres is filled in.
+	//  Post-Conditions: lookup holds the nearest band of every nm.
+	//  NOTE: The bands are sorted by centre once, and a single pointer walks them
+	//  as the wavelength rises, so the work is at most Bands^2 / 2 for the sort and
+	//  Bands + (Last - First) for the walk. Comparing every nm with every band
+	//  would be too many steps for some compilers' constexpr limits.
+	constexpr void fillLookup()
+	{
+		//  Insertion sort by centre, then band. The spectrometers' bands are each in
+		//  order already, so only where their ranges overlap does anything move.
+		int order[Bands] = {};
+		for (int band = 0; band < Bands; ++band)
+		{
+			int i = band;
+			while (i > 0 && centres[order[i - 1]] > centres[band])
+			{
+				order[i] = order[i - 1];
+				--i;
+			}
+			order[i] = band;
+		}
+
+		//  Distances to the sorted centres fall and then rise, so the nearest ones
+		//  form a run that only moves up as the wavelength does. position is kept
+		//  at the last band of that run.
+		int position = 0;
+		for (int wavelength = First; wavelength <= Last; ++wavelength)
+		{
+			while (position + 1 < Bands
+				&& distance(order[position + 1], wavelength) <= distance(order[position], wavelength))
+			{
+				++position;
+			}
+			float nearest = distance(order[position], wavelength);
+			int best = order[position];
+			for (int i = position - 1; i >= 0 && distance(order[i], wavelength) == nearest; --i)
+			{
+				best = order[i] > best ? order[i] : best;
+			}
+			lookup[wavelength - First] = static_cast<short>(best);
+		}
+	}
+
+	//  distance
+	//  Returns how far a band's centre is from a wavelength, in nm.
+	constexpr float distance(int band, int wavelength) const
+	{
+		float difference = centres[band] - wavelength;
+		return difference < 0 ? -difference : difference;
+	}
+
+	//  describe
+	//  Returns a descriptor pointing into this table.
+	constexpr SensorDescriptor describe(const char* name) const
+	{
+		return SensorDescriptor{ name, Bands, centres, First, Last, lookup, badBands };
+	}
+};
+
+//  HyperionSensor
+//  Returns the descriptor of the EO-1 Hyperion sensor. Its lookup covers 356nm to
+//  2600nm.
+const SensorDescriptor& HyperionSensor();
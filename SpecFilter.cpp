@@ -1,5 +1,58 @@
 
 #include "SpecFilter.h"
+#include "SADKernel.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <future>
+
+//  Reflectances at or below this mark samples the USGS library has no data for
+//  (stored as -1.23e34)
+const double USGS_DELETED = -1.0e34;
+
+//  Number of header lines in front of the samples of a USGS file
+const int USGS_HEADER_LINES = 16;
+
+//  isCompatible
+//  Checks whether this plan can be run against a hyperspectral image.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the image has the same wavelength table
+//  the plan was compiled against.
+bool FilterPlan::isCompatible(const SpecImage& hyperImage) const
+{
+	return wavelengths == hyperImage.getWavelengths();
+}
+
+//  getBandMeans
+//  Merges the entries of every band into one, for uses that need a single
+//  reflectance per band (such as a reference spectrum).
+//  Pre-Conditions: None
+//  Post-Conditions: Returns one entry per band the plan uses, in band order,
+//  whose reflectance is the mean of the band's samples and whose weight is 
+//  their count.
+vector<FilterPlan::Band> FilterPlan::getBandMeans() const
+{
+	vector<Band> means;
+	for (size_t b = 0; b < bands.size(); ++b)
+	{
+		if (means.empty() || means.back().band != bands[b].band)
+		{
+			Band entry = { bands[b].band, 0, 0 };
+			means.push_back(entry);
+		}
+		means.back().reflectance += bands[b].reflectance * bands[b].weight;
+		means.back().weight += bands[b].weight;
+	}
+	for (size_t b = 0; b < means.size(); ++b)
+	{
+		means[b].reflectance /= means[b].weight;
+	}
+	return means;
+}
 
 //  SpecFilter
 //  Creates a new filter with no values for any wavelength. Users
@@ -28,12 +81,12 @@ double SpecFilter::GetIntensityNano(const int& wavelength) const
 //  is returned.
 double SpecFilter::GetIntensityMicro(const double& wavelength) const
 {
-	map<double, double>::const_iterator iter = filterData.find(wavelength);
-	if (iter == filterData.end())
+	vector<double>::const_iterator i = lower_bound(sampleWavelengths.begin(), sampleWavelengths.end(), wavelength);
+	if (i == sampleWavelengths.end() || *i != wavelength)
 	{
 		return 0;
 	}
-	return iter->second;
+	return sampleReflectances[i - sampleWavelengths.begin()];
 }
 
 //  SetIntensityNano
@@ -57,7 +110,48 @@ void SpecFilter::SetIntensityNano(const int& wavelength, const double& intensity
 //  value must be between 0 and 1.
 void SpecFilter::SetIntensityMicro(const double& wavelength, const double& intensity)
 {
-	filterData[wavelength] = intensity;
+	vector<double>::iterator i = lower_bound(sampleWavelengths.begin(), sampleWavelengths.end(), wavelength);
+	size_t index = i - sampleWavelengths.begin();
+	if (i != sampleWavelengths.end() && *i == wavelength)
+	{
+		sampleReflectances[index] = intensity;
+		return;
+	}
+	sampleWavelengths.insert(i, wavelength);
+	sampleReflectances.insert(sampleReflectances.begin() + index, intensity);
+}
+
+//  SetSamples
+//  Replaces every sample of the filter.
+//  Pre-Conditions: wavelengths (in micrometers) and reflectances hold count values each.
+//  Post-Conditions: The filter holds the given samples. Where a wavelength is given
+//  more than once, the last reflectance given for it is kept.
+void SpecFilter::SetSamples(const double* wavelengths, const double* reflectances, size_t count)
+{
+	sampleWavelengths.assign(wavelengths, wavelengths + count);
+	sampleReflectances.assign(reflectances, reflectances + count);
+	sortSamples(sampleWavelengths, sampleReflectances);
+}
+
+//  getSampleCount
+//  Returns the number of wavelengths the filter has a reflectance for.
+size_t SpecFilter::getSampleCount() const
+{
+	return sampleWavelengths.size();
+}
+
+//  getSampleWavelengths
+//  Returns the wavelength of every sample, in micrometers and ascending order.
+const vector<double>& SpecFilter::getSampleWavelengths() const
+{
+	return sampleWavelengths;
+}
+
+//  getSampleReflectances
+//  Returns the reflectance of every sample, in the order of getSampleWavelengths.
+const vector<double>& SpecFilter::getSampleReflectances() const
+{
+	return sampleReflectances;
 }
 
 //  LoadFromFile
@@ -69,39 +163,33 @@ void SpecFilter::SetIntensityMicro(const double& wavelength, const double& inten
 //  Post-Conditions: return True if the file was read successfully, false otherwise.
 //  On success the reflectance values will be read in an stored for filtering.
 //  see http://speclab.cr.usgs.gov/spectral.lib06/ds231/datatable.html
+//  NOTE: The file is read in one piece and parsed in place. Samples the library
+//  marks as deleted (-1.23e34) are skipped.
 
 bool SpecFilter::LoadFromFile(string fileName)
 {
-	ifstream inputFile(fileName);
+	TRACE_SCOPE("SpecFilter::LoadFromFile");
+	ifstream inputFile(fileName, ios::binary);
 	if (!inputFile.is_open())
 	{
 		cerr << "Error - Could not find file \"" << fileName << "\"." << endl;
 		return false;
 	}
 
-	string line;
-	int lineCount = 0;
-	while (!inputFile.eof())
+	//  Read the whole file at once and parse it in place
+	inputFile.seekg(0, ios::end);
+	streamoff length = inputFile.tellg();
+	inputFile.seekg(0, ios::beg);
+	string text(length > 0 ? static_cast<size_t>(length) : 0, '\0');
+	if (length > 0 && !inputFile.read(&text[0], length))
 	{
-		getline(inputFile, line);
-		if (lineCount < 16) //  Data starts at line 16
-		{
-			++lineCount;
-			continue;
-		}
-		if (line.find("-1.23e34") != string::npos) //  Indicates data does not exist.
-		{
-			continue;
-		}
-
-		stringstream lineIn(line);
-		double wavelength, reflectance;
-		lineIn >> wavelength;
-		lineIn >> reflectance;
-
-		filterData[wavelength] = reflectance;
+		cerr << "Error - Could not read file \"" << fileName << "\"." << endl;
+		return false;
 	}
 
+	//  New samples go after the old ones so they win where a wavelength repeats
+	parseSamples(text.data(), text.data() + text.size(), sampleWavelengths, sampleReflectances);
+	sortSamples(sampleWavelengths, sampleReflectances);
 	return true;
 }
 
@@ -113,77 +201,987 @@ bool SpecFilter::LoadFromFile(string fileName)
 //  must be passed in
 //  Post-Conditions: A greyscale image (type CV_8UC1) where bright/white 
 //  pixels indicate a likely match to the object type being searched for.
-Mat SpecFilter::filter(const SpecImage& hyperImage) const
+//  NOTE: This compiles the filter for the image (see Compile) and runs the plan,
+//  spread over numThreads threads (0 uses every core), with the given workspace.
+Mat SpecFilter::filter(const SpecImage& hyperImage, int numThreads, Workspace* workspace) const
+{
+	return filter(hyperImage, Compile(hyperImage), numThreads, NULL, NULL, workspace);
+}
+
+//  Compile
+//  Resamples this filter onto the band grid of a hyperspectral image.
+//  Pre-Conditions: The image has been loaded, or is empty (see SpecImage::getWavelengths).
+//  Post-Conditions: Returns a plan holding the filter's samples on the sensor's
+//  bands (see FilterPlan). The plan can be reused for any image from the same
+//  sensor, and scores every pixel as the unresampled filter would.
+FilterPlan SpecFilter::Compile(const SpecImage& hyperImage) const
 {
+	TRACE_SCOPE("SpecFilter::Compile");
+	FilterPlan plan;
+	plan.wavelengths = hyperImage.getWavelengths();
+	int depth = static_cast<int>(plan.wavelengths.size());
 
-	int rows = hyperImage.getRows();
-	int cols = hyperImage.getCols();
-	int dims[] = { rows, cols };
-	Mat histogram(2, dims, CV_64F, Scalar::all(0));
+	//  Samples are in wavelength order, so their bands come out in band order
+	for (size_t i = 0; i < sampleWavelengths.size(); ++i)
+	{
+		int wavelength = static_cast<int>(sampleWavelengths[i] * 1000); //  convert back to nanometers
+		int band = hyperImage.getSensor().getBandIndex(wavelength);
+		if (band < 0 || band >= depth)
+		{
+			continue;
+		}
+		FilterPlan::Band entry = { band, sampleReflectances[i], 1 };
+		plan.bands.push_back(entry);
+	}
+	stable_sort(plan.bands.begin(), plan.bands.end(), [](const FilterPlan::Band& a, const FilterPlan::Band& b)
+	{
+		return a.band < b.band || (a.band == b.band && a.reflectance < b.reflectance);
+	});
 
-	map<double, double>::const_iterator i;
-	for (i = filterData.begin(); i != filterData.end(); ++i)
+	//  |r - x| + |r - x| is 2 |r - x|, so only equal reflectances can share an entry
+	size_t used = 0;
+	for (size_t b = 0; b < plan.bands.size(); ++b)
 	{
-		int wavelength = static_cast<int>(i->first * 1000); //  convert back to nanometers
-		double searchReflectance = i->second;
+		if (used > 0 && plan.bands[used - 1].band == plan.bands[b].band 
+			&& plan.bands[used - 1].reflectance == plan.bands[b].reflectance)
+		{
+			plan.bands[used - 1].weight += 1;
+			continue;
+		}
+		plan.bands[used++] = plan.bands[b];
+	}
+	plan.bands.resize(used);
+	return plan;
+}
+
+//  filter
+//  Runs a compiled filter plan against a hyperspectral image. Each band of the
+//  plan is read once, as raw 16-bit data, and scored with the vectorized SAD
+//  kernel (see SADKernel.h). Scoring, the score range and thresholding happen 
+//  in one pass over a small block of rows at a time. Blocks of rows are shared 
+//  out between numThreads threads (0 uses every core).
+//  Pre-Conditions: plan was compiled for an image from the same sensor.
+//  Post-Conditions: A greyscale image (type CV_8UC1) where bright/white 
+//  pixels indicate a likely match to the object type being searched for. An
+//  empty Mat is returned if the plan does not fit the image. If given, minScore
+//  and maxScore receive the lowest and highest SAD score in the image.
+//  NOTE: Scores are kept in fixed point and match the double precision sum 
+//  within the tolerance documented in SADKernel.h. Every pixel's score is 
+//  computed by one thread in a fixed band order, and the score range is reduced
+//  from per-thread minimums and maximums, so the result does not depend on the
+//  number of threads.
+//  NOTE: Given a workspace, scratch memory and the result come from it (see
+//  filterTiled).
+Mat SpecFilter::filter(const SpecImage& hyperImage, const FilterPlan& plan, int numThreads, 
+	double* minScore, double* maxScore, Workspace* workspace)
+{
+	TRACE_SCOPE("SpecFilter::filter");
+
+	//  Rows per task are a multiple of the 16 row scoring block, with about four
+	//  tasks per thread so uneven rows still balance out
+	const int MIN_TASK_ROWS = 16;
+	const int TASKS_PER_THREAD = 4;
+
+	int rows = max(hyperImage.getRows(), 1);
+	int cols = max(hyperImage.getCols(), 1);
+	int threads = resolveThreadCount(numThreads);
+	int taskRows = rows / (threads * TASKS_PER_THREAD);
+	taskRows = max(MIN_TASK_ROWS, (taskRows + MIN_TASK_ROWS - 1) / MIN_TASK_ROWS * MIN_TASK_ROWS);
+	return filterTiled(hyperImage, plan, taskRows, cols, threads, minScore, maxScore, workspace);
+}
+
+//  filterTiled
+//  Finds pixles in a target image that have similar reflectance values to this filter,
+//  working on one spatial tile at a time.
+//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+//  must be passed in. tileRows and tileCols are positive.
+//  Post-Conditions: The same image filter returns (type CV_8UC1).
+//  NOTE: This compiles the filter for the image (see Compile) and runs the plan.
+Mat SpecFilter::filterTiled(const SpecImage& hyperImage, int tileRows, int tileCols, int numThreads) const
+{
+	return filterTiled(hyperImage, Compile(hyperImage), tileRows, tileCols, numThreads);
+}
+
+//  filterTiled
+//  Runs a compiled filter plan against a hyperspectral image one spatial tile at a
+//  time, with tiles processed concurrently on numThreads threads (0 uses every 
+//  core). Each tile reads only its own window of every band it needs, scores it,
+//  and writes its part of the result, so the working set of a tile is about 
+//  tileRows * tileCols * (bands in the plan) samples.
+//  Pre-Conditions: plan was compiled for an image from the same sensor. tileRows 
+//  and tileCols are positive.
+//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1), 
+//  or an empty Mat if the plan does not fit the image.
+//  NOTE: Peak memory only follows the tile size when the image does not already 
+//  hold every band: memory-mapped cubes (see SpecImage::OpenMapped) are paged in
+//  tile by tile, BIP cubes are gathered per tile, and lazily opened scenes (see
+//  SpecImage::OpenLazy) read each tile's window of the bands they have not 
+//  cached from the GeoTIFFs (see SpecImage::getBandRegion).
+//  NOTE: Given a workspace (see Workspace.h), the result image and each worker
+//  thread's block scores and converted band windows (one tile's worth, reused
+//  for every tile the thread runs) are kept in it and reused by later calls. The
+//  returned image then shares the workspace's memory and is overwritten by the
+//  next filter run with the same workspace; clone it to keep it.
+Mat SpecFilter::filterTiled(const SpecImage& hyperImage, const FilterPlan& plan, int tileRows, int tileCols,
+	int numThreads, double* minScore, double* maxScore, Workspace* workspace)
+{
+	TRACE_SCOPE("SpecFilter::filterTiled");
+	if (!plan.isCompatible(hyperImage))
+	{
+		cerr << "Error - Filter plan was compiled for a different sensor." << endl;
+		return Mat();
+	}
+
+	int rows = max(hyperImage.getRows(), 0);
+	int cols = max(hyperImage.getCols(), 0);
+	tileRows = max(tileRows, 1);
+	tileCols = max(tileCols, 1);
+	int tilesDown = (rows + tileRows - 1) / tileRows;
+	int tilesAcross = (cols + tileCols - 1) / tileCols;
+	int tileCount = tilesDown * tilesAcross;
+
+	//  Every tile keeps its own score range, they are combined once all are done
+	Mat resultImage;
+	Mat tileLow;
+	Mat tileHigh;
+	if (workspace != NULL)
+	{
+		resultImage = workspace->getPlane(Workspace::FILTER_RESULT, rows, cols, CV_8UC1);
+		resultImage.setTo(Scalar::all(0));
+		tileLow = workspace->getPlane(Workspace::TILE_LOW, 1, max(tileCount, 1), CV_32SC1);
+		tileHigh = workspace->getPlane(Workspace::TILE_HIGH, 1, max(tileCount, 1), CV_32SC1);
+		workspace->Reserve(min(resolveThreadCount(numThreads), max(tileCount, 1)));
+	}
+	else
+	{
+		resultImage = Mat(rows, cols, CV_8UC1, Scalar::all(0));
+		tileLow = Mat(1, max(tileCount, 1), CV_32SC1);
+		tileHigh = Mat(1, max(tileCount, 1), CV_32SC1);
+	}
+	tileLow.setTo(Scalar::all(INT_MAX));
+	tileHigh.setTo(Scalar::all(INT_MIN));
+	int* low = tileLow.ptr<int>(0);
+	int* high = tileHigh.ptr<int>(0);
+	parallelForWorkers(tileCount, numThreads, [&](int t, int worker)
+	{
+		int top = (t / tilesAcross) * tileRows;
+		int left = (t % tilesAcross) * tileCols;
+		Rect window(left, top, min(tileCols, cols - left), min(tileRows, rows - top));
+		filterRegion(hyperImage, plan, window, resultImage, low[t], high[t],
+			workspace != NULL ? &workspace->getSlot(worker) : NULL);
+	});
+
+	int lowest = INT_MAX;
+	int highest = INT_MIN;
+	for (int t = 0; t < tileCount; ++t)
+	{
+		lowest = min(lowest, low[t]);
+		highest = max(highest, high[t]);
+	}
+	reportScoreRange(lowest, highest, minScore, maxScore);
+	return resultImage;
+}
+
+//  filterCoarseToFine
+//  Finds pixles in a target image that have similar reflectance values to this filter,
+//  skipping the parts of the scene a pyramid level shows cannot match.
+//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+//  must be passed in.
+//  Post-Conditions: The same image filter returns (type CV_8UC1).
+//  NOTE: This compiles the filter for the image (see Compile) and runs the plan.
+Mat SpecFilter::filterCoarseToFine(const SpecImage& hyperImage, int level, int numThreads) const
+{
+	return filterCoarseToFine(hyperImage, Compile(hyperImage), level, numThreads);
+}
+
+//  filterCoarseToFine
+//  Runs a compiled filter plan against a hyperspectral image coarse to fine. Every
+//  block of the given pyramid level (see SpecImage::BuildPyramid) is scored first:
+//  the block's range of values in each band bounds the score of every pixel in
+//  it, so blocks that are certain to be all matches or all non-matches are filled
+//  in directly. Only the blocks whose bounds straddle a threshold are refined at
+//  full resolution. Rows of blocks are shared out between numThreads threads (0 
+//  uses every core).
+//  Pre-Conditions: plan was compiled for an image from the same sensor.
+//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1),
+//  or an empty Mat if the plan does not fit the image. If given, refined 
+//  receives the fraction (0 to 1) of pixels that were scored at full resolution.
+//  NOTE: The bounds are exact, so the result is the one filter returns. If the
+//  image has no pyramid with that many levels, the whole image is refined.
+Mat SpecFilter::filterCoarseToFine(const SpecImage& hyperImage, const FilterPlan& plan, int level,
+	int numThreads, double* refined)
+{
+	TRACE_SCOPE("SpecFilter::filterCoarseToFine");
+	if (!plan.isCompatible(hyperImage))
+	{
+		cerr << "Error - Filter plan was compiled for a different sensor." << endl;
+		return Mat();
+	}
+	if (level < 1 || level > hyperImage.getPyramidLevels())
+	{
+		if (refined != NULL)
+		{
+			*refined = 1;
+		}
+		return filter(hyperImage, plan, numThreads);
+	}
+
+	const SpecImage::PyramidLevel& pyramid = hyperImage.getPyramidLevel(level);
+	int rows = max(hyperImage.getRows(), 0);
+	int cols = max(hyperImage.getCols(), 0);
+	int factor = pyramid.factor;
+	int coarseRows = pyramid.image->getRows();
+	int coarseCols = pyramid.image->getCols();
+	Mat resultImage(rows, cols, CV_8UC1, Scalar::all(0));
+
+	//  A pixel's score in a band is weight * |reference - value|, so over a block it
+	//  lies between the distance from the reference to the block's range and the 
+	//  distance to the far end of it. Bad bands score the same everywhere, and bands
+	//  without a range could hold any value.
+	struct Bound
+	{
+		const Mat* low;
+		const Mat* high;
+		int reference;
+		int weight;
+	};
+	vector<Bound> bounds;
+	long long constantScore = 0;
+	for (size_t b = 0; b < plan.bands.size(); ++b)
+	{
+		int band = plan.bands[b].band;
+		int reference = toSADReference(plan.bands[b].reflectance);
+		int weight = static_cast<int>(round(plan.bands[b].weight));
+		if (hyperImage.isBadBand(band))
+		{
+			constantScore += SADScoreValue(hyperImage.getBadBandValue(band), reference, weight);
+			continue;
+		}
+		bool ranged = !pyramid.low[band].empty();
+		Bound bound = { ranged ? &pyramid.low[band] : NULL, ranged ? &pyramid.high[band] : NULL, reference, weight };
+		bounds.push_back(bound);
+	}
+
+	vector<long long> refinedPixels(coarseRows, 0);
+	parallelFor(coarseRows, numThreads, [&](int y)
+	{
+		int top = y * factor;
+		int height = min(factor, rows - top);
+		int low = INT_MAX;
+		int high = INT_MIN;
+		int runStart = -1;
+		for (int x = 0; x <= coarseCols; ++x)
+		{
+			bool refine = false;
+			if (x < coarseCols)
+			{
+				long long lowest = constantScore;
+				long long highest = constantScore;
+				for (size_t b = 0; b < bounds.size(); ++b)
+				{
+					int lowValue = bounds[b].low ? bounds[b].low->ptr<uchar>(y)[x] << 8 : 0;
+					int highValue = bounds[b].high ? bounds[b].high->ptr<uchar>(y)[x] << 8 : SAD_SCALE;
+					int reference = bounds[b].reference;
+					int nearest = reference < lowValue ? lowValue - reference : reference > highValue ? reference - highValue : 0;
+					int farthest = max(abs(reference - lowValue), abs(reference - highValue));
+					lowest += static_cast<long long>(bounds[b].weight) * nearest;
+					highest += static_cast<long long>(bounds[b].weight) * farthest;
+				}
+
+				//  Matches score in [SAD_MATCH_STRONG, SAD_MATCH_MAX), see SADClassifyRow
+				bool none = lowest >= SAD_MATCH_MAX || highest < SAD_MATCH_STRONG;
+				bool all = lowest >= SAD_MATCH_STRONG && highest < SAD_MATCH_MAX;
+				refine = !none && !all;
+				if (all)
+				{
+					int left = x * factor;
+					resultImage(Rect(left, top, min(factor, cols - left), height)).setTo(Scalar::all(255));
+				}
+			}
+
+			//  Neighbouring blocks that need refining are scored as one window
+			if (refine && runStart < 0)
+			{
+				runStart = x;
+			}
+			else if (!refine && runStart >= 0)
+			{
+				int left = runStart * factor;
+				Rect window(left, top, min(x * factor, cols) - left, height);
+				filterRegion(hyperImage, plan, window, resultImage, low, high);
+				refinedPixels[y] += window.area();
+				runStart = -1;
+			}
+		}
+	});
+
+	long long total = 0;
+	for (int y = 0; y < coarseRows; ++y)
+	{
+		total += refinedPixels[y];
+	}
+	TRACE_COUNT("pixels refined", total);
+	if (refined != NULL)
+	{
+		*refined = rows > 0 && cols > 0 ? static_cast<double>(total) / (static_cast<double>(rows) * cols) : 0;
+	}
+	return resultImage;
+}
+
+//  filterBranchAndBound
+//  Finds pixles in a target image that have similar reflectance values to this filter,
+//  giving up on pixels as soon as they can no longer match.
+//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+//  must be passed in.
+//  Post-Conditions: The same image filter returns (type CV_8UC1).
+//  NOTE: This compiles the filter for the image (see Compile) and runs the plan.
+Mat SpecFilter::filterBranchAndBound(const SpecImage& hyperImage, int numThreads) const
+{
+	return filterBranchAndBound(hyperImage, Compile(hyperImage), numThreads);
+}
+
+//  filterBranchAndBound
+//  Runs a compiled filter plan against a hyperspectral image, most discriminative
+//  band first, and stops scoring pixels that are certain not to match. Bands are
+//  ordered by how far the reference lies from the scene's mean in that band 
+//  (times the band's weight), estimated from a sparse grid of pixels. Every 8
+//  bands, each run of up to 64 pixels of a row whose partial scores have all
+//  reached SAD_MATCH_MAX is retired: scores only grow, so those pixels are
+//  non-matches whatever the remaining bands hold. Blocks of rows are shared out
+//  between numThreads threads (0 uses every core).
+//  Pre-Conditions: plan was compiled for an image from the same sensor.
+//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1),
+//  or an empty Mat if the plan does not fit the image. If given, skipped 
+//  receives the fraction (0 to 1) of band samples that were never scored.
+//  NOTE: Retired pixels keep a partial score, so no score range is reported.
+Mat SpecFilter::filterBranchAndBound(const SpecImage& hyperImage, const FilterPlan& plan,
+	int numThreads, double* skipped)
+{
+	//  Bands scored between checks, pixels retired together, rows per task, and the
+	//  spacing of the pixels the band means are estimated from
+	const int CHECKPOINT_BANDS = 8;
+	const int SEGMENT_COLS = 64;
+	const int BLOCK_ROWS = 16;
+	const int SAMPLE_STEP = 16;
+
+	TRACE_SCOPE("SpecFilter::filterBranchAndBound");
+	if (!plan.isCompatible(hyperImage))
+	{
+		cerr << "Error - Filter plan was compiled for a different sensor." << endl;
+		return Mat();
+	}
+
+	int rows = max(hyperImage.getRows(), 0);
+	int cols = max(hyperImage.getCols(), 0);
+	int depth = hyperImage.getDepth();
+	bool interleaved = hyperImage.getInterleave() == SpecImage::BIP;
+	Mat resultImage(rows, cols, CV_8UC1, Scalar::all(0));
+
+	//  Bad bands add the same score to every pixel, so they count from the start
+	struct Entry
+	{
+		int band;
+		int reference;
+		int weight;
+		double spread;  //  Expected contribution of the band to a typical pixel's score
 		Mat image;
-		hyperImage.getImage(wavelength).convertTo(image, CV_8UC1);
-		if (image.rows == 0 && image.cols == 0 )
+	};
+	vector<Entry> entries;
+	int constantScore = 0;
+	for (size_t b = 0; b < plan.bands.size(); ++b)
+	{
+		Entry entry;
+		entry.band = plan.bands[b].band;
+		entry.reference = toSADReference(plan.bands[b].reflectance);
+		entry.weight = static_cast<int>(round(plan.bands[b].weight));
+		entry.spread = 0;
+		if (hyperImage.isBadBand(entry.band))
 		{
+			constantScore += SADScoreValue(hyperImage.getBadBandValue(entry.band), entry.reference, entry.weight);
 			continue;
 		}
-		for (int col = 0; col < cols; ++col)
+		if (interleaved && hyperImage.isBandMissing(entry.band))
+		{
+			continue;
+		}
+		if (!interleaved && !entries.empty() && entries.back().band == entry.band)
+		{
+			//  Entries of the same band share its image
+			entry.image = entries.back().image;
+		}
+		else if (!interleaved)
 		{
-			for (int row = 0; row < rows; ++row)
+			//  Empty bands are skipped, and so are bands smaller than the scene
+			entry.image = hyperImage.getBand(entry.band);
+			if (entry.image.rows < rows || entry.image.cols < cols)
 			{
-				double imageReflectance = image.at<uchar>(row, col) / 255.0;
-				histogram.at<double>(row, col) += abs(searchReflectance - imageReflectance);
+				continue;
+			}
+			if (entry.image.type() != CV_16UC1)
+			{
+				TRACE_SCOPE("convertTo");
+				entry.image.convertTo(entry.image, CV_16U);
 			}
 		}
+		entries.push_back(entry);
 	}
 
-	double min = DBL_MAX, max = DBL_MIN;
-	for (int col = 0; col < cols; ++col)
+	//  Order the bands by their contribution at the scene's mean, from a sparse grid
+	for (size_t b = 0; b < entries.size(); ++b)
 	{
-		for (int row = 0; row < rows; ++row)
+		double sum = 0;
+		int samples = 0;
+		for (int r = SAMPLE_STEP / 2; r < rows; r += SAMPLE_STEP)
 		{
-			double val = histogram.at<double>(row, col);
-			if (val < min)
+			for (int c = SAMPLE_STEP / 2; c < cols; c += SAMPLE_STEP, ++samples)
 			{
-				min = val;
+				ushort value = interleaved ? hyperImage.getSpectrum(r, c)[entries[b].band] : entries[b].image.ptr<ushort>(r)[c];
+				sum += min<int>(value, 255) << 8;
 			}
-			if (val > max)
+		}
+		double mean = samples > 0 ? sum / samples : 0;
+		entries[b].spread = entries[b].weight * abs(entries[b].reference - mean);
+	}
+	stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+	{
+		return a.spread > b.spread;
+	});
+	int count = static_cast<int>(entries.size());
+	vector<int> bands(count);
+	vector<int> references(count);
+	vector<int> weights(count);
+	for (int b = 0; b < count; ++b)
+	{
+		bands[b] = entries[b].band;
+		references[b] = entries[b].reference;
+		weights[b] = entries[b].weight;
+	}
+
+	int segments = (cols + SEGMENT_COLS - 1) / SEGMENT_COLS;
+	int blockCount = (rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+	vector<long long> scoredSamples(blockCount, 0);
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		int top = block * BLOCK_ROWS;
+		int blockRows = min(BLOCK_ROWS, rows - top);
+		vector<int> scores(static_cast<size_t>(blockRows) * cols, constantScore);
+		vector<char> alive(static_cast<size_t>(blockRows) * segments, 1);
+		int aliveCount = blockRows * segments;
+		long long scored = 0;
+
+		for (int first = 0; first < count && aliveCount > 0; first += CHECKPOINT_BANDS)
+		{
+			int last = min(count, first + CHECKPOINT_BANDS);
+			for (int r = 0; r < blockRows; ++r)
 			{
-				max = val;
+				for (int s = 0; s < segments; ++s)
+				{
+					if (!alive[r * segments + s])
+					{
+						continue;
+					}
+					int left = s * SEGMENT_COLS;
+					int width = min(SEGMENT_COLS, cols - left);
+					int* acc = &scores[static_cast<size_t>(r) * cols + left];
+					if (interleaved)
+					{
+						SADAccumulateSpectra(hyperImage.getSpectrum(top + r, left), depth, &bands[first],
+							&references[first], &weights[first], last - first, acc, width);
+					}
+					else
+					{
+						for (int b = first; b < last; ++b)
+						{
+							SADAccumulateRow(entries[b].image.ptr<ushort>(top + r) + left, references[b], weights[b], acc, width);
+						}
+					}
+					scored += static_cast<long long>(width) * (last - first);
+
+					//  Retire the run once none of its pixels can still score below the limit
+					if (*min_element(acc, acc + width) >= SAD_MATCH_MAX)
+					{
+						alive[r * segments + s] = 0;
+						aliveCount--;
+					}
+				}
 			}
 		}
+
+		//  Retired pixels already score at or above SAD_MATCH_MAX, which classifies as 0
+		int low = INT_MAX;
+		int high = INT_MIN;
+		for (int r = 0; r < blockRows; ++r)
+		{
+			SADClassifyRow(&scores[static_cast<size_t>(r) * cols], resultImage.ptr<uchar>(top + r), cols, low, high);
+		}
+		scoredSamples[block] = scored;
+	});
+
+	long long total = 0;
+	for (int block = 0; block < blockCount; ++block)
+	{
+		total += scoredSamples[block];
+	}
+	long long possible = static_cast<long long>(rows) * cols * count;
+	TRACE_COUNT("band samples scored", total);
+	TRACE_COUNT("band samples skipped", possible - total);
+	if (skipped != NULL)
+	{
+		*skipped = possible > 0 ? static_cast<double>(possible - total) / possible : 0;
+	}
+	return resultImage;
+}
+
+//  filterStreaming
+//  Finds pixles in a Hyperion scene that have similar reflectance values to this
+//  filter without loading the scene. The scene is opened lazily with room for one
+//  decoded band (see SpecImage::OpenLazy), and its bands are streamed through 
+//  the filter one at a time.
+//  Pre-Conditions: sceneName names a Hyperion scene, as for SpecImage::LoadFromFile.
+//  Post-Conditions: The same image filter returns for the loaded scene (type CV_8UC1).
+//  NOTE: This compiles the filter for the scene (see Compile) and runs the plan.
+Mat SpecFilter::filterStreaming(const string& sceneName, int numThreads) const
+{
+	//  A one byte cap still keeps the band decoded last, and only that one
+	SpecImage scene;
+	scene.OpenLazy(sceneName, 1);
+	return filterStreaming(scene, Compile(scene), numThreads);
+}
+
+//  filterStreaming
+//  Runs a compiled filter plan against a hyperspectral image one band at a time, 
+//  in plan order. While a band is added to a whole-scene score accumulator, the
+//  next one is fetched (decoded, for a lazily opened image) on a background 
+//  thread, and each band is released as soon as it has been added. Rows of a 
+//  band are shared out between numThreads threads (0 uses every core).
+//  Pre-Conditions: plan was compiled for an image from the same sensor.
+//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1),
+//  or an empty Mat if the plan does not fit the image. If given, minScore and 
+//  maxScore receive the lowest and highest SAD score in the image.
+//  NOTE: For an image opened with OpenLazy and a one band cache, at most two 
+//  decoded bands are held at a time, besides the accumulator (one int per pixel).
+Mat SpecFilter::filterStreaming(const SpecImage& hyperImage, const FilterPlan& plan, int numThreads,
+	double* minScore, double* maxScore)
+{
+	//  Rows per parallel work item
+	const int BLOCK_ROWS = 16;
+
+	TRACE_SCOPE("SpecFilter::filterStreaming");
+	if (!plan.isCompatible(hyperImage))
+	{
+		cerr << "Error - Filter plan was compiled for a different sensor." << endl;
+		return Mat();
 	}
 
-	//  There are 224 possible channels (wavelengths). If we set a max allowable difference of 0.20% intensity
-	//  per channel, that's ~40 total possible difference.
-	const double MATCH_MAX = 40.0;
-	Mat resultImage(2, dims, CV_8UC1, Scalar::all(0));
-	for (int col = 0; col < cols; ++col)
+	int rows = max(hyperImage.getRows(), 0);
+	int cols = max(hyperImage.getCols(), 0);
+	Mat resultImage(rows, cols, CV_8UC1, Scalar::all(0));
+	int blockCount = (rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+	//  Bad bands are not read, every pixel scores the same against them. Every other
+	//  band is streamed once, with all of its entries (from streamed[i] up to 
+	//  streamed[i + 1]).
+	int constantScore = 0;
+	vector<size_t> streamed;
+	vector<int> references(plan.bands.size());
+	vector<int> weights(plan.bands.size());
+	for (size_t b = 0; b < plan.bands.size(); ++b)
 	{
+		references[b] = toSADReference(plan.bands[b].reflectance);
+		weights[b] = static_cast<int>(round(plan.bands[b].weight));
+		if (hyperImage.isBadBand(plan.bands[b].band))
+		{
+			constantScore += SADScoreValue(hyperImage.getBadBandValue(plan.bands[b].band), references[b], weights[b]);
+			continue;
+		}
+		if (streamed.empty() || plan.bands[streamed.back()].band != plan.bands[b].band)
+		{
+			streamed.push_back(b);
+		}
+	}
+	vector<int> scores(static_cast<size_t>(rows) * cols, constantScore);
+
+	auto fetch = [&](size_t i)
+	{
+		int band = plan.bands[streamed[i]].band;
+		return async(launch::async, [&hyperImage, band]()
+		{
+			TRACE_SCOPE_ARG("SpecFilter::filterStreaming fetch", "band", band);
+			return hyperImage.getBand(band);
+		});
+	};
+	future<Mat> next;
+	if (!streamed.empty())
+	{
+		next = fetch(0);
+	}
+	for (size_t i = 0; i < streamed.size(); ++i)
+	{
+		Mat image = next.get();
+		if (i + 1 < streamed.size())
+		{
+			next = fetch(i + 1);
+		}
+		if (image.rows != rows || image.cols != cols)
+		{
+			continue;
+		}
+
+		//  Other sample types are converted a row at a time, so no second frame is made
+		size_t firstEntry = streamed[i];
+		size_t lastEntry = firstEntry;
+		while (lastEntry < plan.bands.size() && plan.bands[lastEntry].band == plan.bands[firstEntry].band)
+		{
+			++lastEntry;
+		}
+		bool convert = image.type() != CV_16UC1;
+		parallelFor(blockCount, numThreads, [&](int block)
+		{
+			Mat converted;
+			int last = min(rows, (block + 1) * BLOCK_ROWS);
+			for (int r = block * BLOCK_ROWS; r < last; ++r)
+			{
+				const ushort* src = image.ptr<ushort>(r);
+				if (convert)
+				{
+					image.row(r).convertTo(converted, CV_16U);
+					src = converted.ptr<ushort>(0);
+				}
+				for (size_t e = firstEntry; e < lastEntry; ++e)
+				{
+					SADAccumulateRow(src, references[e], weights[e], &scores[static_cast<size_t>(r) * cols], cols);
+				}
+			}
+		});
+	}
+	TRACE_COUNT("bands streamed", static_cast<long long>(streamed.size()));
+	TRACE_COUNT("band samples scored", static_cast<long long>(rows) * cols * streamed.size());
+
+	vector<int> blockLow(blockCount, INT_MAX);
+	vector<int> blockHigh(blockCount, INT_MIN);
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		int last = min(rows, (block + 1) * BLOCK_ROWS);
+		for (int r = block * BLOCK_ROWS; r < last; ++r)
+		{
+			SADClassifyRow(&scores[static_cast<size_t>(r) * cols], resultImage.ptr<uchar>(r), cols,
+				blockLow[block], blockHigh[block]);
+		}
+	});
+
+	int low = INT_MAX;
+	int high = INT_MIN;
+	for (int block = 0; block < blockCount; ++block)
+	{
+		low = min(low, blockLow[block]);
+		high = max(high, blockHigh[block]);
+	}
+	reportScoreRange(low, high, minScore, maxScore);
+	return resultImage;
+}
+
+//  filterReference
+//  Finds pixles in a target image that have similar reflectance values to this filter,
+//  the way filter originally did: every sample's band is converted to 8 bits and
+//  its absolute difference from the sample is summed in double precision, one 
+//  pixel at a time. It is slow, and kept to check the other filters against.
+//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+//  must be passed in.
+//  Post-Conditions: The same image filter returns (type CV_8UC1), within the 
+//  tolerance documented in SADKernel.h. If given, scores receives the SAD score
+//  of every pixel (type CV_64FC1).
+Mat SpecFilter::filterReference(const SpecImage& hyperImage, Mat* scores) const
+{
+	TRACE_SCOPE("SpecFilter::filterReference");
+	int rows = max(hyperImage.getRows(), 0);
+	int cols = max(hyperImage.getCols(), 0);
+	int depth = hyperImage.getDepth();
+	Mat histogram(rows, cols, CV_64FC1, Scalar::all(0));
+
+	//  Bad bands read as their constant value everywhere
+	double constantScore = 0;
+	for (size_t i = 0; i < sampleWavelengths.size(); ++i)
+	{
+		int wavelength = static_cast<int>(sampleWavelengths[i] * 1000); //  convert back to nanometers
+		int band = hyperImage.getSensor().getBandIndex(wavelength);
+		double searchReflectance = sampleReflectances[i];
+		if (band < 0 || band >= depth)
+		{
+			continue;
+		}
+
+		if (hyperImage.isBadBand(band))
+		{
+			double imageReflectance = min<int>(hyperImage.getBadBandValue(band), 255) / 255.0;
+			constantScore += abs(searchReflectance - imageReflectance);
+			continue;
+		}
+		Mat image;
+		if (!hyperImage.isBandMissing(band))
+		{
+			hyperImage.getBand(band).convertTo(image, CV_8UC1);
+		}
+		if (image.rows != rows || image.cols != cols)
+		{
+			continue;
+		}
 		for (int row = 0; row < rows; ++row)
 		{
-			double val = histogram.at<double>(row, col);
+			for (int col = 0; col < cols; ++col)
+			{
+				double imageReflectance = image.at<uchar>(row, col) / 255.0;
+				histogram.at<double>(row, col) += abs(searchReflectance - imageReflectance);
+			}
+		}
+	}
+
+	Mat resultImage(rows, cols, CV_8UC1, Scalar::all(0));
+	for (int row = 0; row < rows; ++row)
+	{
+		for (int col = 0; col < cols; ++col)
+		{
+			double& val = histogram.at<double>(row, col);
+			val += constantScore;
 			if (val >= MATCH_MAX)
 			{
 				continue;
 			}
 			uchar pixelValue = 255 - static_cast<uchar>(255 * (val / MATCH_MAX));
-			//  resultImage.at<uchar>(row, col) = pixelValue;
-			if (pixelValue > 128)
+			resultImage.at<uchar>(row, col) = (pixelValue > 128) ? 0 : 255;
+		}
+	}
+	if (scores != NULL)
+	{
+		*scores = histogram;
+	}
+	return resultImage;
+}
+
+//  filterRegion
+//  Scores one window of a hyperspectral image against a compiled plan and writes 
+//  the binary result into the same window of resultImage.
+//  Pre-Conditions: plan fits the image, window lies inside the image, resultImage
+//  is a CV_8UC1 image the size of the hyperspectral image.
+//  Post-Conditions: The window of resultImage holds the filter result. minScore and
+//  maxScore (in fixed point) are lowered/raised to include the window's scores.
+//  Scratch memory comes from slot, if given.
+void SpecFilter::filterRegion(const SpecImage& hyperImage, const FilterPlan& plan, const Rect& window,
+	Mat& resultImage, int& minScore, int& maxScore, Workspace::Slot* slot)
+{
+	//  Rows scored together, so the block's scores stay in cache while every band
+	//  is added to them
+	const int BLOCK_ROWS = 16;
+
+	int rows = window.height;
+	int cols = window.width;
+	if (rows <= 0 || cols <= 0)
+	{
+		return;
+	}
+	TRACE_SCOPE_ARG("SpecFilter::filterRegion", "row", window.y);
+
+	//  Band interleaved by pixel cubes are scored straight from each pixel's spectrum,
+	//  every other layout one band row at a time.
+	bool interleaved = hyperImage.getInterleave() == SpecImage::BIP;
+	Workspace::Slot local;
+	Workspace::Slot& scratch = slot != NULL ? *slot : local;
+	vector<Mat>& images = scratch.images;
+	vector<int>& bands = scratch.bands;
+	vector<int>& references = scratch.references;
+	vector<int>& weights = scratch.weights;
+	images.clear();
+	bands.clear();
+	references.clear();
+	weights.clear();
+	int constantScore = 0;
+	for (size_t b = 0; b < plan.bands.size(); ++b)
+	{
+		//  Bad bands are not read, every pixel scores the same against them
+		if (hyperImage.isBadBand(plan.bands[b].band))
+		{
+			constantScore += SADScoreValue(hyperImage.getBadBandValue(plan.bands[b].band),
+				toSADReference(plan.bands[b].reflectance), static_cast<int>(round(plan.bands[b].weight)));
+			continue;
+		}
+		if (interleaved && hyperImage.isBandMissing(plan.bands[b].band))
+		{
+			//  Bands that failed to load are zeros in the cube, and skipped as in 
+			//  every other layout
+			continue;
+		}
+		if (!interleaved && !images.empty() && bands.back() == plan.bands[b].band)
+		{
+			//  Entries of the same band share its window
+			images.push_back(images.back());
+		}
+		else if (!interleaved)
+		{
+			//  Empty bands are skipped, and so are bands smaller than the scene, whose
+			//  region is clipped short of the window
+			Mat image = hyperImage.getBandRegion(plan.bands[b].band, window);
+			if (image.rows < rows || image.cols < cols)
 			{
-				resultImage.at<uchar>(row, col) = 0;
+				continue;
 			}
-			else
+			if (image.type() != CV_16UC1)
 			{
-				resultImage.at<uchar>(row, col) = 255;
+				//  Converted windows are kept per slot, so a reused slot converts in place
+				TRACE_SCOPE("convertTo");
+				if (scratch.converted.size() <= images.size())
+				{
+					scratch.converted.resize(images.size() + 1);
+				}
+				Mat& converted = scratch.converted[images.size()];
+				image.convertTo(converted, CV_16U);
+				TRACE_COUNT("pixels converted", static_cast<long long>(image.total()));
+				image = converted;
 			}
+			images.push_back(image);
 		}
+		bands.push_back(plan.bands[b].band);
+		references.push_back(toSADReference(plan.bands[b].reflectance));
+		weights.push_back(static_cast<int>(round(plan.bands[b].weight)));
 	}
+	int count = static_cast<int>(bands.size());
+	int depth = hyperImage.getDepth();
+	TRACE_COUNT("pixels scored", static_cast<long long>(window.area()));
+	TRACE_COUNT("band samples scored", static_cast<long long>(window.area()) * count);
 
-	return resultImage;
-}
\ No newline at end of file
+	int* scores = Workspace::getScores(scratch, static_cast<size_t>(BLOCK_ROWS) * cols);
+	for (int top = 0; top < rows; top += BLOCK_ROWS)
+	{
+		int blockRows = min(BLOCK_ROWS, rows - top);
+		fill(scores, scores + BLOCK_ROWS * cols, constantScore);
+		if (interleaved)
+		{
+			for (int r = 0; r < blockRows && count > 0; ++r)
+			{
+				SADAccumulateSpectra(hyperImage.getSpectrum(window.y + top + r, window.x), depth, &bands[0], 
+					&references[0], &weights[0], count, &scores[r * cols], cols);
+			}
+		}
+		else
+		{
+			for (int b = 0; b < count; ++b)
+			{
+				for (int r = 0; r < blockRows; ++r)
+				{
+					SADAccumulateRow(images[b].ptr<ushort>(top + r), references[b], weights[b], &scores[r * cols], cols);
+				}
+			}
+		}
+		for (int r = 0; r < blockRows; ++r)
+		{
+			uchar* out = resultImage.ptr<uchar>(window.y + top + r) + window.x;
+			SADClassifyRow(&scores[r * cols], out, cols, minScore, maxScore);
+		}
+	}
+
+	//  A reused slot must not keep the image's bands alive
+	images.clear();
+}
+
+//  reportScoreRange
+//  Converts a fixed point score range into SAD scores for the caller.
+//  Pre-Conditions: None
+//  Post-Conditions: minScore and maxScore, where given, receive the range, or 0 if
+//  no pixel was scored.
+void SpecFilter::reportScoreRange(int low, int high, double* minScore, double* maxScore)
+{
+	bool scored = low <= high;
+	if (minScore != NULL)
+	{
+		*minScore = scored ? static_cast<double>(low) / SAD_SCALE : 0;
+	}
+	if (maxScore != NULL)
+	{
+		*maxScore = scored ? static_cast<double>(high) / SAD_SCALE : 0;
+	}
+}
+
+//  parseSamples
+//  STATIC private method that parses the samples of a USGS formatted Reflectance
+//  Pattern file.
+//  Pre-conditions: [begin, end) holds the whole file.
+//  Post-conditions: The wavelength and reflectance of every data line after the
+//  header are appended to wavelengths and reflectances, in file order. Deleted
+//  samples and lines that do not start with two numbers are skipped.
+void SpecFilter::parseSamples(const char* begin, const char* end, vector<double>& wavelengths,
+	vector<double>& reflectances)
+{
+	const char* line = begin;
+	for (int skipped = 0; skipped < USGS_HEADER_LINES && line < end; ++skipped)
+	{
+		const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+		line = newline ? newline + 1 : end;
+	}
+
+	while (line < end)
+	{
+		const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+		const char* lineEnd = newline ? newline : end;
+
+		double wavelength;
+		double reflectance;
+		const char* p = line;
+		while (p < lineEnd && (*p == ' ' || *p == '\t'))
+		{
+			++p;
+		}
+		from_chars_result first = from_chars(p, lineEnd, wavelength);
+		if (first.ec == errc())
+		{
+			p = first.ptr;
+			while (p < lineEnd && (*p == ' ' || *p == '\t'))
+			{
+				++p;
+			}
+			from_chars_result second = from_chars(p, lineEnd, reflectance);
+			if (second.ec == errc() && reflectance > USGS_DELETED)
+			{
+				wavelengths.push_back(wavelength);
+				reflectances.push_back(reflectance);
+			}
+		}
+		line = newline ? newline + 1 : end;
+	}
+}
+
+//  sortSamples
+//  STATIC private method that puts samples in wavelength order.
+//  Pre-conditions: wavelengths and reflectances are the same size.
+//  Post-conditions: The samples are sorted by wavelength with one sample per
+//  wavelength, the last one given for it.
+void SpecFilter::sortSamples(vector<double>& wavelengths, vector<double>& reflectances)
+{
+	//  USGS files are already in order, so this is usually a single check
+	if (adjacent_find(wavelengths.begin(), wavelengths.end(), greater_equal<double>()) == wavelengths.end())
+	{
+		return;
+	}
+
+	vector<size_t> order(wavelengths.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+	{
+		return wavelengths[a] < wavelengths[b];
+	});
+
+	vector<double> sortedWavelengths;
+	vector<double> sortedReflectances;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		if (!sortedWavelengths.empty() && sortedWavelengths.back() == wavelengths[order[i]])
+		{
+			sortedReflectances.back() = reflectances[order[i]];
+			continue;
+		}
+		sortedWavelengths.push_back(wavelengths[order[i]]);
+		sortedReflectances.push_back(reflectances[order[i]]);
+	}
+	wavelengths.swap(sortedWavelengths);
+	reflectances.swap(sortedReflectances);
+}
@@ -3,8 +3,8 @@ SpecFilter represents a resonance pattern of a physical object.
 Spectral images can be filtered to determine if (and where) the target objects
 are present, in a hyperspectral image.
 
-The filter stores a map of reflectance values where each wavelength has some normalized
-value of expected reflectance at that wavelength. The Sum of Absolute Differences (SAD)
+The filter stores flat arrays of samples, sorted by wavelength, where each wavelength has
+some normalized value of expected reflectance at that wavelength. The Sum of Absolute Differences (SAD)
 technique is used to compare the hyperspectral image against the filter.
 
 @author Anthony Pepe
@@ -14,14 +14,54 @@ technique is used to compare the hyperspectral image against the filter.
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <map>
 #include <string>
+#include <vector>
 
 #include "SpecImage.h"
+#include "Workspace.h"
 
 using namespace cv;
 using namespace std;
 
+//  FilterPlan
+//  A filter resampled onto a sensor's band grid. Every USGS sample of a filter is
+//  mapped to its nearest sensor band, and samples outside the sensor's range are
+//  dropped. Samples that land on the same band keep an entry each, so a pixel's
+//  score is the sum over every sample, as when the filter is run unresampled; 
+//  only samples with the same band and the same reflectance share one entry, 
+//  whose weight is their count. A plan only depends on the sensor's wavelength 
+//  table, so it can be reused for every scene from that sensor.
+//  Bands that are bad in the scene being filtered (see SpecImage::isBadBand) are not
+//  read; every pixel is scored against the value the band is known to hold.
+struct FilterPlan
+{
+	struct Band
+	{
+		int band;            //  Band index in the sensor's wavelength table
+		double reflectance;  //  Reference reflectance, between 0 and 1
+		double weight;       //  Number of filter samples with this band and reflectance (whole number)
+	};
+
+	vector<int> wavelengths;  //  Wavelength table the plan was compiled against
+	vector<Band> bands;       //  Entries in band order, several for a band that several samples map to
+
+	//  getBandMeans
+	//  Merges the entries of every band into one, for uses that need a single
+	//  reflectance per band (such as a reference spectrum).
+	//  Pre-Conditions: None
+	//  Post-Conditions: Returns one entry per band the plan uses, in band order,
+	//  whose reflectance is the mean of the band's samples and whose weight is 
+	//  their count.
+	vector<Band> getBandMeans() const;
+
+	//  isCompatible
+	//  Checks whether this plan can be run against a hyperspectral image.
+	//  Pre-Conditions: None
+	//  Post-Conditions: Returns true if the image has the same wavelength table
+	//  the plan was compiled against.
+	bool isCompatible(const SpecImage& hyperImage) const;
+};
+
 class SpecFilter
 {
 	public:
@@ -62,6 +102,25 @@ class SpecFilter
 		//  Post-Conditions: Reflectance intensity of the filter is returned. The 
 		//  value must be between 0 and 1.
 		void SetIntensityMicro(const double& wavelength, const double& intensity);
+
+		//  SetSamples
+		//  Replaces every sample of the filter.
+		//  Pre-Conditions: wavelengths (in micrometers) and reflectances hold count values each.
+		//  Post-Conditions: The filter holds the given samples. Where a wavelength is given
+		//  more than once, the last reflectance given for it is kept.
+		void SetSamples(const double* wavelengths, const double* reflectances, size_t count);
+
+		//  getSampleCount
+		//  Returns the number of wavelengths the filter has a reflectance for.
+		size_t getSampleCount() const;
+
+		//  getSampleWavelengths
+		//  Returns the wavelength of every sample, in micrometers and ascending order.
+		const vector<double>& getSampleWavelengths() const;
+
+		//  getSampleReflectances
+		//  Returns the reflectance of every sample, in the order of getSampleWavelengths.
+		const vector<double>& getSampleReflectances() const;
 	
 		//  LoadFromFile
 		//  Loads filter data from a USGS formatted Reflectance Pattern file. Previous filter
@@ -72,6 +131,8 @@ class SpecFilter
 		//  Post-Conditions: return True if the file was read successfully, false otherwise.
 		//  On success the reflectance values will be read in an stored for filtering.
 		//  see http://speclab.cr.usgs.gov/spectral.lib06/ds231/datatable.html
+		//  NOTE: The file is read in one piece and parsed in place. Samples the library
+		//  marks as deleted (-1.23e34) are skipped.
 		bool LoadFromFile(string fileName);
 
 		//  filter
@@ -82,8 +143,196 @@ class SpecFilter
 		//  must be passed in
 		//  Post-Conditions: A greyscale image (type CV_8UC1) where bright/white 
 		//  pixels indicate a likely match to the object type being searched for.
-		Mat filter(const SpecImage& hyperImage) const;
+		//  NOTE: This compiles the filter for the image (see Compile) and runs the plan,
+		//  spread over numThreads threads (0 uses every core), with the given workspace.
+		Mat filter(const SpecImage& hyperImage, int numThreads = 0, Workspace* workspace = NULL) const;
+
+		//  Compile
+		//  Resamples this filter onto the band grid of a hyperspectral image.
+		//  Pre-Conditions: The image has been loaded, or is empty (see SpecImage::getWavelengths).
+		//  Post-Conditions: Returns a plan holding the filter's samples on the sensor's
+		//  bands (see FilterPlan). The plan can be reused for any image from the same
+		//  sensor, and scores every pixel as the unresampled filter would.
+		FilterPlan Compile(const SpecImage& hyperImage) const;
+
+		//  filter
+		//  Runs a compiled filter plan against a hyperspectral image. Each band of the
+		//  plan is read once, as raw 16-bit data, and scored with the vectorized SAD
+		//  kernel (see SADKernel.h). Scoring, the score range and thresholding happen 
+		//  in one pass over a small block of rows at a time. Blocks of rows are shared 
+		//  out between numThreads threads (0 uses every core).
+		//  Pre-Conditions: plan was compiled for an image from the same sensor.
+		//  Post-Conditions: A greyscale image (type CV_8UC1) where bright/white 
+		//  pixels indicate a likely match to the object type being searched for. An
+		//  empty Mat is returned if the plan does not fit the image. If given, minScore
+		//  and maxScore receive the lowest and highest SAD score in the image.
+		//  NOTE: Scores are kept in fixed point and match the double precision sum 
+		//  within the tolerance documented in SADKernel.h. Every pixel's score is 
+		//  computed by one thread in a fixed band order, and the score range is reduced
+		//  from per-thread minimums and maximums, so the result does not depend on the
+		//  number of threads.
+		//  NOTE: Given a workspace, scratch memory and the result come from it (see
+		//  filterTiled).
+		static Mat filter(const SpecImage& hyperImage, const FilterPlan& plan, int numThreads = 0,
+			double* minScore = NULL, double* maxScore = NULL, Workspace* workspace = NULL);
+
+		//  filterTiled
+		//  Finds pixles in a target image that have similar reflectance values to this filter,
+		//  working on one spatial tile at a time.
+		//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+		//  must be passed in. tileRows and tileCols are positive.
+		//  Post-Conditions: The same image filter returns (type CV_8UC1).
+		//  NOTE: This compiles the filter for the image (see Compile) and runs the plan.
+		Mat filterTiled(const SpecImage& hyperImage, int tileRows, int tileCols, int numThreads = 0) const;
+
+		//  filterTiled
+		//  Runs a compiled filter plan against a hyperspectral image one spatial tile at a
+		//  time, with tiles processed concurrently on numThreads threads (0 uses every 
+		//  core). Each tile reads only its own window of every band it needs, scores it,
+		//  and writes its part of the result, so the working set of a tile is about 
+		//  tileRows * tileCols * (bands in the plan) samples.
+		//  Pre-Conditions: plan was compiled for an image from the same sensor. tileRows 
+		//  and tileCols are positive.
+		//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1), 
+		//  or an empty Mat if the plan does not fit the image.
+		//  NOTE: Peak memory only follows the tile size when the image does not already 
+		//  hold every band: memory-mapped cubes (see SpecImage::OpenMapped) are paged in
+		//  tile by tile, BIP cubes are gathered per tile, and lazily opened scenes (see
+		//  SpecImage::OpenLazy) read each tile's window of the bands they have not 
+		//  cached from the GeoTIFFs (see SpecImage::getBandRegion).
+		//  NOTE: Given a workspace (see Workspace.h), the result image and each worker
+		//  thread's block scores and converted band windows (one tile's worth, reused
+		//  for every tile the thread runs) are kept in it and reused by later calls. The
+		//  returned image then shares the workspace's memory and is overwritten by the
+		//  next filter run with the same workspace; clone it to keep it.
+		static Mat filterTiled(const SpecImage& hyperImage, const FilterPlan& plan, int tileRows, int tileCols,
+			int numThreads = 0, double* minScore = NULL, double* maxScore = NULL, Workspace* workspace = NULL);
+
+		//  filterCoarseToFine
+		//  Finds pixles in a target image that have similar reflectance values to this filter,
+		//  skipping the parts of the scene a pyramid level shows cannot match.
+		//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+		//  must be passed in.
+		//  Post-Conditions: The same image filter returns (type CV_8UC1).
+		//  NOTE: This compiles the filter for the image (see Compile) and runs the plan.
+		Mat filterCoarseToFine(const SpecImage& hyperImage, int level = 3, int numThreads = 0) const;
+
+		//  filterCoarseToFine
+		//  Runs a compiled filter plan against a hyperspectral image coarse to fine. Every
+		//  block of the given pyramid level (see SpecImage::BuildPyramid) is scored first:
+		//  the block's range of values in each band bounds the score of every pixel in
+		//  it, so blocks that are certain to be all matches or all non-matches are filled
+		//  in directly. Only the blocks whose bounds straddle a threshold are refined at
+		//  full resolution. Rows of blocks are shared out between numThreads threads (0 
+		//  uses every core).
+		//  Pre-Conditions: plan was compiled for an image from the same sensor.
+		//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1),
+		//  or an empty Mat if the plan does not fit the image. If given, refined 
+		//  receives the fraction (0 to 1) of pixels that were scored at full resolution.
+		//  NOTE: The bounds are exact, so the result is the one filter returns. If the
+		//  image has no pyramid with that many levels, the whole image is refined.
+		static Mat filterCoarseToFine(const SpecImage& hyperImage, const FilterPlan& plan, int level,
+			int numThreads = 0, double* refined = NULL);
+
+		//  filterBranchAndBound
+		//  Finds pixles in a target image that have similar reflectance values to this filter,
+		//  giving up on pixels as soon as they can no longer match.
+		//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+		//  must be passed in.
+		//  Post-Conditions: The same image filter returns (type CV_8UC1).
+		//  NOTE: This compiles the filter for the image (see Compile) and runs the plan.
+		Mat filterBranchAndBound(const SpecImage& hyperImage, int numThreads = 0) const;
+
+		//  filterBranchAndBound
+		//  Runs a compiled filter plan against a hyperspectral image, most discriminative
+		//  band first, and stops scoring pixels that are certain not to match. Bands are
+		//  ordered by how far the reference lies from the scene's mean in that band 
+		//  (times the band's weight), estimated from a sparse grid of pixels. Every 8
+		//  bands, each run of up to 64 pixels of a row whose partial scores have all
+		//  reached SAD_MATCH_MAX is retired: scores only grow, so those pixels are
+		//  non-matches whatever the remaining bands hold. Blocks of rows are shared out
+		//  between numThreads threads (0 uses every core).
+		//  Pre-Conditions: plan was compiled for an image from the same sensor.
+		//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1),
+		//  or an empty Mat if the plan does not fit the image. If given, skipped 
+		//  receives the fraction (0 to 1) of band samples that were never scored.
+		//  NOTE: Retired pixels keep a partial score, so no score range is reported.
+		static Mat filterBranchAndBound(const SpecImage& hyperImage, const FilterPlan& plan,
+			int numThreads = 0, double* skipped = NULL);
+
+		//  filterStreaming
+		//  Finds pixles in a Hyperion scene that have similar reflectance values to this
+		//  filter without loading the scene. The scene is opened lazily with room for one
+		//  decoded band (see SpecImage::OpenLazy), and its bands are streamed through 
+		//  the filter one at a time.
+		//  Pre-Conditions: sceneName names a Hyperion scene, as for SpecImage::LoadFromFile.
+		//  Post-Conditions: The same image filter returns for the loaded scene (type CV_8UC1).
+		//  NOTE: This compiles the filter for the scene (see Compile) and runs the plan.
+		Mat filterStreaming(const string& sceneName, int numThreads = 0) const;
+
+		//  filterStreaming
+		//  Runs a compiled filter plan against a hyperspectral image one band at a time, 
+		//  in plan order. While a band is added to a whole-scene score accumulator, the
+		//  next one is fetched (decoded, for a lazily opened image) on a background 
+		//  thread, and each band is released as soon as it has been added. Rows of a 
+		//  band are shared out between numThreads threads (0 uses every core).
+		//  Pre-Conditions: plan was compiled for an image from the same sensor.
+		//  Post-Conditions: The same image filter returns for the plan (type CV_8UC1),
+		//  or an empty Mat if the plan does not fit the image. If given, minScore and 
+		//  maxScore receive the lowest and highest SAD score in the image.
+		//  NOTE: For an image opened with OpenLazy and a one band cache, at most two 
+		//  decoded bands are held at a time, besides the accumulator (one int per pixel).
+		static Mat filterStreaming(const SpecImage& hyperImage, const FilterPlan& plan, int numThreads = 0,
+			double* minScore = NULL, double* maxScore = NULL);
+
+		//  filterReference
+		//  Finds pixles in a target image that have similar reflectance values to this filter,
+		//  the way filter originally did: every sample's band is converted to 8 bits and
+		//  its absolute difference from the sample is summed in double precision, one 
+		//  pixel at a time. It is slow, and kept to check the other filters against.
+		//  Pre-Conditions: A image Hyperspectral image to run this filter against 
+		//  must be passed in.
+		//  Post-Conditions: The same image filter returns (type CV_8UC1), within the 
+		//  tolerance documented in SADKernel.h. If given, scores receives the SAD score
+		//  of every pixel (type CV_64FC1).
+		Mat filterReference(const SpecImage& hyperImage, Mat* scores = NULL) const;
 
 	private:
-		map<double, double> filterData;
+		vector<double> sampleWavelengths;   //  Micrometers, ascending, no repeats
+		vector<double> sampleReflectances;  //  Reflectance of each sample
+
+		//  parseSamples
+		//  STATIC private method that parses the samples of a USGS formatted Reflectance
+		//  Pattern file.
+		//  Pre-conditions: [begin, end) holds the whole file.
+		//  Post-conditions: The wavelength and reflectance of every data line after the
+		//  header are appended to wavelengths and reflectances, in file order. Deleted
+		//  samples and lines that do not start with two numbers are skipped.
+		static void parseSamples(const char* begin, const char* end, vector<double>& wavelengths,
+			vector<double>& reflectances);
+
+		//  sortSamples
+		//  STATIC private method that puts samples in wavelength order.
+		//  Pre-conditions: wavelengths and reflectances are the same size.
+		//  Post-conditions: The samples are sorted by wavelength with one sample per
+		//  wavelength, the last one given for it.
+		static void sortSamples(vector<double>& wavelengths, vector<double>& reflectances);
+
+		//  filterRegion
+		//  Scores one window of a hyperspectral image against a compiled plan and writes 
+		//  the binary result into the same window of resultImage.
+		//  Pre-Conditions: plan fits the image, window lies inside the image, resultImage
+		//  is a CV_8UC1 image the size of the hyperspectral image.
+		//  Post-Conditions: The window of resultImage holds the filter result. minScore and
+		//  maxScore (in fixed point) are lowered/raised to include the window's scores.
+		//  Scratch memory comes from slot, if given.
+		static void filterRegion(const SpecImage& hyperImage, const FilterPlan& plan, const Rect& window,
+			Mat& resultImage, int& minScore, int& maxScore, Workspace::Slot* slot = NULL);
+
+		//  reportScoreRange
+		//  Converts a fixed point score range into SAD scores for the caller.
+		//  Pre-Conditions: None
+		//  Post-Conditions: minScore and maxScore, where given, receive the range, or 0 if
+		//  no pixel was scored.
+		static void reportScoreRange(int low, int high, double* minScore, double* maxScore);
 };
\ No newline at end of file
@@ -6,13 +6,31 @@
 //  provided image, to ease filtering of the data.
 
 #include "SpecImage.h"
+#include "Parallel.h"
+#include "Trace.h"
 
-vector<int> SpecImage::hyperionWavelengthTable;
+#include <fstream>
+#include <iomanip>
+#include <mutex>
 
+// SpecImage
+// Creates an empty SpecImage object for the Hyperion sensor. Use LoadFromFile
+//  or OpenLazy to load spectral images into it.
+// Pre-Condition: None
+// Post-Condition: An empty SpecImage is created.
+SpecImage::SpecImage()
+{
+	layout = BSQ;
+	imgRows = 0;
+	imgCols = 0;
+	origin = Point(0, 0);
+	sensor = &HyperionSensor();
+	resetBadBands();
+}
 
 // SpecImage
-// Creates a new SpecImage object, loads the hyperionWavelengthTable, and loads 
-//  spectral images based on the image's root file name. See LoadFromFile for more 
+// Creates a new SpecImage object for the Hyperion sensor, and loads spectral 
+//  images based on the image's root file name. See LoadFromFile for more 
 //  information on loading spectral images.
 // Pre-Condition: Filename refers to a folder of Hyperion hyperspectral satellite
 //  images that have not been renamed. These images are expected to be in the 
@@ -20,16 +38,23 @@ vector<int> SpecImage::hyperionWavelengthTable;
 // Post-Condition: Images from the specified folder are loaded into this SpecImage
 //  object, and can be accessed by SpecImage methods.
 
-SpecImage::SpecImage(string fileName)
+SpecImage::SpecImage(string fileName, Interleave interleave, int numThreads) : SpecImage()
+{
+	cout << "Loading image data.." << endl;
+	LoadFromFile(fileName, interleave, numThreads);
+	cout << "Image data loaded" << endl;
+}
+
+// SpecImage
+// Creates a new SpecImage object for the Hyperion sensor, and loads a window of
+//  a scene. See LoadFromFile for more information on loading windows.
+// Pre-Condition: As for the whole scene constructor. window is in pixels of the
+//  full scene.
+// Post-Condition: The part of every band inside the window is loaded.
+SpecImage::SpecImage(string fileName, Rect window, Interleave interleave, int numThreads) : SpecImage()
 {
-	if (hyperionWavelengthTable.capacity() != 242)
-	{
-		cout << "Creating wavelength table.." << endl;
-		initilizeWavelengthTable();
-		cout << "Wavelength table created" << endl;
-	}
 	cout << "Loading image data.." << endl;
-	LoadFromFile(fileName);
+	LoadFromFile(fileName, window, interleave, numThreads);
 	cout << "Image data loaded" << endl;
 }
 
@@ -46,59 +71,746 @@ SpecImage::SpecImage(string fileName)
 //   through "EO1H0460272013279110KF_B242_L1GST"
 // Ex2: "EO1H0420342016268110PF_1T" loads files "EO1H0420342016268110PF_B001_L1T"
 //   through "EO1H0420342016268110PF_B242_L1T"
-void SpecImage::LoadFromFile(string fileName)
+// NOTE: When interleave is BIL or BIP the bands are transposed into a single
+//  contiguous uint16 cube while loading, in small groups, so the full set of 
+//  band-sequential Mats is never resident at the same time.
+// NOTE: Bands are decoded on numThreads worker threads (0 uses every core). Band 
+//  order is kept, and bands that are missing or fail to decode are reported on 
+//  cerr and recorded in getLoadStatus; they are stored as empty images. So are
+//  bands whose size differs from the scene's, which is the size of the first 
+//  band that loaded.
+// NOTE: Bad bands (see isBadBand) are not read at all. Decoded bands that hold
+//  a single value everywhere are added to the bad bands, and their image is
+//  released.
+void SpecImage::LoadFromFile(string fileName, Interleave interleave, int numThreads)
 {
-	// Determine if the file types are Hyperion's L1T file type or not.
-	bool L1T = false;
-	if (fileName.length() > 3 && fileName.substr(fileName.length() - 3, fileName.length()) == "_1T")
+	LoadFromFile(fileName, Rect(), interleave, numThreads);
+}
+
+// LoadFromFile
+// Loads a window of a scene, given in pixels of the full scene. Only the strips
+//  or tiles of each band's GeoTIFF that intersect the window are read and 
+//  decoded (see TiffWindow.h), so time and memory follow the size of the window.
+// Pre-Condition: As for loading the whole scene.
+// Post-Condition: Every band holds the part of the band inside the window, and
+//  the image behaves as a scene of that size: getRows, getCols, getImage, the
+//  composites and the filters all work on the window. getWindow returns where
+//  it lies in the full scene.
+// NOTE: The window is clipped to the scene. Band files that cannot be read a
+//  window at a time (such as compressed with a scheme TiffWindow.h does not 
+//  handle) are decoded whole and cropped. An empty window loads the whole scene.
+// NOTE: A window can be uniform where the band is not (open water, or a single
+//  pixel), so bands of a window are not checked for constant values. Call 
+//  DetectConstantBands to mask the ones that are.
+void SpecImage::LoadFromFile(string fileName, Rect window, Interleave interleave, int numThreads)
+{
+	// Number of bands buffered before they are transposed into the cube
+	const int TRANSPOSE_GROUP = 16;
+	const int depth = sensor->bandCount;
+	TRACE_SCOPE("SpecImage::LoadFromFile");
+
+	layout = interleave;
+	cube.release();
+	cache.reset();
+	mapping.reset();
+	pyramid.reset();
+	restoreBadBands();
+	imgRows = 0;
+	imgCols = 0;
+	origin = Point(max(window.x, 0), max(window.y, 0));
+	if (window.area() <= 0)
 	{
-		L1T = true;
-		fileName += "/" + fileName.substr(0, fileName.length() - 3);
+		window = Rect();
+		origin = Point(0, 0);
 	}
-	else
+	specImg.assign(depth, imgData());
+	loadStatus.assign(depth, BandLoadStatus());
+	for (int i = 0; i < depth; i++)
 	{
-		fileName += "/" + fileName;
+		specImg[i].wavelength = static_cast<int>(sensor->centres[i]);
 	}
 
-	// For each spectral band image in the hypersepectral image...
-	//     Generate the file name,
-	//     Read the file into memory and store it in the vector
-	for (int i = 1; i <= 242; i++)
+	// Bands are decoded in independent tasks. Band sequential images are stored 
+	//  as they are decoded, interleaved layouts decode a group of bands and then 
+	//  transpose that group into the cube, so each task writes its own bands only.
+	int groupSize = (layout == BSQ) ? 1 : TRANSPOSE_GROUP;
+	int groupCount = (depth + groupSize - 1) / groupSize;
+	mutex cubeLock;
+	vector<int> constant(depth, -1);
+	vector<Size> sizes(depth);
+	bool detectConstant = (window.area() <= 0);
+
+	parallelFor(groupCount, numThreads, [&](int g)
 	{
-		Mat img;
-		if (L1T)
+		int first = g * groupSize;
+		int last = min(depth, first + groupSize);
+		vector<Mat> group;
+		for (int i = first; i < last; i++)
 		{
-			if (i / 100 > 0)
+			Mat img;
+			if (badBands[i])
+			{
+				loadStatus[i].band = i + 1;
+				loadStatus[i].fileName = getBandFileName(fileName, i + 1);
+				loadStatus[i].masked = true;
+			}
+			else
 			{
-				img = imread(fileName + "_B" + to_string(i) + "_L1T.TIF", -1);
+				img = readBand(fileName, i + 1, loadStatus[i], window);
+				sizes[i] = img.size();
 			}
-			else if (i / 10 > 0)
+
+			// Constant bands carry no information, like the uncalibrated ones
+			if (!img.empty() && detectConstant)
+			{
+				double low, high;
+				minMaxLoc(img, &low, &high);
+				constant[i] = (low == high) ? static_cast<int>(low) : -1;
+			}
+			if (layout == BSQ)
 			{
-				img = imread(fileName + "_B0" + to_string(i) + "_L1T.TIF", -1);
+				specImg[i].img = img;
 			}
 			else
 			{
-				img = imread(fileName + "_B00" + to_string(i) + "_L1T.TIF", -1);
+				group.push_back(img);
 			}
 		}
-		else
+		if (layout == BSQ)
+		{
+			return;
+		}
+
+		// Allocate the cube as soon as any task knows the scene size. The members 
+		//  are only touched under the lock; the task packs into its own copy.
+		Mat target;
+		int cols = 0;
+		{
+			lock_guard<mutex> guard(cubeLock);
+			for (size_t k = 0; k < group.size() && cube.empty(); k++)
+			{
+				if (!group[k].empty())
+				{
+					imgRows = group[k].rows;
+					imgCols = group[k].cols;
+					cube = Mat(imgRows, imgCols * depth, CV_16UC1, Scalar::all(0));
+				}
+			}
+			target = cube;
+			cols = imgCols;
+		}
+		packBands(target, layout, cols, first, group);
+	});
+
+	// Band sequential scenes take their size from the first band that was loaded
+	for (int i = 0; i < depth && layout == BSQ && imgRows == 0; i++)
+	{
+		imgRows = specImg[i].img.rows;
+		imgCols = specImg[i].img.cols;
+	}
+
+	// Bands of another size than the scene (such as truncated files) would be 
+	//  read past their end by every consumer, so they count as not loaded
+	for (int i = 0; i < depth; i++)
+	{
+		if (loadStatus[i].loaded && (sizes[i].height != imgRows || sizes[i].width != imgCols))
+		{
+			loadStatus[i].loaded = false;
+			loadStatus[i].error = "size differs from the scene";
+			specImg[i].img.release();
+			constant[i] = -1;
+		}
+	}
+
+	// Report failures in band order once every worker is done
+	int failed = 0;
+	for (int i = 0; i < depth; i++)
+	{
+		if (!loadStatus[i].loaded && !loadStatus[i].masked)
+		{
+			cerr << "Error - Band B" << setw(3) << setfill('0') << loadStatus[i].band << setfill(' ')
+				<< " (\"" << loadStatus[i].fileName << "\"): " << loadStatus[i].error << endl;
+			failed++;
+		}
+	}
+	if (failed > 0)
+	{
+		cerr << "Warning - " << failed << " of " << depth << " bands could not be loaded" << endl;
+	}
+
+	// Mask the constant bands
+	bool masked = false;
+	for (int i = 0; i < depth; i++)
+	{
+		if (constant[i] >= 0)
+		{
+			badBands[i] = 1;
+			badBandValues[i] = static_cast<ushort>(constant[i]);
+			specImg[i].img.release();
+			masked = true;
+		}
+	}
+	if (masked)
+	{
+		updateGoodLookup();
+	}
+
+	// BIL bands are column ranges of the cube, so they can be handed out directly
+	if (layout == BIL && !cube.empty())
+	{
+		for (int i = 0; i < depth; i++)
 		{
-			if (i / 100 > 0)
+			specImg[i].img = cube.colRange(i * imgCols, (i + 1) * imgCols);
+		}
+	}
+}
+
+// LoadFromFile
+// Loads the window of a scene covering an area given in map coordinates. The 
+//  GeoTIFF tags of the first band that is not bad place the scene on the map.
+// Pre-Condition: As for loading the whole scene, and the bands are GeoTIFFs.
+// Post-Condition: The window of every pixel that overlaps area is loaded, as 
+//  for a window given in pixels. If the bands are not georeferenced or the area
+//  misses the scene, an error is printed and nothing is loaded.
+void SpecImage::LoadFromFile(string fileName, const GeoRect& area, Interleave interleave, int numThreads)
+{
+	int band = 0;
+	while (band < sensor->bandCount && sceneBadBands[band])
+	{
+		band++;
+	}
+	string bandFile = getBandFileName(fileName, band + 1);
+	ifstream file(bandFile, ios::binary);
+	TiffLayout tiff;
+	string error;
+	if (!file.is_open() || !ReadTiffLayout(file, tiff, error) || !tiff.hasGeo)
+	{
+		cerr << "Error - Band \"" << bandFile << "\" is not a georeferenced GeoTIFF." << endl;
+		return;
+	}
+	Rect window = GeoToPixelRect(tiff, area);
+	if (window.area() <= 0)
+	{
+		cerr << "Error - The area does not overlap scene \"" << fileName << "\"." << endl;
+		return;
+	}
+	LoadFromFile(fileName, window, interleave, numThreads);
+}
+
+// OpenMapped
+// Opens a native cube file (see CubeFile.h) by memory-mapping it. No image 
+//  data is read up front; getImage returns Mats that point directly into the
+//  mapping, and the operating system loads pages as they are touched.
+// Pre-Condition: cubeFile was written by SaveCube or ConvertToCube.
+// Post-Condition: Returns true if the cube was opened, in the interleave it 
+//  was saved with. On failure an error is printed and false is returned.
+// NOTE: Mats returned by getImage point into the mapping, which is released 
+//  when the last copy of this SpecImage is destroyed or loads another scene.
+bool SpecImage::OpenMapped(string cubeFile)
+{
+	shared_ptr<MappedFile> file = make_shared<MappedFile>();
+	CubeHeader header;
+	if (!file->Open(cubeFile) || !ReadCubeHeader(file->getData(), file->getSize(), header))
+	{
+		cerr << "Error - Could not open cube file \"" << cubeFile << "\"." << endl;
+		return false;
+	}
+	if (static_cast<int>(header.bands) != sensor->bandCount)
+	{
+		cerr << "Error - Cube file \"" << cubeFile << "\" has " << header.bands 
+			<< " bands, expected " << sensor->bandCount << " " << sensor->name << " bands." << endl;
+		return false;
+	}
+
+	int depth = static_cast<int>(header.bands);
+	layout = static_cast<Interleave>(header.interleave);
+	cube.release();
+	cache.reset();
+	pyramid.reset();
+	restoreBadBands();
+	loadStatus.clear();
+	imgRows = static_cast<int>(header.rows);
+	imgCols = static_cast<int>(header.cols);
+	origin = Point(0, 0);
+	specImg.assign(depth, imgData());
+	for (int i = 0; i < depth; i++)
+	{
+		specImg[i].wavelength = static_cast<int>(round(header.wavelengths[i]));
+	}
+
+	// Hand out headers that point into the mapping, nothing is copied
+	ushort* samples = reinterpret_cast<ushort*>(file->getData() + header.dataOffset);
+	size_t bandSize = static_cast<size_t>(imgRows) * imgCols;
+	if (layout == BSQ)
+	{
+		for (int i = 0; i < depth; i++)
+		{
+			specImg[i].img = Mat(imgRows, imgCols, CV_16UC1, samples + i * bandSize);
+		}
+	}
+	else
+	{
+		cube = Mat(imgRows, imgCols * depth, CV_16UC1, samples);
+		for (int i = 0; i < depth && layout == BIL; i++)
+		{
+			specImg[i].img = cube.colRange(i * imgCols, (i + 1) * imgCols);
+		}
+	}
+
+	mapping = file;
+	return true;
+}
+
+// isMapped
+// Returns whether the image data lives in a memory-mapped cube file.
+// Pre-Condition: None
+// Post-Condition: Returns true if the scene was opened with OpenMapped.
+bool SpecImage::isMapped() const
+{
+	return static_cast<bool>(mapping);
+}
+
+// SaveCube
+// Writes the loaded scene to a native cube file (see CubeFile.h), in the 
+//  current interleave.
+// Pre-Condition: A scene is loaded.
+// Post-Condition: Returns true if the file was written. Bands that could not
+//  be loaded are stored as zeros.
+bool SpecImage::SaveCube(string cubeFile) const
+{
+	int depth = getDepth();
+	int rows = getRows();
+	int cols = getCols();
+	if (depth == 0 || rows <= 0 || cols <= 0)
+	{
+		cerr << "Error - No image data to save to \"" << cubeFile << "\"." << endl;
+		return false;
+	}
+
+	ofstream out(cubeFile, ios::binary);
+	if (!out.is_open())
+	{
+		cerr << "Error - Could not create cube file \"" << cubeFile << "\"." << endl;
+		return false;
+	}
+
+	CubeHeader header;
+	header.interleave = static_cast<uint32_t>(layout);
+	header.depth = CV_16U;
+	header.rows = rows;
+	header.cols = cols;
+	header.bands = depth;
+	for (int i = 0; i < depth; i++)
+	{
+		header.wavelengths.push_back(static_cast<float>(specImg[i].wavelength));
+	}
+	WriteCubeHeader(out, header);
+
+	if (layout == BSQ)
+	{
+		vector<ushort> zeros(cols, 0);
+		for (int i = 0; i < depth; i++)
+		{
+			Mat band = getBand(i);
+			if (band.rows != rows || band.cols != cols)
 			{
-				img = imread(fileName + "_B" + to_string(i) + "_L1GST.TIF", -1);
+				band = Mat();
 			}
-			else if (i / 10 > 0)
+			else if (band.type() != CV_16UC1)
 			{
-				img = imread(fileName + "_B0" + to_string(i) + "_L1GST.TIF", -1);
+				band.convertTo(band, CV_16U);
 			}
-			else
+			for (int r = 0; r < rows; r++)
+			{
+				const ushort* line = band.empty() ? &zeros[0] : band.ptr<ushort>(r);
+				out.write(reinterpret_cast<const char*>(line), cols * sizeof(ushort));
+			}
+		}
+	}
+	else
+	{
+		for (int r = 0; r < rows; r++)
+		{
+			out.write(reinterpret_cast<const char*>(cube.ptr<ushort>(r)), cube.cols * sizeof(ushort));
+		}
+	}
+
+	if (!out)
+	{
+		cerr << "Error - Could not write cube file \"" << cubeFile << "\"." << endl;
+		return false;
+	}
+	return true;
+}
+
+// ConvertToCube
+// STATIC method to convert a Hyperion scene folder into a native cube file, 
+//  so later runs can open it with OpenMapped instead of decoding GeoTIFFs.
+// Pre-Condition: Filename refers to a folder of Hyperion hyperspectral satellite
+//  images, named as described in LoadFromFile (both _L1T and _L1GST naming).
+// Post-Condition: Returns true if cubeFile was written with the given interleave.
+//  Bands that could not be read, and the sensor's bad bands, are stored as zeros.
+// NOTE: The scene is streamed into the file rather than loaded, so memory follows
+//  a few bands instead of the scene. Band sequential cubes are written numThreads
+//  bands at a time (0 uses every core), BIL and BIP cubes a group of rows of 
+//  every band at a time, read as windows of the bands (see readBand). Band files
+//  that cannot be read a window at a time are decoded once per group of rows.
+bool SpecImage::ConvertToCube(string fileName, string cubeFile, Interleave interleave, int numThreads)
+{
+	// Rows of every band that are read and interleaved together
+	const int ROW_GROUP = 64;
+	TRACE_SCOPE("SpecImage::ConvertToCube");
+
+	// A scene that is not loaded gives the sensor and its default bad bands
+	SpecImage scene;
+	const int depth = scene.sensor->bandCount;
+	const vector<char>& badBands = scene.sceneBadBands;
+
+	// The scene size comes from the first band that can be decoded
+	int rows = 0;
+	int cols = 0;
+	for (int i = 0; i < depth && rows == 0; i++)
+	{
+		if (badBands[i])
+		{
+			continue;
+		}
+		BandLoadStatus status;
+		Mat band = readBand(fileName, i + 1, status);
+		rows = band.rows;
+		cols = band.cols;
+	}
+	if (rows <= 0 || cols <= 0)
+	{
+		cerr << "Error - No band of \"" << fileName << "\" could be read." << endl;
+		return false;
+	}
+
+	ofstream out(cubeFile, ios::binary);
+	if (!out.is_open())
+	{
+		cerr << "Error - Could not create cube file \"" << cubeFile << "\"." << endl;
+		return false;
+	}
+
+	CubeHeader header;
+	header.interleave = static_cast<uint32_t>(interleave);
+	header.depth = CV_16U;
+	header.rows = rows;
+	header.cols = cols;
+	header.bands = depth;
+	for (int i = 0; i < depth; i++)
+	{
+		header.wavelengths.push_back(static_cast<float>(static_cast<int>(scene.sensor->centres[i])));
+	}
+	WriteCubeHeader(out, header);
+
+	// Each band keeps its first failure, so it is reported once
+	vector<BandLoadStatus> failures(depth);
+	if (interleave == BSQ)
+	{
+		int batch = resolveThreadCount(numThreads);
+		vector<Mat> bands(batch);
+		vector<ushort> zeros(cols, 0);
+		for (int first = 0; first < depth && out; first += batch)
+		{
+			int count = min(batch, depth - first);
+			parallelFor(count, numThreads, [&](int k)
+			{
+				int i = first + k;
+				BandLoadStatus status;
+				bands[k] = badBands[i] ? Mat() : readBand(fileName, i + 1, status);
+				if (!badBands[i] && !status.loaded)
+				{
+					failures[i] = status;
+				}
+				if (bands[k].rows != rows || bands[k].cols != cols)
+				{
+					bands[k] = Mat();
+				}
+				else if (bands[k].type() != CV_16UC1)
+				{
+					bands[k].convertTo(bands[k], CV_16U);
+				}
+			});
+			for (int k = 0; k < count; k++)
 			{
-				img = imread(fileName + "_B00" + to_string(i) + "_L1GST.TIF", -1);
+				for (int r = 0; r < rows; r++)
+				{
+					const ushort* line = bands[k].empty() ? &zeros[0] : bands[k].ptr<ushort>(r);
+					out.write(reinterpret_cast<const char*>(line), cols * sizeof(ushort));
+				}
+				bands[k].release();
 			}
 		}
+	}
+	else
+	{
+		vector<Mat> bands(depth);
+		for (int top = 0; top < rows && out; top += ROW_GROUP)
+		{
+			Rect window(0, top, cols, min(ROW_GROUP, rows - top));
+			parallelFor(depth, numThreads, [&](int i)
+			{
+				BandLoadStatus status;
+				bands[i] = badBands[i] ? Mat() : readBand(fileName, i + 1, status, window);
+				if (!badBands[i] && !status.loaded && failures[i].error.empty())
+				{
+					failures[i] = status;
+				}
+			});
+
+			Mat group(window.height, cols * depth, CV_16UC1);
+			packBands(group, interleave, cols, 0, bands);
+			for (int r = 0; r < group.rows; r++)
+			{
+				out.write(reinterpret_cast<const char*>(group.ptr<ushort>(r)), group.cols * sizeof(ushort));
+			}
+		}
+	}
+
+	int failed = 0;
+	for (int i = 0; i < depth; i++)
+	{
+		if (!failures[i].error.empty())
+		{
+			cerr << "Error - Band B" << setw(3) << setfill('0') << failures[i].band << setfill(' ')
+				<< " (\"" << failures[i].fileName << "\"): " << failures[i].error << endl;
+			failed++;
+		}
+	}
+	if (failed > 0)
+	{
+		cerr << "Warning - " << failed << " of " << depth << " bands could not be read and are stored as zeros" << endl;
+	}
+
+	if (!out)
+	{
+		cerr << "Error - Could not write cube file \"" << cubeFile << "\"." << endl;
+		return false;
+	}
+	return true;
+}
+
+// getBandFileName
+// Generates the file name of a single band image of a Hyperion scene.
+// Pre-Condition: fileName is the scene's root file name, as given to LoadFromFile.
+//  band is a Hyperion band number, starting at 1.
+// Post-Condition: Returns the path of the band's GeoTIFF file.
+// Ex: ("EO1H0420342016268110PF_1T", 7) returns 
+//  "EO1H0420342016268110PF_1T/EO1H0420342016268110PF_B007_L1T.TIF"
+string SpecImage::getBandFileName(string fileName, int band)
+{
+	// Determine if the file types are Hyperion's L1T file type or not.
+	bool L1T = false;
+	if (fileName.length() > 3 && fileName.substr(fileName.length() - 3, fileName.length()) == "_1T")
+	{
+		L1T = true;
+		fileName += "/" + fileName.substr(0, fileName.length() - 3);
+	}
+	else
+	{
+		fileName += "/" + fileName;
+	}
+
+	char number[8];
+	snprintf(number, sizeof(number), "%03d", band);
+	return fileName + "_B" + number + (L1T ? "_L1T.TIF" : "_L1GST.TIF");
+}
+
+// getLoadStatus
+// Returns the outcome and timing of loading each band in the last LoadFromFile.
+// Pre-Condition: None
+// Post-Condition: Returns one entry per band in band order. For lazily opened 
+//  scenes only bands decoded so far have been filled in (band is 0 for others).
+vector<SpecImage::BandLoadStatus> SpecImage::getLoadStatus() const
+{
+	if (cache)
+	{
+		lock_guard<mutex> guard(cache->lock);
+		return cache->status;
+	}
+	return loadStatus;
+}
+
+// OpenLazy
+// Opens a Hyperion scene without decoding its bands. Each band is decoded the
+//  first time getImage asks for it and kept in a least-recently-used cache 
+//  that holds at most maxCacheBytes of band data (0 for no limit).
+// Pre-Condition: Filename refers to a folder of Hyperion hyperspectral satellite 
+//  images, named as described in LoadFromFile.
+// Post-Condition: The scene is opened in band sequential layout. Only one band 
+//  is decoded, to learn the scene size. Copies of this SpecImage share the cache.
+// NOTE: Mats returned by getImage stay valid after their band is evicted, so 
+//  memory held by callers is not counted against the cap.
+void SpecImage::OpenLazy(string fileName, size_t maxCacheBytes)
+{
+	const int depth = sensor->bandCount;
+
+	layout = BSQ;
+	cube.release();
+	mapping.reset();
+	pyramid.reset();
+	restoreBadBands();
+	loadStatus.clear();
+	imgRows = 0;
+	imgCols = 0;
+	origin = Point(0, 0);
+	specImg.assign(depth, imgData());
+	for (int i = 0; i < depth; i++)
+	{
+		specImg[i].wavelength = static_cast<int>(sensor->centres[i]);
+	}
+
+	cache = make_shared<BandCache>();
+	cache->sceneName = fileName;
+	cache->maxBytes = maxCacheBytes;
+	cache->residentBytes = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+	cache->bands.assign(depth, Mat());
+	cache->present.assign(depth, false);
+	cache->status.assign(depth, BandLoadStatus());
+	cache->position.assign(depth, cache->recent.end());
+
+	// The scene size comes from the first band that can be decoded
+	for (int i = 0; i < depth && imgRows == 0; i++)
+	{
+		if (badBands[i])
+		{
+			continue;
+		}
+		Mat band = getCachedBand(i);
+		imgRows = band.rows;
+		imgCols = band.cols;
+	}
+}
+
+// isLazy
+// Returns whether bands are decoded on demand (see OpenLazy).
+// Pre-Condition: None
+// Post-Condition: Returns true if the scene was opened with OpenLazy.
+bool SpecImage::isLazy() const
+{
+	return static_cast<bool>(cache);
+}
+
+// getCacheStats
+// Returns the hit, miss and eviction counters of the lazy band cache.
+// Pre-Condition: None
+// Post-Condition: Returns the current counters. All counters are zero if the 
+//  scene was not opened with OpenLazy.
+SpecImage::CacheStats SpecImage::getCacheStats() const
+{
+	CacheStats stats = { 0, 0, 0, 0, 0, 0 };
+	if (!cache)
+	{
+		return stats;
+	}
+
+	lock_guard<mutex> guard(cache->lock);
+	stats.hits = cache->hits;
+	stats.misses = cache->misses;
+	stats.evictions = cache->evictions;
+	stats.residentBands = static_cast<int>(cache->recent.size());
+	stats.residentBytes = cache->residentBytes;
+	stats.maxBytes = cache->maxBytes;
+	return stats;
+}
 
-		specImg.push_back({hyperionWavelengthTable[i-1],img});
-	} // end for-loop of spectral images.
+// getInterleave
+// Returns the in-memory layout of the spectral cube.
+// Pre-Condition: None
+// Post-Condition: Returns BSQ, BIL or BIP.
+SpecImage::Interleave SpecImage::getInterleave() const
+{
+	return layout;
+}
+
+// setInterleave
+// Rearranges the loaded spectral cube into the given in-memory layout.
+// Pre-Condition: None
+// Post-Condition: The cube is stored using the requested layout. Image data is
+//  unchanged, and getImage returns the same bands as before.
+// NOTE: A lazily opened scene is fully decoded by this, and stops being lazy.
+void SpecImage::setInterleave(Interleave interleave)
+{
+	if (interleave == layout && !cache)
+	{
+		return;
+	}
+
+	int rows = getRows();
+	int cols = getCols();
+	int depth = getDepth();
+	vector<Mat> bands;
+	bands.reserve(depth);
+	for (int i = 0; i < depth; i++)
+	{
+		bands.push_back(getBand(i));
+	}
+
+	// Every band is now resident, so the scene is no longer lazy
+	cache.reset();
+	layout = interleave;
+	if (layout == BSQ)
+	{
+		// BIL bands are views of the old cube, so they need their own memory
+		for (int i = 0; i < depth; i++)
+		{
+			specImg[i].img = bands[i].isContinuous() ? bands[i] : bands[i].clone();
+		}
+		cube.release();
+		imgRows = rows;
+		imgCols = cols;
+		return;
+	}
+
+	imgRows = rows;
+	imgCols = cols;
+	cube = Mat(imgRows, imgCols * depth, CV_16UC1, Scalar::all(0));
+	packBands(cube, layout, imgCols, 0, bands);
+	for (int i = 0; i < depth; i++)
+	{
+		if (layout == BIL)
+		{
+			specImg[i].img = cube.colRange(i * imgCols, (i + 1) * imgCols);
+		}
+		else
+		{
+			specImg[i].img = Mat();
+		}
+	}
+}
+
+// getSpectrum
+// Fetches the full spectrum of a single pixel in a BIP cube.
+// Pre-Condition: The cube is stored as BIP, and row/col are inside the image.
+// Post-Condition: Returns a pointer to getDepth() contiguous uint16 values, one 
+//  per band in band order. Returns NULL if the cube is not stored as BIP.
+const ushort* SpecImage::getSpectrum(int row, int col) const
+{
+	if (layout != BIP || cube.empty())
+	{
+		return NULL;
+	}
+	return cube.ptr<ushort>(row) + col * getDepth();
+}
+
+// getLine
+// Fetches every band of a single image row in a BIL cube.
+// Pre-Condition: The cube is stored as BIL, and row is inside the image.
+// Post-Condition: Returns a pointer to getDepth() * getCols() contiguous uint16
+//  values, where band b of the row starts at offset b * getCols(). Returns NULL
+//  if the cube is not stored as BIL.
+const ushort* SpecImage::getLine(int row) const
+{
+	if (layout != BIL || cube.empty())
+	{
+		return NULL;
+	}
+	return cube.ptr<ushort>(row);
 }
 
 // getImage
@@ -110,38 +822,211 @@ void SpecImage::LoadFromFile(string fileName)
 //  image is out of range, an empty Mat is returned.
 Mat SpecImage::getImage(int wavelength) const
 {
-	if (wavelength < 356 || wavelength > 2600)
+	TRACE_SCOPE("SpecImage::getImage");
+	int index = getBandIndex(wavelength);
+	if (index < 0)
 	{	
 		return  Mat(0, 0, CV_64F, Scalar::all(0));
 	}
+	return getBand(index);
+}
+
+// getBandIndex
+// Finds the index of the band nearest to a wavelength, as used by getImage.
+// Pre-Condition: None
+// Post-Condition: Returns the band index in the range [0, getDepth()), or -1 if
+//  the wavelength is out of range. Bad bands are never returned; the nearest 
+//  band that is not masked is used instead.
+// NOTE: This is a single read of a lookup table (see SensorDescriptor.h) that
+//  is rebuilt whenever the bad band mask changes.
+int SpecImage::getBandIndex(int wavelength) const
+{
+	if (wavelength < sensor->lookupFirst || wavelength > sensor->lookupLast)
+	{
+		return -1;
+	}
+	return goodLookup[wavelength - sensor->lookupFirst];
+}
+
+// getSensor
+// Returns the descriptor of the sensor that recorded the image.
+// Pre-Condition: None
+// Post-Condition: Returns the sensor's band tables. Images are Hyperion scenes.
+const SensorDescriptor& SpecImage::getSensor() const
+{
+	return *sensor;
+}
+
+// isBadBand
+// Returns whether a band is masked out as bad. Bad bands are not loaded, and 
+//  are skipped by getImage, the composites, filters and spectral indices.
+// Pre-Condition: index is in the range [0, getDepth())
+// Post-Condition: Returns true if the band is masked out.
+bool SpecImage::isBadBand(int index) const
+{
+	return badBands[index] != 0;
+}
 
-	// Estimate the closest wavelength image
-	int index;
-	if (wavelength <= 852)
+// isBandMissing
+// Returns whether a band's file could not be read or decoded (see 
+//  getLoadStatus). Missing bands are empty, but read as zeros through 
+//  getSpectrum, so consumers of BIP cubes must skip them explicitly.
+// Pre-Condition: index is in the range [0, getDepth())
+// Post-Condition: Returns true if loading the band failed. Bands of lazily 
+//  opened scenes only count once they have been tried.
+bool SpecImage::isBandMissing(int index) const
+{
+	if (cache)
 	{
-		index = static_cast<int>(round((wavelength - 355.59f)/10.175f));
+		lock_guard<mutex> guard(cache->lock);
+		return cache->status[index].band != 0 && !cache->status[index].loaded;
 	}
-	else if (wavelength >= 1063)
+	if (static_cast<size_t>(index) >= loadStatus.size())
 	{
-		index = static_cast<int>(round((wavelength - 851.92f) / 10.09f));
+		return false;
 	}
-	else
+	return !loadStatus[index].loaded && !loadStatus[index].masked;
+}
+
+// getBadBands
+// Returns the indices of every band that is masked out, in band order.
+// Pre-Condition: None
+// Post-Condition: Returns the bad bands. A new SpecImage starts with the 
+//  sensor's default bad bands (see SensorDescriptor.h).
+// NOTE: Constant bands found in a scene stay masked until another scene is 
+//  loaded or opened, which starts again from the mask set by setBadBands or
+//  resetBadBands.
+vector<int> SpecImage::getBadBands() const
+{
+	vector<int> bands;
+	for (size_t i = 0; i < badBands.size(); i++)
+	{
+		if (badBands[i])
+		{
+			bands.push_back(static_cast<int>(i));
+		}
+	}
+	return bands;
+}
+
+// getBadBandValue
+// Returns the value every pixel of a bad band is taken to hold.
+// Pre-Condition: index is in the range [0, getDepth())
+// Post-Condition: Returns the value found by constant band detection, or 0 
+//  (the value of uncalibrated bands) for bands masked any other way.
+ushort SpecImage::getBadBandValue(int index) const
+{
+	return badBandValues[index];
+}
+
+// setBadBands
+// Replaces the bad band mask.
+// Pre-Condition: Every index is in the range [0, getDepth())
+// Post-Condition: Exactly the given bands are masked out. Set the mask before 
+//  LoadFromFile or OpenLazy to avoid reading the masked bands.
+void SpecImage::setBadBands(const vector<int>& bands)
+{
+	badBands.assign(sensor->bandCount, 0);
+	badBandValues.assign(sensor->bandCount, 0);
+	for (size_t i = 0; i < bands.size(); i++)
 	{
-		// Crazy overlap area
-		int index1 = static_cast<int>(round((wavelength - 355.59f) / 10.175f));
-		int index2 = static_cast<int>(round((wavelength - 851.92f) / 10.09f));
+		badBands[bands[i]] = 1;
+	}
+	sceneBadBands = badBands;
+	updateGoodLookup();
+}
 
-		// Check which result gives us a closer wavelength, use that
-		if (abs(wavelength - hyperionWavelengthTable[index1]) < abs(wavelength - hyperionWavelengthTable[index2]))
+// resetBadBands
+// Restores the sensor's default bad bands.
+// Pre-Condition: None
+// Post-Condition: The mask holds the sensor's default bad bands only.
+void SpecImage::resetBadBands()
+{
+	badBands.assign(sensor->bandCount, 0);
+	badBandValues.assign(sensor->bandCount, 0);
+	for (int i = 0; i < sensor->bandCount; i++)
+	{
+		badBands[i] = sensor->badBands[i] ? 1 : 0;
+	}
+	sceneBadBands = badBands;
+	updateGoodLookup();
+}
+
+// DetectConstantBands
+// Adds every band that holds a single value everywhere to the bad bands, from 
+//  each band's minimum and maximum. Bands are checked on numThreads threads 
+//  (0 uses every core).
+// Pre-Condition: None
+// Post-Condition: Returns the number of bands that were added to the mask.
+// NOTE: LoadFromFile does this while decoding whole scenes, but not windows.
+//  Lazily opened scenes decode every band that is not yet masked.
+int SpecImage::DetectConstantBands(int numThreads)
+{
+	TRACE_SCOPE("SpecImage::DetectConstantBands");
+	int depth = getDepth();
+	vector<int> constant(depth, -1);
+	parallelFor(depth, numThreads, [&](int i)
+	{
+		if (badBands[i])
 		{
-			index = index1;
+			return;
 		}
-		else
+		Mat band = getBand(i);
+		if (band.empty())
+		{
+			return;
+		}
+		double low, high;
+		minMaxLoc(band, &low, &high);
+		constant[i] = (low == high) ? static_cast<int>(low) : -1;
+	});
+
+	int added = 0;
+	for (int i = 0; i < depth; i++)
+	{
+		if (constant[i] >= 0)
 		{
-			index = index2;
+			badBands[i] = 1;
+			badBandValues[i] = static_cast<ushort>(constant[i]);
+			if (layout == BSQ && !cache && !mapping)
+			{
+				specImg[i].img.release();
+			}
+			added++;
 		}
 	}
-	return specImg[index].img;
+	if (added > 0)
+	{
+		updateGoodLookup();
+	}
+	return added;
+}
+
+// getWavelengths
+// Returns the wavelength table of the loaded bands.
+// Pre-Condition: None
+// Post-Condition: Returns the wavelength (in nanometers) of every band, in band order.
+//  An image that has not been loaded returns the sensor's full table, so filters
+//  can be compiled (see SpecFilter::Compile) before any scene is opened.
+vector<int> SpecImage::getWavelengths() const
+{
+	if (specImg.empty())
+	{
+		vector<int> wavelengths(sensor->bandCount);
+		for (int i = 0; i < sensor->bandCount; i++)
+		{
+			wavelengths[i] = static_cast<int>(sensor->centres[i]);
+		}
+		return wavelengths;
+	}
+
+	vector<int> wavelengths;
+	wavelengths.reserve(specImg.size());
+	for (size_t i = 0; i < specImg.size(); i++)
+	{
+		wavelengths.push_back(specImg[i].wavelength);
+	}
+	return wavelengths;
 }
 
 // getRows
@@ -154,6 +1039,10 @@ int SpecImage::getRows() const
 	{
 		return -1;
 	}
+	if (layout != BSQ || cache || imgRows > 0)
+	{
+		return imgRows;
+	}
 	return specImg[0].img.rows;
 }
 
@@ -167,9 +1056,140 @@ int SpecImage::getCols() const
 	{
 		return -1;
 	}
+	if (layout != BSQ || cache || imgCols > 0)
+	{
+		return imgCols;
+	}
 	return specImg[0].img.cols;
 }
 
+// getWindow
+// Returns where the loaded image lies in the full scene, in pixels.
+// Pre-Condition: None
+// Post-Condition: Returns the window given to LoadFromFile, clipped to the
+//  scene, or the whole image if a whole scene was loaded or opened.
+Rect SpecImage::getWindow() const
+{
+	return Rect(origin.x, origin.y, max(getCols(), 0), max(getRows(), 0));
+}
+
+// BuildPyramid
+// Builds a spectral pyramid of the loaded scene: level k (1 to levels) averages
+//  every band over blocks of 2^k x 2^k pixels, so the default levels are 2x, 4x
+//  and 8x smaller in each direction. Bands are reduced on numThreads threads 
+//  (0 uses every core).
+// Pre-Condition: The image has been loaded. levels is at least 1.
+// Post-Condition: The pyramid is cached until another scene is loaded or 
+//  opened, and is shared by copies of this SpecImage made after it was built.
+// NOTE: Each level is a SpecImage of its own, with the same bad bands, so it can
+//  be filtered or saved (see SaveCube) like any scene, for example as a preview.
+//  Edge blocks that are cut off by the scene average the pixels they hold.
+void SpecImage::BuildPyramid(int levels, int numThreads)
+{
+	TRACE_SCOPE("SpecImage::BuildPyramid");
+	int depth = getDepth();
+	int rows = getRows();
+	int cols = getCols();
+	shared_ptr<vector<PyramidLevel> > built = make_shared<vector<PyramidLevel> >(max(levels, 0));
+	for (int k = 0; k < levels; k++)
+	{
+		PyramidLevel& level = (*built)[k];
+		level.factor = 1 << (k + 1);
+		level.low.resize(depth);
+		level.high.resize(depth);
+		level.image = make_shared<SpecImage>();
+
+		SpecImage& coarse = *level.image;
+		coarse.sensor = sensor;
+		coarse.badBands = badBands;
+		coarse.sceneBadBands = sceneBadBands;
+		coarse.badBandValues = badBandValues;
+		coarse.goodLookup = goodLookup;
+		coarse.imgRows = (max(rows, 0) + level.factor - 1) / level.factor;
+		coarse.imgCols = (max(cols, 0) + level.factor - 1) / level.factor;
+		coarse.origin = Point(origin.x / level.factor, origin.y / level.factor);
+		coarse.specImg.assign(depth, imgData());
+		for (int i = 0; i < depth; i++)
+		{
+			coarse.specImg[i].wavelength = specImg[i].wavelength;
+		}
+	}
+
+	// Each band is read once and reduced to every level. Bands that failed to load,
+	//  or do not match the scene's size, are left empty like bad bands.
+	parallelFor(depth, numThreads, [&](int i)
+	{
+		Mat band = isBandMissing(i) ? Mat() : getBand(i);
+		if (band.rows != rows || band.cols != cols || levels <= 0)
+		{
+			return;
+		}
+		if (band.type() != CV_16UC1)
+		{
+			band.convertTo(band, CV_16U);
+		}
+		for (int k = 0; k < levels; k++)
+		{
+			PyramidLevel& level = (*built)[k];
+			int factor = level.factor;
+			int coarseRows = level.image->imgRows;
+			int coarseCols = level.image->imgCols;
+			Mat average(coarseRows, coarseCols, CV_16UC1);
+			Mat low(coarseRows, coarseCols, CV_8UC1);
+			Mat high(coarseRows, coarseCols, CV_8UC1);
+			vector<unsigned> sum(coarseCols);
+			vector<int> count(coarseCols);
+			for (int y = 0; y < coarseRows; y++)
+			{
+				uchar* lowRow = low.ptr<uchar>(y);
+				uchar* highRow = high.ptr<uchar>(y);
+				fill(sum.begin(), sum.end(), 0);
+				fill(count.begin(), count.end(), 0);
+				fill(lowRow, lowRow + coarseCols, 255);
+				fill(highRow, highRow + coarseCols, 0);
+				for (int r = y * factor; r < min(rows, (y + 1) * factor); r++)
+				{
+					const ushort* src = band.ptr<ushort>(r);
+					for (int c = 0; c < cols; c++)
+					{
+						int x = c / factor;
+						uchar clamped = static_cast<uchar>(min<int>(src[c], 255));
+						sum[x] += src[c];
+						count[x]++;
+						lowRow[x] = min(lowRow[x], clamped);
+						highRow[x] = max(highRow[x], clamped);
+					}
+				}
+				ushort* dst = average.ptr<ushort>(y);
+				for (int x = 0; x < coarseCols; x++)
+				{
+					dst[x] = static_cast<ushort>((sum[x] + count[x] / 2) / count[x]);
+				}
+			}
+			level.image->specImg[i].img = average;
+			level.low[i] = low;
+			level.high[i] = high;
+		}
+	});
+	pyramid = built;
+}
+
+// getPyramidLevels
+// Returns the number of levels of the cached pyramid, or 0 if none was built.
+int SpecImage::getPyramidLevels() const
+{
+	return pyramid ? static_cast<int>(pyramid->size()) : 0;
+}
+
+// getPyramidLevel
+// Fetches a level of the cached pyramid.
+// Pre-Condition: level is in the range [1, getPyramidLevels()]
+// Post-Condition: Returns the level, whose factor is 2^level.
+const SpecImage::PyramidLevel& SpecImage::getPyramidLevel(int level) const
+{
+	return (*pyramid)[level - 1];
+}
+
 // getDepth
 // Returns the number of wavelengths present in the hyperspectral image.
 // Pre-Condition: None
@@ -333,29 +1353,45 @@ Mat SpecImage::getRGB()
 // Post-Condition: Returns an 8UC3 image created as a result of using three 
 //  grayscale images acquired from the provided wavelengths. The variables (eg 
 //  redWaveLength) coorespond to the color channel they will fill (eg R). 
-Mat SpecImage::getComposite(int redWavelength, int blueWavelength, int greenWavelength)
+// NOTE: Given a workspace (see Workspace.h), the converted channels and the 
+//  composite are kept in it and reused by later calls. The returned image then
+//  shares the workspace's memory and is overwritten by the next composite made
+//  with the same workspace; clone it to keep it.
+Mat SpecImage::getComposite(int redWavelength, int blueWavelength, int greenWavelength, Workspace* workspace)
 {
+	TRACE_SCOPE("SpecImage::getComposite");
 	Mat redVal;
 	Mat greenVal;
 	Mat blueVal;
 
-	vector<Mat> mergeArray;
-
 	int Max = 256 * 16;
 	int Min = 0;
 
-	getImage(redWavelength).convertTo(redVal, CV_8U);
-	getImage(blueWavelength).convertTo(greenVal, CV_8U);
-	getImage(greenWavelength).convertTo(blueVal, CV_8U);
-
-	mergeArray.push_back(blueVal);
-	mergeArray.push_back(greenVal);
-	mergeArray.push_back(redVal);
+	Mat red = getImage(redWavelength);
+	Mat blue = getImage(blueWavelength);
+	Mat green = getImage(greenWavelength);
 
+	// convertTo writes into a workspace plane of the right size instead of allocating
 	Mat_<Vec3b> composite;
+	if (workspace != NULL)
+	{
+		redVal = workspace->getPlane(Workspace::COMPOSITE_RED, red.rows, red.cols, CV_8UC1);
+		greenVal = workspace->getPlane(Workspace::COMPOSITE_GREEN, blue.rows, blue.cols, CV_8UC1);
+		blueVal = workspace->getPlane(Workspace::COMPOSITE_BLUE, green.rows, green.cols, CV_8UC1);
+		composite = workspace->getPlane(Workspace::COMPOSITE, red.rows, red.cols, CV_8UC3);
+	}
+	{
+		TRACE_SCOPE("convertTo");
+		red.convertTo(redVal, CV_8U);
+		blue.convertTo(greenVal, CV_8U);
+		green.convertTo(blueVal, CV_8U);
+		TRACE_COUNT("pixels converted", static_cast<long long>(red.total() + blue.total() + green.total()));
+	}
+
+	Mat mergeArray[3] = { blueVal, greenVal, redVal };
 
 	//merge(mergeArray, composite); // This will not work in Release mode
-	merge(&mergeArray[0], mergeArray.size(), composite);
+	merge(mergeArray, 3, composite);
 
 	return composite;
 }
@@ -371,54 +1407,485 @@ Mat SpecImage::getComposite(int redWavelength, int blueWavelength, int greenWave
 //  channel they will fill (eg R).
 // NOTE: The returned pointer is created in this function and must be deleted by 
 //  the calling function.
-Mat SpecImage::makeComposite(Mat redImage, Mat blueImage, Mat greenImage)
+// NOTE: Given a workspace, memory is reused as for getComposite.
+Mat SpecImage::makeComposite(Mat redImage, Mat blueImage, Mat greenImage, Workspace* workspace)
 {
+	TRACE_SCOPE("SpecImage::makeComposite");
 	Mat redVal;
 	Mat greenVal;
 	Mat blueVal;
 
-	vector<Mat> mergeArray;
-
 	int Max = 256 * 16;
 	int Min = 0;
 
-	redImage.convertTo(redVal, CV_8U, 255.0 / (Max - Min), -255.0*Min / (Max - Min));
-	blueImage.convertTo(greenVal, CV_8U, 255.0 / (Max - Min), -255.0*Min / (Max - Min));
-	greenImage.convertTo(blueVal, CV_8U, 255.0 / (Max - Min), -255.0*Min / (Max - Min));
+	Mat_<Vec3b> composite;
+	if (workspace != NULL)
+	{
+		redVal = workspace->getPlane(Workspace::COMPOSITE_RED, redImage.rows, redImage.cols, CV_8UC1);
+		greenVal = workspace->getPlane(Workspace::COMPOSITE_GREEN, blueImage.rows, blueImage.cols, CV_8UC1);
+		blueVal = workspace->getPlane(Workspace::COMPOSITE_BLUE, greenImage.rows, greenImage.cols, CV_8UC1);
+		composite = workspace->getPlane(Workspace::COMPOSITE, redImage.rows, redImage.cols, CV_8UC3);
+	}
 
-	mergeArray.push_back(blueVal);
-	mergeArray.push_back(greenVal);
-	mergeArray.push_back(redVal);
+	{
+		TRACE_SCOPE("convertTo");
+		redImage.convertTo(redVal, CV_8U, 255.0 / (Max - Min), -255.0*Min / (Max - Min));
+		blueImage.convertTo(greenVal, CV_8U, 255.0 / (Max - Min), -255.0*Min / (Max - Min));
+		greenImage.convertTo(blueVal, CV_8U, 255.0 / (Max - Min), -255.0*Min / (Max - Min));
+		TRACE_COUNT("pixels converted", static_cast<long long>(redImage.total() + blueImage.total() + greenImage.total()));
+	}
 
-	Mat_<Vec3b> composite;
+	Mat mergeArray[3] = { blueVal, greenVal, redVal };
 
 	//merge(mergeArray, composite); // This will not work in Release mode
-	merge(&mergeArray[0], mergeArray.size(), composite);
+	merge(mergeArray, 3, composite);
 
 	return composite;
 }
 
-// initilizeWavelengthTable
-// Private method to load the Hyperion Wavelength table
-// Pre-conditions: None
-// Post-conditions: The SpecImage wavelength table is loaded (run at creation)
-// Developer Notes:  Hyperion has an odd part of it's wavelength table where bands 
-//  71 through 91 overlap with 50 through 70. This is taken into account here. 
-//  This could be improved by importing the actual table, but this estimation is 
-//  decently accurate.
-void SpecImage::initilizeWavelengthTable()
+// getBand
+// Fetches a single spectral image by its band index (see getBandIndex).
+// Pre-Condition: index is in the range [0, getDepth())
+// Post-Condition: Returns the band image. BSQ, BIL and mapped bands are returned 
+//  without copying, BIP bands are gathered into a new Mat. Bands that could not 
+//  be loaded, and bad bands, are empty.
+Mat SpecImage::getBand(int index) const
+{
+	if (badBands[index])
+	{
+		return Mat();
+	}
+	if (cache)
+	{
+		return getCachedBand(index);
+	}
+	if (layout != BIP)
+	{
+		return specImg[index].img;
+	}
+	if (cube.empty())
+	{
+		return Mat();
+	}
+
+	int depth = getDepth();
+	Mat band(imgRows, imgCols, CV_16UC1);
+	for (int r = 0; r < imgRows; r++)
+	{
+		const ushort* src = cube.ptr<ushort>(r) + index;
+		ushort* dst = band.ptr<ushort>(r);
+		for (int c = 0; c < imgCols; c++)
+		{
+			dst[c] = src[c * depth];
+		}
+	}
+	return band;
+}
+
+// getBandRegion
+// Fetches a window of a single spectral image by its band index.
+// Pre-Condition: index is in the range [0, getDepth())
+// Post-Condition: Returns the part of the band inside window (clipped to the 
+//  image). BSQ, BIL and mapped bands return a view without copying, BIP bands
+//  gather only the window. An empty Mat is returned if the band is empty or bad.
+// NOTE: Lazily opened scenes (see OpenLazy) read only the window from the band's
+//  file unless the band is already cached, and do not add it to the cache.
+Mat SpecImage::getBandRegion(int index, Rect window) const
+{
+	window = window & Rect(0, 0, max(getCols(), 0), max(getRows(), 0));
+	if (layout == BIP && !cache)
+	{
+		if (cube.empty() || window.area() == 0 || badBands[index])
+		{
+			return Mat();
+		}
+		int depth = getDepth();
+		Mat region(window.height, window.width, CV_16UC1);
+		for (int r = 0; r < window.height; r++)
+		{
+			const ushort* src = cube.ptr<ushort>(window.y + r) + window.x * depth + index;
+			ushort* dst = region.ptr<ushort>(r);
+			for (int c = 0; c < window.width; c++)
+			{
+				dst[c] = src[c * depth];
+			}
+		}
+		return region;
+	}
+
+	if (cache && window.area() > 0 && !badBands[index])
+	{
+		return getCachedRegion(index, window);
+	}
+
+	Mat band = getBand(index);
+	if (band.empty() || window.area() == 0)
+	{
+		return Mat();
+	}
+	return band(window);
+}
+
+// getCachedBand
+// Private method to fetch a band through the lazy band cache.
+// Pre-conditions: The scene was opened with OpenLazy, index is in the range 
+//  [0, getDepth())
+// Post-conditions: Returns the band, decoding it if it is not cached, or an 
+//  empty Mat if it fails to decode or differs in size from the scene. The band
+//  becomes the most recently used one, and older bands are evicted until the 
+//  cache fits its cap again.
+Mat SpecImage::getCachedBand(int index) const
 {
-	hyperionWavelengthTable.reserve(242); // Reserve to reduce resizing
-	for (int i = 0; i < 242; i++)
 	{
-		if (i < 69)
+		lock_guard<mutex> guard(cache->lock);
+		if (cache->present[index])
+		{
+			cache->hits++;
+			cache->recent.splice(cache->recent.begin(), cache->recent, cache->position[index]);
+			return cache->bands[index];
+		}
+		cache->misses++;
+	}
+
+	// Decode without holding the lock so other bands can be served meanwhile
+	BandLoadStatus status;
+	Mat band = readBand(cache->sceneName, index + 1, status);
+	if (status.loaded && imgRows > 0 && (band.rows != imgRows || band.cols != imgCols))
+	{
+		status.loaded = false;
+		status.error = "size differs from the scene";
+		band.release();
+	}
+	if (!status.loaded)
+	{
+		cerr << "Error - Band B" << setw(3) << setfill('0') << status.band << setfill(' ')
+			<< " (\"" << status.fileName << "\"): " << status.error << endl;
+	}
+
+	lock_guard<mutex> guard(cache->lock);
+	cache->status[index] = status;
+	if (cache->present[index])
+	{
+		// Another thread decoded the same band first
+		cache->recent.splice(cache->recent.begin(), cache->recent, cache->position[index]);
+		return cache->bands[index];
+	}
+
+	// Failed bands are cached as empty images so they are not retried every call
+	cache->bands[index] = band;
+	cache->present[index] = true;
+	cache->recent.push_front(index);
+	cache->position[index] = cache->recent.begin();
+	cache->residentBytes += band.total() * band.elemSize();
+
+	// Evict least recently used bands, but always keep the one just decoded
+	while (cache->maxBytes > 0 && cache->residentBytes > cache->maxBytes && cache->recent.size() > 1)
+	{
+		int victim = cache->recent.back();
+		cache->recent.pop_back();
+		cache->residentBytes -= cache->bands[victim].total() * cache->bands[victim].elemSize();
+		cache->bands[victim] = Mat();
+		cache->present[victim] = false;
+		cache->position[victim] = cache->recent.end();
+		cache->evictions++;
+	}
+	return band;
+}
+
+// getCachedRegion
+// Private method to fetch a window of a band of a lazily opened scene.
+// Pre-conditions: The scene was opened with OpenLazy, index is in the range 
+//  [0, getDepth()), and window is not empty and inside the image.
+// Post-conditions: Returns a view of the cached band if it is cached, otherwise
+//  the window read from the band's file (see readBand), which is not cached. A
+//  band that fails to read is cached as empty, so it is reported only once.
+Mat SpecImage::getCachedRegion(int index, const Rect& window) const
+{
+	{
+		lock_guard<mutex> guard(cache->lock);
+		if (cache->present[index])
+		{
+			cache->hits++;
+			cache->recent.splice(cache->recent.begin(), cache->recent, cache->position[index]);
+			Mat band = cache->bands[index];
+			return band.empty() ? Mat() : band(window);
+		}
+		cache->misses++;
+	}
+
+	BandLoadStatus status;
+	Mat region = readBand(cache->sceneName, index + 1, status, window);
+	if (status.loaded && region.size() != window.size())
+	{
+		status.loaded = false;
+		status.error = "size differs from the scene";
+	}
+	if (status.loaded)
+	{
+		return region;
+	}
+
+	lock_guard<mutex> guard(cache->lock);
+	if (!cache->present[index])
+	{
+		cerr << "Error - Band B" << setw(3) << setfill('0') << status.band << setfill(' ')
+			<< " (\"" << status.fileName << "\"): " << status.error << endl;
+		cache->status[index] = status;
+		cache->bands[index] = Mat();
+		cache->present[index] = true;
+		cache->recent.push_front(index);
+		cache->position[index] = cache->recent.begin();
+	}
+	return Mat();
+}
+
+// packBands
+// STATIC private method to copy a group of band-sequential images into a cube.
+// Pre-conditions: cube is a BIL or BIP (see layout) CV_16UC1 cube of images 
+//  cols wide, bands holds images for consecutive band indices starting at 
+//  firstBand.
+// Post-conditions: The bands are stored in the cube. Empty or mis-sized images
+//  are stored as zeros.
+// NOTE: The cube is passed in rather than read from the members, so workers 
+//  that load bands in parallel only touch the Mat header they were given.
+void SpecImage::packBands(Mat cube, Interleave layout, int cols, int firstBand, const vector<Mat>& bands)
+{
+	if (cube.empty() || cols <= 0)
+	{
+		return;
+	}
+
+	int rows = cube.rows;
+	int depth = cube.cols / cols;
+	int count = static_cast<int>(bands.size());
+
+	// Bring every band to uint16, treating missing or mis-sized bands as zero
+	vector<Mat> src(count);
+	for (int k = 0; k < count; k++)
+	{
+		if (bands[k].rows != rows || bands[k].cols != cols)
 		{
-			hyperionWavelengthTable.push_back(static_cast<int>(355.59f + i*10.175f));
 			continue;
 		}
+		if (bands[k].type() != CV_16UC1)
+		{
+			bands[k].convertTo(src[k], CV_16U);
+		}
+		else
+		{
+			src[k] = bands[k];
+		}
+	}
+
+	vector<const ushort*> srcRow(count);
+	for (int r = 0; r < rows; r++)
+	{
+		ushort* dst = cube.ptr<ushort>(r);
+		for (int k = 0; k < count; k++)
+		{
+			srcRow[k] = src[k].empty() ? NULL : src[k].ptr<ushort>(r);
+		}
+
+		if (layout == BIL)
+		{
+			for (int k = 0; k < count; k++)
+			{
+				ushort* line = dst + (firstBand + k) * cols;
+				if (srcRow[k] == NULL)
+				{
+					memset(line, 0, cols * sizeof(ushort));
+				}
+				else
+				{
+					memcpy(line, srcRow[k], cols * sizeof(ushort));
+				}
+			}
+		}
 		else
 		{
-			hyperionWavelengthTable.push_back(static_cast<int>(851.92f + (i-70)*10.09f));
+			// Write the whole group for one pixel before moving to the next, so the
+			//  writes into the interleaved row stay close together.
+			for (int c = 0; c < cols; c++)
+			{
+				ushort* spectrum = dst + c * depth + firstBand;
+				for (int k = 0; k < count; k++)
+				{
+					spectrum[k] = srcRow[k] == NULL ? 0 : srcRow[k][c];
+				}
+			}
+		}
+	}
+}
+
+// readBand
+// Private method to read and decode a single band image, or a window of it.
+// Pre-conditions: fileName is the scene's root file name, band is a Hyperion band
+//  number starting at 1.
+// Post-conditions: Returns the decoded band, or its part inside window if the 
+//  window is not empty, or an empty Mat if it could not be loaded. status 
+//  records the file name, outcome, and the time spent reading the file from
+//  disk and decoding it.
+Mat SpecImage::readBand(const string& fileName, int band, BandLoadStatus& status, const Rect& window)
+{
+	TRACE_SCOPE_ARG("SpecImage::readBand", "band", band);
+	status.band = band;
+	status.fileName = getBandFileName(fileName, band);
+	status.loaded = false;
+	status.masked = false;
+	status.error = "";
+	status.readMs = 0;
+	status.decodeMs = 0;
+
+	Mat img;
+	if (window.area() > 0 && readBandWindow(status, window, img))
+	{
+		return img;
+	}
+
+	// Read the raw file into memory first so I/O and decoding can be timed apart
+	int64 start = getTickCount();
+	ifstream file(status.fileName, ios::binary | ios::ate);
+	if (!file.is_open())
+	{
+		status.error = "file not found";
+		return Mat();
+	}
+	streamsize size = file.tellg();
+	file.seekg(0, ios::beg);
+	vector<uchar> buffer(size > 0 ? static_cast<size_t>(size) : 0);
+	if (size <= 0 || !file.read(reinterpret_cast<char*>(&buffer[0]), size))
+	{
+		status.error = "file could not be read";
+		status.readMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+		return Mat();
+	}
+	int64 read = getTickCount();
+	status.readMs = (read - start) * 1000.0 / getTickFrequency();
+	TRACE_COUNT("bytes read", size);
+
+	{
+		TRACE_SCOPE_ARG("imdecode", "band", band);
+		img = imdecode(buffer, IMREAD_UNCHANGED);
+	}
+	status.decodeMs = (getTickCount() - read) * 1000.0 / getTickFrequency();
+	if (img.empty())
+	{
+		status.error = "file is corrupt or not a supported image";
+		return Mat();
+	}
+	TRACE_COUNT("bytes decoded", static_cast<long long>(img.total() * img.elemSize()));
+
+	// Files that could not be read a window at a time are cropped after decoding
+	if (window.area() > 0)
+	{
+		Rect clipped = window & Rect(0, 0, img.cols, img.rows);
+		if (clipped.area() <= 0)
+		{
+			status.error = "window is outside the image";
+			return Mat();
 		}
+		img = img(clipped).clone();
 	}
-}
\ No newline at end of file
+
+	status.loaded = true;
+	return img;
+}
+
+// readBandWindow
+// Private method to read a window of a band a strip or tile at a time.
+// Pre-conditions: status names the band file, and window is not empty.
+// Post-conditions: Returns true if the file could be read that way, with img 
+//  holding the window (or empty, with status.error set, if it failed). Returns
+//  false, with nothing read, if the file has to be decoded whole instead.
+bool SpecImage::readBandWindow(BandLoadStatus& status, const Rect& window, Mat& img)
+{
+	int64 start = getTickCount();
+	ifstream file(status.fileName, ios::binary);
+	TiffLayout tiff;
+	string error;
+	if (!file.is_open() || !ReadTiffLayout(file, tiff, error) || !isTiffWindowSupported(tiff))
+	{
+		return false;
+	}
+
+	Rect clipped = window & Rect(0, 0, tiff.width, tiff.height);
+	if (clipped.area() <= 0)
+	{
+		status.error = "window is outside the image";
+		return true;
+	}
+
+	vector<vector<uchar> > blocks;
+	if (!ReadTiffBlocks(file, tiff, clipped, blocks, error))
+	{
+		status.error = error;
+		status.readMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+		return true;
+	}
+	int64 read = getTickCount();
+	status.readMs = (read - start) * 1000.0 / getTickFrequency();
+	long long size = 0;
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		size += blocks[b].size();
+	}
+	TRACE_COUNT("bytes read", size);
+
+	{
+		TRACE_SCOPE_ARG("DecodeTiffWindow", "band", status.band);
+		img = DecodeTiffWindow(tiff, clipped, blocks, error);
+	}
+	status.decodeMs = (getTickCount() - read) * 1000.0 / getTickFrequency();
+	if (img.empty())
+	{
+		status.error = error;
+		return true;
+	}
+	TRACE_COUNT("bytes decoded", static_cast<long long>(img.total() * img.elemSize()));
+
+	status.loaded = true;
+	return true;
+}
+
+// restoreBadBands
+// Private method to drop the constant bands found in the previous scene.
+// Pre-conditions: sceneBadBands holds one entry per sensor band.
+// Post-conditions: The mask is sceneBadBands again, and every bad band value
+//  is 0.
+void SpecImage::restoreBadBands()
+{
+	badBands = sceneBadBands;
+	badBandValues.assign(sensor->bandCount, 0);
+	updateGoodLookup();
+}
+
+// updateGoodLookup
+// Private method to rebuild goodLookup after the bad band mask changed.
+// Pre-conditions: badBands holds one entry per sensor band.
+// Post-conditions: goodLookup holds the nearest band that is not masked for
+//  every nm of the sensor's lookup, or -1 if every band is masked.
+void SpecImage::updateGoodLookup()
+{
+	int first = sensor->lookupFirst;
+	goodLookup.assign(sensor->lookupLast - first + 1, -1);
+	for (size_t w = 0; w < goodLookup.size(); w++)
+	{
+		// Most wavelengths are nearest to a good band already
+		int band = sensor->lookup[w];
+		if (!badBands[band])
+		{
+			goodLookup[w] = static_cast<short>(band);
+			continue;
+		}
+		float best = -1;
+		for (int b = 0; b < sensor->bandCount; b++)
+		{
+			float distance = abs(sensor->centres[b] - static_cast<float>(first + w));
+			if (!badBands[b] && (best < 0 || distance <= best))
+			{
+				goodLookup[w] = static_cast<short>(b);
+				best = distance;
+			}
+		}
+	}
+}
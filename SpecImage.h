@@ -13,24 +13,101 @@ Defines a Spectral Image, which contains hundreds of separate images taken of th
 #include <opencv2/highgui/highgui.hpp>
 
 #include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <iostream>
 
+#include "CubeFile.h"
+#include "SensorDescriptor.h"
+#include "TiffWindow.h"
+#include "Workspace.h"
+
 using namespace cv;
 using namespace std;
 
 class SpecImage
 {
 	public:
+		// Interleave
+		// Describes how the spectral cube is laid out in memory.
+		//  BSQ - Band sequential. Every band is its own Mat (the original layout).
+		//  BIL - Band interleaved by line. One contiguous uint16 allocation where each
+		//        image row holds every band's copy of that row, one after the other.
+		//  BIP - Band interleaved by pixel. One contiguous uint16 allocation where each
+		//        pixel's full spectrum is stored contiguously.
+		enum Interleave { BSQ, BIL, BIP };
+
+		// BandLoadStatus
+		// Outcome of loading a single band image. Times are in milliseconds, with 
+		//  readMs covering disk I/O and decodeMs covering GeoTIFF decoding. Bad bands
+		//  (see isBadBand) are not read and have masked set.
+		struct BandLoadStatus
+		{
+			int band;
+			string fileName;
+			bool loaded;
+			bool masked;
+			string error;
+			double readMs;
+			double decodeMs;
+		};
+
+		// CacheStats
+		// Counters for the band cache used by lazily opened images. residentBytes is
+		//  the memory held by cached bands, maxBytes the configured cap (0 if unlimited).
+		struct CacheStats
+		{
+			long long hits;
+			long long misses;
+			long long evictions;
+			int residentBands;
+			size_t residentBytes;
+			size_t maxBytes;
+		};
+
+		// PyramidLevel
+		// One level of a spectral pyramid (see BuildPyramid). image is the scene with
+		//  every band averaged over blocks of factor x factor pixels. low and high hold
+		//  the lowest and highest value of each block, clamped to 255 as SpecFilter 
+		//  scores them, as one CV_8UC1 image per band the size of image. Bands that 
+		//  were bad, empty, missing or not the scene's size when the level was built
+		//  are empty in all three.
+		struct PyramidLevel
+		{
+			int factor;
+			shared_ptr<SpecImage> image;
+			vector<Mat> low;
+			vector<Mat> high;
+		};
+
 		// SpecImage
-		// Creates a new SpecImage object, loads the hyperionWavelengthTable, and loads 
-		//  spectral images based on the image's root file name. See LoadFromFile for more 
+		// Creates an empty SpecImage object for the Hyperion sensor. Use LoadFromFile
+		//  or OpenLazy to load spectral images into it.
+		// Pre-Condition: None
+		// Post-Condition: An empty SpecImage is created.
+		SpecImage();
+
+		// SpecImage
+		// Creates a new SpecImage object for the Hyperion sensor, and loads spectral 
+		//  images based on the image's root file name. See LoadFromFile for more 
 		//  information on loading spectral images.
 		// Pre-Condition: Filename refers to a folder of Hyperion hyperspectral satellite
 		//  images that have not been renamed. These images are expected to be in the 
-		//  GeoTIF format.
+		//  GeoTIF format. Interleave selects the in-memory layout of the loaded cube, 
+		//  and numThreads the number of threads decoding bands (0 uses every core).
 		// Post-Condition: Images from the specified folder are loaded into this SpecImage
 		//  object, and can be accessed by SpecImage methods.
-		SpecImage(string fileName);
+		SpecImage(string fileName, Interleave interleave = BSQ, int numThreads = 0);
+
+		// SpecImage
+		// Creates a new SpecImage object for the Hyperion sensor, and loads a window of
+		//  a scene. See LoadFromFile for more information on loading windows.
+		// Pre-Condition: As for the whole scene constructor. window is in pixels of the
+		//  full scene.
+		// Post-Condition: The part of every band inside the window is loaded.
+		SpecImage(string fileName, Rect window, Interleave interleave = BSQ, int numThreads = 0);
 
 		// LoadFromFile
 		// Creates a new Spectral Image based on the image's root file name. This is done 
@@ -45,7 +122,152 @@ class SpecImage
 		//   through "EO1H0460272013279110KF_B242_L1GST"
 		// Ex2: "EO1H0420342016268110PF_1T" loads files "EO1H0420342016268110PF_B001_L1T"
 		//   through "EO1H0420342016268110PF_B242_L1T"
-		void LoadFromFile(string fileName);
+		// NOTE: When interleave is BIL or BIP the bands are transposed into a single
+		//  contiguous uint16 cube while loading, in small groups, so the full set of 
+		//  band-sequential Mats is never resident at the same time.
+		// NOTE: Bands are decoded on numThreads worker threads (0 uses every core). Band 
+		//  order is kept, and bands that are missing or fail to decode are reported on 
+		//  cerr and recorded in getLoadStatus; they are stored as empty images. So are
+		//  bands whose size differs from the scene's, which is the size of the first 
+		//  band that loaded.
+		// NOTE: Bad bands (see isBadBand) are not read at all. Decoded bands that hold
+		//  a single value everywhere are added to the bad bands, and their image is
+		//  released.
+		void LoadFromFile(string fileName, Interleave interleave = BSQ, int numThreads = 0);
+
+		// LoadFromFile
+		// Loads a window of a scene, given in pixels of the full scene. Only the strips
+		//  or tiles of each band's GeoTIFF that intersect the window are read and 
+		//  decoded (see TiffWindow.h), so time and memory follow the size of the window.
+		// Pre-Condition: As for loading the whole scene.
+		// Post-Condition: Every band holds the part of the band inside the window, and
+		//  the image behaves as a scene of that size: getRows, getCols, getImage, the
+		//  composites and the filters all work on the window. getWindow returns where
+		//  it lies in the full scene.
+		// NOTE: The window is clipped to the scene. Band files that cannot be read a
+		//  window at a time (such as compressed with a scheme TiffWindow.h does not 
+		//  handle) are decoded whole and cropped. An empty window loads the whole scene.
+		// NOTE: A window can be uniform where the band is not (open water, or a single
+		//  pixel), so bands of a window are not checked for constant values. Call 
+		//  DetectConstantBands to mask the ones that are.
+		void LoadFromFile(string fileName, Rect window, Interleave interleave = BSQ, int numThreads = 0);
+
+		// LoadFromFile
+		// Loads the window of a scene covering an area given in map coordinates. The 
+		//  GeoTIFF tags of the first band that is not bad place the scene on the map.
+		// Pre-Condition: As for loading the whole scene, and the bands are GeoTIFFs.
+		// Post-Condition: The window of every pixel that overlaps area is loaded, as 
+		//  for a window given in pixels. If the bands are not georeferenced or the area
+		//  misses the scene, an error is printed and nothing is loaded.
+		void LoadFromFile(string fileName, const GeoRect& area, Interleave interleave = BSQ, int numThreads = 0);
+
+		// OpenLazy
+		// Opens a Hyperion scene without decoding its bands. Each band is decoded the
+		//  first time getImage asks for it and kept in a least-recently-used cache 
+		//  that holds at most maxCacheBytes of band data (0 for no limit).
+		// Pre-Condition: Filename refers to a folder of Hyperion hyperspectral satellite 
+		//  images, named as described in LoadFromFile.
+		// Post-Condition: The scene is opened in band sequential layout. Only one band 
+		//  is decoded, to learn the scene size. Copies of this SpecImage share the cache.
+		// NOTE: Mats returned by getImage stay valid after their band is evicted, so 
+		//  memory held by callers is not counted against the cap.
+		void OpenLazy(string fileName, size_t maxCacheBytes);
+
+		// isLazy
+		// Returns whether bands are decoded on demand (see OpenLazy).
+		// Pre-Condition: None
+		// Post-Condition: Returns true if the scene was opened with OpenLazy.
+		bool isLazy() const;
+
+		// getCacheStats
+		// Returns the hit, miss and eviction counters of the lazy band cache.
+		// Pre-Condition: None
+		// Post-Condition: Returns the current counters. All counters are zero if the 
+		//  scene was not opened with OpenLazy.
+		CacheStats getCacheStats() const;
+
+		// OpenMapped
+		// Opens a native cube file (see CubeFile.h) by memory-mapping it. No image 
+		//  data is read up front; getImage returns Mats that point directly into the
+		//  mapping, and the operating system loads pages as they are touched.
+		// Pre-Condition: cubeFile was written by SaveCube or ConvertToCube.
+		// Post-Condition: Returns true if the cube was opened, in the interleave it 
+		//  was saved with. On failure an error is printed and false is returned.
+		// NOTE: Mats returned by getImage point into the mapping, which is released 
+		//  when the last copy of this SpecImage is destroyed or loads another scene.
+		bool OpenMapped(string cubeFile);
+
+		// isMapped
+		// Returns whether the image data lives in a memory-mapped cube file.
+		// Pre-Condition: None
+		// Post-Condition: Returns true if the scene was opened with OpenMapped.
+		bool isMapped() const;
+
+		// SaveCube
+		// Writes the loaded scene to a native cube file (see CubeFile.h), in the 
+		//  current interleave.
+		// Pre-Condition: A scene is loaded.
+		// Post-Condition: Returns true if the file was written. Bands that could not
+		//  be loaded are stored as zeros.
+		bool SaveCube(string cubeFile) const;
+
+		// ConvertToCube
+		// STATIC method to convert a Hyperion scene folder into a native cube file, 
+		//  so later runs can open it with OpenMapped instead of decoding GeoTIFFs.
+		// Pre-Condition: Filename refers to a folder of Hyperion hyperspectral satellite
+		//  images, named as described in LoadFromFile (both _L1T and _L1GST naming).
+		// Post-Condition: Returns true if cubeFile was written with the given interleave.
+		//  Bands that could not be read, and the sensor's bad bands, are stored as zeros.
+		// NOTE: The scene is streamed into the file rather than loaded, so memory follows
+		//  a few bands instead of the scene. Band sequential cubes are written numThreads
+		//  bands at a time (0 uses every core), BIL and BIP cubes a group of rows of 
+		//  every band at a time, read as windows of the bands (see readBand). Band files
+		//  that cannot be read a window at a time are decoded once per group of rows.
+		static bool ConvertToCube(string fileName, string cubeFile, Interleave interleave = BSQ, int numThreads = 0);
+
+		// getBandFileName
+		// Generates the file name of a single band image of a Hyperion scene.
+		// Pre-Condition: fileName is the scene's root file name, as given to LoadFromFile.
+		//  band is a Hyperion band number, starting at 1.
+		// Post-Condition: Returns the path of the band's GeoTIFF file.
+		// Ex: ("EO1H0420342016268110PF_1T", 7) returns 
+		//  "EO1H0420342016268110PF_1T/EO1H0420342016268110PF_B007_L1T.TIF"
+		static string getBandFileName(string fileName, int band);
+
+		// getLoadStatus
+		// Returns the outcome and timing of loading each band in the last LoadFromFile.
+		// Pre-Condition: None
+		// Post-Condition: Returns one entry per band in band order. For lazily opened 
+		//  scenes only bands decoded so far have been filled in (band is 0 for others).
+		vector<BandLoadStatus> getLoadStatus() const;
+
+		// getInterleave
+		// Returns the in-memory layout of the spectral cube.
+		// Pre-Condition: None
+		// Post-Condition: Returns BSQ, BIL or BIP.
+		Interleave getInterleave() const;
+
+		// setInterleave
+		// Rearranges the loaded spectral cube into the given in-memory layout.
+		// Pre-Condition: None
+		// Post-Condition: The cube is stored using the requested layout. Image data is
+		//  unchanged, and getImage returns the same bands as before.
+		void setInterleave(Interleave interleave);
+
+		// getSpectrum
+		// Fetches the full spectrum of a single pixel in a BIP cube.
+		// Pre-Condition: The cube is stored as BIP, and row/col are inside the image.
+		// Post-Condition: Returns a pointer to getDepth() contiguous uint16 values, one 
+		//  per band in band order. Returns NULL if the cube is not stored as BIP.
+		const ushort* getSpectrum(int row, int col) const;
+
+		// getLine
+		// Fetches every band of a single image row in a BIL cube.
+		// Pre-Condition: The cube is stored as BIL, and row is inside the image.
+		// Post-Condition: Returns a pointer to getDepth() * getCols() contiguous uint16
+		//  values, where band b of the row starts at offset b * getCols(). Returns NULL
+		//  if the cube is not stored as BIL.
+		const ushort* getLine(int row) const;
 
 		// getImage
 		// Fetches a single spectral image, which is specified by its wavelength.
@@ -56,6 +278,104 @@ class SpecImage
 		//  image is out of range, an empty Mat is returned.
 		Mat getImage(int wavelength) const;
 
+		// getBandIndex
+		// Finds the index of the band nearest to a wavelength, as used by getImage.
+		// Pre-Condition: None
+		// Post-Condition: Returns the band index in the range [0, getDepth()), or -1 if
+		//  the wavelength is out of range. Bad bands are never returned; the nearest 
+		//  band that is not masked is used instead.
+		// NOTE: This is a single read of a lookup table (see SensorDescriptor.h) that
+		//  is rebuilt whenever the bad band mask changes.
+		int getBandIndex(int wavelength) const;
+
+		// getSensor
+		// Returns the descriptor of the sensor that recorded the image.
+		// Pre-Condition: None
+		// Post-Condition: Returns the sensor's band tables. Images are Hyperion scenes.
+		const SensorDescriptor& getSensor() const;
+
+		// isBadBand
+		// Returns whether a band is masked out as bad. Bad bands are not loaded, and 
+		//  are skipped by getImage, the composites, filters and spectral indices.
+		// Pre-Condition: index is in the range [0, getDepth())
+		// Post-Condition: Returns true if the band is masked out.
+		bool isBadBand(int index) const;
+
+		// isBandMissing
+		// Returns whether a band's file could not be read or decoded (see 
+		//  getLoadStatus). Missing bands are empty, but read as zeros through 
+		//  getSpectrum, so consumers of BIP cubes must skip them explicitly.
+		// Pre-Condition: index is in the range [0, getDepth())
+		// Post-Condition: Returns true if loading the band failed. Bands of lazily 
+		//  opened scenes only count once they have been tried.
+		bool isBandMissing(int index) const;
+
+		// getBadBands
+		// Returns the indices of every band that is masked out, in band order.
+		// Pre-Condition: None
+		// Post-Condition: Returns the bad bands. A new SpecImage starts with the 
+		//  sensor's default bad bands (see SensorDescriptor.h).
+		// NOTE: Constant bands found in a scene stay masked until another scene is 
+		//  loaded or opened, which starts again from the mask set by setBadBands or
+		//  resetBadBands.
+		vector<int> getBadBands() const;
+
+		// getBadBandValue
+		// Returns the value every pixel of a bad band is taken to hold.
+		// Pre-Condition: index is in the range [0, getDepth())
+		// Post-Condition: Returns the value found by constant band detection, or 0 
+		//  (the value of uncalibrated bands) for bands masked any other way.
+		ushort getBadBandValue(int index) const;
+
+		// setBadBands
+		// Replaces the bad band mask.
+		// Pre-Condition: Every index is in the range [0, getDepth())
+		// Post-Condition: Exactly the given bands are masked out. Set the mask before 
+		//  LoadFromFile or OpenLazy to avoid reading the masked bands.
+		void setBadBands(const vector<int>& bands);
+
+		// resetBadBands
+		// Restores the sensor's default bad bands.
+		// Pre-Condition: None
+		// Post-Condition: The mask holds the sensor's default bad bands only.
+		void resetBadBands();
+
+		// DetectConstantBands
+		// Adds every band that holds a single value everywhere to the bad bands, from 
+		//  each band's minimum and maximum. Bands are checked on numThreads threads 
+		//  (0 uses every core).
+		// Pre-Condition: None
+		// Post-Condition: Returns the number of bands that were added to the mask.
+		// NOTE: LoadFromFile does this while decoding whole scenes, but not windows.
+		//  Lazily opened scenes decode every band that is not yet masked.
+		int DetectConstantBands(int numThreads = 0);
+
+		// getBand
+		// Fetches a single spectral image by its band index (see getBandIndex).
+		// Pre-Condition: index is in the range [0, getDepth())
+		// Post-Condition: Returns the band image. BSQ, BIL and mapped bands are returned 
+		//  without copying, BIP bands are gathered into a new Mat. Bands that could not 
+		//  be loaded, and bad bands, are empty.
+		Mat getBand(int index) const;
+
+		// getBandRegion
+		// Fetches a window of a single spectral image by its band index.
+		// Pre-Condition: index is in the range [0, getDepth())
+		// Post-Condition: Returns the part of the band inside window (clipped to the 
+		//  image). BSQ, BIL and mapped bands return a view without copying, BIP bands
+		//  gather only the window. An empty Mat is returned if the band is empty or bad.
+		// NOTE: Lazily opened scenes (see OpenLazy) read only the window from the band's
+		//  file unless the band is already cached, and do not add it to the cache.
+		Mat getBandRegion(int index, Rect window) const;
+
+		// getWavelengths
+		// Returns the wavelength table of the loaded bands.
+		// Pre-Condition: None
+		// Post-Condition: Returns the wavelength (in nanometers) of every band, in band order.
+		//  An image that has not been loaded returns the sensor's full table, so filters
+		//  can be compiled (see SpecFilter::Compile) before any scene is opened.
+		vector<int> getWavelengths() const;
+
 		// getRows
 		// Returns the height of the hyperspectral image (height of a single image).
 		// Pre-Condition: None
@@ -68,6 +388,36 @@ class SpecImage
 		// Post-Condition: Returns an integer representing the width of the SpecImage.
 		int getCols() const;
 
+		// getWindow
+		// Returns where the loaded image lies in the full scene, in pixels.
+		// Pre-Condition: None
+		// Post-Condition: Returns the window given to LoadFromFile, clipped to the
+		//  scene, or the whole image if a whole scene was loaded or opened.
+		Rect getWindow() const;
+
+		// BuildPyramid
+		// Builds a spectral pyramid of the loaded scene: level k (1 to levels) averages
+		//  every band over blocks of 2^k x 2^k pixels, so the default levels are 2x, 4x
+		//  and 8x smaller in each direction. Bands are reduced on numThreads threads 
+		//  (0 uses every core).
+		// Pre-Condition: The image has been loaded. levels is at least 1.
+		// Post-Condition: The pyramid is cached until another scene is loaded or 
+		//  opened, and is shared by copies of this SpecImage made after it was built.
+		// NOTE: Each level is a SpecImage of its own, with the same bad bands, so it can
+		//  be filtered or saved (see SaveCube) like any scene, for example as a preview.
+		//  Edge blocks that are cut off by the scene average the pixels they hold.
+		void BuildPyramid(int levels = 3, int numThreads = 0);
+
+		// getPyramidLevels
+		// Returns the number of levels of the cached pyramid, or 0 if none was built.
+		int getPyramidLevels() const;
+
+		// getPyramidLevel
+		// Fetches a level of the cached pyramid.
+		// Pre-Condition: level is in the range [1, getPyramidLevels()]
+		// Post-Condition: Returns the level, whose factor is 2^level.
+		const PyramidLevel& getPyramidLevel(int level) const;
+
 		// getDepth
 		// Returns the number of wavelengths present in the hyperspectral image.
 		// Pre-Condition: None
@@ -98,7 +448,11 @@ class SpecImage
 		// Post-Condition: Returns an 8UC3 image created as a result of using three 
 		//  grayscale images acquired from the provided wavelengths. The variables (eg 
 		//  redWaveLength) coorespond to the color channel they will fill (eg R). 
-		Mat getComposite(int redWavelength, int blueWavelength, int greenWavelength);
+		// NOTE: Given a workspace (see Workspace.h), the converted channels and the 
+		//  composite are kept in it and reused by later calls. The returned image then
+		//  shares the workspace's memory and is overwritten by the next composite made
+		//  with the same workspace; clone it to keep it.
+		Mat getComposite(int redWavelength, int blueWavelength, int greenWavelength, Workspace* workspace = NULL);
 
 		// makeComposite
 		// STATIC method to make a composite image given three grayscale images where
@@ -111,7 +465,8 @@ class SpecImage
 		//  channel they will fill (eg R).
 		// NOTE: The returned pointer is created in this function and must be deleted by 
 		//  the calling function.
-		Mat makeComposite(Mat redImage, Mat blueImage, Mat greenImage);
+		// NOTE: Given a workspace, memory is reused as for getComposite.
+		Mat makeComposite(Mat redImage, Mat blueImage, Mat greenImage, Workspace* workspace = NULL);
 	private:
 		struct imgData
 		{
@@ -120,15 +475,113 @@ class SpecImage
 		};
 
 		vector<imgData> specImg;
-		static vector<int> hyperionWavelengthTable;
-
-		// initilizeWavelengthTable
-		// Private method to load the Hyperion Wavelength table
-		// Pre-conditions: None
-		// Post-conditions: The SpecImage wavelength table is loaded (run at creation)
-		// Developer Notes:  Hyperion has an odd part of it's wavelength table where bands 
-		//  71 through 91 overlap with 50 through 70. This is taken into account here. 
-		//  This could be improved by importing the actual table, but this estimation is 
-		//  decently accurate.
-		static void initilizeWavelengthTable();
+		const SensorDescriptor* sensor;
+
+		// Bad band mask, one entry per sensor band, and the nearest band that is not 
+		//  masked for every nm of the sensor's lookup. sceneBadBands is the mask 
+		//  set by resetBadBands or setBadBands, which every scene starts from before
+		//  its constant bands are added.
+		vector<char> badBands;
+		vector<char> sceneBadBands;
+		vector<ushort> badBandValues;
+		vector<short> goodLookup;
+
+		// Contiguous CV_16UC1 storage used by the BIL and BIP layouts. Both have rows
+		//  rows of cols * depth values; a BIL row holds each band's row in turn, a BIP
+		//  row holds each pixel's spectrum in turn. Empty for BSQ.
+		Interleave layout;
+		Mat cube;
+		int imgRows;
+		int imgCols;
+		Point origin; // Top left corner of the loaded window in the full scene
+
+		vector<BandLoadStatus> loadStatus;
+
+		// BandCache
+		// Least-recently-used cache of decoded bands, used by lazily opened images. It 
+		//  is shared between copies of a SpecImage and guarded by its own lock.
+		struct BandCache
+		{
+			string sceneName;
+			size_t maxBytes;
+			size_t residentBytes;
+			long long hits;
+			long long misses;
+			long long evictions;
+			vector<Mat> bands;
+			vector<bool> present;
+			vector<BandLoadStatus> status;
+			list<int> recent; // Most recently used band first
+			vector<list<int>::iterator> position;
+			mutex lock;
+		};
+		shared_ptr<BandCache> cache;
+
+		// Memory mapping backing the image data of scenes opened with OpenMapped
+		shared_ptr<MappedFile> mapping;
+
+		// Pyramid built by BuildPyramid, level k at index k - 1
+		shared_ptr<const vector<PyramidLevel> > pyramid;
+
+		// getCachedBand
+		// Private method to fetch a band through the lazy band cache.
+		// Pre-conditions: The scene was opened with OpenLazy, index is in the range 
+		//  [0, getDepth())
+		// Post-conditions: Returns the band, decoding it if it is not cached, or an 
+		//  empty Mat if it fails to decode or differs in size from the scene. The band
+		//  becomes the most recently used one, and older bands are evicted until the 
+		//  cache fits its cap again.
+		Mat getCachedBand(int index) const;
+
+		// getCachedRegion
+		// Private method to fetch a window of a band of a lazily opened scene.
+		// Pre-conditions: The scene was opened with OpenLazy, index is in the range 
+		//  [0, getDepth()), and window is not empty and inside the image.
+		// Post-conditions: Returns a view of the cached band if it is cached, otherwise
+		//  the window read from the band's file (see readBand), which is not cached. A
+		//  band that fails to read is cached as empty, so it is reported only once.
+		Mat getCachedRegion(int index, const Rect& window) const;
+
+		// readBand
+		// Private method to read and decode a single band image, or a window of it.
+		// Pre-conditions: fileName is the scene's root file name, band is a Hyperion band
+		//  number starting at 1.
+		// Post-conditions: Returns the decoded band, or its part inside window if the 
+		//  window is not empty, or an empty Mat if it could not be loaded. status 
+		//  records the file name, outcome, and the time spent reading the file from
+		//  disk and decoding it.
+		static Mat readBand(const string& fileName, int band, BandLoadStatus& status, const Rect& window = Rect());
+
+		// readBandWindow
+		// Private method to read a window of a band a strip or tile at a time.
+		// Pre-conditions: status names the band file, and window is not empty.
+		// Post-conditions: Returns true if the file could be read that way, with img 
+		//  holding the window (or empty, with status.error set, if it failed). Returns
+		//  false, with nothing read, if the file has to be decoded whole instead.
+		static bool readBandWindow(BandLoadStatus& status, const Rect& window, Mat& img);
+
+		// packBands
+		// STATIC private method to copy a group of band-sequential images into a cube.
+		// Pre-conditions: cube is a BIL or BIP (see layout) CV_16UC1 cube of images 
+		//  cols wide, bands holds images for consecutive band indices starting at 
+		//  firstBand.
+		// Post-conditions: The bands are stored in the cube. Empty or mis-sized images
+		//  are stored as zeros.
+		// NOTE: The cube is passed in rather than read from the members, so workers 
+		//  that load bands in parallel only touch the Mat header they were given.
+		static void packBands(Mat cube, Interleave layout, int cols, int firstBand, const vector<Mat>& bands);
+
+		// restoreBadBands
+		// Private method to drop the constant bands found in the previous scene.
+		// Pre-conditions: sceneBadBands holds one entry per sensor band.
+		// Post-conditions: The mask is sceneBadBands again, and every bad band value
+		//  is 0.
+		void restoreBadBands();
+
+		// updateGoodLookup
+		// Private method to rebuild goodLookup after the bad band mask changed.
+		// Pre-conditions: badBands holds one entry per sensor band.
+		// Post-conditions: goodLookup holds the nearest band that is not masked for
+		//  every nm of the sensor's lookup, or -1 if every band is masked.
+		void updateGoodLookup();
 };
\ No newline at end of file
@@ -0,0 +1,479 @@
+#include "SpectralIndex.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+
+//  Rows computed by one task
+static const int INDEX_BLOCK_ROWS = 16;
+
+//  IndexBank
+//  Creates an empty index bank.
+IndexBank::IndexBank()
+{
+	//  Nothing to construct
+}
+
+//  AddIndex
+//  Parses an index expression and adds it to the bank.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the expression was parsed and added under
+//  the given name. Otherwise an error is printed and false is returned.
+bool IndexBank::AddIndex(const string& name, const string& expression)
+{
+	Index index;
+	index.name = name;
+	index.expression = expression;
+	string error;
+	if (!parse(expression, index.program, error))
+	{
+		cerr << "Error - Index \"" << name << "\": " << error << "." << endl;
+		return false;
+	}
+
+	//  Every push grows the stack by one row, every operator but negation shrinks it
+	int depth = 0;
+	index.stackDepth = 0;
+	for (size_t i = 0; i < index.program.size(); ++i)
+	{
+		OpCode code = index.program[i].code;
+		depth += (code == PUSH_WAVELENGTH || code == PUSH_CONSTANT) ? 1 : (code == NEGATE ? 0 : -1);
+		index.stackDepth = max(index.stackDepth, depth);
+	}
+	indices.push_back(index);
+	return true;
+}
+
+//  AddStandardIndex
+//  Adds one of the indices listed by getStandardIndices under its own name.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the index is known and was added, false
+//  (after printing an error) otherwise.
+bool IndexBank::AddStandardIndex(const string& name)
+{
+	vector<pair<string, string> > standard = getStandardIndices();
+	for (size_t i = 0; i < standard.size(); ++i)
+	{
+		if (standard[i].first == name)
+		{
+			return AddIndex(standard[i].first, standard[i].second);
+		}
+	}
+	cerr << "Error - Unknown index \"" << name << "\"." << endl;
+	return false;
+}
+
+//  getStandardIndices
+//  STATIC method that lists the built in indices, as name and expression pairs.
+//  Wavelengths are picked from the Hyperion band centres.
+vector<pair<string, string> > IndexBank::getStandardIndices()
+{
+	vector<pair<string, string> > standard;
+	standard.push_back(make_pair("NDVI", "(R864 - R650) / (R864 + R650)"));       //  Vegetation
+	standard.push_back(make_pair("SR", "R864 / R650"));                           //  Simple ratio
+	standard.push_back(make_pair("NDWI", "(R559 - R864) / (R559 + R864)"));       //  Open water
+	standard.push_back(make_pair("NDMI", "(R864 - R1649) / (R864 + R1649)"));     //  Leaf moisture
+	standard.push_back(make_pair("NBR", "(R864 - R2203) / (R864 + R2203)"));      //  Burn ratio
+	standard.push_back(make_pair("NDBI", "(R1649 - R864) / (R1649 + R864)"));     //  Built up areas
+	standard.push_back(make_pair("NDRE", "(R793 - R721) / (R793 + R721)"));       //  Red edge
+	standard.push_back(make_pair("CIRE", "R793 / R721 - 1"));                     //  Red edge chlorophyll
+	standard.push_back(make_pair("PRI", "(R528 - R569) / (R528 + R569)"));        //  Photochemical reflectance
+	standard.push_back(make_pair("MCARI", "((R701 - R671) - 0.2 * (R701 - R548)) * (R701 / R671)"));
+	standard.push_back(make_pair("CAI", "0.5 * (R2002 + R2203) - R2103"));        //  Cellulose absorption
+	standard.push_back(make_pair("SWIR", "R1649 / R2203"));                       //  SWIR ratio
+	return standard;
+}
+
+//  getCount
+//  Returns the number of indices in the bank.
+int IndexBank::getCount() const
+{
+	return static_cast<int>(indices.size());
+}
+
+//  getName
+//  Returns the name of the index at the given index.
+//  Pre-Conditions: index is in the range [0, getCount())
+string IndexBank::getName(int index) const
+{
+	return indices[index].name;
+}
+
+//  getExpression
+//  Returns the expression of the index at the given index, as it was added.
+//  Pre-Conditions: index is in the range [0, getCount())
+string IndexBank::getExpression(int index) const
+{
+	return indices[index].expression;
+}
+
+//  compute
+//  Computes every index of the bank over a hyperspectral image in one pass.
+//  Rows are shared between numThreads threads (0 uses every core).
+//  Pre-Conditions: The image has been loaded.
+//  Post-Conditions: Returns one CV_32FC1 image per index, in bank order. A
+//  division by zero gives 0. An index with a wavelength outside the image, or
+//  that uses a band that could not be loaded, is returned empty (after
+//  printing an error). The result does not depend on the thread count.
+vector<Mat> IndexBank::compute(const SpecImage& hyperImage, int numThreads) const
+{
+	int rows = hyperImage.getRows();
+	int cols = hyperImage.getCols();
+	int depth = hyperImage.getDepth();
+	int count = getCount();
+	vector<Mat> results(count);
+	if (count == 0 || rows <= 0 || cols <= 0)
+	{
+		return results;
+	}
+	TRACE_SCOPE("IndexBank::compute");
+
+	//  Resolve every wavelength to a band. A band used by several indices, or
+	//  several times by one index, gets a single slot and is read once per row.
+	vector<int> slot(depth, -1);
+	vector<int> bands;
+	vector<vector<int> > operands(count);
+	vector<bool> valid(count, true);
+	for (int i = 0; i < count; ++i)
+	{
+		const vector<Op>& program = indices[i].program;
+		for (size_t k = 0; k < program.size() && valid[i]; ++k)
+		{
+			if (program[k].code != PUSH_WAVELENGTH)
+			{
+				continue;
+			}
+			int band = hyperImage.getBandIndex(static_cast<int>(program[k].value));
+			if (band < 0 || band >= depth)
+			{
+				cerr << "Error - Index \"" << indices[i].name << "\": wavelength "
+					<< program[k].value << "nm is outside the image." << endl;
+				valid[i] = false;
+			}
+		}
+		for (size_t k = 0; k < program.size() && valid[i]; ++k)
+		{
+			int operand = -1;
+			if (program[k].code == PUSH_WAVELENGTH)
+			{
+				int band = hyperImage.getBandIndex(static_cast<int>(program[k].value));
+				if (slot[band] < 0)
+				{
+					slot[band] = static_cast<int>(bands.size());
+					bands.push_back(band);
+				}
+				operand = slot[band];
+			}
+			operands[i].push_back(operand);
+		}
+	}
+
+	//  Band interleaved by pixel cubes are gathered from each pixel's spectrum,
+	//  every other layout is read one band row at a time
+	bool interleaved = hyperImage.getInterleave() == SpecImage::BIP;
+	vector<Mat> images(bands.size());
+	vector<bool> missing(bands.size(), false);
+	for (size_t b = 0; b < bands.size() && interleaved; ++b)
+	{
+		missing[b] = hyperImage.isBandMissing(bands[b]);
+	}
+	for (size_t b = 0; b < bands.size() && !interleaved; ++b)
+	{
+		//  A band of another size than the scene counts as missing
+		images[b] = hyperImage.getBand(bands[b]);
+		missing[b] = images[b].rows != rows || images[b].cols != cols;
+		if (!missing[b] && images[b].type() != CV_16UC1)
+		{
+			TRACE_SCOPE("convertTo");
+			images[b].convertTo(images[b], CV_16U);
+			TRACE_COUNT("pixels converted", static_cast<long long>(images[b].total()));
+		}
+	}
+
+	int stackDepth = 1;
+	int computed = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		for (size_t k = 0; k < operands[i].size() && valid[i]; ++k)
+		{
+			if (operands[i][k] >= 0 && missing[operands[i][k]])
+			{
+				cerr << "Error - Index \"" << indices[i].name << "\": band "
+					<< bands[operands[i][k]] + 1 << " could not be loaded." << endl;
+				valid[i] = false;
+			}
+		}
+		if (valid[i])
+		{
+			results[i] = Mat(rows, cols, CV_32FC1);
+			stackDepth = max(stackDepth, indices[i].stackDepth);
+			computed++;
+		}
+	}
+	if (computed == 0)
+	{
+		return results;
+	}
+	TRACE_COUNT("index pixels computed", static_cast<long long>(rows) * cols * computed);
+
+	int blockCount = (rows + INDEX_BLOCK_ROWS - 1) / INDEX_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		//  One float row per band, and the evaluation stack. Stack entries point
+		//  either at a band row or at their own scratch row.
+		vector<float> bandRows(bands.size() * static_cast<size_t>(cols));
+		vector<float> scratch(static_cast<size_t>(stackDepth) * cols);
+		vector<const float*> stack(stackDepth);
+
+		int last = min(rows, (block + 1) * INDEX_BLOCK_ROWS);
+		for (int r = block * INDEX_BLOCK_ROWS; r < last; ++r)
+		{
+			//  Read every band row once
+			if (interleaved)
+			{
+				const ushort* spectra = hyperImage.getSpectrum(r, 0);
+				for (int c = 0; c < cols; ++c)
+				{
+					const ushort* spectrum = spectra + static_cast<size_t>(c) * depth;
+					for (size_t b = 0; b < bands.size(); ++b)
+					{
+						bandRows[b * cols + c] = spectrum[bands[b]];
+					}
+				}
+			}
+			else
+			{
+				for (size_t b = 0; b < bands.size(); ++b)
+				{
+					if (missing[b])
+					{
+						continue;
+					}
+					const ushort* src = images[b].ptr<ushort>(r);
+					float* dst = &bandRows[b * cols];
+					for (int c = 0; c < cols; ++c)
+					{
+						dst[c] = src[c];
+					}
+				}
+			}
+
+			//  Evaluate every index over the row
+			for (int i = 0; i < count; ++i)
+			{
+				if (!valid[i])
+				{
+					continue;
+				}
+				const vector<Op>& program = indices[i].program;
+				int top = 0;
+				for (size_t k = 0; k < program.size(); ++k)
+				{
+					const Op& op = program[k];
+					if (op.code == PUSH_WAVELENGTH)
+					{
+						stack[top++] = &bandRows[static_cast<size_t>(operands[i][k]) * cols];
+						continue;
+					}
+					if (op.code == PUSH_CONSTANT)
+					{
+						float* dst = &scratch[static_cast<size_t>(top) * cols];
+						fill(dst, dst + cols, op.value);
+						stack[top++] = dst;
+						continue;
+					}
+					if (op.code == NEGATE)
+					{
+						const float* a = stack[top - 1];
+						float* dst = &scratch[static_cast<size_t>(top - 1) * cols];
+						for (int c = 0; c < cols; ++c)
+						{
+							dst[c] = -a[c];
+						}
+						stack[top - 1] = dst;
+						continue;
+					}
+
+					//  Binary operators replace the top two rows with their result
+					const float* a = stack[top - 2];
+					const float* b = stack[top - 1];
+					float* dst = &scratch[static_cast<size_t>(top - 2) * cols];
+					switch (op.code)
+					{
+						case ADD:
+							for (int c = 0; c < cols; ++c) dst[c] = a[c] + b[c];
+							break;
+						case SUBTRACT:
+							for (int c = 0; c < cols; ++c) dst[c] = a[c] - b[c];
+							break;
+						case MULTIPLY:
+							for (int c = 0; c < cols; ++c) dst[c] = a[c] * b[c];
+							break;
+						default:
+							for (int c = 0; c < cols; ++c) dst[c] = b[c] != 0.0f ? a[c] / b[c] : 0.0f;
+							break;
+					}
+					stack[--top - 1] = dst;
+				}
+				copy(stack[0], stack[0] + cols, results[i].ptr<float>(r));
+			}
+		}
+	});
+	return results;
+}
+
+//  parse
+//  Private method that compiles an expression into a postfix program.
+//  Pre-conditions: None
+//  Post-conditions: Returns true and fills program, or returns false and sets
+//  error to what is wrong with the expression.
+//  NOTE: The grammar, parsed by recursive descent, is
+//  	sum     = product (("+" | "-") product)*
+//  	product = unary (("*" | "/") unary)*
+//  	unary   = "-" unary | primary
+//  	primary = number | "R" number | "(" sum ")"
+bool IndexBank::parse(const string& expression, vector<Op>& program, string& error)
+{
+	size_t pos = 0;
+	program.clear();
+	error.clear();
+
+	//  Skips spaces and returns the next character, or 0 at the end
+	auto peek = [&]() -> char
+	{
+		while (pos < expression.size() && isspace(static_cast<unsigned char>(expression[pos])))
+		{
+			pos++;
+		}
+		return pos < expression.size() ? expression[pos] : 0;
+	};
+	auto fail = [&](const string& message) -> bool
+	{
+		if (error.empty())
+		{
+			error = message + " at position " + to_string(pos + 1);
+		}
+		return false;
+	};
+	auto emit = [&](OpCode code, float value)
+	{
+		Op op;
+		op.code = code;
+		op.value = value;
+		program.push_back(op);
+	};
+
+	function<bool()> sum;
+	auto number = [&](float& value) -> bool
+	{
+		const char* start = expression.c_str() + pos;
+		char* end = NULL;
+		value = static_cast<float>(strtod(start, &end));
+		if (end == start)
+		{
+			return fail("Expected a number");
+		}
+		pos += end - start;
+		return true;
+	};
+	auto primary = [&]() -> bool
+	{
+		char next = peek();
+		float value;
+		if (next == '(')
+		{
+			pos++;
+			if (!sum())
+			{
+				return false;
+			}
+			if (peek() != ')')
+			{
+				return fail("Expected \")\"");
+			}
+			pos++;
+			return true;
+		}
+		if (next == 'R' || next == 'r')
+		{
+			pos++;
+			if (!isdigit(static_cast<unsigned char>(peek())) || !number(value))
+			{
+				return fail("Expected a wavelength after \"R\"");
+			}
+			emit(PUSH_WAVELENGTH, value);
+			return true;
+		}
+		if (isdigit(static_cast<unsigned char>(next)) || next == '.')
+		{
+			if (!number(value))
+			{
+				return false;
+			}
+			emit(PUSH_CONSTANT, value);
+			return true;
+		}
+		return fail(next == 0 ? "Unexpected end of expression" : string("Unexpected \"") + next + "\"");
+	};
+	function<bool()> unary = [&]() -> bool
+	{
+		if (peek() == '-')
+		{
+			pos++;
+			if (!unary())
+			{
+				return false;
+			}
+			emit(NEGATE, 0);
+			return true;
+		}
+		return primary();
+	};
+	auto product = [&]() -> bool
+	{
+		if (!unary())
+		{
+			return false;
+		}
+		for (char next = peek(); next == '*' || next == '/'; next = peek())
+		{
+			pos++;
+			if (!unary())
+			{
+				return false;
+			}
+			emit(next == '*' ? MULTIPLY : DIVIDE, 0);
+		}
+		return true;
+	};
+	sum = [&]() -> bool
+	{
+		if (!product())
+		{
+			return false;
+		}
+		for (char next = peek(); next == '+' || next == '-'; next = peek())
+		{
+			pos++;
+			if (!product())
+			{
+				return false;
+			}
+			emit(next == '+' ? ADD : SUBTRACT, 0);
+		}
+		return true;
+	};
+
+	if (!sum())
+	{
+		return false;
+	}
+	if (peek() != 0)
+	{
+		return fail(string("Unexpected \"") + expression[pos] + "\"");
+	}
+	return true;
+}
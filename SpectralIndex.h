@@ -0,0 +1,103 @@
+/*
+IndexBank computes spectral indices (NDVI, NDWI, NBR and the like) of a
+hyperspectral image. Each index is an arithmetic expression over wavelengths,
+written as R followed by the wavelength in nanometers:
+
+	NDVI = (R860 - R650) / (R860 + R650)
+
+Expressions use numbers, wavelengths, + - * /, unary minus and parentheses. The
+wavelengths are resolved to the nearest band of the image (see
+SpecImage::getBandIndex). Every index of the bank is computed in one pass over
+the image: each band row that any index uses is read once and converted to float,
+then every index is evaluated over the whole row before moving on.
+
+Band values are the raw 16-bit values of the image, so indices that are ratios of
+bands are unaffected by the scale of the data.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+#include "SpecImage.h"
+
+using namespace cv;
+using namespace std;
+
+class IndexBank
+{
+	public:
+		//  IndexBank
+		//  Creates an empty index bank.
+		IndexBank();
+
+		//  AddIndex
+		//  Parses an index expression and adds it to the bank.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the expression was parsed and added under
+		//  the given name. Otherwise an error is printed and false is returned.
+		bool AddIndex(const string& name, const string& expression);
+
+		//  AddStandardIndex
+		//  Adds one of the indices listed by getStandardIndices under its own name.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the index is known and was added, false
+		//  (after printing an error) otherwise.
+		bool AddStandardIndex(const string& name);
+
+		//  getStandardIndices
+		//  STATIC method that lists the built in indices, as name and expression pairs.
+		//  Wavelengths are picked from the Hyperion band centres.
+		static vector<pair<string, string> > getStandardIndices();
+
+		//  getCount
+		//  Returns the number of indices in the bank.
+		int getCount() const;
+
+		//  getName
+		//  Returns the name of the index at the given index.
+		//  Pre-Conditions: index is in the range [0, getCount())
+		string getName(int index) const;
+
+		//  getExpression
+		//  Returns the expression of the index at the given index, as it was added.
+		//  Pre-Conditions: index is in the range [0, getCount())
+		string getExpression(int index) const;
+
+		//  compute
+		//  Computes every index of the bank over a hyperspectral image in one pass.
+		//  Rows are shared between numThreads threads (0 uses every core).
+		//  Pre-Conditions: The image has been loaded.
+		//  Post-Conditions: Returns one CV_32FC1 image per index, in bank order. A
+		//  division by zero gives 0. An index with a wavelength outside the image, or
+		//  that uses a band that could not be loaded, is returned empty (after
+		//  printing an error). The result does not depend on the thread count.
+		vector<Mat> compute(const SpecImage& hyperImage, int numThreads = 0) const;
+
+	private:
+		//  Operations of a compiled expression, run on a stack of rows
+		enum OpCode { PUSH_WAVELENGTH, PUSH_CONSTANT, ADD, SUBTRACT, MULTIPLY, DIVIDE, NEGATE };
+
+		struct Op
+		{
+			OpCode code;
+			float value;  //  Wavelength (nm) or constant pushed
+		};
+
+		struct Index
+		{
+			string name;
+			string expression;
+			vector<Op> program;  //  Postfix order
+			int stackDepth;      //  Rows the program needs on its stack
+		};
+
+		vector<Index> indices;
+
+		//  parse
+		//  Private method that compiles an expression into a postfix program.
+		//  Pre-conditions: None
+		//  Post-conditions: Returns true and fills program, or returns false and sets
+		//  error to what is wrong with the expression.
+		static bool parse(const string& expression, vector<Op>& program, string& error);
+};
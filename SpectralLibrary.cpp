@@ -0,0 +1,393 @@
+#include "SpectralLibrary.h"
+#include "FilterBankFile.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <filesystem>
+
+//  Rows classified per parallel work item
+const int LIBRARY_BLOCK_ROWS = 16;
+
+//  spectrumDistance
+//  Returns the fixed point SAD between two spectra of count values.
+static int spectrumDistance(const int* a, const int* b, int count)
+{
+	int sum = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		sum += abs(a[i] - b[i]);
+	}
+	return sum;
+}
+
+//  SpectralLibrary
+//  Creates an empty spectral library.
+SpectralLibrary::SpectralLibrary()
+{
+}
+
+//  AddMaterial
+//  Adds a reference spectrum to the library.
+//  Pre-Conditions: None
+//  Post-Conditions: The spectrum is stored under the given name. Its index is the
+//  number of materials that were in the library before it.
+void SpectralLibrary::AddMaterial(const string& name, const SpecFilter& spectrum)
+{
+	names.push_back(name);
+	spectra.push_back(spectrum);
+}
+
+//  LoadDirectory
+//  Loads every file of a directory as a USGS formatted Reflectance Pattern file
+//  (see SpecFilter::LoadFromFile). Files are read on numThreads threads (0 uses
+//  every core) and added in file name order, named after the file without its
+//  extension.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns the number of materials added. Files that could not
+//  be read, or that hold no samples, are reported on cerr and skipped. Returns 0
+//  (after printing an error) if the directory could not be listed.
+int SpectralLibrary::LoadDirectory(const string& directory, int numThreads)
+{
+	TRACE_SCOPE("SpectralLibrary::LoadDirectory");
+	vector<filesystem::path> files;
+	error_code error;
+	for (filesystem::directory_iterator i(directory, error), end; !error && i != end; i.increment(error))
+	{
+		if (i->is_regular_file())
+		{
+			files.push_back(i->path());
+		}
+	}
+	if (error)
+	{
+		cerr << "Error - Could not list spectral library \"" << directory << "\"." << endl;
+		return 0;
+	}
+	sort(files.begin(), files.end());
+
+	vector<SpecFilter> loaded(files.size());
+	vector<char> ok(files.size(), 0);
+	parallelFor(static_cast<int>(files.size()), numThreads, [&](int f)
+	{
+		ok[f] = loaded[f].LoadFromFile(files[f].string());
+	});
+
+	int added = 0;
+	for (size_t f = 0; f < files.size(); ++f)
+	{
+		if (ok[f] && loaded[f].getSampleCount() == 0)
+		{
+			cerr << "Error - File \"" << files[f].string() << "\" holds no readable spectrum." << endl;
+		}
+		else if (ok[f])
+		{
+			AddMaterial(files[f].stem().string(), loaded[f]);
+			++added;
+		}
+	}
+	TRACE_COUNT("materials loaded", added);
+	return added;
+}
+
+//  SaveToFile
+//  Writes every material of the library, with its name, to a filter bank file
+//  (see FilterBankFile.h), so the library can be loaded again without parsing
+//  a file per material.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the file was written, false otherwise.
+bool SpectralLibrary::SaveToFile(const string& fileName) const
+{
+	return WriteFilterBankFile(fileName, names, spectra);
+}
+
+//  LoadFromFile
+//  Adds every material of a filter bank file (see FilterBankFile.h) to the
+//  library, in file order.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns true if the file was read and its materials added,
+//  false (with nothing added) otherwise.
+bool SpectralLibrary::LoadFromFile(const string& fileName)
+{
+	return ReadFilterBankFile(fileName, names, spectra);
+}
+
+//  getCount
+//  Returns the number of materials in the library.
+int SpectralLibrary::getCount() const
+{
+	return static_cast<int>(spectra.size());
+}
+
+//  getName
+//  Returns the name of the material at the given index.
+//  Pre-Conditions: index is in the range [0, getCount())
+string SpectralLibrary::getName(int index) const
+{
+	return names[index];
+}
+
+//  classify
+//  Finds the nearest material of every pixel. Rows are shared between
+//  numThreads threads (0 uses every core).
+//  Pre-Conditions: The image has been loaded.
+//  Post-Conditions: Returns a CV_16UC1 label image holding 1 + the index of the
+//  nearest material, or 0 where no material is closer than maxDistance (or the
+//  library is empty). distance is set to a CV_32FC1 image of the distance to
+//  the nearest material. Materials with no samples in the sensor's range are
+//  reported on cerr and never chosen.
+//  NOTE: Distances are sums over the usable bands, so thresholds scale with the
+//  number of them, as SAD scores do. The result does not depend on the number
+//  of threads.
+Mat SpectralLibrary::classify(const SpecImage& hyperImage, Mat& distance, double maxDistance,
+	int numThreads) const
+{
+	TRACE_SCOPE("SpectralLibrary::classify");
+	int rows = hyperImage.getRows();
+	int cols = hyperImage.getCols();
+	Mat labels(rows, cols, CV_16UC1, Scalar::all(0));
+	distance = Mat(rows, cols, CV_32FC1, Scalar::all(FLT_MAX));
+
+	//  Usable bands: not masked and loaded
+	bool interleaved = hyperImage.getInterleave() == SpecImage::BIP;
+	vector<int> bands;
+	vector<Mat> images;
+	for (int band = 0; band < hyperImage.getDepth(); ++band)
+	{
+		if (hyperImage.isBadBand(band) || hyperImage.isBandMissing(band))
+		{
+			continue;
+		}
+		if (!interleaved)
+		{
+			//  Bands smaller than the scene are skipped like missing ones
+			Mat image = hyperImage.getBand(band);
+			if (image.rows < rows || image.cols < cols)
+			{
+				continue;
+			}
+			if (image.type() != CV_16UC1)
+			{
+				TRACE_SCOPE("convertTo");
+				image.convertTo(image, CV_16U);
+			}
+			images.push_back(image);
+		}
+		bands.push_back(band);
+	}
+	int depth = static_cast<int>(bands.size());
+	if (depth == 0 || rows <= 0 || cols <= 0)
+	{
+		return labels;
+	}
+
+	//  Compile every material onto the usable bands. Bands between two of the
+	//  plan's entries are interpolated by wavelength, bands past its ends take
+	//  the nearest entry.
+	vector<int> wavelengths = hyperImage.getWavelengths();
+	vector<int> references;
+	vector<int> materials;
+	for (int m = 0; m < getCount(); ++m)
+	{
+		vector<FilterPlan::Band> plan = spectra[m].Compile(hyperImage).getBandMeans();
+		if (plan.empty())
+		{
+			cerr << "Error - Material \"" << names[m] << "\" has no samples in the sensor's range." << endl;
+			continue;
+		}
+		size_t next = 0;
+		for (int i = 0; i < depth; ++i)
+		{
+			while (next < plan.size() && plan[next].band < bands[i])
+			{
+				++next;
+			}
+			double reflectance;
+			if (next < plan.size() && plan[next].band == bands[i])
+			{
+				reflectance = plan[next].reflectance;
+			}
+			else if (next == 0)
+			{
+				reflectance = plan.front().reflectance;
+			}
+			else if (next == plan.size())
+			{
+				reflectance = plan.back().reflectance;
+			}
+			else
+			{
+				const FilterPlan::Band& below = plan[next - 1];
+				const FilterPlan::Band& above = plan[next];
+				double span = wavelengths[above.band] - wavelengths[below.band];
+				double t = span > 0 ? (wavelengths[bands[i]] - wavelengths[below.band]) / span : 0;
+				reflectance = below.reflectance + t * (above.reflectance - below.reflectance);
+			}
+			references.push_back(toSADReference(reflectance));
+		}
+		materials.push_back(m);
+	}
+	int count = static_cast<int>(materials.size());
+	if (count == 0)
+	{
+		return labels;
+	}
+
+	//  The tree's items index into references, in the order they were compiled,
+	//  so the lowest item is the material added first
+	vector<int> items(count);
+	for (int i = 0; i < count; ++i)
+	{
+		items[i] = i;
+	}
+	vector<Node> nodes;
+	nodes.reserve(count);
+	int root = buildTree(items, 0, count, references, depth, nodes);
+
+	int limit = static_cast<int>(min<double>(maxDistance * SAD_SCALE, INT_MAX));
+	atomic<long long> compared(0);
+	int blockCount = (rows + LIBRARY_BLOCK_ROWS - 1) / LIBRARY_BLOCK_ROWS;
+	parallelFor(blockCount, numThreads, [&](int block)
+	{
+		vector<int> pixels(static_cast<size_t>(cols) * depth);
+		vector<pair<int, int> > stack;
+		long long blockCompared = 0;
+		int last = min(rows, (block + 1) * LIBRARY_BLOCK_ROWS);
+		for (int r = block * LIBRARY_BLOCK_ROWS; r < last; ++r)
+		{
+			//  Spectra of the row in fixed point, one pixel after another
+			if (interleaved)
+			{
+				int stride = hyperImage.getDepth();
+				const ushort* src = hyperImage.getSpectrum(r, 0);
+				for (int c = 0; c < cols; ++c, src += stride)
+				{
+					int* dst = &pixels[static_cast<size_t>(c) * depth];
+					for (int i = 0; i < depth; ++i)
+					{
+						dst[i] = min<int>(src[bands[i]], 255) << 8;
+					}
+				}
+			}
+			else
+			{
+				for (int i = 0; i < depth; ++i)
+				{
+					const ushort* src = images[i].ptr<ushort>(r);
+					for (int c = 0; c < cols; ++c)
+					{
+						pixels[static_cast<size_t>(c) * depth + i] = min<int>(src[c], 255) << 8;
+					}
+				}
+			}
+
+			ushort* label = labels.ptr<ushort>(r);
+			float* best = distance.ptr<float>(r);
+			for (int c = 0; c < cols; ++c)
+			{
+				const int* pixel = &pixels[static_cast<size_t>(c) * depth];
+				int bestItem = -1;
+				int bestValue = INT_MAX;
+
+				//  Every branch waits on the stack with the least distance the triangle
+				//  inequality allows for it. It is skipped only when that is strictly
+				//  more than the best so far, so ties are all visited and go to the
+				//  lowest item.
+				stack.assign(1, make_pair(root, 0));
+				while (!stack.empty())
+				{
+					int n = stack.back().first;
+					int bound = stack.back().second;
+					stack.pop_back();
+					if (n < 0 || bound > bestValue)
+					{
+						continue;
+					}
+					const Node& node = nodes[n];
+					int d = spectrumDistance(pixel, &references[static_cast<size_t>(node.material) * depth], depth);
+					++blockCompared;
+					if (d < bestValue || (d == bestValue && node.material < bestItem))
+					{
+						bestValue = d;
+						bestItem = node.material;
+					}
+
+					//  Inside materials are at least d - threshold away, outside ones
+					//  at least threshold - d. The nearer side is searched first.
+					pair<int, int> inside(node.inside, max(0, d - node.threshold));
+					pair<int, int> outside(node.outside, max(0, node.threshold - d));
+					if (d <= node.threshold)
+					{
+						stack.push_back(outside);
+						stack.push_back(inside);
+					}
+					else
+					{
+						stack.push_back(inside);
+						stack.push_back(outside);
+					}
+				}
+
+				best[c] = static_cast<float>(bestValue) / SAD_SCALE;
+				label[c] = bestValue < limit ? static_cast<ushort>(materials[bestItem] + 1) : 0;
+			}
+		}
+		compared += blockCompared;
+	});
+	TRACE_COUNT("spectra compared", compared.load());
+	return labels;
+}
+
+//  buildTree
+//  STATIC private method that builds the vantage point tree over
+//  materials[first, last).
+//  Pre-conditions: references holds count values per material.
+//  Post-conditions: Returns the index of the subtree's root in nodes, or -1 if
+//  the range is empty.
+int SpectralLibrary::buildTree(vector<int>& materials, int first, int last, const vector<int>& references,
+	int count, vector<Node>& nodes)
+{
+	if (first >= last)
+	{
+		return -1;
+	}
+
+	//  The first material is the vantage point. The rest are split at the median
+	//  of their distance to it, ties broken by index, so the tree is the same on
+	//  every run.
+	int vantage = materials[first];
+	const int* origin = &references[static_cast<size_t>(vantage) * count];
+	vector<pair<int, int> > order;
+	for (int i = first + 1; i < last; ++i)
+	{
+		const int* other = &references[static_cast<size_t>(materials[i]) * count];
+		order.push_back(make_pair(spectrumDistance(origin, other, count), materials[i]));
+	}
+	int index = static_cast<int>(nodes.size());
+	Node node = { vantage, 0, -1, -1 };
+	nodes.push_back(node);
+	if (order.empty())
+	{
+		return index;
+	}
+
+	size_t median = order.size() / 2;
+	nth_element(order.begin(), order.begin() + median, order.end());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		materials[first + 1 + i] = order[i].second;
+	}
+
+	//  Materials before the median are no further than it, those from it on no
+	//  nearer
+	int split = first + 1 + static_cast<int>(median);
+	nodes[index].threshold = order[median].first;
+	int inside = buildTree(materials, first + 1, split, references, count, nodes);
+	int outside = buildTree(materials, split, last, references, count, nodes);
+	nodes[index].inside = inside;
+	nodes[index].outside = outside;
+	return index;
+}
@@ -0,0 +1,116 @@
+/*
+SpectralLibrary holds a whole library of USGS reference spectra (such as every
+file of splib06) and classifies each pixel of a hyperspectral image to its
+nearest material.
+
+The library is compiled onto the image's usable bands (bad bands are left out):
+each material is resampled with SpecFilter::Compile and averaged per band (see
+FilterPlan::getBandMeans), and bands its samples do not reach are interpolated
+from the neighbouring bands, so every material has a value on every band. The
+distance between a pixel and a material is the SAD between them over those bands
+with unit weights, in fixed point as in SADKernel.h. That distance is a metric, so
+the materials are arranged in a vantage point tree and each pixel's search skips
+every branch the triangle inequality rules out. The result is the material a brute
+force comparison against every material finds, with ties going to the material
+added first.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+#include "SADKernel.h"
+#include "SpecFilter.h"
+#include "SpecImage.h"
+
+using namespace cv;
+using namespace std;
+
+class SpectralLibrary
+{
+	public:
+		//  SpectralLibrary
+		//  Creates an empty spectral library.
+		SpectralLibrary();
+
+		//  AddMaterial
+		//  Adds a reference spectrum to the library.
+		//  Pre-Conditions: None
+		//  Post-Conditions: The spectrum is stored under the given name. Its index is the
+		//  number of materials that were in the library before it.
+		void AddMaterial(const string& name, const SpecFilter& spectrum);
+
+		//  LoadDirectory
+		//  Loads every file of a directory as a USGS formatted Reflectance Pattern file
+		//  (see SpecFilter::LoadFromFile). Files are read on numThreads threads (0 uses
+		//  every core) and added in file name order, named after the file without its
+		//  extension.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns the number of materials added. Files that could not
+		//  be read, or that hold no samples, are reported on cerr and skipped. Returns 0
+		//  (after printing an error) if the directory could not be listed.
+		int LoadDirectory(const string& directory, int numThreads = 0);
+
+		//  SaveToFile
+		//  Writes every material of the library, with its name, to a filter bank file
+		//  (see FilterBankFile.h), so the library can be loaded again without parsing
+		//  a file per material.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the file was written, false otherwise.
+		bool SaveToFile(const string& fileName) const;
+
+		//  LoadFromFile
+		//  Adds every material of a filter bank file (see FilterBankFile.h) to the
+		//  library, in file order.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns true if the file was read and its materials added,
+		//  false (with nothing added) otherwise.
+		bool LoadFromFile(const string& fileName);
+
+		//  getCount
+		//  Returns the number of materials in the library.
+		int getCount() const;
+
+		//  getName
+		//  Returns the name of the material at the given index.
+		//  Pre-Conditions: index is in the range [0, getCount())
+		string getName(int index) const;
+
+		//  classify
+		//  Finds the nearest material of every pixel. Rows are shared between
+		//  numThreads threads (0 uses every core).
+		//  Pre-Conditions: The image has been loaded.
+		//  Post-Conditions: Returns a CV_16UC1 label image holding 1 + the index of the
+		//  nearest material, or 0 where no material is closer than maxDistance (or the
+		//  library is empty). distance is set to a CV_32FC1 image of the distance to
+		//  the nearest material. Materials with no samples in the sensor's range are
+		//  reported on cerr and never chosen.
+		//  NOTE: Distances are sums over the usable bands, so thresholds scale with the
+		//  number of them, as SAD scores do. The result does not depend on the number
+		//  of threads.
+		Mat classify(const SpecImage& hyperImage, Mat& distance, double maxDistance = MATCH_MAX,
+			int numThreads = 0) const;
+
+	private:
+		vector<string> names;
+		vector<SpecFilter> spectra;
+
+		//  Node of the vantage point tree. Materials within threshold of the vantage
+		//  material are under inside, the others under outside (-1 for none).
+		struct Node
+		{
+			int material;
+			int threshold;
+			int inside;
+			int outside;
+		};
+
+		//  buildTree
+		//  STATIC private method that builds the vantage point tree over
+		//  materials[first, last).
+		//  Pre-conditions: references holds count values per material.
+		//  Post-conditions: Returns the index of the subtree's root in nodes, or -1 if
+		//  the range is empty.
+		static int buildTree(vector<int>& materials, int first, int last, const vector<int>& references,
+			int count, vector<Node>& nodes);
+};
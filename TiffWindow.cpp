@@ -0,0 +1,489 @@
+#include "TiffWindow.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// TIFF and GeoTIFF tags read by ReadTiffLayout
+enum TiffTag
+{
+	TAG_IMAGE_WIDTH = 256,
+	TAG_IMAGE_LENGTH = 257,
+	TAG_BITS_PER_SAMPLE = 258,
+	TAG_COMPRESSION = 259,
+	TAG_STRIP_OFFSETS = 273,
+	TAG_SAMPLES_PER_PIXEL = 277,
+	TAG_ROWS_PER_STRIP = 278,
+	TAG_STRIP_BYTE_COUNTS = 279,
+	TAG_PLANAR_CONFIG = 284,
+	TAG_PREDICTOR = 317,
+	TAG_TILE_WIDTH = 322,
+	TAG_TILE_LENGTH = 323,
+	TAG_TILE_OFFSETS = 324,
+	TAG_TILE_BYTE_COUNTS = 325,
+	TAG_SAMPLE_FORMAT = 339,
+	TAG_MODEL_PIXEL_SCALE = 33550,
+	TAG_MODEL_TIEPOINT = 33922
+};
+
+// Compression schemes DecodeTiffWindow understands
+const int TIFF_NONE = 1;
+const int TIFF_LZW = 5;
+const int TIFF_PACKBITS = 32773;
+
+// get16
+// Reads an unsigned 16-bit value in the file's byte order.
+static uint32_t get16(const uchar* p, bool bigEndian)
+{
+	return bigEndian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+// get32
+// Reads an unsigned 32-bit value in the file's byte order.
+static uint32_t get32(const uchar* p, bool bigEndian)
+{
+	return bigEndian
+		? (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+		: p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// getDouble
+// Reads an IEEE double in the file's byte order.
+static double getDouble(const uchar* p, bool bigEndian)
+{
+	uchar bytes[8];
+	for (int i = 0; i < 8; i++)
+	{
+		bytes[i] = bigEndian ? p[7 - i] : p[i];
+	}
+	double value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+// readTagValues
+// Reads every value of a directory entry, as doubles.
+// Pre-Condition: entry points to a 12 byte directory entry read from in.
+// Post-Condition: Returns true and fills values for SHORT, LONG and DOUBLE
+//  entries, whether they are stored in the entry or elsewhere in the file.
+//  Returns false for other types or on a read error.
+static bool readTagValues(istream& in, const uchar* entry, bool bigEndian, vector<double>& values)
+{
+	int type = get16(entry + 2, bigEndian);
+	uint32_t count = get32(entry + 4, bigEndian);
+	int size = type == 3 ? 2 : type == 4 ? 4 : type == 12 ? 8 : 0;
+	if (size == 0 || count == 0 || count > (1u << 28))
+	{
+		return false;
+	}
+
+	// Values that fit in 4 bytes are stored in the entry itself
+	vector<uchar> data(static_cast<size_t>(count) * size);
+	if (data.size() <= 4)
+	{
+		memcpy(&data[0], entry + 8, data.size());
+	}
+	else
+	{
+		in.clear();
+		in.seekg(get32(entry + 8, bigEndian));
+		if (!in.read(reinterpret_cast<char*>(&data[0]), data.size()))
+		{
+			return false;
+		}
+	}
+
+	values.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const uchar* p = &data[static_cast<size_t>(i) * size];
+		values[i] = size == 2 ? get16(p, bigEndian) : size == 4 ? get32(p, bigEndian) : getDouble(p, bigEndian);
+	}
+	return true;
+}
+
+// ReadTiffLayout
+// Parses the first image directory of a TIFF file.
+// Pre-Condition: in is a binary stream over the whole file.
+// Post-Condition: Returns true and fills layout if the file is a classic TIFF,
+//  false (with error set) otherwise. The layout may still be unsupported by
+//  DecodeTiffWindow (see isTiffWindowSupported).
+bool ReadTiffLayout(istream& in, TiffLayout& layout, string& error)
+{
+	uchar header[8];
+	in.clear();
+	in.seekg(0);
+	if (!in.read(reinterpret_cast<char*>(header), sizeof(header))
+		|| !((header[0] == 'I' && header[1] == 'I') || (header[0] == 'M' && header[1] == 'M')))
+	{
+		error = "file is not a TIFF";
+		return false;
+	}
+	layout = TiffLayout();
+	layout.bigEndian = header[0] == 'M';
+	if (get16(header + 2, layout.bigEndian) != 42)
+	{
+		error = "file is not a classic TIFF";
+		return false;
+	}
+
+	uchar countBytes[2];
+	in.seekg(get32(header + 4, layout.bigEndian));
+	if (!in.read(reinterpret_cast<char*>(countBytes), sizeof(countBytes)))
+	{
+		error = "TIFF directory could not be read";
+		return false;
+	}
+	int entryCount = get16(countBytes, layout.bigEndian);
+	vector<uchar> entries(entryCount * 12);
+	if (entryCount == 0 || !in.read(reinterpret_cast<char*>(&entries[0]), entries.size()))
+	{
+		error = "TIFF directory could not be read";
+		return false;
+	}
+
+	// Defaults from the TIFF 6.0 specification
+	layout.bitsPerSample = 1;
+	layout.samplesPerPixel = 1;
+	layout.sampleFormat = 1;
+	layout.planarConfig = 1;
+	layout.compression = TIFF_NONE;
+	layout.predictor = 1;
+	int rowsPerStrip = 0;
+	vector<double> offsets;
+	vector<double> byteCounts;
+	vector<double> scale;
+	vector<double> tiepoint;
+	for (int e = 0; e < entryCount; e++)
+	{
+		const uchar* entry = &entries[e * 12];
+		int tag = get16(entry, layout.bigEndian);
+		vector<double> values;
+		if (!readTagValues(in, entry, layout.bigEndian, values))
+		{
+			continue;
+		}
+		int value = static_cast<int>(values[0]);
+		switch (tag)
+		{
+			case TAG_IMAGE_WIDTH: layout.width = value; break;
+			case TAG_IMAGE_LENGTH: layout.height = value; break;
+			case TAG_BITS_PER_SAMPLE: layout.bitsPerSample = value; break;
+			case TAG_COMPRESSION: layout.compression = value; break;
+			case TAG_SAMPLES_PER_PIXEL: layout.samplesPerPixel = value; break;
+			case TAG_ROWS_PER_STRIP: rowsPerStrip = value; break;
+			case TAG_PLANAR_CONFIG: layout.planarConfig = value; break;
+			case TAG_PREDICTOR: layout.predictor = value; break;
+			case TAG_TILE_WIDTH: layout.blockWidth = value; break;
+			case TAG_TILE_LENGTH: layout.blockHeight = value; break;
+			case TAG_SAMPLE_FORMAT: layout.sampleFormat = value; break;
+			case TAG_STRIP_OFFSETS: case TAG_TILE_OFFSETS: offsets = values; break;
+			case TAG_STRIP_BYTE_COUNTS: case TAG_TILE_BYTE_COUNTS: byteCounts = values; break;
+			case TAG_MODEL_PIXEL_SCALE: scale = values; break;
+			case TAG_MODEL_TIEPOINT: tiepoint = values; break;
+		}
+	}
+
+	if (layout.width <= 0 || layout.height <= 0)
+	{
+		error = "TIFF has no image size";
+		return false;
+	}
+
+	// Strips are tiles as wide as the image
+	layout.tiled = layout.blockWidth > 0 && layout.blockHeight > 0;
+	if (!layout.tiled)
+	{
+		layout.blockWidth = layout.width;
+		layout.blockHeight = (rowsPerStrip <= 0 || rowsPerStrip > layout.height) ? layout.height : rowsPerStrip;
+	}
+	size_t blockCount = static_cast<size_t>((layout.width + layout.blockWidth - 1) / layout.blockWidth)
+		* ((layout.height + layout.blockHeight - 1) / layout.blockHeight);
+	if (offsets.size() < blockCount || byteCounts.size() < blockCount)
+	{
+		error = "TIFF strip or tile table is incomplete";
+		return false;
+	}
+	layout.offsets.assign(offsets.begin(), offsets.begin() + blockCount);
+	layout.byteCounts.assign(byteCounts.begin(), byteCounts.begin() + blockCount);
+
+	// The tiepoint maps raster point (i, j) to model point (x, y); the map's y axis
+	//  points up, the raster's down
+	if (scale.size() >= 2 && tiepoint.size() >= 6 && scale[0] > 0 && scale[1] > 0)
+	{
+		layout.hasGeo = true;
+		layout.pixelWidth = scale[0];
+		layout.pixelHeight = scale[1];
+		layout.originX = tiepoint[3] - tiepoint[0] * scale[0];
+		layout.originY = tiepoint[4] + tiepoint[1] * scale[1];
+	}
+	return true;
+}
+
+// isTiffWindowSupported
+// Returns whether DecodeTiffWindow can decode windows of a file with this layout.
+bool isTiffWindowSupported(const TiffLayout& layout)
+{
+	return layout.samplesPerPixel == 1
+		&& (layout.bitsPerSample == 8 || layout.bitsPerSample == 16)
+		&& (layout.sampleFormat == 1 || layout.sampleFormat == 2)
+		&& (layout.compression == TIFF_NONE || layout.compression == TIFF_LZW || layout.compression == TIFF_PACKBITS)
+		&& (layout.predictor == 1 || (layout.predictor == 2 && layout.compression == TIFF_LZW));
+}
+
+// ReadTiffBlocks
+// Reads the stored strips or tiles of a TIFF that intersect a window.
+// Pre-Condition: layout was parsed from in, and window lies inside the image.
+// Post-Condition: Returns true and fills blocks with the raw bytes of every
+//  strip or tile, in file order, that the window touches. Strips and tiles it
+//  does not touch are left empty. Returns false (with error set) on a read error.
+bool ReadTiffBlocks(istream& in, const TiffLayout& layout, const Rect& window,
+	vector<vector<uchar> >& blocks, string& error)
+{
+	int across = (layout.width + layout.blockWidth - 1) / layout.blockWidth;
+	blocks.assign(layout.offsets.size(), vector<uchar>());
+	for (int by = window.y / layout.blockHeight; by * layout.blockHeight < window.y + window.height; by++)
+	{
+		for (int bx = window.x / layout.blockWidth; bx * layout.blockWidth < window.x + window.width; bx++)
+		{
+			size_t index = static_cast<size_t>(by) * across + bx;
+			vector<uchar>& block = blocks[index];
+			block.resize(layout.byteCounts[index]);
+			in.clear();
+			in.seekg(layout.offsets[index]);
+			if (!block.empty() && !in.read(reinterpret_cast<char*>(&block[0]), block.size()))
+			{
+				error = "TIFF strip or tile could not be read";
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// decodeLZW
+// Decodes a TIFF LZW stream: codes are MSB first, start at 9 bits and widen one
+//  code early, 256 clears the table and 257 ends the data.
+// Pre-Condition: None
+// Post-Condition: Returns true if at least expected bytes were decoded into out.
+static bool decodeLZW(const vector<uchar>& src, vector<uchar>& out, size_t expected)
+{
+	const int CLEAR = 256;
+	const int END = 257;
+	struct Entry
+	{
+		int prefix;
+		uchar suffix;
+		uchar first;
+		int length;
+	};
+	Entry table[4096];
+	for (int i = 0; i < 256; i++)
+	{
+		table[i] = { -1, static_cast<uchar>(i), static_cast<uchar>(i), 1 };
+	}
+
+	out.clear();
+	out.reserve(expected);
+	size_t bitPos = 0;
+	size_t bitCount = src.size() * 8;
+	int width = 9;
+	int next = 258;
+	int previous = -1;
+	while (bitPos + width <= bitCount && out.size() < expected)
+	{
+		int code = 0;
+		for (int b = 0; b < width; b++, bitPos++)
+		{
+			code = (code << 1) | ((src[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+		}
+		if (code == END)
+		{
+			break;
+		}
+		if (code == CLEAR)
+		{
+			width = 9;
+			next = 258;
+			previous = -1;
+			continue;
+		}
+		if (previous < 0)
+		{
+			if (code > 255)
+			{
+				return false;
+			}
+			out.push_back(static_cast<uchar>(code));
+			previous = code;
+			continue;
+		}
+		if (code > next || next >= 4096)
+		{
+			return false;
+		}
+
+		// A code one past the table is the previous string plus its own first byte
+		uchar first = code < next ? table[code].first : table[previous].first;
+		table[next] = { previous, first, table[previous].first, table[previous].length + 1 };
+		next++;
+
+		size_t start = out.size();
+		out.resize(start + table[code].length);
+		for (int c = code; c >= 0; c = table[c].prefix)
+		{
+			out[start + table[c].length - 1] = table[c].suffix;
+		}
+		previous = code;
+		if (next >= (1 << width) - 1 && width < 12)
+		{
+			width++;
+		}
+	}
+	return out.size() >= expected;
+}
+
+// decodePackBits
+// Decodes a PackBits stream of runs and literals.
+// Pre-Condition: None
+// Post-Condition: Returns true if at least expected bytes were decoded into out.
+static bool decodePackBits(const vector<uchar>& src, vector<uchar>& out, size_t expected)
+{
+	out.clear();
+	out.reserve(expected);
+	size_t i = 0;
+	while (i < src.size() && out.size() < expected)
+	{
+		int n = static_cast<signed char>(src[i++]);
+		if (n >= 0)
+		{
+			size_t count = min<size_t>(n + 1, src.size() - i);
+			out.insert(out.end(), src.begin() + i, src.begin() + i + count);
+			i += count;
+		}
+		else if (n > -128 && i < src.size())
+		{
+			out.insert(out.end(), 1 - n, src[i++]);
+		}
+	}
+	return out.size() >= expected;
+}
+
+// DecodeTiffWindow
+// Decodes a window of a TIFF from the blocks ReadTiffBlocks read.
+// Pre-Condition: isTiffWindowSupported(layout), and blocks was read for window.
+// Post-Condition: Returns the window as a CV_8UC1, CV_16UC1 or CV_16SC1 image (the
+//  type imdecode gives the whole band), or an empty Mat (with error set) if a
+//  block is corrupt.
+Mat DecodeTiffWindow(const TiffLayout& layout, const Rect& window, const vector<vector<uchar> >& blocks,
+	string& error)
+{
+	int bytes = layout.bitsPerSample / 8;
+	int type = bytes == 1 ? CV_8UC1 : layout.sampleFormat == 2 ? CV_16SC1 : CV_16UC1;
+	Mat result(window.height, window.width, type);
+	int across = (layout.width + layout.blockWidth - 1) / layout.blockWidth;
+	vector<uchar> decoded;
+	vector<ushort> row(layout.blockWidth);
+
+	for (int by = window.y / layout.blockHeight; by * layout.blockHeight < window.y + window.height; by++)
+	{
+		for (int bx = window.x / layout.blockWidth; bx * layout.blockWidth < window.x + window.width; bx++)
+		{
+			const vector<uchar>& block = blocks[static_cast<size_t>(by) * across + bx];
+
+			// Tiles are always whole, the last strip only holds the rows that are left
+			int top = by * layout.blockHeight;
+			int left = bx * layout.blockWidth;
+			int blockRows = layout.tiled ? layout.blockHeight : min(layout.blockHeight, layout.height - top);
+			size_t rowBytes = static_cast<size_t>(layout.blockWidth) * bytes;
+			size_t expected = rowBytes * blockRows;
+
+			bool ok = true;
+			const uchar* data = block.empty() ? NULL : &block[0];
+			if (layout.compression == TIFF_LZW)
+			{
+				ok = decodeLZW(block, decoded, expected);
+				data = decoded.empty() ? NULL : &decoded[0];
+			}
+			else if (layout.compression == TIFF_PACKBITS)
+			{
+				ok = decodePackBits(block, decoded, expected);
+				data = decoded.empty() ? NULL : &decoded[0];
+			}
+			else
+			{
+				ok = block.size() >= expected;
+			}
+			if (!ok)
+			{
+				error = "TIFF strip or tile is corrupt";
+				return Mat();
+			}
+
+			// Copy the rows and columns of the block that lie in the window
+			int firstRow = max(top, window.y);
+			int lastRow = min(top + blockRows, window.y + window.height);
+			int firstCol = max(left, window.x);
+			int lastCol = min(left + layout.blockWidth, window.x + window.width);
+			for (int y = firstRow; y < lastRow; y++)
+			{
+				const uchar* src = data + (y - top) * rowBytes;
+				uchar* dst = result.ptr<uchar>(y - window.y) + (firstCol - window.x) * bytes;
+				if (bytes == 1)
+				{
+					// Horizontal differencing is undone across the whole block row
+					uchar sum = 0;
+					int start = layout.predictor == 2 ? left : firstCol;
+					for (int x = start; x < lastCol; x++)
+					{
+						uchar value = src[x - left];
+						sum = layout.predictor == 2 ? static_cast<uchar>(sum + value) : value;
+						if (x >= firstCol)
+						{
+							dst[x - firstCol] = sum;
+						}
+					}
+					continue;
+				}
+
+				ushort* out = reinterpret_cast<ushort*>(dst);
+				ushort sum = 0;
+				int start = layout.predictor == 2 ? left : firstCol;
+				for (int x = start; x < lastCol; x++)
+				{
+					ushort value = static_cast<ushort>(get16(src + (x - left) * 2, layout.bigEndian));
+					sum = layout.predictor == 2 ? static_cast<ushort>(sum + value) : value;
+					if (x >= firstCol)
+					{
+						out[x - firstCol] = sum;
+					}
+				}
+			}
+		}
+	}
+	return result;
+}
+
+// GeoToPixelRect
+// Finds the pixels of a georeferenced TIFF that a map rectangle covers.
+// Pre-Condition: layout.hasGeo is true.
+// Post-Condition: Returns the smallest pixel rectangle holding every pixel that
+//  overlaps area, clipped to the image. Empty if area misses the image.
+Rect GeoToPixelRect(const TiffLayout& layout, const GeoRect& area)
+{
+	double left = floor((area.minX - layout.originX) / layout.pixelWidth);
+	double right = ceil((area.maxX - layout.originX) / layout.pixelWidth);
+	double top = floor((layout.originY - area.maxY) / layout.pixelHeight);
+	double bottom = ceil((layout.originY - area.minY) / layout.pixelHeight);
+
+	left = max(left, 0.0);
+	top = max(top, 0.0);
+	right = min(right, static_cast<double>(layout.width));
+	bottom = min(bottom, static_cast<double>(layout.height));
+	if (right <= left || bottom <= top)
+	{
+		return Rect();
+	}
+	return Rect(static_cast<int>(left), static_cast<int>(top),
+		static_cast<int>(right - left), static_cast<int>(bottom - top));
+}
@@ -0,0 +1,99 @@
+/*
+TiffWindow
+Reads a rectangular window of a single-channel GeoTIFF band without decoding the
+rest of it. The file's directory is parsed for the strip or tile layout, and only
+the strips or tiles that intersect the window are read from disk and decoded, so
+the work follows the size of the window instead of the size of the band.
+
+Supported files are classic (not Big) TIFFs holding one 8-bit or 16-bit sample
+per pixel, unsigned or signed (Hyperion L1T bands are signed 16-bit). They may be
+stored in strips or tiles, uncompressed (as Hyperion delivers them), LZW
+compressed with or without the horizontal predictor (as OpenCV writes them) or
+PackBits compressed. Anything else is reported as unsupported so the caller can
+decode the whole band instead.
+
+The GeoTIFF model tiepoint and pixel scale tags, where present, place the image
+on the map so a window can be given in map coordinates (see GeoRect).
+*/
+
+#pragma once
+#include <opencv2/core/core.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// GeoRect
+// An axis-aligned rectangle in the map coordinates of a GeoTIFF (for Hyperion
+//  L1T scenes, UTM metres).
+struct GeoRect
+{
+	double minX;
+	double minY;
+	double maxX;
+	double maxY;
+};
+
+struct TiffLayout
+{
+	int width;
+	int height;
+	int bitsPerSample;
+	int samplesPerPixel;
+	int sampleFormat;      // 1 unsigned, 2 signed
+	int planarConfig;      // 1 interleaved samples, 2 separate planes
+	int compression;       // 1 none, 5 LZW, 32773 PackBits
+	int predictor;         // 1 none, 2 horizontal differencing
+	bool tiled;            // Stored in tiles rather than strips
+	int blockWidth;        // Tile width, or the image width for strips
+	int blockHeight;       // Tile height, or rows per strip
+	bool bigEndian;
+	vector<uint32_t> offsets;     // File offset of every strip or tile
+	vector<uint32_t> byteCounts;  // Stored size of every strip or tile
+	bool hasGeo;
+	double originX;        // Map position of the top left corner of pixel (0, 0)
+	double originY;
+	double pixelWidth;     // Map units per pixel, across and down
+	double pixelHeight;
+};
+
+// ReadTiffLayout
+// Parses the first image directory of a TIFF file.
+// Pre-Condition: in is a binary stream over the whole file.
+// Post-Condition: Returns true and fills layout if the file is a classic TIFF,
+//  false (with error set) otherwise. The layout may still be unsupported by
+//  DecodeTiffWindow (see isTiffWindowSupported).
+bool ReadTiffLayout(istream& in, TiffLayout& layout, string& error);
+
+// isTiffWindowSupported
+// Returns whether DecodeTiffWindow can decode windows of a file with this layout.
+bool isTiffWindowSupported(const TiffLayout& layout);
+
+// ReadTiffBlocks
+// Reads the stored strips or tiles of a TIFF that intersect a window.
+// Pre-Condition: layout was parsed from in, and window lies inside the image.
+// Post-Condition: Returns true and fills blocks with the raw bytes of every
+//  strip or tile, in file order, that the window touches. Strips and tiles it
+//  does not touch are left empty. Returns false (with error set) on a read error.
+bool ReadTiffBlocks(istream& in, const TiffLayout& layout, const Rect& window,
+	vector<vector<uchar> >& blocks, string& error);
+
+// DecodeTiffWindow
+// Decodes a window of a TIFF from the blocks ReadTiffBlocks read.
+// Pre-Condition: isTiffWindowSupported(layout), and blocks was read for window.
+// Post-Condition: Returns the window as a CV_8UC1, CV_16UC1 or CV_16SC1 image (the
+//  type imdecode gives the whole band), or an empty Mat (with error set) if a 
+//  block is corrupt.
+Mat DecodeTiffWindow(const TiffLayout& layout, const Rect& window, const vector<vector<uchar> >& blocks,
+	string& error);
+
+// GeoToPixelRect
+// Finds the pixels of a georeferenced TIFF that a map rectangle covers.
+// Pre-Condition: layout.hasGeo is true.
+// Post-Condition: Returns the smallest pixel rectangle holding every pixel that
+//  overlaps area, clipped to the image. Empty if area misses the image.
+Rect GeoToPixelRect(const TiffLayout& layout, const GeoRect& area);
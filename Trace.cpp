@@ -0,0 +1,352 @@
+/*
+Trace
+Lightweight instrumentation for finding where the time of a run goes. Stages are
+wrapped in scoped timers and report byte and pixel counters. While tracing is
+enabled every timer and counter is recorded per thread; the recording can be
+written as a Chrome trace-event file (open it in chrome://tracing or Perfetto)
+and summarized as a table.
+
+Tracing is off by default. When it is off a timer costs a single relaxed atomic
+load, and building with HYPERSPECTRAL_NO_TRACE defined removes the timers and
+counters entirely.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Trace.h"
+
+using namespace std;
+
+atomic<bool> Trace::enabled(false);
+
+namespace
+{
+	// One recorded timer or counter. Counters have start == end.
+	struct TraceEvent
+	{
+		const char* name;
+		const char* argName;
+		long long argValue;
+		long long start;
+		long long end;
+		bool counter;
+	};
+
+	// The events of a single thread. The lock is only ever contended while a
+	//  trace is written or reset.
+	struct ThreadRecording
+	{
+		int thread;
+		mutex lock;
+		vector<TraceEvent> events;
+	};
+
+	// The recordings of running threads, and the events of threads that have exited,
+	//  so that short lived workers (see parallelFor) still show up in the trace. 
+	//  Recordings are owned by their thread, and are dropped from the registry once
+	//  it has exited.
+	mutex registryLock;
+	vector<weak_ptr<ThreadRecording> > registry;
+	vector<pair<int, TraceEvent> > retired;
+	int threadCount = 0;
+	atomic<long long> epoch(0);
+
+	long long steadyNanoseconds()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Drops the registry entries of threads that have exited. registryLock is held.
+	void pruneRegistry()
+	{
+		registry.erase(remove_if(registry.begin(), registry.end(), [](const weak_ptr<ThreadRecording>& entry)
+		{
+			return entry.expired();
+		}), registry.end());
+	}
+
+	// Owns a thread's recording, and hands its events over to retired when the
+	//  thread exits
+	struct RecordingOwner
+	{
+		shared_ptr<ThreadRecording> recording;
+
+		~RecordingOwner()
+		{
+			if (!recording)
+			{
+				return;
+			}
+			lock_guard<mutex> guard(registryLock);
+			lock_guard<mutex> threadGuard(recording->lock);
+			for (size_t e = 0; e < recording->events.size(); e++)
+			{
+				retired.push_back(make_pair(recording->thread, recording->events[e]));
+			}
+			recording->events.clear();
+		}
+	};
+
+	ThreadRecording& threadRecording()
+	{
+		thread_local RecordingOwner owner;
+		if (!owner.recording)
+		{
+			owner.recording = make_shared<ThreadRecording>();
+			lock_guard<mutex> guard(registryLock);
+			pruneRegistry();
+			owner.recording->thread = ++threadCount;
+			registry.push_back(owner.recording);
+		}
+		return *owner.recording;
+	}
+
+	// Copies every recorded event, tagged with the thread that recorded it
+	void collectEvents(vector<pair<int, TraceEvent> >& events)
+	{
+		lock_guard<mutex> guard(registryLock);
+		pruneRegistry();
+		events = retired;
+		for (size_t i = 0; i < registry.size(); i++)
+		{
+			shared_ptr<ThreadRecording> recording = registry[i].lock();
+			if (!recording)
+			{
+				continue;
+			}
+			lock_guard<mutex> threadGuard(recording->lock);
+			for (size_t e = 0; e < recording->events.size(); e++)
+			{
+				events.push_back(make_pair(recording->thread, recording->events[e]));
+			}
+		}
+	}
+
+	// Writes a string as a JSON string literal
+	void writeJsonString(ostream& out, const char* text)
+	{
+		out << '"';
+		for (const char* c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				out << '\\';
+			}
+			out << *c;
+		}
+		out << '"';
+	}
+}
+
+// Enable
+// Turns recording on or off. Turning it on starts a new trace.
+// Pre-Condition: None
+// Post-Condition: Timers and counters are recorded until tracing is disabled.
+void Trace::Enable(bool enable)
+{
+	if (enable && !isEnabled())
+	{
+		Reset();
+	}
+	enabled.store(enable);
+}
+
+// Reset
+// Discards everything recorded so far.
+// Pre-Condition: No traced work is running on other threads.
+// Post-Condition: The trace is empty and its clock restarts at zero.
+void Trace::Reset()
+{
+	lock_guard<mutex> guard(registryLock);
+	pruneRegistry();
+	retired.clear();
+	for (size_t i = 0; i < registry.size(); i++)
+	{
+		shared_ptr<ThreadRecording> recording = registry[i].lock();
+		if (recording)
+		{
+			lock_guard<mutex> threadGuard(recording->lock);
+			recording->events.clear();
+		}
+	}
+	epoch.store(steadyNanoseconds(), memory_order_relaxed);
+}
+
+// now
+// Returns the current time in nanoseconds, on the trace's clock.
+// Pre-Condition: None
+// Post-Condition: Returns a monotonic time in nanoseconds.
+long long Trace::now()
+{
+	return steadyNanoseconds() - epoch.load(memory_order_relaxed);
+}
+
+// RecordScope
+// Records a finished timer. Used by TraceScope.
+// Pre-Condition: start and end are nanosecond times taken with now().
+// Post-Condition: The timer is added to the calling thread's recording.
+void Trace::RecordScope(const char* name, const char* argName, long long argValue,
+	long long start, long long end)
+{
+	ThreadRecording& recording = threadRecording();
+	TraceEvent event = { name, argName, argValue, start, end, false };
+	lock_guard<mutex> guard(recording.lock);
+	recording.events.push_back(event);
+}
+
+// RecordCount
+// Private method to record an amount added to a counter.
+// Pre-Condition: Tracing is enabled.
+// Post-Condition: The amount is added to the calling thread's recording.
+void Trace::RecordCount(const char* name, long long value)
+{
+	ThreadRecording& recording = threadRecording();
+	long long time = now();
+	TraceEvent event = { name, NULL, value, time, time, true };
+	lock_guard<mutex> guard(recording.lock);
+	recording.events.push_back(event);
+}
+
+// WriteChromeTrace
+// Writes the recording in the Chrome trace-event JSON format. Timers become
+//  complete ("X") events on the thread that ran them and counters become
+//  counter ("C") events holding their running total.
+// Pre-Condition: No traced work is running on other threads.
+// Post-Condition: Returns true if the file was written, otherwise an error is
+//  printed and false is returned.
+bool Trace::WriteChromeTrace(const string& fileName)
+{
+	vector<pair<int, TraceEvent> > events;
+	collectEvents(events);
+	sort(events.begin(), events.end(), [](const pair<int, TraceEvent>& a, const pair<int, TraceEvent>& b)
+	{
+		return a.second.start < b.second.start;
+	});
+
+	ofstream out(fileName);
+	if (!out.is_open())
+	{
+		cerr << "Error - Could not write trace file \"" << fileName << "\"." << endl;
+		return false;
+	}
+
+	// Timestamps are in microseconds
+	map<string, long long> totals;
+	char time[64];
+	out << "{\"traceEvents\":[" << endl;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const TraceEvent& event = events[i].second;
+		snprintf(time, sizeof(time), "%.3f", event.start / 1000.0);
+		out << (i ? ",\n" : "") << "{\"name\":";
+		writeJsonString(out, event.name);
+		out << ",\"pid\":1,\"tid\":" << events[i].first << ",\"ts\":" << time;
+		if (event.counter)
+		{
+			long long& total = totals[event.name];
+			total += event.argValue;
+			out << ",\"ph\":\"C\",\"args\":{\"value\":" << total << "}}";
+			continue;
+		}
+
+		snprintf(time, sizeof(time), "%.3f", (event.end - event.start) / 1000.0);
+		out << ",\"ph\":\"X\",\"dur\":" << time;
+		if (event.argName)
+		{
+			out << ",\"args\":{";
+			writeJsonString(out, event.argName);
+			out << ":" << event.argValue << "}";
+		}
+		out << "}";
+	}
+	out << endl << "]}" << endl;
+	return static_cast<bool>(out);
+}
+
+// WriteSummary
+// Writes a table with the call count and total, mean, minimum and maximum time
+//  of every timer (slowest first), followed by the total of every counter.
+// Pre-Condition: No traced work is running on other threads.
+// Post-Condition: The table has been written to out.
+void Trace::WriteSummary(ostream& out)
+{
+	struct Timing
+	{
+		string name;
+		long long calls;
+		long long total;
+		long long low;
+		long long high;
+	};
+
+	vector<pair<int, TraceEvent> > events;
+	collectEvents(events);
+
+	map<string, Timing> timings;
+	map<string, long long> counters;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const TraceEvent& event = events[i].second;
+		if (event.counter)
+		{
+			counters[event.name] += event.argValue;
+			continue;
+		}
+
+		long long duration = event.end - event.start;
+		map<string, Timing>::iterator timing = timings.find(event.name);
+		if (timing == timings.end())
+		{
+			Timing first = { event.name, 1, duration, duration, duration };
+			timings[event.name] = first;
+			continue;
+		}
+		timing->second.calls++;
+		timing->second.total += duration;
+		timing->second.low = min(timing->second.low, duration);
+		timing->second.high = max(timing->second.high, duration);
+	}
+
+	vector<Timing> sorted;
+	for (map<string, Timing>::iterator i = timings.begin(); i != timings.end(); ++i)
+	{
+		sorted.push_back(i->second);
+	}
+	sort(sorted.begin(), sorted.end(), [](const Timing& a, const Timing& b)
+	{
+		return a.total > b.total;
+	});
+
+	char line[256];
+	snprintf(line, sizeof(line), "%-36s %10s %12s %12s %12s %12s", "Timer", "Calls", "Total ms",
+		"Mean ms", "Min ms", "Max ms");
+	out << line << endl;
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		snprintf(line, sizeof(line), "%-36s %10lld %12.3f %12.3f %12.3f %12.3f", sorted[i].name.c_str(),
+			sorted[i].calls, sorted[i].total / 1e6, sorted[i].total / 1e6 / sorted[i].calls,
+			sorted[i].low / 1e6, sorted[i].high / 1e6);
+		out << line << endl;
+	}
+
+	if (!counters.empty())
+	{
+		out << endl;
+		snprintf(line, sizeof(line), "%-36s %20s", "Counter", "Total");
+		out << line << endl;
+		for (map<string, long long>::iterator i = counters.begin(); i != counters.end(); ++i)
+		{
+			snprintf(line, sizeof(line), "%-36s %20lld", i->first.c_str(), i->second);
+			out << line << endl;
+		}
+	}
+}
@@ -0,0 +1,145 @@
+/*
+Trace
+Lightweight instrumentation for finding where the time of a run goes. Stages are
+wrapped in scoped timers and report byte and pixel counters. While tracing is
+enabled every timer and counter is recorded per thread; the recording can be
+written as a Chrome trace-event file (open it in chrome://tracing or Perfetto)
+and summarized as a table.
+
+Tracing is off by default. When it is off a timer costs a single relaxed atomic
+load, and building with HYPERSPECTRAL_NO_TRACE defined removes the timers and
+counters entirely.
+*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+class Trace
+{
+	public:
+
+		// Enable
+		// Turns recording on or off. Turning it on starts a new trace.
+		// Pre-Condition: None
+		// Post-Condition: Timers and counters are recorded until tracing is disabled.
+		static void Enable(bool enable);
+
+		// isEnabled
+		// Checks whether timers and counters are being recorded.
+		// Pre-Condition: None
+		// Post-Condition: Returns true if tracing is enabled.
+		static bool isEnabled()
+		{
+			return enabled.load(memory_order_relaxed);
+		}
+
+		// Reset
+		// Discards everything recorded so far.
+		// Pre-Condition: No traced work is running on other threads.
+		// Post-Condition: The trace is empty and its clock restarts at zero.
+		static void Reset();
+
+		// Count
+		// Adds value to a named counter (for example bytes read or pixels scored).
+		// Pre-Condition: name is a string literal, or otherwise outlives the trace.
+		// Post-Condition: The amount is recorded if tracing is enabled.
+		static void Count(const char* name, long long value)
+		{
+			if (isEnabled())
+			{
+				RecordCount(name, value);
+			}
+		}
+
+		// WriteChromeTrace
+		// Writes the recording in the Chrome trace-event JSON format. Timers become
+		//  complete ("X") events on the thread that ran them and counters become
+		//  counter ("C") events holding their running total.
+		// Pre-Condition: No traced work is running on other threads.
+		// Post-Condition: Returns true if the file was written, otherwise an error is
+		//  printed and false is returned.
+		static bool WriteChromeTrace(const string& fileName);
+
+		// WriteSummary
+		// Writes a table with the call count and total, mean, minimum and maximum time
+		//  of every timer (slowest first), followed by the total of every counter.
+		// Pre-Condition: No traced work is running on other threads.
+		// Post-Condition: The table has been written to out.
+		static void WriteSummary(ostream& out);
+
+		// RecordScope
+		// Records a finished timer. Used by TraceScope.
+		// Pre-Condition: start and end are nanosecond times taken with now().
+		// Post-Condition: The timer is added to the calling thread's recording.
+		static void RecordScope(const char* name, const char* argName, long long argValue,
+			long long start, long long end);
+
+		// now
+		// Returns the current time in nanoseconds, on the trace's clock.
+		// Pre-Condition: None
+		// Post-Condition: Returns a monotonic time in nanoseconds.
+		static long long now();
+
+	private:
+		static void RecordCount(const char* name, long long value);
+
+		static atomic<bool> enabled;
+};
+
+// TraceScope
+// Times the block it is declared in, from construction to destruction. An optional
+//  named integer argument (for example a band number) is stored with the timing.
+class TraceScope
+{
+	public:
+		TraceScope(const char* name, const char* argName = NULL, long long argValue = 0)
+			: name(name), argName(argName), argValue(argValue), start(Trace::isEnabled() ? Trace::now() : -1)
+		{
+		}
+
+		~TraceScope()
+		{
+			End();
+		}
+
+		// End
+		// Stops the timer before the end of the block, for example ahead of waiting
+		//  on the user.
+		// Pre-Condition: None
+		// Post-Condition: The timing is recorded once; later calls do nothing.
+		void End()
+		{
+			if (start >= 0)
+			{
+				Trace::RecordScope(name, argName, argValue, start, Trace::now());
+				start = -1;
+			}
+		}
+
+	private:
+		TraceScope(const TraceScope&);
+		TraceScope& operator=(const TraceScope&);
+
+		const char* name;
+		const char* argName;
+		long long argValue;
+		long long start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef HYPERSPECTRAL_NO_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, argName, argValue)
+#define TRACE_COUNT(name, value)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, argName, argValue) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, argName, argValue)
+#define TRACE_COUNT(name, value) Trace::Count(name, value)
+#endif
@@ -0,0 +1,286 @@
+/*
+Watershed segmentation of filter maps, so that areas of interest found by a
+SpecFilter can be outlined.
+*/
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "Parallel.h"
+#include "Trace.h"
+#include "Watershed.h"
+
+using namespace cv;
+using namespace std;
+
+//  Pixels of the neighbouring tiles segmented along with each tile. This covers
+//  the reach of the noise removal (an opening with a 17x17 element) and of the
+//  sure background dilation, with room left for the flooding to settle.
+static const int WATERSHED_MARGIN = 32;
+
+//  segmentTile
+//  Segments one tile of the image, together with its margin.
+//  Pre-Conditions: color is the 8UC3 image and thresh its global Otsu threshold
+//  image. outer is core grown by the margin and clipped to the image.
+//  Post-Conditions: labels holds the 32SC1 watershed labels of the core (-1 on
+//  lines, 1 for background, 2 and up for regions) and count the highest label.
+static void segmentTile(const Mat& color, const Mat& thresh, const Rect& core, const Rect& outer,
+	Mat& labels, int& count)
+{
+	TRACE_SCOPE_ARG("Watershed::tile", "row", core.y);
+
+	//  Tiles are copied so every tile is filtered the same way at its edges
+	Mat tileColor = color(outer).clone();
+	Mat tileThresh = thresh(outer).clone();
+
+	//  Noise removal
+	int morph_size = 8;
+	Mat element = getStructuringElement(2, Size(2 * morph_size + 1, 2 * morph_size + 1), Point(morph_size, morph_size));
+
+	//  Apply the specified morphology operation
+	Mat opening;
+	morphologyEx(tileThresh, opening, 2, element);
+
+	//  Sure background area
+	Mat sure_bg;
+	Mat kernel(3, 3, CV_8UC1);
+	kernel = cv::Scalar(1);
+	dilate(opening, sure_bg, kernel, Point(-1, -1), 3);
+
+	//  Finding sure foreground area
+	Mat dist_transform;
+	threshold(opening, opening, 50, 255, CV_THRESH_BINARY);
+	distanceTransform(opening, dist_transform, DIST_L2, 5);
+	Mat sure_fg;
+	threshold(dist_transform, sure_fg, 4, 255, THRESH_TOZERO);
+
+	//  Finding unknown region
+	{
+		TRACE_SCOPE("convertTo");
+		sure_fg.convertTo(sure_fg, CV_8UC1);
+		TRACE_COUNT("pixels converted", static_cast<long long>(sure_fg.total()));
+	}
+	Mat unknown;
+	subtract(sure_bg, sure_fg, unknown);
+
+	//  Marker labelling
+	Mat markers;
+	count = connectedComponents(sure_fg, markers, 8, CV_32S);
+
+	//  Add one to all labels so that sure background is not 0, but 1
+	//  Also mark the region of unknown with zero
+	for (int r = 0; r < markers.rows; r++)
+	{
+		int* marker = markers.ptr<int>(r);
+		const uchar* unknownRow = unknown.ptr<uchar>(r);
+		for (int c = 0; c < markers.cols; c++)
+		{
+			marker[c] = unknownRow[c] == 255 ? 0 : marker[c] + 1;
+		}
+	}
+
+	//  Apply watershed method
+	watershed(tileColor, markers);
+	labels = markers(Rect(core.x - outer.x, core.y - outer.y, core.width, core.height)).clone();
+}
+
+//  findRoot
+//  Finds the representative of a label in the union-find forest, halving the
+//  path on the way.
+static int findRoot(vector<int>& parent, int label)
+{
+	while (parent[label] != label)
+	{
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
+
+//  joinLabels
+//  Merges the regions of two labels that touch across a tile edge. The smaller
+//  label becomes the representative. Lines and the background are never merged.
+static void joinLabels(vector<int>& parent, int a, int b)
+{
+	if (a <= 1 || b <= 1 || a == b)
+	{
+		return;
+	}
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	if (a != b)
+	{
+		parent[max(a, b)] = min(a, b);
+	}
+}
+
+//  WatershedSegment
+//  Applies Watershed segmentation to the supplied image without any GUI. The image
+//  is cut into tiles of tileRows x tileCols pixels which are segmented in parallel
+//  on numThreads threads (0 uses every core). Each tile is segmented together with
+//  a margin of its neighbours, and regions that continue across tile edges are
+//  merged afterwards, so the tiles join up into one labelling.
+//  Pre-Conditions: img is a 8UC, wherein bright values indicate areas of interest.
+//  img is expected to be either grayscale (8UC1) or color (8UC3).
+//  Post-Conditions: Returns the overlay and the label raster (see WatershedResult).
+//  Regions are numbered tile by tile, so the result does not depend on the number
+//  of threads.
+//  NOTE: The Otsu threshold is found once for the whole image so that every tile
+//  separates areas of interest the same way.
+WatershedResult WatershedSegment(const Mat& img, int tileRows, int tileCols, int numThreads)
+{
+	TRACE_SCOPE("WatershedSegment");
+	WatershedResult result;
+	if (img.empty())
+	{
+		return result;
+	}
+
+	//  Create a binary threshold image
+	Mat color;
+	Mat gray;
+	if (img.channels() == 1)
+	{
+		gray = img;
+		cvtColor(img, color, CV_GRAY2BGR);
+	}
+	else
+	{
+		color = img.clone();
+		cvtColor(img, gray, CV_BGR2GRAY);
+	}
+	Mat thresh;
+	threshold(gray, thresh, 0, 255, THRESH_BINARY_INV + THRESH_OTSU);
+
+	//  Segment every tile with its margin
+	int rows = img.rows;
+	int cols = img.cols;
+	tileRows = max(tileRows, 1);
+	tileCols = max(tileCols, 1);
+	int tilesDown = (rows + tileRows - 1) / tileRows;
+	int tilesAcross = (cols + tileCols - 1) / tileCols;
+	int tileCount = tilesDown * tilesAcross;
+	Rect bounds(0, 0, cols, rows);
+	vector<Rect> cores(tileCount);
+	vector<Mat> tileLabels(tileCount);
+	vector<int> tileCounts(tileCount, 0);
+	parallelFor(tileCount, numThreads, [&](int t)
+	{
+		int top = (t / tilesAcross) * tileRows;
+		int left = (t % tilesAcross) * tileCols;
+		cores[t] = Rect(left, top, min(tileCols, cols - left), min(tileRows, rows - top));
+		Rect outer(cores[t].x - WATERSHED_MARGIN, cores[t].y - WATERSHED_MARGIN,
+			cores[t].width + 2 * WATERSHED_MARGIN, cores[t].height + 2 * WATERSHED_MARGIN);
+		segmentTile(color, thresh, cores[t], outer & bounds, tileLabels[t], tileCounts[t]);
+	});
+
+	//  Give every tile's regions their own range of labels, sharing the background
+	vector<int> firstLabel(tileCount);
+	int labelCount = 2;
+	for (int t = 0; t < tileCount; ++t)
+	{
+		firstLabel[t] = labelCount;
+		labelCount += max(tileCounts[t] - 1, 0);
+	}
+	result.labels = Mat(rows, cols, CV_32SC1);
+	parallelFor(tileCount, numThreads, [&](int t)
+	{
+		for (int r = 0; r < cores[t].height; ++r)
+		{
+			const int* src = tileLabels[t].ptr<int>(r);
+			int* dst = result.labels.ptr<int>(cores[t].y + r) + cores[t].x;
+			for (int c = 0; c < cores[t].width; ++c)
+			{
+				dst[c] = src[c] <= 1 ? src[c] : firstLabel[t] + src[c] - 2;
+			}
+		}
+		tileLabels[t].release();
+	});
+
+	//  Merge regions that touch across tile edges
+	vector<int> parent(labelCount);
+	for (int i = 0; i < labelCount; ++i)
+	{
+		parent[i] = i;
+	}
+	for (int x = tileCols; x < cols; x += tileCols)
+	{
+		for (int r = 0; r < rows; ++r)
+		{
+			joinLabels(parent, result.labels.at<int>(r, x - 1), result.labels.at<int>(r, x));
+		}
+	}
+	for (int y = tileRows; y < rows; y += tileRows)
+	{
+		const int* above = result.labels.ptr<int>(y - 1);
+		const int* below = result.labels.ptr<int>(y);
+		for (int c = 0; c < cols; ++c)
+		{
+			joinLabels(parent, above[c], below[c]);
+		}
+	}
+
+	//  Number the merged regions without gaps and draw the lines
+	vector<int> finalLabel(labelCount, 0);
+	int nextLabel = 2;
+	finalLabel[1] = 1;
+	for (int i = 2; i < labelCount; ++i)
+	{
+		int root = findRoot(parent, i);
+		finalLabel[i] = (root == i) ? nextLabel++ : finalLabel[root];
+	}
+	result.overlay = color;
+	parallelFor(tileCount, numThreads, [&](int t)
+	{
+		for (int r = cores[t].y; r < cores[t].y + cores[t].height; ++r)
+		{
+			int* label = result.labels.ptr<int>(r);
+			Vec3b* pixel = result.overlay.ptr<Vec3b>(r);
+			for (int c = cores[t].x; c < cores[t].x + cores[t].width; ++c)
+			{
+				if (label[c] > 0)
+				{
+					label[c] = finalLabel[label[c]];
+				}
+				else if (label[c] == -1)
+				{
+					pixel[c] = Vec3b(0, 255, 0);
+				}
+			}
+		}
+	});
+	return result;
+}
+
+//  Watershed
+//  This method applies Watershed segmetation on the supplied image, returning
+//  and image whose green channel is made up of the watershed lines. If display
+//  is set the image is shown to the user at the end of the method (with a
+//  waitKey(0)) and saved as "Watershed.png".
+//  Pre-Conditions: Img is a 8UC, wherein bright values indicate areas of
+//  interest. Img is expected to be either grayscale (8UC1) or color (8UC3).
+//  Post-Conditions: The original img is returned with watershed markings overlayed
+//  in pure-green (0, 255, 0). Bright areas are outlined as areas of interest. The
+//  returned Img is always 8UC3.
+//  NOTE: The segmentation is done by WatershedSegment with its default tiles.
+//  DISCLAIMER: This code is adapted from the example for watershed segmentnation
+//  written in Python at the following link:
+//  http:// docs.opencv.org/3.1.0/d3/db4/tutorial_py_watershed.html
+Mat Watershed(Mat img, bool display)
+{
+	TraceScope stage("Watershed");
+	img = WatershedSegment(img).overlay;
+	stage.End();
+
+	//  Show generaed watershed image with markers
+	if (display)
+	{
+		imshow("Watershed", img);
+		imwrite("Watershed.png", img);
+		waitKey(0);
+	}
+
+	return img;
+}
@@ -0,0 +1,49 @@
+/*
+Watershed segmentation of filter maps, so that areas of interest found by a
+SpecFilter can be outlined.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+//  WatershedResult
+//  The output of WatershedSegment.
+struct WatershedResult
+{
+	Mat overlay;  //  The input image (8UC3) with the watershed lines in pure-green
+	Mat labels;   //  32SC1 labels: -1 on watershed lines, 1 for the background and
+	              //  2 and up for the segmented regions
+};
+
+//  WatershedSegment
+//  Applies Watershed segmentation to the supplied image without any GUI. The image
+//  is cut into tiles of tileRows x tileCols pixels which are segmented in parallel
+//  on numThreads threads (0 uses every core). Each tile is segmented together with
+//  a margin of its neighbours, and regions that continue across tile edges are
+//  merged afterwards, so the tiles join up into one labelling.
+//  Pre-Conditions: img is a 8UC, wherein bright values indicate areas of interest.
+//  img is expected to be either grayscale (8UC1) or color (8UC3).
+//  Post-Conditions: Returns the overlay and the label raster (see WatershedResult).
+//  Regions are numbered tile by tile, so the result does not depend on the number
+//  of threads.
+//  NOTE: The Otsu threshold is found once for the whole image so that every tile
+//  separates areas of interest the same way.
+WatershedResult WatershedSegment(const Mat& img, int tileRows = 512, int tileCols = 512, int numThreads = 0);
+
+//  Watershed
+//  This method applies Watershed segmetation on the supplied image, returning
+//  and image whose green channel is made up of the watershed lines. If display
+//  is set the image is shown to the user at the end of the method (with a
+//  waitKey(0)) and saved as "Watershed.png".
+//  Pre-Conditions: Img is a 8UC, wherein bright values indicate areas of
+//  interest. Img is expected to be either grayscale (8UC1) or color (8UC3).
+//  Post-Conditions: The original img is returned with watershed markings overlayed
+//  in pure-green (0, 255, 0). Bright areas are outlined as areas of interest. The
+//  returned Img is always 8UC3.
+//  NOTE: The segmentation is done by WatershedSegment with its default tiles.
+//  DISCLAIMER: This code is adapted from the example for watershed segmentnation
+//  written in Python at the following link:
+//  http:// docs.opencv.org/3.1.0/d3/db4/tutorial_py_watershed.html
+Mat Watershed(Mat img, bool display = true);
@@ -0,0 +1,75 @@
+#include "Workspace.h"
+
+//  Workspace
+//  Creates an empty workspace. Buffers are allocated by the first calls that
+//  use them.
+Workspace::Workspace()
+{
+	planes.resize(PLANE_COUNT);
+}
+
+//  getPlane
+//  Fetches a whole-image buffer with the given size and type.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns a Mat that shares the workspace's buffer. It is only
+//  reallocated if its size or type changed since the last call.
+Mat Workspace::getPlane(Plane plane, int rows, int cols, int type)
+{
+	planes[plane].create(rows, cols, type);
+	return planes[plane];
+}
+
+//  Reserve
+//  Makes sure the workspace has at least the given number of slots, one per
+//  worker thread of the runs that use it.
+//  Pre-Conditions: No parallel run is using the workspace's slots.
+//  Post-Conditions: getSlot can be called for every index below count.
+void Workspace::Reserve(int count)
+{
+	if (count > static_cast<int>(slots.size()))
+	{
+		slots.resize(count);
+	}
+}
+
+//  getSlot
+//  Fetches the scratch memory of one worker thread.
+//  Pre-Conditions: index is below the number of slots reserved.
+Workspace::Slot& Workspace::getSlot(int index)
+{
+	return slots[index];
+}
+
+//  getScores
+//  STATIC method that fetches at least count scores of a slot's block scores.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns the start of the slot's block scores, grown only if
+//  it held fewer than count scores.
+int* Workspace::getScores(Slot& slot, size_t count)
+{
+	if (slot.scores.total() < count)
+	{
+		slot.scores.create(1, static_cast<int>(count), CV_32SC1);
+	}
+	return slot.scores.ptr<int>(0);
+}
+
+//  getBytes
+//  Returns the total size of the workspace's buffers, in bytes.
+size_t Workspace::getBytes() const
+{
+	size_t bytes = 0;
+	for (size_t p = 0; p < planes.size(); ++p)
+	{
+		bytes += planes[p].total() * planes[p].elemSize();
+	}
+	for (size_t s = 0; s < slots.size(); ++s)
+	{
+		bytes += slots[s].scores.total() * slots[s].scores.elemSize();
+		for (size_t b = 0; b < slots[s].converted.size(); ++b)
+		{
+			bytes += slots[s].converted[b].total() * slots[s].converted[b].elemSize();
+		}
+	}
+	return bytes;
+}
@@ -0,0 +1,88 @@
+/*
+Workspace holds the scratch memory of filter and composite runs so it can be
+reused from one call to the next. SpecFilter::filter and filterTiled keep their
+result image, their per-tile score ranges and every worker thread's block scores
+and converted band windows in it, and SpecImage::getComposite and makeComposite keep
+their converted channels and merged image in it. Once a workspace has served a
+call for a scene of some size, later calls for scenes of that size reuse the
+same buffers instead of allocating and page-faulting fresh memory.
+
+Buffers are cv::Mats, allocated by OpenCV's aligned allocator. A workspace is
+not thread safe: give every thread that runs filters or composites its own.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+class Workspace
+{
+	public:
+		//  Whole-image buffers a workspace keeps, one of each
+		enum Plane
+		{
+			FILTER_RESULT,    //  Result image of SpecFilter::filter and filterTiled
+			TILE_LOW,         //  Lowest score of every tile of filterTiled
+			TILE_HIGH,        //  Highest score of every tile of filterTiled
+			COMPOSITE_RED,    //  Converted channels of getComposite and makeComposite
+			COMPOSITE_GREEN,
+			COMPOSITE_BLUE,
+			COMPOSITE,        //  Merged result of getComposite and makeComposite
+			PLANE_COUNT
+		};
+
+		//  Slot
+		//  Scratch memory of one worker thread of a parallel run (see 
+		//  parallelForWorkers), reused for every task the thread runs, such as the
+		//  tiles of filterTiled. Vectors are cleared rather than freed between uses.
+		struct Slot
+		{
+			Mat scores;              //  CV_32SC1 block scores
+			vector<Mat> images;      //  Band windows being scored
+			vector<Mat> converted;   //  Band windows converted to CV_16UC1
+			vector<int> bands;
+			vector<int> references;
+			vector<int> weights;
+		};
+
+		//  Workspace
+		//  Creates an empty workspace. Buffers are allocated by the first calls that
+		//  use them.
+		Workspace();
+
+		//  getPlane
+		//  Fetches a whole-image buffer with the given size and type.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns a Mat that shares the workspace's buffer. It is only
+		//  reallocated if its size or type changed since the last call.
+		Mat getPlane(Plane plane, int rows, int cols, int type);
+
+		//  Reserve
+		//  Makes sure the workspace has at least the given number of slots, one per
+		//  worker thread of the runs that use it.
+		//  Pre-Conditions: No parallel run is using the workspace's slots.
+		//  Post-Conditions: getSlot can be called for every index below count.
+		void Reserve(int count);
+
+		//  getSlot
+		//  Fetches the scratch memory of one worker thread.
+		//  Pre-Conditions: index is below the number of slots reserved.
+		Slot& getSlot(int index);
+
+		//  getScores
+		//  STATIC method that fetches at least count scores of a slot's block scores.
+		//  Pre-Conditions: None
+		//  Post-Conditions: Returns the start of the slot's block scores, grown only if
+		//  it held fewer than count scores.
+		static int* getScores(Slot& slot, size_t count);
+
+		//  getBytes
+		//  Returns the total size of the workspace's buffers, in bytes.
+		size_t getBytes() const;
+
+	private:
+		vector<Mat> planes;
+		vector<Slot> slots;
+};
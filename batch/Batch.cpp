@@ -0,0 +1,451 @@
+/*
+Batch runs the hyperspectral products over many scenes without any GUI. The work
+is pipelined in three stages connected by bounded queues: while scene N is being
+filtered, scene N+1 is loaded from disk and the outputs of scene N-1 are written.
+
+Usage: batch [options] SCENE...
+	--scenes FILE     Read more scene folders from FILE, one per line
+	--filter FILE     USGS filter file to map, may be repeated
+	--products LIST   Comma separated products to make (default all of them):
+	                    vegetation  color and SWIR composites, vegetation health maps
+	                    filters     one map per --filter, named after the file (with a
+	                                number added if another output has the name)
+	                    treeswater  trees and water maps and their composite
+	                    watershed   watershed segmentation of the trees/water composite
+	--trees FILE      Trees filter for treeswater and watershed (default douglas_fir.txt)
+	--water FILE      Water filter for treeswater and watershed (default water.txt)
+	--output DIR      Output folder, one subfolder per scene (default output)
+	--threads N       Threads for loading and filtering, 0 uses every core (default 0)
+	--load-threads N  Threads of --threads given to loading, the rest go to filtering,
+	                  which runs at the same time (default half of them)
+	--queue N         Scenes that may wait between two stages (default 1)
+	--trace FILE      Trace the run (see Trace.h) into a Chrome trace file and
+	                  print a summary table on standard error
+
+Returns 0 if every scene was processed, otherwise 1.
+*/
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <cctype>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "FilterBank.h"
+#include "Parallel.h"
+#include "Products.h"
+#include "SpecImage.h"
+#include "Trace.h"
+#include "Watershed.h"
+
+using namespace cv;
+using namespace std;
+
+struct BatchOptions
+{
+	vector<string> scenes;
+	vector<string> filterFiles;
+	bool vegetation;
+	bool filters;
+	bool treesWater;
+	bool watershed;
+	string treesFilter;
+	string waterFilter;
+	string outputFolder;
+	int numThreads;
+	int loadThreads;                 //  Share of numThreads used by the load stage
+	int filterThreads;               //  Share of numThreads used by the filter stage
+	int queueSize;
+	string traceFile;
+};
+
+//  SceneJob
+//  One scene as it moves through the pipeline.
+struct SceneJob
+{
+	string scene;                    //  Scene folder name
+	shared_ptr<SpecImage> image;     //  Loaded scene, released once filtered
+	vector<pair<string, Mat> > outputs;  //  Output file name and image
+	string error;                    //  Why the scene failed, empty on success
+	double loadMs;
+	double filterMs;
+};
+
+//  elapsedMs
+//  Returns the milliseconds since a getTickCount() time.
+static double elapsedMs(int64 start)
+{
+	return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+//  fileStem
+//  Returns a path's file name without folders or extension.
+//  Ex: "filters/douglas_fir.txt" returns "douglas_fir"
+static string fileStem(const string& path)
+{
+	return filesystem::path(path).stem().string();
+}
+
+//  uniqueName
+//  Returns name, or name followed by the first number that makes it unique,
+//  and adds the result to taken. Names are compared without case, as output
+//  file names may be on a case insensitive file system.
+//  Ex: "trees" returns "trees_2" if taken holds "trees"
+static string uniqueName(const string& name, set<string>& taken)
+{
+	string unique = name;
+	for (int n = 2; ; n++)
+	{
+		string key = unique;
+		for (size_t i = 0; i < key.size(); i++)
+		{
+			key[i] = static_cast<char>(tolower(static_cast<unsigned char>(key[i])));
+		}
+		if (taken.insert(key).second)
+		{
+			return unique;
+		}
+		unique = name + "_" + to_string(n);
+	}
+}
+
+//  parseArguments
+//  Reads the command line into options.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns false (after printing an error) if an argument is
+//  unknown or missing its value, or if there is nothing to do. The thread
+//  budget is split between the load and filter stages, which run at once.
+static bool parseArguments(int argc, char* argv[], BatchOptions& options)
+{
+	options.vegetation = true;
+	options.filters = true;
+	options.treesWater = true;
+	options.watershed = true;
+	options.treesFilter = "douglas_fir.txt";
+	options.waterFilter = "water.txt";
+	options.outputFolder = "output";
+	options.numThreads = 0;
+	options.loadThreads = 0;
+	options.queueSize = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0)
+		{
+			options.scenes.push_back(arg);
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			cerr << "Error - Missing value for \"" << arg << "\"." << endl;
+			return false;
+		}
+		string value = argv[++i];
+		if (arg == "--scenes")
+		{
+			ifstream list(value);
+			if (!list.is_open())
+			{
+				cerr << "Error - Could not find scene list \"" << value << "\"." << endl;
+				return false;
+			}
+			string line;
+			while (getline(list, line))
+			{
+				line.erase(line.find_last_not_of(" \t\r") + 1);
+				if (!line.empty())
+				{
+					options.scenes.push_back(line);
+				}
+			}
+		}
+		else if (arg == "--filter") options.filterFiles.push_back(value);
+		else if (arg == "--products")
+		{
+			options.vegetation = options.filters = options.treesWater = options.watershed = false;
+			stringstream products(value);
+			string product;
+			while (getline(products, product, ','))
+			{
+				if (product == "vegetation") options.vegetation = true;
+				else if (product == "filters") options.filters = true;
+				else if (product == "treeswater") options.treesWater = true;
+				else if (product == "watershed") options.watershed = true;
+				else
+				{
+					cerr << "Error - Unknown product \"" << product << "\"." << endl;
+					return false;
+				}
+			}
+		}
+		else if (arg == "--trees") options.treesFilter = value;
+		else if (arg == "--water") options.waterFilter = value;
+		else if (arg == "--output") options.outputFolder = value;
+		else if (arg == "--threads") options.numThreads = atoi(value.c_str());
+		else if (arg == "--load-threads") options.loadThreads = atoi(value.c_str());
+		else if (arg == "--queue") options.queueSize = max(1, atoi(value.c_str()));
+		else if (arg == "--trace") options.traceFile = value;
+		else
+		{
+			cerr << "Error - Unknown argument \"" << arg << "\"." << endl;
+			return false;
+		}
+	}
+
+	if (options.scenes.empty())
+	{
+		cerr << "Error - No scenes given." << endl;
+		return false;
+	}
+
+	int threads = resolveThreadCount(options.numThreads);
+	if (options.loadThreads <= 0)
+	{
+		options.loadThreads = max(1, threads / 2);
+	}
+	options.filterThreads = max(1, threads - options.loadThreads);
+	return true;
+}
+
+//  loadScene
+//  First stage: reads every band of a scene.
+//  Pre-Conditions: None
+//  Post-Conditions: job holds the loaded image, or an error if no band could be
+//  loaded.
+static void loadScene(SceneJob& job, const BatchOptions& options)
+{
+	TRACE_SCOPE("Batch::load");
+	int64 start = getTickCount();
+	job.image = make_shared<SpecImage>();
+	job.image->LoadFromFile(job.scene, SpecImage::BSQ, options.loadThreads);
+	job.loadMs = elapsedMs(start);
+
+	vector<SpecImage::BandLoadStatus> status = job.image->getLoadStatus();
+	int loaded = 0;
+	for (size_t b = 0; b < status.size(); b++)
+	{
+		loaded += status[b].loaded ? 1 : 0;
+	}
+	if (loaded == 0)
+	{
+		job.error = "no bands could be loaded";
+		job.image.reset();
+	}
+}
+
+//  filterScene
+//  Second stage: makes every selected product of a loaded scene. All filter maps
+//  come from a single pass of bank over the image.
+//  Pre-Conditions: The scene was loaded. bank holds the --filter files first,
+//  followed by the trees and water filters if treesWater or watershed is made.
+//  Post-Conditions: job holds the products' images and no longer holds the scene.
+static void filterScene(SceneJob& job, const BatchOptions& options, const FilterBank& bank)
+{
+	TRACE_SCOPE("Batch::filter");
+	int64 start = getTickCount();
+
+	if (options.vegetation)
+	{
+		VegetationMaps maps = MakeVegetationMaps(*job.image, options.filterThreads);
+		job.outputs.push_back(make_pair("ColorComposite.png", maps.colorComposite));
+		job.outputs.push_back(make_pair("SWIR.png", maps.swir));
+		job.outputs.push_back(make_pair("RedVegGray.png", maps.redVegetationGray));
+		job.outputs.push_back(make_pair("RedVegColor.png", maps.redVegetationColor));
+	}
+
+	vector<Mat> maps;
+	if (bank.getCount() > 0)
+	{
+		maps = bank.filter(*job.image, options.filterThreads);
+	}
+	int filterCount = options.filters ? static_cast<int>(options.filterFiles.size()) : 0;
+	for (int f = 0; f < filterCount && f < static_cast<int>(maps.size()); f++)
+	{
+		job.outputs.push_back(make_pair(bank.getName(f) + ".png", maps[f]));
+	}
+
+	if ((options.treesWater || options.watershed) && static_cast<int>(maps.size()) >= filterCount + 2)
+	{
+		Mat trees = maps[filterCount];
+		Mat water = maps[filterCount + 1];
+		Mat waterAndTrees = MakeTreesWaterComposite(trees, water, options.filterThreads);
+		if (options.treesWater)
+		{
+			job.outputs.push_back(make_pair("trees.png", trees));
+			job.outputs.push_back(make_pair("water.png", water));
+			job.outputs.push_back(make_pair("waterAndTrees.png", waterAndTrees));
+		}
+		if (options.watershed)
+		{
+			job.outputs.push_back(make_pair("Watershed.png",
+				WatershedSegment(waterAndTrees, 512, 512, options.filterThreads).overlay));
+		}
+	}
+
+	job.image.reset();
+	job.filterMs = elapsedMs(start);
+}
+
+//  writeScene
+//  Third stage: writes a scene's outputs to <output>/<scene>/.
+//  Pre-Conditions: None
+//  Post-Conditions: Every output was written, or job holds an error.
+static void writeScene(SceneJob& job, const BatchOptions& options)
+{
+	TRACE_SCOPE("Batch::write");
+	filesystem::path folder = filesystem::path(options.outputFolder) / filesystem::path(job.scene).filename();
+	error_code error;
+	filesystem::create_directories(folder, error);
+	if (error)
+	{
+		job.error = "could not create " + folder.string();
+		return;
+	}
+	for (size_t i = 0; i < job.outputs.size(); i++)
+	{
+		string fileName = (folder / job.outputs[i].first).string();
+		if (job.outputs[i].second.empty() || !imwrite(fileName, job.outputs[i].second))
+		{
+			job.error = "could not write " + fileName;
+		}
+	}
+}
+
+//  main
+//  Runs the three pipeline stages (load, filter, write) on their own threads.
+//  Pre-Conditions: The scene folders and filter files exist.
+//  Post-Conditions: Returns 0 if every scene was processed, otherwise 1.
+int main(int argc, char* argv[])
+{
+	BatchOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		return 1;
+	}
+	Trace::Enable(!options.traceFile.empty());
+
+	//  Filters are loaded once and shared by every scene. Their maps are written
+	//  under the filter's name, so it may not be the name of another output.
+	FilterBank bank;
+	if (options.filters)
+	{
+		set<string> taken = { "colorcomposite", "swir", "redveggray", "redvegcolor", "trees", "water",
+			"waterandtrees", "watershed" };
+		for (size_t f = 0; f < options.filterFiles.size(); f++)
+		{
+			string name = uniqueName(fileStem(options.filterFiles[f]), taken);
+			if (!bank.AddFilterFromFile(name, options.filterFiles[f]))
+			{
+				return 1;
+			}
+		}
+	}
+	if (options.treesWater || options.watershed)
+	{
+		if (!bank.AddFilterFromFile("trees", options.treesFilter) ||
+			!bank.AddFilterFromFile("water", options.waterFilter))
+		{
+			return 1;
+		}
+	}
+
+	BoundedQueue<SceneJob> loaded(options.queueSize);
+	BoundedQueue<SceneJob> filtered(options.queueSize);
+	int failed = 0;
+
+	thread loader([&]()
+	{
+		for (size_t s = 0; s < options.scenes.size(); s++)
+		{
+			SceneJob job;
+			job.scene = options.scenes[s];
+			job.loadMs = 0;
+			job.filterMs = 0;
+			try
+			{
+				loadScene(job, options);
+			}
+			catch (const exception& e)
+			{
+				job.error = e.what();
+				job.image.reset();
+			}
+			if (!loaded.Push(move(job)))
+			{
+				break;
+			}
+		}
+		loaded.Close();
+	});
+
+	thread writer([&]()
+	{
+		SceneJob job;
+		while (filtered.Pop(job))
+		{
+			int64 start = getTickCount();
+			if (job.error.empty())
+			{
+				try
+				{
+					writeScene(job, options);
+				}
+				catch (const exception& e)
+				{
+					job.error = e.what();
+				}
+			}
+			if (!job.error.empty())
+			{
+				cerr << "Error - Scene \"" << job.scene << "\": " << job.error << endl;
+				failed++;
+				continue;
+			}
+			cerr << job.scene << ": loaded in " << job.loadMs << "ms, filtered in " << job.filterMs
+				<< "ms, written in " << elapsedMs(start) << "ms" << endl;
+		}
+	});
+
+	//  The filter stage runs on this thread
+	SceneJob job;
+	while (loaded.Pop(job))
+	{
+		if (job.error.empty())
+		{
+			try
+			{
+				filterScene(job, options, bank);
+			}
+			catch (const exception& e)
+			{
+				job.error = e.what();
+				job.image.reset();
+			}
+		}
+		filtered.Push(move(job));
+	}
+	filtered.Close();
+
+	loader.join();
+	writer.join();
+
+	if (Trace::isEnabled())
+	{
+		Trace::Enable(false);
+		Trace::WriteChromeTrace(options.traceFile);
+		Trace::WriteSummary(cerr);
+	}
+	cerr << options.scenes.size() - failed << " of " << options.scenes.size() << " scenes processed" << endl;
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,441 @@
+/*
+Benchmark times the main stages of the hyperspectral pipeline on a synthetic
+Hyperion scene, so that regressions can be caught and optimized paths can be
+compared against the reference implementations. It runs headless.
+
+Usage: benchmark [options]
+	--rows N         Scene height in pixels (default 256)
+	--cols N         Scene width in pixels (default 256)
+	--scene NAME     Scene folder, must end in _1T (default EO1HSYNTHETIC_1T)
+	--filter FILE    USGS filter file to run (default douglas_fir.txt)
+	--material FILE  USGS file used as a scene material, may be repeated
+	                 (default douglas_fir.txt and water.txt)
+	--threads N      Threads for the parallel stages, 0 uses every core (default 0)
+	--warmup N       Untimed runs before each benchmark (default 1)
+	--reps N         Timed runs of each benchmark (default 5)
+	--format F       json or csv (default json)
+	--output FILE    Write results to FILE instead of standard output
+	--trace FILE     Trace every run (see Trace.h) into a Chrome trace file
+	                 and print a summary table on standard error
+	--keep           Keep the generated scene instead of deleting it
+	--reuse          Use an existing scene folder instead of generating one
+*/
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Parallel.h"
+#include "ReducedCube.h"
+#include "SpecFilter.h"
+#include "SpecImage.h"
+#include "SpectralIndex.h"
+#include "SpectralLibrary.h"
+#include "SyntheticScene.h"
+#include "Trace.h"
+#include "Watershed.h"
+#include "Workspace.h"
+
+using namespace cv;
+using namespace std;
+
+struct BenchmarkOptions
+{
+	SyntheticSceneOptions scene;
+	string sceneName;
+	string filterFile;
+	vector<string> materialFiles;
+	int numThreads;
+	int warmup;
+	int repetitions;
+	string format;
+	string outputFile;
+	string traceFile;
+	bool keep;
+	bool reuse;
+};
+
+struct BenchmarkResult
+{
+	string name;          //  Stage being timed
+	int threads;          //  Threads the stage was given (1 for serial stages)
+	int operations;       //  Calls made per timed run
+	vector<double> ms;    //  Time of each timed run, in milliseconds
+};
+
+//  parseArguments
+//  Reads the command line into options.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns false (after printing an error) if an argument is
+//  unknown or missing its value.
+static bool parseArguments(int argc, char* argv[], BenchmarkOptions& options)
+{
+	options.sceneName = "EO1HSYNTHETIC_1T";
+	options.filterFile = "douglas_fir.txt";
+	options.numThreads = 0;
+	options.warmup = 1;
+	options.repetitions = 5;
+	options.format = "json";
+	options.keep = false;
+	options.reuse = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--keep")
+		{
+			options.keep = true;
+			continue;
+		}
+		if (arg == "--reuse")
+		{
+			options.reuse = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			cerr << "Error - Missing value for \"" << arg << "\"." << endl;
+			return false;
+		}
+		string value = argv[++i];
+		if (arg == "--rows") options.scene.rows = atoi(value.c_str());
+		else if (arg == "--cols") options.scene.cols = atoi(value.c_str());
+		else if (arg == "--scene") options.sceneName = value;
+		else if (arg == "--filter") options.filterFile = value;
+		else if (arg == "--material") options.materialFiles.push_back(value);
+		else if (arg == "--threads") options.numThreads = atoi(value.c_str());
+		else if (arg == "--warmup") options.warmup = max(0, atoi(value.c_str()));
+		else if (arg == "--reps") options.repetitions = max(1, atoi(value.c_str()));
+		else if (arg == "--format") options.format = value;
+		else if (arg == "--output") options.outputFile = value;
+		else if (arg == "--trace") options.traceFile = value;
+		else
+		{
+			cerr << "Error - Unknown argument \"" << arg << "\"." << endl;
+			return false;
+		}
+	}
+
+	if (options.format != "json" && options.format != "csv")
+	{
+		cerr << "Error - Unknown format \"" << options.format << "\"." << endl;
+		return false;
+	}
+	if (options.materialFiles.empty())
+	{
+		options.materialFiles.push_back("douglas_fir.txt");
+		options.materialFiles.push_back("water.txt");
+	}
+	options.scene.numThreads = options.numThreads;
+	return true;
+}
+
+//  measure
+//  Times a stage. The stage is run warmup times untimed, then repetitions times
+//  timed.
+//  Pre-Conditions: stage can be run repeatedly.
+//  Post-Conditions: Returns the time of every timed run.
+static BenchmarkResult measure(const string& name, int threads, int operations,
+	const BenchmarkOptions& options, const function<void()>& stage)
+{
+	BenchmarkResult result = { name, threads, operations, vector<double>() };
+	for (int i = 0; i < options.warmup; i++)
+	{
+		stage();
+	}
+	for (int i = 0; i < options.repetitions; i++)
+	{
+		int64 start = getTickCount();
+		stage();
+		result.ms.push_back((getTickCount() - start) * 1000.0 / getTickFrequency());
+	}
+	cerr << name << " (" << threads << " threads): " << result.ms.front() << "ms" << endl;
+	return result;
+}
+
+//  summarize
+//  Computes the minimum, median, mean and maximum of a run's times.
+//  Pre-Conditions: ms is not empty.
+//  Post-Conditions: The statistics are returned through the references.
+static void summarize(vector<double> ms, double& low, double& median, double& mean, double& high)
+{
+	sort(ms.begin(), ms.end());
+	low = ms.front();
+	high = ms.back();
+	size_t middle = ms.size() / 2;
+	median = ms.size() % 2 ? ms[middle] : (ms[middle - 1] + ms[middle]) / 2;
+	mean = 0;
+	for (size_t i = 0; i < ms.size(); i++)
+	{
+		mean += ms[i];
+	}
+	mean /= ms.size();
+}
+
+//  writeJson
+//  Writes the run's configuration and results as a JSON document.
+//  Pre-Conditions: None
+//  Post-Conditions: The document has been written to out.
+static void writeJson(ostream& out, const BenchmarkOptions& options, const vector<BenchmarkResult>& results)
+{
+	out << "{" << endl;
+	out << "  \"scene\": { \"rows\": " << options.scene.rows << ", \"cols\": " << options.scene.cols
+		<< ", \"bands\": 242 }," << endl;
+	out << "  \"threads\": " << resolveThreadCount(options.numThreads) << "," << endl;
+	out << "  \"warmup\": " << options.warmup << "," << endl;
+	out << "  \"repetitions\": " << options.repetitions << "," << endl;
+	out << "  \"results\": [" << endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		double low, median, mean, high;
+		summarize(results[i].ms, low, median, mean, high);
+		out << "    { \"name\": \"" << results[i].name << "\", \"threads\": " << results[i].threads
+			<< ", \"operations\": " << results[i].operations
+			<< ", \"min_ms\": " << low << ", \"median_ms\": " << median
+			<< ", \"mean_ms\": " << mean << ", \"max_ms\": " << high << ", \"runs_ms\": [";
+		for (size_t r = 0; r < results[i].ms.size(); r++)
+		{
+			out << (r ? ", " : "") << results[i].ms[r];
+		}
+		out << "] }" << (i + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl;
+	out << "}" << endl;
+}
+
+//  writeCsv
+//  Writes one line per result, after a header line.
+//  Pre-Conditions: None
+//  Post-Conditions: The table has been written to out.
+static void writeCsv(ostream& out, const BenchmarkOptions& options, const vector<BenchmarkResult>& results)
+{
+	out << "name,threads,operations,rows,cols,repetitions,min_ms,median_ms,mean_ms,max_ms" << endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		double low, median, mean, high;
+		summarize(results[i].ms, low, median, mean, high);
+		out << results[i].name << "," << results[i].threads << "," << results[i].operations << ","
+			<< options.scene.rows << "," << options.scene.cols << "," << options.repetitions << ","
+			<< low << "," << median << "," << mean << "," << high << endl;
+	}
+}
+
+//  main
+//  Generates the synthetic scene, times every stage and reports the results.
+//  Pre-Conditions: The filter and material files can be found.
+//  Post-Conditions: Returns 0 if every stage ran, otherwise 1.
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		return 1;
+	}
+	int threads = resolveThreadCount(options.numThreads);
+
+	//  SpecImage reports progress on standard output, keep that clear for results
+	streambuf* resultBuffer = cout.rdbuf(cerr.rdbuf());
+
+	//  Build the scene
+	if (!options.reuse)
+	{
+		for (size_t i = 0; i < options.materialFiles.size(); i++)
+		{
+			SpecFilter material;
+			if (!material.LoadFromFile(options.materialFiles[i]))
+			{
+				return 1;
+			}
+			options.scene.materials.push_back(material);
+		}
+		cerr << "Generating " << options.scene.rows << "x" << options.scene.cols
+			<< " scene \"" << options.sceneName << "\".." << endl;
+		if (!GenerateSyntheticScene(options.sceneName, options.scene))
+		{
+			return 1;
+		}
+	}
+
+	vector<BenchmarkResult> results;
+	SpecImage hyperImage;
+	Trace::Enable(!options.traceFile.empty());
+
+	results.push_back(measure("SpecImage::LoadFromFile", threads, 1, options, [&]()
+	{
+		hyperImage.LoadFromFile(options.sceneName, SpecImage::BSQ, options.numThreads);
+	}));
+	results.push_back(measure("SpecImage::LoadFromFile", 1, 1, options, [&]()
+	{
+		hyperImage.LoadFromFile(options.sceneName, SpecImage::BSQ, 1);
+	}));
+
+	//  One getImage per band centre
+	vector<int> wavelengths = hyperImage.getWavelengths();
+	results.push_back(measure("SpecImage::getImage", 1, static_cast<int>(wavelengths.size()), options, [&]()
+	{
+		for (size_t i = 0; i < wavelengths.size(); i++)
+		{
+			hyperImage.getImage(wavelengths[i]);
+		}
+	}));
+	results.push_back(measure("SpecImage::getComposite", 1, 1, options, [&]()
+	{
+		hyperImage.getComposite(641, 580, 509);
+	}));
+	Workspace workspace;
+	results.push_back(measure("SpecImage::getComposite (workspace)", 1, 1, options, [&]()
+	{
+		hyperImage.getComposite(641, 580, 509, &workspace);
+	}));
+
+	SpecFilter filter;
+	bool filterLoaded = true;
+	results.push_back(measure("SpecFilter::LoadFromFile", 1, 1, options, [&]()
+	{
+		filter = SpecFilter();
+		filterLoaded = filter.LoadFromFile(options.filterFile);
+	}));
+	if (!filterLoaded)
+	{
+		return 1;
+	}
+
+	Mat filterMap;
+	results.push_back(measure("SpecFilter::filter", threads, 1, options, [&]()
+	{
+		filterMap = filter.filter(hyperImage, options.numThreads);
+	}));
+	results.push_back(measure("SpecFilter::filter", 1, 1, options, [&]()
+	{
+		filterMap = filter.filter(hyperImage, 1);
+	}));
+
+	//  The original double precision filter, as the baseline the others are sped up from
+	results.push_back(measure("SpecFilter::filterReference", 1, 1, options, [&]()
+	{
+		filter.filterReference(hyperImage);
+	}));
+
+	//  The same run with its scratch memory and result kept in a workspace
+	results.push_back(measure("SpecFilter::filter (workspace)", threads, 1, options, [&]()
+	{
+		filter.filter(hyperImage, options.numThreads, &workspace);
+	}));
+
+	results.push_back(measure("SpecFilter::filterBranchAndBound", threads, 1, options, [&]()
+	{
+		filter.filterBranchAndBound(hyperImage, options.numThreads);
+	}));
+
+	//  One band at a time straight from the band files
+	results.push_back(measure("SpecFilter::filterStreaming", threads, 1, options, [&]()
+	{
+		filter.filterStreaming(options.sceneName, options.numThreads);
+	}));
+
+	//  Coarse to fine filtering against an 8x pyramid level
+	results.push_back(measure("SpecImage::BuildPyramid", threads, 1, options, [&]()
+	{
+		hyperImage.BuildPyramid(3, options.numThreads);
+	}));
+	FilterPlan coarsePlan = filter.Compile(hyperImage);
+	results.push_back(measure("SpecFilter::filterCoarseToFine", threads, 1, options, [&]()
+	{
+		SpecFilter::filterCoarseToFine(hyperImage, coarsePlan, 3, options.numThreads);
+	}));
+
+	//  Every built in index in one pass
+	IndexBank indices;
+	vector<pair<string, string> > standard = IndexBank::getStandardIndices();
+	for (size_t i = 0; i < standard.size(); i++)
+	{
+		indices.AddIndex(standard[i].first, standard[i].second);
+	}
+	results.push_back(measure("IndexBank::compute", threads, 1, options, [&]()
+	{
+		indices.compute(hyperImage, options.numThreads);
+	}));
+	results.push_back(measure("IndexBank::compute", 1, 1, options, [&]()
+	{
+		indices.compute(hyperImage, 1);
+	}));
+
+	//  Filter matching in a reduced space against the full-band distance
+	ReducedCube reduced;
+	results.push_back(measure("ReducedCube::Build", threads, 1, options, [&]()
+	{
+		reduced.Build(hyperImage, 10, options.numThreads);
+	}));
+	FilterPlan plan = filter.Compile(hyperImage);
+	results.push_back(measure("ReducedCube::Distance", threads, 1, options, [&]()
+	{
+		reduced.Distance(plan, options.numThreads);
+	}));
+	results.push_back(measure("ReducedCube::FullDistance", threads, 1, options, [&]()
+	{
+		reduced.FullDistance(hyperImage, plan, options.numThreads);
+	}));
+
+	//  Nearest material out of a library of smooth synthetic spectra
+	SpectralLibrary library;
+	mt19937 random(0x5EC7);
+	uniform_real_distribution<double> levels(0.05, 0.6);
+	uniform_real_distribution<double> slopes(-0.2, 0.2);
+	for (int m = 0; m < 256; m++)
+	{
+		SpecFilter material;
+		double level = levels(random);
+		double slope = slopes(random);
+		for (int nm = 400; nm <= 2500; nm += 10)
+		{
+			double t = (nm - 400) / 2100.0;
+			material.SetIntensityMicro(nm / 1000.0, level + slope * t + 0.05 * sin(t * (3 + m % 7)));
+		}
+		library.AddMaterial("material" + to_string(m), material);
+	}
+	results.push_back(measure("SpectralLibrary::classify", threads, 1, options, [&]()
+	{
+		Mat distance;
+		library.classify(hyperImage, distance, MATCH_MAX, options.numThreads);
+	}));
+
+	results.push_back(measure("Watershed", 1, 1, options, [&]()
+	{
+		Watershed(filterMap.clone(), false);
+	}));
+
+	//  Report
+	cout.rdbuf(resultBuffer);
+	if (Trace::isEnabled())
+	{
+		Trace::Enable(false);
+		Trace::WriteChromeTrace(options.traceFile);
+		Trace::WriteSummary(cerr);
+	}
+	if (options.outputFile.empty())
+	{
+		options.format == "json" ? writeJson(cout, options, results) : writeCsv(cout, options, results);
+	}
+	else
+	{
+		ofstream out(options.outputFile);
+		if (!out.is_open())
+		{
+			cerr << "Error - Could not write \"" << options.outputFile << "\"." << endl;
+			return 1;
+		}
+		options.format == "json" ? writeJson(out, options, results) : writeCsv(out, options, results);
+	}
+
+	if (!options.keep && !options.reuse)
+	{
+		RemoveSyntheticScene(options.sceneName);
+	}
+	return 0;
+}
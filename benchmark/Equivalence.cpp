@@ -0,0 +1,264 @@
+/*
+Equivalence checks every optimized filter path against SpecFilter::filterReference,
+the original double precision filter, on a synthetic Hyperion scene. It is run by
+ctest (add_test in CMakeLists.txt) from the build folder, where the filter files
+are copied.
+
+The scene is checked twice: as generated, and with one band replaced by a file a
+few rows short, which loading must reject (see SpecImage::LoadFromFile) so that
+every path leaves the band out as the reference does. The TIFF window decoder
+(see TiffCheck.h) and the watershed tiling (see WatershedCheck.h) are checked too.
+
+A pixel may only differ from the reference when its reference score lies within
+the fixed point tolerance documented in SADKernel.h of a threshold, where the
+rounding of the fixed point score can put it on the other side.
+
+Usage: equivalence [--rows N] [--cols N] [--threads N] [--keep]
+Exits with 0 if every path agrees with the reference, 1 otherwise.
+*/
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FilterBank.h"
+#include "SADKernel.h"
+#include "SpecFilter.h"
+#include "SpecImage.h"
+#include "SyntheticScene.h"
+#include "TiffCheck.h"
+#include "WatershedCheck.h"
+#include "Workspace.h"
+
+using namespace cv;
+using namespace std;
+
+struct FilterPath
+{
+	string name;                //  Filter method being checked
+	function<Mat()> run;        //  Runs it and returns its result
+};
+
+//  countMismatches
+//  Compares a filter result against the reference pixel by pixel.
+//  Pre-Conditions: reference and scores are the result and scores of
+//  filterReference, tolerance is the largest fixed point error of a score.
+//  Post-Conditions: Returns the number of pixels that differ although their
+//  reference score is further than tolerance from every threshold, or -1 if the
+//  result is not the size and type of the reference. within receives the number
+//  of pixels that differ within the tolerance.
+static long countMismatches(const Mat& result, const Mat& reference, const Mat& scores, double tolerance,
+	long& within)
+{
+	//  A pixel matches for scores in [SAD_MATCH_STRONG, SAD_MATCH_MAX), see SADKernel.h
+	const double STRONG = static_cast<double>(SAD_MATCH_STRONG) / SAD_SCALE;
+
+	within = 0;
+	if (result.rows != reference.rows || result.cols != reference.cols || result.type() != CV_8UC1)
+	{
+		return -1;
+	}
+	long mismatches = 0;
+	for (int r = 0; r < reference.rows; r++)
+	{
+		for (int c = 0; c < reference.cols; c++)
+		{
+			if (result.at<uchar>(r, c) == reference.at<uchar>(r, c))
+			{
+				continue;
+			}
+			double score = scores.at<double>(r, c);
+			if (abs(score - STRONG) <= tolerance || abs(score - MATCH_MAX) <= tolerance)
+			{
+				within++;
+			}
+			else
+			{
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
+
+//  checkPaths
+//  Runs every filter path on a scene and compares it against the reference.
+//  Pre-Conditions: hyperImage holds the scene sceneName loaded band sequential
+//  with a pyramid of 2 levels, interleaved the same scene loaded BIP.
+//  Post-Conditions: One line is printed per filter and path. Returns true if
+//  every path agrees with the reference.
+static bool checkPaths(const string& sceneName, const SpecImage& hyperImage, const SpecImage& interleaved,
+	int numThreads)
+{
+	const char* filterFiles[] = { "douglas_fir.txt", "spruce.txt", "water.txt", "wetland.txt" };
+	FilterBank bank;
+	for (const char* file : filterFiles)
+	{
+		if (!bank.AddFilterFromFile(file, file))
+		{
+			cerr << "Error - Could not load filter \"" << file << "\"." << endl;
+			return false;
+		}
+	}
+
+	//  The bank scores every filter in one pass, so its maps are made once
+	vector<Mat> bankMaps = bank.filter(hyperImage, numThreads);
+	vector<Mat> bankMapsBIP = bank.filter(interleaved, numThreads);
+
+	bool passed = true;
+	for (int f = 0; f < bank.getCount(); f++)
+	{
+		const char* file = filterFiles[f];
+		SpecFilter filter;
+		filter.LoadFromFile(file);
+		Mat scores;
+		Mat reference = filter.filterReference(hyperImage, &scores);
+		double tolerance = filter.getSampleCount() / 130560.0;
+		FilterPlan plan = filter.Compile(hyperImage);
+		Workspace workspace;
+		cout << file << ": " << countNonZero(reference) << " of " << reference.total() << " pixels match" << endl;
+
+		vector<FilterPath> paths =
+		{
+			{ "filter", [&]() { return SpecFilter::filter(hyperImage, plan, numThreads); } },
+			{ "filter (BIP)", [&]() { return filter.filter(interleaved, numThreads); } },
+			{ "filterTiled", [&]() { return SpecFilter::filterTiled(hyperImage, plan, 20, 30, numThreads); } },
+			{ "filterCoarseToFine", [&]() { return SpecFilter::filterCoarseToFine(hyperImage, plan, 2, numThreads); } },
+			{ "filterBranchAndBound", [&]() { return SpecFilter::filterBranchAndBound(hyperImage, plan, numThreads); } },
+			{ "filterStreaming", [&]() { return filter.filterStreaming(sceneName, numThreads); } },
+			{ "filter (workspace)", [&]() { return SpecFilter::filter(hyperImage, plan, numThreads, NULL, NULL, &workspace).clone(); } },
+			{ "filter (reused workspace)", [&]() { return SpecFilter::filter(hyperImage, plan, numThreads, NULL, NULL, &workspace).clone(); } },
+			{ "FilterBank::filter", [&]() { return bankMaps[f]; } },
+			{ "FilterBank::filter (BIP)", [&]() { return bankMapsBIP[f]; } },
+		};
+		for (size_t p = 0; p < paths.size(); p++)
+		{
+			long within = 0;
+			long mismatches = countMismatches(paths[p].run(), reference, scores, tolerance, within);
+			bool ok = mismatches == 0;
+			passed = passed && ok;
+			cout << (ok ? "ok   " : "FAIL ") << file << " " << paths[p].name << ": ";
+			if (mismatches < 0)
+			{
+				cout << "result is not the size of the scene" << endl;
+			}
+			else
+			{
+				cout << mismatches << " mismatches, " << within << " within tolerance" << endl;
+			}
+		}
+	}
+	return passed;
+}
+
+//  shortenBand
+//  Rewrites a band's file with its image less a few rows, as a truncated delivery
+//  would hold it.
+//  Pre-Conditions: hyperImage was loaded from disk and the band was loaded.
+//  Post-Conditions: Returns true if the file was rewritten.
+static bool shortenBand(const SpecImage& hyperImage, int band)
+{
+	const int MISSING_ROWS = 7;
+	Mat image = hyperImage.getBand(band);
+	if (image.rows <= MISSING_ROWS)
+	{
+		return false;
+	}
+	return imwrite(hyperImage.getLoadStatus()[band].fileName, image.rowRange(0, image.rows - MISSING_ROWS).clone());
+}
+
+int main(int argc, char* argv[])
+{
+	SyntheticSceneOptions scene;
+	scene.rows = 96;
+	scene.cols = 80;
+	scene.patchSize = 8;
+	scene.noise = 0.2;  //  Enough noise that every filter has matches and non-matches
+	int numThreads = 3;
+	bool keep = false;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--keep")
+		{
+			keep = true;
+		}
+		else if (arg == "--rows" && i + 1 < argc)
+		{
+			scene.rows = atoi(argv[++i]);
+		}
+		else if (arg == "--cols" && i + 1 < argc)
+		{
+			scene.cols = atoi(argv[++i]);
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			numThreads = atoi(argv[++i]);
+		}
+		else
+		{
+			cerr << "Error - Unknown or incomplete argument \"" << arg << "\"." << endl;
+			return 1;
+		}
+	}
+
+	const string sceneName = "EO1HEQUIVALENCE_1T";
+	const char* materialFiles[] = { "douglas_fir.txt", "water.txt" };
+	for (const char* file : materialFiles)
+	{
+		SpecFilter material;
+		if (!material.LoadFromFile(file))
+		{
+			cerr << "Error - Could not load material \"" << file << "\"." << endl;
+			return 1;
+		}
+		scene.materials.push_back(material);
+	}
+	if (!GenerateSyntheticScene(sceneName, scene))
+	{
+		return 1;
+	}
+
+	SpecImage hyperImage;
+	hyperImage.LoadFromFile(sceneName, SpecImage::BSQ, numThreads);
+	hyperImage.BuildPyramid(2);
+	SpecImage interleaved;
+	interleaved.LoadFromFile(sceneName, SpecImage::BIP, numThreads);
+
+	bool passed = checkPaths(sceneName, hyperImage, interleaved, numThreads);
+
+	//  A truncated band must be rejected at load time, and then left out like a
+	//  band that is missing altogether
+	const int SHORT_BAND = 40;
+	cout << "Band B" << SHORT_BAND + 1 << " a few rows short:" << endl;
+	if (!shortenBand(hyperImage, SHORT_BAND))
+	{
+		cerr << "Error - Could not rewrite band B" << SHORT_BAND + 1 << "." << endl;
+		passed = false;
+	}
+	else
+	{
+		hyperImage.LoadFromFile(sceneName, SpecImage::BSQ, numThreads);
+		hyperImage.BuildPyramid(2);
+		interleaved.LoadFromFile(sceneName, SpecImage::BIP, numThreads);
+		bool rejected = hyperImage.isBandMissing(SHORT_BAND) && hyperImage.getBand(SHORT_BAND).empty()
+			&& interleaved.isBandMissing(SHORT_BAND);
+		cout << (rejected ? "ok   " : "FAIL ") << "short band is reported missing" << endl;
+		passed = rejected && checkPaths(sceneName, hyperImage, interleaved, numThreads) && passed;
+	}
+
+	if (!keep)
+	{
+		RemoveSyntheticScene(sceneName);
+	}
+
+	cout << "TIFF windows:" << endl;
+	passed = CheckTiffWindows() && passed;
+	cout << "Watershed tiles:" << endl;
+	passed = CheckWatershed() && passed;
+	return passed ? 0 : 1;
+}
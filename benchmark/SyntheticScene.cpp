@@ -0,0 +1,206 @@
+/*
+SyntheticScene generates Hyperion-like scenes for benchmarking. A scene is a folder
+of 242 single band 16-bit images, named exactly like a Hyperion L1T delivery
+("<scene>/<scene minus _1T>_Bnnn_L1T.TIF"), so it can be opened with
+SpecImage::LoadFromFile like real data.
+
+Pixels are drawn from a small set of materials. Each material is a SpecFilter (for
+example one of the USGS files shipped with the repo) resampled onto the Hyperion
+band grid, so the repo's own filters find matches in the generated scene.
+*/
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+
+#include "Parallel.h"
+#include "SyntheticScene.h"
+
+using namespace cv;
+using namespace std;
+
+SyntheticSceneOptions::SyntheticSceneOptions()
+{
+	rows = 256;
+	cols = 256;
+	patchSize = 16;
+	noise = 0.1;
+	seed = 1;
+	numThreads = 0;
+}
+
+//  materialSpectrum
+//  Resamples a material onto every band of a wavelength table. Bands the material
+//  has no samples for are linearly interpolated between the nearest bands that do,
+//  and held constant past either end.
+//  Pre-Conditions: wavelengthImage is an (empty) SpecImage holding the sensor's
+//  wavelength table.
+//  Post-Conditions: Returns one reflectance per band of the table.
+static vector<double> materialSpectrum(const SpecFilter& material, const SpecImage& wavelengthImage)
+{
+	int depth = static_cast<int>(wavelengthImage.getWavelengths().size());
+	vector<double> spectrum(depth, 0.0);
+	vector<FilterPlan::Band> plan = material.Compile(wavelengthImage).getBandMeans();
+	if (plan.empty())
+	{
+		return spectrum;
+	}
+
+	for (size_t i = 0; i < plan.size(); i++)
+	{
+		spectrum[plan[i].band] = plan[i].reflectance;
+	}
+	for (int b = 0; b < plan.front().band; b++)
+	{
+		spectrum[b] = plan.front().reflectance;
+	}
+	for (int b = plan.back().band + 1; b < depth; b++)
+	{
+		spectrum[b] = plan.back().reflectance;
+	}
+	for (size_t i = 1; i < plan.size(); i++)
+	{
+		const FilterPlan::Band& low = plan[i - 1];
+		const FilterPlan::Band& high = plan[i];
+		for (int b = low.band + 1; b < high.band; b++)
+		{
+			double t = static_cast<double>(b - low.band) / (high.band - low.band);
+			spectrum[b] = low.reflectance + t * (high.reflectance - low.reflectance);
+		}
+	}
+	return spectrum;
+}
+
+//  builtinSpectrum
+//  A rough green vegetation curve (low visible, red edge at 700nm, high near
+//  infrared), used when no materials are given.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns one reflectance per wavelength.
+static vector<double> builtinSpectrum(const vector<int>& wavelengths)
+{
+	vector<double> spectrum(wavelengths.size());
+	for (size_t b = 0; b < wavelengths.size(); b++)
+	{
+		double nm = wavelengths[b];
+		double edge = 1.0 / (1.0 + exp(-(nm - 715.0) / 15.0));
+		double water = nm > 1350 ? 0.5 : 1.0;
+		spectrum[b] = (0.05 + 0.45 * edge) * water;
+	}
+	return spectrum;
+}
+
+//  GenerateSyntheticScene
+//  Writes a synthetic scene to disk.
+//  Pre-Conditions: sceneName ends in "_1T" and the working directory is writable.
+//  Post-Conditions: The folder sceneName holds 242 band images in the Hyperion L1T
+//  layout and true is returned. On failure an error is printed and false is
+//  returned.
+//  NOTE: Samples are scaled so that 255 is a reflectance of 1, which is the scale
+//  SpecFilter compares pixels at. Every band uses its own random stream, so the
+//  scene does not depend on the number of threads. The sensor's default bad bands
+//  are written as zeros, as in a real delivery.
+bool GenerateSyntheticScene(const string& sceneName, const SyntheticSceneOptions& options)
+{
+	if (options.rows <= 0 || options.cols <= 0 || options.patchSize <= 0)
+	{
+		cerr << "Error - Invalid synthetic scene size." << endl;
+		return false;
+	}
+
+	error_code error;
+	filesystem::create_directories(sceneName, error);
+	if (error)
+	{
+		cerr << "Error - Could not create folder \"" << sceneName << "\"." << endl;
+		return false;
+	}
+
+	//  Resample every material onto the sensor's bands
+	SpecImage wavelengthImage;
+	vector<int> wavelengths = wavelengthImage.getWavelengths();
+	int depth = static_cast<int>(wavelengths.size());
+	vector<vector<double>> spectra;
+	for (size_t i = 0; i < options.materials.size(); i++)
+	{
+		spectra.push_back(materialSpectrum(options.materials[i], wavelengthImage));
+	}
+	if (spectra.empty())
+	{
+		spectra.push_back(builtinSpectrum(wavelengths));
+	}
+
+	//  Pick a material and a noise level for every patch of the scene, so that
+	//  filters see a spread of good and poor matches
+	Mat material(options.rows, options.cols, CV_8UC1);
+	Mat noiseLevel(options.rows, options.cols, CV_32FC1);
+	mt19937 patchRandom(options.seed);
+	uniform_int_distribution<int> pickMaterial(0, static_cast<int>(spectra.size()) - 1);
+	uniform_real_distribution<float> pickNoise(0.0f, 2.0f * static_cast<float>(options.noise));
+	int patchRows = (options.rows + options.patchSize - 1) / options.patchSize;
+	int patchCols = (options.cols + options.patchSize - 1) / options.patchSize;
+	vector<uchar> patchMaterial(patchRows * patchCols);
+	vector<float> patchNoise(patchRows * patchCols);
+	for (size_t i = 0; i < patchMaterial.size(); i++)
+	{
+		patchMaterial[i] = static_cast<uchar>(pickMaterial(patchRandom));
+		patchNoise[i] = pickNoise(patchRandom);
+	}
+	for (int r = 0; r < options.rows; r++)
+	{
+		for (int c = 0; c < options.cols; c++)
+		{
+			int patch = (r / options.patchSize) * patchCols + c / options.patchSize;
+			material.at<uchar>(r, c) = patchMaterial[patch];
+			noiseLevel.at<float>(r, c) = patchNoise[patch];
+		}
+	}
+
+	//  Write each band with its own random stream
+	atomic<bool> failed(false);
+	parallelFor(depth, options.numThreads, [&](int b)
+	{
+		mt19937 bandRandom(options.seed * 1000003u + static_cast<unsigned int>(b));
+		normal_distribution<double> noise(0.0, 1.0);
+		Mat band(options.rows, options.cols, CV_16UC1, Scalar::all(0));
+
+		//  The sensor's uncalibrated bands are delivered as zeros
+		for (int r = 0; r < options.rows && !wavelengthImage.isBadBand(b); r++)
+		{
+			const uchar* materialRow = material.ptr<uchar>(r);
+			const float* noiseRow = noiseLevel.ptr<float>(r);
+			ushort* bandRow = band.ptr<ushort>(r);
+			for (int c = 0; c < options.cols; c++)
+			{
+				double reflectance = spectra[materialRow[c]][b] + noiseRow[c] * noise(bandRandom);
+				bandRow[c] = saturate_cast<ushort>(max(reflectance, 0.0) * 255.0);
+			}
+		}
+
+		string bandFile = SpecImage::getBandFileName(sceneName, b + 1);
+		if (!imwrite(bandFile, band))
+		{
+			failed = true;
+		}
+	});
+
+	if (failed)
+	{
+		cerr << "Error - Could not write the bands of \"" << sceneName << "\"." << endl;
+		return false;
+	}
+	return true;
+}
+
+//  RemoveSyntheticScene
+//  Deletes a scene written by GenerateSyntheticScene.
+//  Pre-Conditions: None
+//  Post-Conditions: The folder sceneName and its contents no longer exist.
+void RemoveSyntheticScene(const string& sceneName)
+{
+	error_code error;
+	filesystem::remove_all(sceneName, error);
+}
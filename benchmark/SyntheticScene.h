@@ -0,0 +1,46 @@
+/*
+SyntheticScene generates Hyperion-like scenes for benchmarking. A scene is a folder
+of 242 single band 16-bit images, named exactly like a Hyperion L1T delivery
+("<scene>/<scene minus _1T>_Bnnn_L1T.TIF"), so it can be opened with
+SpecImage::LoadFromFile like real data.
+
+Pixels are drawn from a small set of materials. Each material is a SpecFilter (for
+example one of the USGS files shipped with the repo) resampled onto the Hyperion
+band grid, so the repo's own filters find matches in the generated scene.
+*/
+#pragma once
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+#include "SpecFilter.h"
+
+using namespace cv;
+using namespace std;
+
+struct SyntheticSceneOptions
+{
+	int rows;                     //  Scene height in pixels
+	int cols;                     //  Scene width in pixels
+	int patchSize;                //  Side of the square patches a single material covers
+	double noise;                 //  Mean standard deviation of the reflectance noise (varies per patch)
+	unsigned int seed;            //  Seed, so the same options always give the same scene
+	int numThreads;               //  Threads used to write bands (0 uses every core)
+	vector<SpecFilter> materials; //  Material spectra; a built-in one is used if empty
+
+	SyntheticSceneOptions();
+};
+
+//  GenerateSyntheticScene
+//  Writes a synthetic scene to disk.
+//  Pre-Conditions: sceneName ends in "_1T" and the working directory is writable.
+//  Post-Conditions: The folder sceneName holds 242 band images in the Hyperion L1T
+//  layout and true is returned. The sensor's default bad bands are all zeros. On
+//  failure an error is printed and false is returned.
+bool GenerateSyntheticScene(const string& sceneName, const SyntheticSceneOptions& options);
+
+//  RemoveSyntheticScene
+//  Deletes a scene written by GenerateSyntheticScene.
+//  Pre-Conditions: None
+//  Post-Conditions: The folder sceneName and its contents no longer exist.
+void RemoveSyntheticScene(const string& sceneName);
@@ -0,0 +1,430 @@
+/*
+TiffCheck checks the window decoder of TiffWindow.h against OpenCV. See TiffCheck.h.
+
+The files written here are classic little-endian TIFFs with one unsigned 16-bit
+sample per pixel. Compressed blocks are encoded the way libtiff does it: LZW codes
+MSB first, widening one code early, and PackBits one row at a time.
+*/
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TiffCheck.h"
+#include "TiffWindow.h"
+
+using namespace cv;
+using namespace std;
+
+struct TiffCase
+{
+	string name;                //  File name, also printed
+	bool openCV;                //  Written by imwrite (always in strips)
+	int compression;            //  1 none, 5 LZW, 32773 PackBits
+	bool predictor;             //  Horizontal differencing (LZW only)
+	int blockWidth;             //  Tile width, 0 for strips
+	int blockHeight;            //  Tile height, or rows per strip
+};
+
+//  putLittle
+//  Appends the low bytes of value to out, least significant first.
+static void putLittle(vector<uchar>& out, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		out.push_back(static_cast<uchar>((value >> (8 * i)) & 0xFF));
+	}
+}
+
+//  encodeLZW
+//  Encodes bytes as a TIFF LZW stream, starting with a clear code and ending with
+//  the end of data code.
+static vector<uchar> encodeLZW(const vector<uchar>& data)
+{
+	const int CLEAR = 256;
+	const int END = 257;
+	const int LIMIT = 4094;
+	vector<uchar> out;
+	uint32_t buffer = 0;
+	int buffered = 0;
+	int width = 9;
+	auto put = [&](int code)
+	{
+		buffer = (buffer << width) | static_cast<uint32_t>(code);
+		buffered += width;
+		while (buffered >= 8)
+		{
+			out.push_back(static_cast<uchar>(buffer >> (buffered - 8)));
+			buffered -= 8;
+		}
+	};
+
+	map<pair<int, uchar>, int> table;
+	int next = END + 1;
+	put(CLEAR);
+	if (data.empty())
+	{
+		put(END);
+	}
+	else
+	{
+		int prefix = data[0];
+		for (size_t i = 1; i < data.size(); i++)
+		{
+			auto found = table.find(make_pair(prefix, data[i]));
+			if (found != table.end())
+			{
+				prefix = found->second;
+				continue;
+			}
+			put(prefix);
+			table[make_pair(prefix, data[i])] = next++;
+			prefix = data[i];
+			if (next == LIMIT)
+			{
+				put(CLEAR);
+				table.clear();
+				next = END + 1;
+				width = 9;
+			}
+			else if (next > (1 << width) - 1)
+			{
+				width++;
+			}
+		}
+		put(prefix);
+
+		//  The decoder adds an entry for the last code too, which may widen the end code
+		next++;
+		if (next > (1 << width) - 1 && width < 12)
+		{
+			width++;
+		}
+		put(END);
+	}
+	if (buffered > 0)
+	{
+		out.push_back(static_cast<uchar>(buffer << (8 - buffered)));
+	}
+	return out;
+}
+
+//  encodePackBits
+//  Encodes bytes as PackBits, runs of equal bytes as repeats and the rest as
+//  literal runs of at most 128 bytes.
+static void encodePackBits(const uchar* data, size_t size, vector<uchar>& out)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t run = 1;
+		while (i + run < size && run < 128 && data[i + run] == data[i])
+		{
+			run++;
+		}
+		if (run >= 2)
+		{
+			out.push_back(static_cast<uchar>(257 - run));
+			out.push_back(data[i]);
+			i += run;
+			continue;
+		}
+		size_t literal = 1;
+		while (i + literal < size && literal < 128
+			&& !(i + literal + 1 < size && data[i + literal] == data[i + literal + 1]))
+		{
+			literal++;
+		}
+		out.push_back(static_cast<uchar>(literal - 1));
+		out.insert(out.end(), data + i, data + i + literal);
+		i += literal;
+	}
+}
+
+//  encodeBlock
+//  Stores one strip or tile: its samples, little-endian, with the case's predictor
+//  and compression applied.
+//  Pre-Conditions: block is CV_16UC1.
+static vector<uchar> encodeBlock(const Mat& block, const TiffCase& tiff)
+{
+	vector<uchar> raw;
+	for (int r = 0; r < block.rows; r++)
+	{
+		const ushort* row = block.ptr<ushort>(r);
+		for (int c = 0; c < block.cols; c++)
+		{
+			ushort value = tiff.predictor && c > 0 ? static_cast<ushort>(row[c] - row[c - 1]) : row[c];
+			putLittle(raw, value, 2);
+		}
+	}
+	if (tiff.compression == 5)
+	{
+		return encodeLZW(raw);
+	}
+	if (tiff.compression == 32773)
+	{
+		vector<uchar> packed;
+		size_t rowBytes = static_cast<size_t>(block.cols) * 2;
+		for (int r = 0; r < block.rows; r++)
+		{
+			encodePackBits(&raw[r * rowBytes], rowBytes, packed);
+		}
+		return packed;
+	}
+	return raw;
+}
+
+//  writeTiff
+//  Writes an image as a TIFF in the strips or tiles of a case.
+//  Pre-Conditions: image is CV_16UC1, and tiles are multiples of 16 pixels.
+//  Post-Conditions: Returns true if the file was written.
+static bool writeTiff(const Mat& image, const TiffCase& tiff)
+{
+	bool tiled = tiff.blockWidth > 0;
+	int blockWidth = tiled ? tiff.blockWidth : image.cols;
+	int across = (image.cols + blockWidth - 1) / blockWidth;
+	int down = (image.rows + tiff.blockHeight - 1) / tiff.blockHeight;
+
+	//  Blocks follow the 8 byte header, the directory follows the blocks. Tiles
+	//  are padded to their full size, the last strip only holds the rows left.
+	vector<uchar> file = { 'I', 'I', 42, 0 };
+	putLittle(file, 0, 4);
+	vector<uint32_t> offsets;
+	vector<uint32_t> byteCounts;
+	for (int by = 0; by < down; by++)
+	{
+		for (int bx = 0; bx < across; bx++)
+		{
+			Rect area(bx * blockWidth, by * tiff.blockHeight, blockWidth, tiff.blockHeight);
+			Rect inside = area & Rect(0, 0, image.cols, image.rows);
+			Mat block(tiled ? area.height : inside.height, area.width, CV_16UC1, Scalar::all(0));
+			Mat filled = block(Rect(0, 0, inside.width, inside.height));
+			image(inside).copyTo(filled);
+			vector<uchar> stored = encodeBlock(block, tiff);
+			offsets.push_back(static_cast<uint32_t>(file.size()));
+			byteCounts.push_back(static_cast<uint32_t>(stored.size()));
+			file.insert(file.end(), stored.begin(), stored.end());
+			if (file.size() % 2 != 0)
+			{
+				file.push_back(0);
+			}
+		}
+	}
+
+	//  Tag, type (3 SHORT, 4 LONG) and values, in ascending tag order
+	struct Field
+	{
+		int tag;
+		int type;
+		vector<uint32_t> values;
+	};
+	vector<Field> fields =
+	{
+		{ 256, 4, { static_cast<uint32_t>(image.cols) } },
+		{ 257, 4, { static_cast<uint32_t>(image.rows) } },
+		{ 258, 3, { 16 } },
+		{ 259, 3, { static_cast<uint32_t>(tiff.compression) } },
+		{ 262, 3, { 1 } },
+	};
+	if (!tiled)
+	{
+		fields.push_back({ 273, 4, offsets });
+	}
+	fields.push_back({ 277, 3, { 1 } });
+	if (!tiled)
+	{
+		fields.push_back({ 278, 4, { static_cast<uint32_t>(tiff.blockHeight) } });
+		fields.push_back({ 279, 4, byteCounts });
+	}
+	fields.push_back({ 284, 3, { 1 } });
+	if (tiff.predictor)
+	{
+		fields.push_back({ 317, 3, { 2 } });
+	}
+	if (tiled)
+	{
+		fields.push_back({ 322, 4, { static_cast<uint32_t>(tiff.blockWidth) } });
+		fields.push_back({ 323, 4, { static_cast<uint32_t>(tiff.blockHeight) } });
+		fields.push_back({ 324, 4, offsets });
+		fields.push_back({ 325, 4, byteCounts });
+	}
+	fields.push_back({ 339, 3, { 1 } });
+
+	//  Values that do not fit in an entry are stored after the directory
+	uint32_t directory = static_cast<uint32_t>(file.size());
+	uint32_t extra = directory + 2 + static_cast<uint32_t>(fields.size()) * 12 + 4;
+	vector<uchar> values;
+	file[4] = static_cast<uchar>(directory & 0xFF);
+	file[5] = static_cast<uchar>((directory >> 8) & 0xFF);
+	file[6] = static_cast<uchar>((directory >> 16) & 0xFF);
+	file[7] = static_cast<uchar>(directory >> 24);
+	putLittle(file, static_cast<uint32_t>(fields.size()), 2);
+	for (size_t f = 0; f < fields.size(); f++)
+	{
+		int size = fields[f].type == 3 ? 2 : 4;
+		uint32_t count = static_cast<uint32_t>(fields[f].values.size());
+		putLittle(file, fields[f].tag, 2);
+		putLittle(file, fields[f].type, 2);
+		putLittle(file, count, 4);
+		if (count * size <= 4)
+		{
+			for (uint32_t v = 0; v < count; v++)
+			{
+				putLittle(file, fields[f].values[v], size);
+			}
+			putLittle(file, 0, 4 - count * size);
+		}
+		else
+		{
+			putLittle(file, extra + static_cast<uint32_t>(values.size()), 4);
+			for (uint32_t v = 0; v < count; v++)
+			{
+				putLittle(values, fields[f].values[v], size);
+			}
+		}
+	}
+	putLittle(file, 0, 4);
+	file.insert(file.end(), values.begin(), values.end());
+
+	ofstream out(tiff.name, ios::binary);
+	out.write(reinterpret_cast<const char*>(file.data()), file.size());
+	return static_cast<bool>(out);
+}
+
+//  readWindow
+//  Reads a window of a TIFF a strip or tile at a time, as SpecImage does for a
+//  band, clipping it to the image first.
+//  Pre-Conditions: None
+//  Post-Conditions: Returns the clipped window, or an empty Mat (with error set)
+//  if the file could not be read that way.
+static Mat readWindow(const string& fileName, const Rect& window, string& error)
+{
+	ifstream file(fileName, ios::binary);
+	TiffLayout layout;
+	if (!file.is_open() || !ReadTiffLayout(file, layout, error))
+	{
+		return Mat();
+	}
+	if (!isTiffWindowSupported(layout))
+	{
+		error = "layout is not supported";
+		return Mat();
+	}
+	Rect clipped = window & Rect(0, 0, layout.width, layout.height);
+	vector<vector<uchar> > blocks;
+	if (clipped.area() <= 0 || !ReadTiffBlocks(file, layout, clipped, blocks, error))
+	{
+		return Mat();
+	}
+	return DecodeTiffWindow(layout, clipped, blocks, error);
+}
+
+//  sameImage
+//  Returns whether two images have the same size, type and pixels.
+static bool sameImage(const Mat& a, const Mat& b)
+{
+	if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type())
+	{
+		return false;
+	}
+	for (int r = 0; r < a.rows; r++)
+	{
+		if (memcmp(a.ptr(r), b.ptr(r), a.cols * a.elemSize()) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//  CheckTiffWindows
+//  Writes the test files, compares every window, and removes the files again.
+//  Pre-Conditions: The working directory is writable.
+//  Post-Conditions: One line is printed per file. Returns true if every window
+//  decoded equal to imread's crop of the file.
+bool CheckTiffWindows()
+{
+	//  Odd sizes, so the last strips and tiles are partial
+	const int ROWS = 53;
+	const int COLS = 75;
+
+	//  A ramp with noise, flat runs for PackBits, and values above 255 so both
+	//  bytes of every sample matter
+	Mat image(ROWS, COLS, CV_16UC1);
+	uint32_t state = 12345;
+	for (int r = 0; r < ROWS; r++)
+	{
+		for (int c = 0; c < COLS; c++)
+		{
+			state = state * 1103515245 + 12345;
+			ushort value = static_cast<ushort>(r * 517 + c * 3 + ((state >> 16) & 0x3F));
+			image.at<ushort>(r, c) = (c / 10) % 3 == 0 ? static_cast<ushort>(40000 + r) : value;
+		}
+	}
+
+	vector<TiffCase> cases =
+	{
+		{ "tiffcheck_opencv_none.tif", true, 1, false, 0, 0 },
+		{ "tiffcheck_opencv_lzw.tif", true, 5, false, 0, 0 },
+		{ "tiffcheck_opencv_packbits.tif", true, 32773, false, 0, 0 },
+		{ "tiffcheck_strips_none.tif", false, 1, false, 0, 8 },
+		{ "tiffcheck_strips_lzw.tif", false, 5, false, 0, 8 },
+		{ "tiffcheck_strips_lzw_predictor.tif", false, 5, true, 0, 8 },
+		{ "tiffcheck_strip_lzw_whole.tif", false, 5, false, 0, ROWS },  //  Fills the LZW table
+		{ "tiffcheck_strips_packbits.tif", false, 32773, false, 0, 8 },
+		{ "tiffcheck_tiles_none.tif", false, 1, false, 16, 16 },
+		{ "tiffcheck_tiles_lzw.tif", false, 5, false, 32, 16 },
+		{ "tiffcheck_tiles_lzw_predictor.tif", false, 5, true, 16, 32 },
+		{ "tiffcheck_tiles_packbits.tif", false, 32773, false, 16, 16 },
+	};
+	vector<Rect> windows =
+	{
+		Rect(0, 0, COLS, ROWS),                 //  Whole image
+		Rect(17, 9, 30, 20),                    //  Inside, across strips and tiles
+		Rect(40, 16, 1, 1),                     //  A single pixel
+		Rect(0, 31, COLS, 1),                   //  One row through every tile
+		Rect(COLS - 12, ROWS - 7, 30, 20),      //  Clipped at the right and bottom
+		Rect(-5, -3, 21, 12),                   //  Clipped at the left and top
+		Rect(-10, -10, COLS + 20, ROWS + 20),   //  Larger than the image
+	};
+
+	bool passed = true;
+	for (size_t t = 0; t < cases.size(); t++)
+	{
+		const TiffCase& tiff = cases[t];
+		bool written = tiff.openCV
+			? imwrite(tiff.name, image, vector<int>{ IMWRITE_TIFF_COMPRESSION, tiff.compression })
+			: writeTiff(image, tiff);
+		Mat reference = written ? imread(tiff.name, IMREAD_UNCHANGED) : Mat();
+		string problem;
+		if (!written)
+		{
+			problem = "could not be written";
+		}
+		else if (!sameImage(reference, image))
+		{
+			problem = "imread does not read back the image written";
+		}
+		for (size_t w = 0; w < windows.size() && problem.empty(); w++)
+		{
+			string error;
+			Rect clipped = windows[w] & Rect(0, 0, COLS, ROWS);
+			Mat window = readWindow(tiff.name, windows[w], error);
+			if (!sameImage(window, reference(clipped)))
+			{
+				problem = "window " + to_string(w) + " differs from imread" + (error.empty() ? "" : " (" + error + ")");
+			}
+		}
+		passed = passed && problem.empty();
+		cout << (problem.empty() ? "ok   " : "FAIL ") << tiff.name << ": "
+			<< (problem.empty() ? to_string(windows.size()) + " windows match" : problem) << endl;
+		remove(tiff.name.c_str());
+	}
+	return passed;
+}
@@ -0,0 +1,16 @@
+/*
+TiffCheck checks the window decoder of TiffWindow.h against OpenCV. Small 16-bit
+TIFFs are written in every layout the decoder handles: strips written by OpenCV
+(uncompressed, LZW and PackBits), and strips and tiles written here (OpenCV has no
+way to write tiles), uncompressed, LZW with and without the horizontal predictor
+and PackBits. Windows of each file, including ones clipped at the edges, are then
+read a strip or tile at a time and compared with the same crop of imread.
+*/
+#pragma once
+
+//  CheckTiffWindows
+//  Writes the test files, compares every window, and removes the files again.
+//  Pre-Conditions: The working directory is writable.
+//  Post-Conditions: One line is printed per file. Returns true if every window
+//  decoded equal to imread's crop of the file.
+bool CheckTiffWindows();
@@ -0,0 +1,153 @@
+/*
+WatershedCheck checks the tiling and threading of WatershedSegment. See
+WatershedCheck.h.
+
+WatershedSegment inverts its Otsu threshold, so the mask is bright with dark shapes,
+and the dark shapes are the regions segmented. The small tiles are 64 x 48 pixels,
+so the band and most of the discs are cut by tile edges and only come out as one
+region each if the edge merge joins their pieces.
+*/
+#include <opencv2/core/core.hpp>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Watershed.h"
+#include "WatershedCheck.h"
+
+using namespace cv;
+using namespace std;
+
+struct WatershedCase
+{
+	string name;                //  Printed
+	int tileRows;               //  Tile size passed to WatershedSegment
+	int tileCols;
+	int numThreads;
+};
+
+//  makeMask
+//  Draws the synthetic mask: dark discs of several sizes and one dark band across
+//  the middle, on a bright background.
+static Mat makeMask(int rows, int cols)
+{
+	Mat mask(rows, cols, CV_8UC1, Scalar(220));
+	for (int i = 0; i < 14; i++)
+	{
+		int centreCol = 20 + (i * 67) % (cols - 30);
+		int centreRow = 20 + (i * 89) % (rows - 30);
+		int radius = 10 + (i * 7) % 15;
+		for (int r = max(0, centreRow - radius); r < min(rows, centreRow + radius); r++)
+		{
+			for (int c = max(0, centreCol - radius); c < min(cols, centreCol + radius); c++)
+			{
+				if ((r - centreRow) * (r - centreRow) + (c - centreCol) * (c - centreCol) <= radius * radius)
+				{
+					mask.at<uchar>(r, c) = 30;
+				}
+			}
+		}
+	}
+	mask(Rect(30, 100, cols - 60, 40)) = Scalar(30);
+	return mask;
+}
+
+//  countRegions
+//  Returns the number of distinct region labels (2 and up) in a label raster.
+static int countRegions(const Mat& labels)
+{
+	set<int> regions;
+	for (int r = 0; r < labels.rows; r++)
+	{
+		const int* label = labels.ptr<int>(r);
+		for (int c = 0; c < labels.cols; c++)
+		{
+			if (label[c] >= 2)
+			{
+				regions.insert(label[c]);
+			}
+		}
+	}
+	return static_cast<int>(regions.size());
+}
+
+//  sameImage
+//  Returns true if the two images have the same size and type and equal pixels.
+static bool sameImage(const Mat& a, const Mat& b)
+{
+	if (a.size() != b.size() || a.type() != b.type())
+	{
+		return false;
+	}
+	size_t rowBytes = a.cols * a.elemSize();
+	for (int r = 0; r < a.rows; r++)
+	{
+		const uchar* rowA = a.ptr<uchar>(r);
+		const uchar* rowB = b.ptr<uchar>(r);
+		for (size_t i = 0; i < rowBytes; i++)
+		{
+			if (rowA[i] != rowB[i])
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//  CheckWatershed
+//  Segments the synthetic mask every way and compares the results.
+//  Pre-Conditions: None.
+//  Post-Conditions: One line is printed per way of segmenting. Returns true if
+//  every overlay equals the whole-image one with the same number of regions, and
+//  the small tiles label every pixel the same on one thread and on several.
+bool CheckWatershed()
+{
+	const int ROWS = 300;
+	const int COLS = 260;
+	Mat mask = makeMask(ROWS, COLS);
+
+	//  The first case is the reference the others are compared with
+	vector<WatershedCase> cases = {
+		{ "whole image, 1 thread", ROWS, COLS, 1 },
+		{ "64x48 tiles, 1 thread", 64, 48, 1 },
+		{ "64x48 tiles, 4 threads", 64, 48, 4 },
+		{ "64x48 tiles, every core", 64, 48, 0 },
+		{ "100x100 tiles, 3 threads", 100, 100, 3 },
+	};
+
+	WatershedResult reference = WatershedSegment(mask, cases[0].tileRows, cases[0].tileCols, cases[0].numThreads);
+	int referenceRegions = countRegions(reference.labels);
+	cout << "ok   " << cases[0].name << ": " << referenceRegions << " regions" << endl;
+	bool passed = referenceRegions > 1;
+
+	Mat tiledLabels;
+	for (size_t i = 1; i < cases.size(); i++)
+	{
+		const WatershedCase& check = cases[i];
+		WatershedResult result = WatershedSegment(mask, check.tileRows, check.tileCols, check.numThreads);
+		int regions = countRegions(result.labels);
+		string problem;
+		if (!sameImage(result.overlay, reference.overlay))
+		{
+			problem = "overlay differs from the whole image";
+		}
+		else if (regions != referenceRegions)
+		{
+			problem = to_string(regions) + " regions instead of " + to_string(referenceRegions);
+		}
+		else if (check.tileRows == 64 && !tiledLabels.empty() && !sameImage(result.labels, tiledLabels))
+		{
+			problem = "labels differ from 1 thread";
+		}
+		if (check.tileRows == 64 && tiledLabels.empty())
+		{
+			tiledLabels = result.labels;
+		}
+		passed = passed && problem.empty();
+		cout << (problem.empty() ? "ok   " : "FAIL ") << check.name << ": "
+			<< (problem.empty() ? to_string(regions) + " regions, same overlay" : problem) << endl;
+	}
+	return passed;
+}
@@ -0,0 +1,15 @@
+/*
+WatershedCheck checks that WatershedSegment gives the same segmentation however
+the image is cut into tiles and however many threads segment them. A synthetic
+mask with shapes lying across tile edges is segmented as one whole-image tile,
+and in small tiles on one thread and on several.
+*/
+#pragma once
+
+//  CheckWatershed
+//  Segments the synthetic mask every way and compares the results.
+//  Pre-Conditions: None.
+//  Post-Conditions: One line is printed per way of segmenting. Returns true if
+//  every overlay equals the whole-image one with the same number of regions, and
+//  the small tiles label every pixel the same on one thread and on several.
+bool CheckWatershed();
@@ -11,10 +11,14 @@ Date: December 2016
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <cstdlib>
 #include <iostream>
 
+#include "Products.h"
 #include "SpecFilter.h"
 #include "SpecImage.h"
+#include "Trace.h"
+#include "Watershed.h"
 
 using namespace cv;
 using namespace std;
@@ -51,110 +55,6 @@ string type2str(int type)
 	return r;
 }
 
-//  Watershed
-//  This method applies Watershed segmetation on the supplied image, returning
-//  and image whose green channel is made up of the watershed lines. This image
-//  is shown to the user at the end of the method (with a waitKey(0)).
-//  Pre-Conditions: Img is a 8UC, wherein bright values indicate areas of
-//  interest. Img is expected to be either grayscale (8UC1) or color (8UC3).
-//  Post-Conditions: The original img is returned with watershed markings overlayed
-//  in pure-green (0, 255, 0). Bright areas are outlined as areas of interest. The
-//  returned Img is always 8UC3.
-//  DISCLAIMER: This code is adapted from the example for watershed segmentnation
-//  written in Python at the following link:
-//  http:// docs.opencv.org/3.1.0/d3/db4/tutorial_py_watershed.html
-Mat Watershed(Mat img)
-{
-	//  Create a binary threshold image
-	Mat thresh;
-	if (img.channels() == 1)
-	{
-		thresh = img;
-		cvtColor(img, img, CV_GRAY2BGR);
-	}
-	else
-	{
-		cvtColor(img, thresh, CV_BGR2GRAY);
-	}
-	threshold(thresh, thresh, 0, 255, THRESH_BINARY_INV + THRESH_OTSU);
-
-	//  Noise removal
-	int morph_size = 8;
-	Mat element = getStructuringElement(2, Size(2 * morph_size + 1, 2 * morph_size + 1), Point(morph_size, morph_size));
-
-	//  Apply the specified morphology operation
-	Mat opening;
-	morphologyEx(thresh, opening, 2, element);
-
-	//  Sure background area
-	Mat sure_bg;
-	Mat kernel(3, 3, CV_8UC1);
-	kernel = cv::Scalar(1);
-	dilate(opening, sure_bg, kernel, Point(-1, -1), 3);
-
-	//  Finding sure foreground area
-	Mat dist_transform;
-	double maxVal;
-	double minVal;
-	minMaxLoc(opening, &minVal, &maxVal);
-	threshold(opening, opening, 50, 255, CV_THRESH_BINARY);
-
-	distanceTransform(opening, dist_transform, DIST_L2, 5);
-	Mat sure_fg;
-	minMaxLoc(dist_transform, &minVal, &maxVal);
-	threshold(dist_transform, sure_fg, 4, 255, THRESH_TOZERO);
-
-	//  Finding unknown region
-	sure_fg.convertTo(sure_fg, CV_8UC1);
-	Mat unknown;
-	subtract(sure_bg, sure_fg, unknown);
-
-	//  Marker labelling
-	Mat markers;
-	connectedComponents(sure_fg, markers);
-
-	//  Add one to all labels so that sure background is not 0, but 1
-	//  Also mark the region of unknown with zero
-	for (int r = 0; r < markers.rows; r++)
-	{
-		for (int c = 0; c < markers.cols; c++)
-		{
-			if (unknown.at<uchar>(r, c) == 255)
-			{
-				markers.at<uchar>(r, c) = 0;
-			}
-			else
-			{
-				markers.at<uchar>(r, c) = markers.at<uchar>(r, c) + 1;
-			}
-		}
-	}
-
-	//  Apply watershed method
-	watershed(img, markers);
-
-	//  Draw markekrs in pure-green on image
-	for (int r = 0; r < img.rows; r++)
-	{
-		for (int c = 0; c < img.cols; c++)
-		{
-			if (markers.at<char>(r, c) == -1)
-			{
-				img.at<Vec3b>(r, c)[2] = 0;
-				img.at<Vec3b>(r, c)[1] = 255;
-				img.at<Vec3b>(r, c)[0] = 0;
-			}
-		}
-	}
-
-	//  Show generaed watershed image with markers
-	imshow("Watershed", img);
-	imwrite("Watershed.png", img);
-	waitKey(0);
-
-	return img;
-}
-
 //  FindVegetation
 //  This method takes a given SpecImage and displays the images listed below: 
 //  		-Original Color composite
@@ -167,29 +67,14 @@ Mat Watershed(Mat img)
 //  health (those areas unlikely to have vegetation) are displayed as gray.
 Mat FindVegetation(SpecImage hyperImage)
 {
-	Mat colorComposite = hyperImage.getComposite(641, 580, 509); //  Hyperion reccomended color composite
-	Mat swir = hyperImage.getComposite(1954, 1629, 1074); //  Short Wavelength InfraRed (SWIR)
-	
-	Mat grayscale;
-	Mat veg = hyperImage.getImage(855); //  16US1
-
-	short arbitraryThreshold = 32768 / 64;
-	veg.convertTo(veg, CV_8UC1, 255.0 / arbitraryThreshold);
+	TraceScope stage("FindVegetation");
+	VegetationMaps maps = MakeVegetationMaps(hyperImage);
+	Mat colorComposite = maps.colorComposite;
+	Mat swir = maps.swir;
+	Mat redVegetationGray = maps.redVegetationGray;
+	Mat redVegetationColor = maps.redVegetationColor;
 
-	cvtColor(colorComposite, grayscale, CV_RGB2GRAY); //  Convert to gray
-
-	Mat redVegetationGray = grayscale.clone();
-	Mat redVegetationColor = colorComposite.clone();
-	cvtColor(redVegetationGray, redVegetationGray, CV_GRAY2BGR); //  Return to 3 channels
-
-	for (int r = 0; r < redVegetationColor.rows; r++)
-	{
-		for (int c = 0; c < redVegetationColor.cols; c++)
-		{
-			redVegetationColor.at<Vec3b>(r, c)[2] = max(veg.at<uchar>(r, c), colorComposite.at<Vec3b>(r, c)[2]);
-			redVegetationGray.at<Vec3b>(r, c)[2] = max(veg.at<uchar>(r, c), grayscale.at<uchar>(r, c));
-		}
-	}
+	stage.End();
 
 	imshow("Color Composite", colorComposite);
 	imshow("Red Veggies Gray", redVegetationGray);
@@ -238,58 +123,13 @@ Mat SpecFilterTest(SpecImage hyperImage, string filterName)
 //  trees, whereas blue areas are those with water.
 Mat TreesWaterFilter(SpecImage hyperImage)
 {
-	SpecFilter filterfir;
-	filterfir.LoadFromFile("douglas_fir.txt");
-	Mat resultTree = filterfir.filter(hyperImage);
-
-	SpecFilter filterWater;
-	filterWater.LoadFromFile("water.txt");
-	Mat resultWater = filterWater.filter(hyperImage);
-
-	Mat overlap = resultTree.clone();
-	for (int row = 0; row < overlap.rows; row++)
-	{
-		for (int col = 0; col < overlap.cols; col++)
-		{
-			uchar wat = resultWater.at<uchar>(row, col);
-			uchar trees = overlap.at<uchar>(row, col);
-			if (overlap.at<uchar>(row, col) == 255 && resultWater.at<uchar>(row, col) == 255)
-			{
-				overlap.at<uchar>(row, col) = 255;
-			}
-			else
-			{
-				overlap.at<uchar>(row, col) = 0;
-			}
-		}
-	}
-
-	Mat waterAndTrees(overlap.rows, overlap.cols, CV_8UC3);
-	for (int row = 0; row < waterAndTrees.rows; row++)
-	{
-		for (int col = 0; col < waterAndTrees.cols; col++)
-		{
-			if (resultWater.at<uchar>(row, col) == 255)
-			{
-				waterAndTrees.at<Vec3b>(row, col)[0] = 255;
-			}
-			else
-			{
-				waterAndTrees.at<Vec3b>(row, col)[0] = 0;
-			}
-			if(resultTree.at<uchar>(row, col) == 255)
-			{
-				waterAndTrees.at<Vec3b>(row, col)[2] = 255;
-			}
-			else
-			{
-				waterAndTrees.at<Vec3b>(row, col)[2] = 0;
-			}
-			waterAndTrees.at<Vec3b>(row, col)[1] = 0;
-			Vec3b i = waterAndTrees.at<Vec3b>(row, col);
-		}
-	}
+	TraceScope stage("TreesWaterFilter");
+	TreesWaterMaps maps = MakeTreesWaterMaps(hyperImage);
+	Mat resultTree = maps.trees;
+	Mat resultWater = maps.water;
+	Mat waterAndTrees = maps.waterAndTrees;
 
+	stage.End();
 	
 	imshow("Original", hyperImage.getComposite(650, 580, 508));
 	imwrite("Original.png", hyperImage.getComposite(650, 580, 508));
@@ -310,8 +150,14 @@ Mat TreesWaterFilter(SpecImage hyperImage)
 //  contains the correct images with the correct filenames.
 //  Post-Conditions: Runs the uncommented methods, each of which is detailed
 //  above
+//  NOTE: If the environment variable HYPERSPECTRAL_TRACE names a file, the run is
+//  traced (see Trace.h): a Chrome trace is written to that file and a summary 
+//  table is printed at the end.
 int main(int argc, char* argv[])
 {
+	const char* traceFile = getenv("HYPERSPECTRAL_TRACE");
+	Trace::Enable(traceFile != NULL && traceFile[0] != '\0');
+
 	SpecImage newSpecImg("EO1H0010492002110110KZ_1T");
 
 	Mat img;
@@ -319,5 +165,11 @@ int main(int argc, char* argv[])
 	//  img = SpecFilterTest(newSpecImg, "douglas_fir");
 	img = TreesWaterFilter(newSpecImg);
 	Mat watershed = Watershed(img);
+
+	if (Trace::isEnabled())
+	{
+		Trace::WriteChromeTrace(traceFile);
+		Trace::WriteSummary(cout);
+	}
 }
 